@@ -23,7 +23,7 @@
  *    - Scanline effect overlay (F9 toggle in-game)
  *    - Stats overlay: FPS, cycles, pixels lit (~ key toggle)
  *    - Enhanced debugger: run-to-address (F10 addr), XRAM watchpoints
- *    - Enriched headless: --frames N --input UDLR1234 --dump --test
+ *    - Enriched headless: --frames N --input UDLR1234 --movie FILE --profile FILE --dump --test
  *    - Built-in self-test suite (--test)
  *
  *  v14 features:
@@ -41,6 +41,8 @@
  *    gcc -O2 -DUSE_SDL -o advision adventure_vision.c -lSDL2 -lm
  *  With embedded ROMs + cover art:
  *    gcc -O2 -DUSE_SDL -DEMBED_ROMS -DEMBED_COVERS -o advision adventure_vision.c -lSDL2 -lm
+ *  With a resource pack (embed_roms.sh --pack) assembled in:
+ *    gcc -O2 -DUSE_SDL -DEMBED_PACK='"advision.avpk"' -o advision adventure_vision.c -lSDL2 -lm
  *  Usage:
  *    ./advision [bios.rom game.rom]
  *    Without args: scans current dir for ROMs and shows game selector.
@@ -58,6 +60,9 @@
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stddef.h>
 #ifndef _MSC_VER
 #include <strings.h>  /* strcasecmp on POSIX */
 #endif
@@ -82,10 +87,30 @@ static char *strcasestr(const char *haystack, const char *needle) {
 
 #ifdef _MSC_VER
 #define strcasecmp _stricmp
+#define AV_FORCE_INLINE __forceinline
+#else
+#define AV_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/* Acquire/release word access for the single-producer/single-consumer
+ * queues between the emulation and audio threads (MSVC volatile is
+ * acquire/release on x86/x64) */
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AV_LOAD_ACQ(p)     (*(volatile uint32_t *)(p))
+#define AV_STORE_REL(p, v) (*(volatile uint32_t *)(p) = (v))
+#define AV_FENCE()         _ReadWriteBarrier()
+#define AV_XCHG(p, v)      ((uint32_t)_InterlockedExchange((volatile long *)(p), (long)(v)))
+#else
+#define AV_LOAD_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AV_STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define AV_FENCE()         __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define AV_XCHG(p, v)      __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
 #endif
 
 #ifdef USE_SDL
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>  /* GL types only; entry points via SDL_GL_GetProcAddress */
 /* Convenience macros for audio thread safety */
 #define AUDIO_LOCK(av)   do { if ((av)->adev) SDL_LockAudioDevice((SDL_AudioDeviceID)(av)->adev); } while(0)
 #define AUDIO_UNLOCK(av) do { if ((av)->adev) SDL_UnlockAudioDevice((SDL_AudioDeviceID)(av)->adev); } while(0)
@@ -102,7 +127,17 @@ static char *strcasestr(const char *haystack, const char *needle) {
 #ifndef SDLK_BACKQUOTE
 #define SDLK_BACKQUOTE SDL_SCANCODE_TO_KEYCODE(SDL_SCANCODE_GRAVE)
 #endif
+#else
+/* No audio thread: the sound queue is drained by its producer */
+#define AUDIO_LOCK(av)   ((void)(av))
+#define AUDIO_UNLOCK(av) ((void)(av))
+#endif
+
+/* AV_LIB: the core alone, for linking into other programs (libadvision.h) */
+#if defined(AV_LIB) && defined(USE_SDL)
+#error "AV_LIB builds the core without SDL"
 #endif
+#include "libadvision.h"
 
 #ifdef EMBED_ROMS
 #include "embedded_roms.h"
@@ -134,18 +169,21 @@ static char *strcasestr(const char *haystack, const char *needle) {
 
 #define AUDIO_RATE      44100
 #define AUDIO_SAMPLES   512
-#define MAX_BP          16
+#define PC_SPACE        0x1000    /* 12-bit program counter */
 
-/* Rewind buffer: stores snapshots of CPU+RAM state */
-#define REWIND_FRAMES   120   /* 8 seconds at 15fps */
+/* Rewind buffer: newest snapshot whole, older ones as RLE'd XOR deltas */
+#define REWIND_FRAMES   9000        /* 10 minutes at 15fps */
+#define REWIND_BYTES    (3 << 20)   /* delta ring; oldest frames evicted first */
 
 /* Audio filter profiles */
 #define AUDIO_RAW       0   /* no filter */
 #define AUDIO_SPEAKER   1   /* single-pole LP ~4kHz + soft clip */
 #define AUDIO_HEADPHONE 2   /* gentler LP ~8kHz, no clip */
+#define CLIP_LUT_N      256 /* soft-clip table steps (tanh argument 0-8) */
 #define AUDIO_PROFILES  3
+#ifdef USE_SDL
 static const char *audio_profile_names[] = {"Raw","Speaker","Headphone"};
-static const float audio_lp_alpha[] = {1.0f, 0.45f, 0.7f};
+#endif
 
 /* Default T1 sensor pulse timing (configurable via ini) */
 #define DEF_T1_START    200
@@ -155,8 +193,11 @@ static const float audio_lp_alpha[] = {1.0f, 0.45f, 0.7f};
 
 /* ---- Forward decl ---- */
 typedef struct AV AV;
+typedef struct AVRender AVRender;
+typedef struct NetLink NetLink;
 static void av_port_write(AV *av, uint8_t port, uint8_t val);
 static uint8_t av_port_read(AV *av, uint8_t port);
+static void movie_frame(AV *av);
 
 /* ============================================================================
  *  INTEL 8048 CPU
@@ -179,8 +220,15 @@ typedef struct {
     uint8_t  xram[XRAM_SZ];
     uint64_t cycles;
     int      tpre;
+    /* Debugger XRAM watch: read then write bitmaps (NULL = off, set per
+     * frame by av_run_frame) and the first access to hit one */
+    const uint8_t *watch;
+    uint16_t watch_hit;         /* 0, or WATCH_HIT | WATCH_WR? | address */
 } I8048;
 
+#define WATCH_HIT       0x1000
+#define WATCH_WR        0x2000
+
 static inline uint8_t *R(I8048 *c, uint8_t r) {
     return &c->iram[(c->BS ? 24 : 0) + (r & 7)];
 }
@@ -227,19 +275,60 @@ static inline uint8_t ft(I8048 *c) {
     c->PC = (c->PC + 1) & 0xFFF;
     return v;
 }
+static inline void xram_watch(I8048 *c, uint16_t full, uint16_t wr) {
+    const uint8_t *m = c->watch + (wr ? XRAM_SZ / 8 : 0);
+    if ((m[full >> 3] >> (full & 7) & 1) && !c->watch_hit)
+        c->watch_hit = (uint16_t)(WATCH_HIT | wr | full);
+}
 static inline uint8_t xram_rd(I8048 *c, uint8_t addr) {
     uint16_t full = ((uint16_t)(c->P1 & 0x03) << 8) | addr;
+    if (c->watch) xram_watch(c, full, 0);
     return c->xram[full & (XRAM_SZ-1)];
 }
 static inline void xram_wr(I8048 *c, uint8_t addr, uint8_t val) {
     uint16_t full = ((uint16_t)(c->P1 & 0x03) << 8) | addr;
+    if (c->watch) xram_watch(c, full, WATCH_WR);
     c->xram[full & (XRAM_SZ-1)] = val;
 }
 
-/* Forward declaration for LED register emulation (defined in display section) */
-static int led_reg_decode(uint8_t p2);
-/* Forward-declared: latch XRAM read data to LED register (AV not yet defined) */
-static void av_led_latch(AV *av, uint8_t p2, uint8_t data);
+/* Retire an instruction of `cy` machine cycles: advance the cycle counter,
+ * clock the timer prescaler and dispatch a pending timer interrupt.
+ * Shared by the interpreter and the pre-decoded block engine so both
+ * account time identically. Returns true if an IRQ was dispatched. */
+static inline bool i8048_retire(I8048 *c, int cy) {
+    c->cycles += cy;
+
+    /* Timer prescaler: increments every 32 cycles */
+    if (c->timer_en) {
+        c->tpre += cy;
+        while (c->tpre >= 32) {
+            c->tpre -= 32;
+            if (++c->timer == 0) {
+                c->timer_ovf = true;
+                /* Per MCS-48 Figure 11: overflow FF is gated by tcnti_en.
+                 * Note 1: "When Interrupt In Progress FF is set... Overflow
+                 * FF will NOT store any overflow." Timer Flag is still set.
+                 * irq_en is the external interrupt enable — timer has its own
+                 * enable (tcnti_en), so irq_en does NOT gate timer IRQ latch. */
+                if (c->tcnti_en && !c->in_irq)
+                    c->irq_pend = true;
+            }
+        }
+    }
+
+    /* IRQ dispatch — 8048 requires 1 instruction after EI before accepting */
+    if (c->ei_delay > 0) c->ei_delay--;
+    if (c->irq_pend && c->irq_en && !c->in_irq && c->ei_delay == 0) {
+        c->irq_pend = false;
+        c->in_irq = true;
+        c->irq_en = false;
+        bpsw(c); push8(c);
+        c->PC = 0x007;
+        return true;
+    }
+    return false;
+}
+
 
 static int i8048_exec(I8048 *c, AV *sys) {
     uint16_t op_pc = c->PC; /* save for debug before auto-increment */
@@ -404,37 +493,360 @@ static int i8048_exec(I8048 *c, AV *sys) {
         break;
     }
 
-    c->cycles += cy;
+    i8048_retire(c, cy);
+    return cy;
+}
 
-    /* Timer prescaler: increments every 32 cycles */
+/* Idle-loop skip. The BIOS spends much of a frame in JNT1/JT1 loops on
+ * the mirror sync and in DJNZ delay loops, each a 2-cycle jump to itself.
+ * If the instruction at PC is one of those and would branch to itself
+ * from the current state, iterate it up to `budget` cycles in one step:
+ * nothing it reads changes as long as T1 holds, no IRQ is due and the
+ * timer does not overflow. The caller's budget runs to its next T1 sample
+ * or event; iterations ending there read the level before it, as they do
+ * interpreted. The overflowing iteration and the DJNZ exit are left
+ * to the interpreter. Cycles, prescaler, timer and the loop register end
+ * exactly where the iterations would leave them. Returns cycles skipped. */
+static int i8048_idle_skip(I8048 *c, int budget) {
+    uint16_t pc = c->PC;
+    uint8_t op = rom_rd(c, pc), *r = NULL;
+    if ((((pc + 2) & 0xF00) | rom_rd(c, pc + 1)) != pc) return 0;
+    if (op == 0x46) { if (c->t1) return 0; }        /* JNT1 $ */
+    else if (op == 0x56) { if (!c->t1) return 0; }  /* JT1 $ */
+    else if ((op & 0xF8) == 0xE8) r = R(c, op & 7); /* DJNZ Rn,$ */
+    else return 0;
+    if (c->ei_delay || (c->irq_pend && c->irq_en && !c->in_irq)) return 0;
+    int n = budget / 2;
+    if (r && n > (*r ? *r : 256) - 1) n = (*r ? *r : 256) - 1;
     if (c->timer_en) {
-        c->tpre += cy;
-        while (c->tpre >= 32) {
-            c->tpre -= 32;
-            if (++c->timer == 0) {
-                c->timer_ovf = true;
-                /* Per MCS-48 Figure 11: overflow FF is gated by tcnti_en.
-                 * Note 1: "When Interrupt In Progress FF is set... Overflow
-                 * FF will NOT store any overflow." Timer Flag is still set.
-                 * irq_en is the external interrupt enable — timer has its own
-                 * enable (tcnti_en), so irq_en does NOT gate timer IRQ latch. */
-                if (c->tcnti_en && !c->in_irq)
-                    c->irq_pend = true;
-            }
-        }
+        int ovf = (256 - c->timer) * 32 - c->tpre;  /* cycles to the overflow */
+        if (n > (ovf - 1) / 2) n = (ovf - 1) / 2;
+    }
+    if (n <= 0) return 0;
+    c->cycles += 2 * n;
+    if (c->timer_en) {
+        c->tpre += 2 * n;
+        c->timer += c->tpre / 32;
+        c->tpre %= 32;
     }
+    if (r) *r -= n;
+    return 2 * n;
+}
 
-    /* IRQ dispatch — 8048 requires 1 instruction after EI before accepting */
-    if (c->ei_delay > 0) c->ei_delay--;
-    if (c->irq_pend && c->irq_en && !c->in_irq && c->ei_delay == 0) {
-        c->irq_pend = false;
-        c->in_irq = true;
-        c->irq_en = false;
-        bpsw(c); push8(c);
-        c->PC = 0x007;
+/* ============================================================================
+ *  PRE-DECODED BLOCK ENGINE
+ * ============================================================================
+ *
+ *  Alternative to i8048_exec for long headless runs. Program memory is
+ *  decoded lazily into I8048Op records (handler, immediate operand, cycle
+ *  cost, next PC) so the hot loop never goes through rom_rd() or the opcode
+ *  switch. Two decode maps exist, one per P1.2 state (IROM visible or not).
+ *  i8048_exec_block() follows straight-line runs through the current map
+ *  until a control-flow instruction, an IRQ dispatch, a bank mapping change
+ *  (P1.2 / MB) or the caller's cycle budget ends the run.
+ *
+ *  Instruction semantics mirror i8048_exec exactly; the self-test suite
+ *  compares both engines over several frames of a synthetic program.
+ */
+
+#define CPU_ENGINE_INTERP 0   /* one instruction per call (reference) */
+#define CPU_ENGINE_BLOCK  1   /* pre-decoded straight-line runs */
+
+typedef struct I8048Op I8048Op;
+typedef void (*I8048Fn)(I8048 *c, AV *sys, const I8048Op *o);
+struct I8048Op {
+    I8048Fn  fn;        /* NULL = not decoded yet */
+    uint16_t next_pc;   /* PC after opcode + operand fetch */
+    uint8_t  op;        /* opcode byte */
+    uint8_t  imm;       /* immediate / branch target low byte */
+    uint8_t  cy;        /* machine cycles */
+    uint8_t  flags;     /* OPF_* */
+};
+#define OPF_END   0x01  /* instruction may redirect PC: run ends after it */
+#define OPF_MAP   0x02  /* instruction may change P1.2 / MB mapping */
+
+typedef struct {
+    I8048Op ops[2][EROM_SZ];   /* [P1.2][PC] */
+    uint8_t irom[IROM_SZ];     /* ROM image the maps were decoded from */
+    uint8_t erom[EROM_SZ];
+} I8048Cache;
+
+#define OP(name) static void name(I8048 *c, AV *sys, const I8048Op *o)
+#define OP_ARGS_UNUSED (void)c; (void)sys; (void)o
+
+OP(op_nop)      { OP_ARGS_UNUSED; }
+OP(op_mov_a_r)  { (void)sys; c->A = *R(c, o->op&7); }
+OP(op_mov_r_a)  { (void)sys; *R(c, o->op&7) = c->A; }
+OP(op_mov_a_i)  { (void)sys; c->A = o->imm; }
+OP(op_mov_r_i)  { (void)sys; *R(c, o->op&7) = o->imm; }
+OP(op_mov_a_m)  { (void)sys; c->A = c->iram[*R(c,o->op&1)&(IRAM_SZ-1)]; }
+OP(op_mov_m_a)  { (void)sys; c->iram[*R(c,o->op&1)&(IRAM_SZ-1)] = c->A; }
+OP(op_mov_m_i)  { (void)sys; c->iram[*R(c,o->op&1)&(IRAM_SZ-1)] = o->imm; }
+OP(op_xch_r)    { (void)sys; uint8_t *r=R(c,o->op&7), t=c->A; c->A=*r; *r=t; }
+OP(op_xch_m)    { (void)sys; uint8_t a=*R(c,o->op&1)&(IRAM_SZ-1), t=c->iram[a]; c->iram[a]=c->A; c->A=t; }
+OP(op_xchd_m)   { (void)sys; uint8_t a=*R(c,o->op&1)&(IRAM_SZ-1), t=c->A&0xF; c->A=(c->A&0xF0)|(c->iram[a]&0xF); c->iram[a]=(c->iram[a]&0xF0)|t; }
+
+static inline void op_add(I8048 *c, uint8_t t, uint8_t cin) {
+    uint16_t t16 = c->A + t + cin;
+    c->AC = ((c->A&0xF)+(t&0xF)+cin) > 0xF; c->C = t16 > 0xFF; c->A = (uint8_t)t16;
+}
+OP(op_add_r)    { (void)sys; op_add(c, *R(c,o->op&7), 0); }
+OP(op_add_i)    { (void)sys; op_add(c, o->imm, 0); }
+OP(op_add_m)    { (void)sys; op_add(c, c->iram[*R(c,o->op&1)&(IRAM_SZ-1)], 0); }
+OP(op_addc_r)   { (void)sys; op_add(c, *R(c,o->op&7), c->C); }
+OP(op_addc_i)   { (void)sys; op_add(c, o->imm, c->C); }
+OP(op_addc_m)   { (void)sys; op_add(c, c->iram[*R(c,o->op&1)&(IRAM_SZ-1)], c->C); }
+
+OP(op_anl_r)    { (void)sys; c->A &= *R(c,o->op&7); }
+OP(op_anl_i)    { (void)sys; c->A &= o->imm; }
+OP(op_anl_m)    { (void)sys; c->A &= c->iram[*R(c,o->op&1)&(IRAM_SZ-1)]; }
+OP(op_orl_r)    { (void)sys; c->A |= *R(c,o->op&7); }
+OP(op_orl_i)    { (void)sys; c->A |= o->imm; }
+OP(op_orl_m)    { (void)sys; c->A |= c->iram[*R(c,o->op&1)&(IRAM_SZ-1)]; }
+OP(op_xrl_r)    { (void)sys; c->A ^= *R(c,o->op&7); }
+OP(op_xrl_i)    { (void)sys; c->A ^= o->imm; }
+OP(op_xrl_m)    { (void)sys; c->A ^= c->iram[*R(c,o->op&1)&(IRAM_SZ-1)]; }
+
+OP(op_inc_a)    { (void)sys; (void)o; c->A++; }
+OP(op_inc_r)    { (void)sys; (*R(c,o->op&7))++; }
+OP(op_inc_m)    { (void)sys; c->iram[*R(c,o->op&1)&(IRAM_SZ-1)]++; }
+OP(op_dec_a)    { (void)sys; (void)o; c->A--; }
+OP(op_dec_r)    { (void)sys; (*R(c,o->op&7))--; }
+OP(op_clr_a)    { (void)sys; (void)o; c->A = 0; }
+OP(op_cpl_a)    { (void)sys; (void)o; c->A = ~c->A; }
+OP(op_da_a)     { (void)sys; (void)o; uint8_t t; if((c->A&0xF)>9||c->AC){t=c->A;c->A+=6;if(c->A<t)c->C=1;}if((c->A>>4)>9||c->C){c->A+=0x60;c->C=1;} }
+OP(op_swap_a)   { (void)sys; (void)o; c->A=((c->A&0xF)<<4)|((c->A>>4)&0xF); }
+OP(op_rl_a)     { (void)sys; (void)o; c->A=(c->A<<1)|(c->A>>7); }
+OP(op_rlc_a)    { (void)sys; (void)o; uint8_t t=c->C; c->C=(c->A>>7)&1; c->A=(c->A<<1)|t; }
+OP(op_rr_a)     { (void)sys; (void)o; c->A=(c->A>>1)|(c->A<<7); }
+OP(op_rrc_a)    { (void)sys; (void)o; uint8_t t=c->C; c->C=c->A&1; c->A=(c->A>>1)|(t<<7); }
+
+OP(op_clr_c)    { (void)sys; (void)o; c->C = 0; }
+OP(op_cpl_c)    { (void)sys; (void)o; c->C = !c->C; }
+OP(op_clr_f0)   { (void)sys; (void)o; c->F0 = 0; }
+OP(op_cpl_f0)   { (void)sys; (void)o; c->F0 = !c->F0; }
+OP(op_clr_f1)   { (void)sys; (void)o; c->F1 = 0; }
+OP(op_cpl_f1)   { (void)sys; (void)o; c->F1 = !c->F1; }
+OP(op_sel_rb0)  { (void)sys; (void)o; c->BS = 0; }
+OP(op_sel_rb1)  { (void)sys; (void)o; c->BS = 1; }
+OP(op_sel_mb0)  { (void)sys; (void)o; c->MB = 0; }
+OP(op_sel_mb1)  { (void)sys; (void)o; c->MB = 1; }
+
+/* Branches: PC already points past the operand, as after ft() */
+#define BR(cond) do { if (cond) c->PC = (c->PC&0xF00)|o->imm; } while(0)
+OP(op_jmp)      { (void)sys; c->PC=((uint16_t)(o->op&0xE0)<<3)|o->imm; if(c->MB&&!c->in_irq)c->PC|=0x800; }
+OP(op_jmpp)     { (void)sys; (void)o; c->PC=(c->PC&0xF00)|rom_rd(c,(c->PC&0xF00)|c->A); }
+OP(op_djnz)     { (void)sys; uint8_t *r=R(c,o->op&7); (*r)--; BR(*r); }
+OP(op_jc)       { (void)sys; BR(c->C); }
+OP(op_jnc)      { (void)sys; BR(!c->C); }
+OP(op_jz)       { (void)sys; BR(!c->A); }
+OP(op_jnz)      { (void)sys; BR(c->A); }
+OP(op_jnt0)     { (void)sys; BR(!c->t0); }
+OP(op_jt0)      { (void)sys; BR(c->t0); }
+OP(op_jnt1)     { (void)sys; BR(!c->t1); }
+OP(op_jt1)      { (void)sys; BR(c->t1); }
+OP(op_jf0)      { (void)sys; BR(c->F0); }
+OP(op_jf1)      { (void)sys; BR(c->F1); }
+OP(op_jtf)      { (void)sys; if(c->timer_ovf){c->PC=(c->PC&0xF00)|o->imm;c->timer_ovf=0;} }
+OP(op_jb)       { (void)sys; BR(c->A&(1<<((o->op>>5)&7))); }
+#undef BR
+OP(op_call)     { (void)sys; bpsw(c); push8(c); c->PC=((uint16_t)(o->op&0xE0)<<3)|o->imm; if(c->MB&&!c->in_irq)c->PC|=0x800; }
+OP(op_ret)      { (void)sys; (void)o; pop_pc(c); }
+OP(op_retr)     { (void)sys; (void)o; pop_pc_psw(c); c->irq_en=1; c->in_irq=0; }
+
+OP(op_en_i)     { (void)sys; (void)o; c->irq_en=1; c->ei_delay=1; }
+OP(op_dis_i)    { (void)sys; (void)o; c->irq_en=0; }
+OP(op_en_tcnti) { (void)sys; (void)o; c->tcnti_en=1; }
+OP(op_dis_tcnti){ (void)sys; (void)o; c->tcnti_en=0; c->irq_pend=false; }
+OP(op_strt_t)   { (void)sys; (void)o; c->timer_en=1; c->counter_en=0; c->tpre=0; }
+OP(op_strt_cnt) { (void)sys; (void)o; c->counter_en=1; c->timer_en=0; c->tpre=0; }
+OP(op_stop_tcnt){ (void)sys; (void)o; c->timer_en=0; c->counter_en=0; c->tpre=0; }
+OP(op_mov_a_t)  { (void)sys; (void)o; c->A=c->timer; }
+OP(op_mov_t_a)  { (void)sys; (void)o; c->timer=c->A; c->tpre=0; }
+OP(op_mov_a_psw){ (void)sys; (void)o; bpsw(c); c->A=c->PSW; }
+OP(op_mov_psw_a){ (void)sys; (void)o; c->PSW=c->A; c->C=(c->PSW>>7)&1; c->AC=(c->PSW>>6)&1; c->F0=(c->PSW>>5)&1; c->BS=(c->PSW>>4)&1; c->SP=c->PSW&7; }
+
+OP(op_ins_bus)  { (void)o; c->A=av_port_read(sys,0); }
+OP(op_outl_bus) { (void)o; c->BUS=c->A; av_port_write(sys,0,c->A); }
+OP(op_orl_bus)  { c->BUS|=o->imm; av_port_write(sys,0,c->BUS); }
+OP(op_anl_bus)  { c->BUS&=o->imm; av_port_write(sys,0,c->BUS); }
+OP(op_in_p1)    { (void)o; c->A=av_port_read(sys,1); }
+OP(op_in_p2)    { (void)o; c->A=av_port_read(sys,2); }
+OP(op_outl_p1)  { (void)o; c->P1=c->A; av_port_write(sys,1,c->A); }
+OP(op_outl_p2)  { (void)o; c->P2=c->A; av_port_write(sys,2,c->A); }
+OP(op_anl_p1)   { c->P1&=o->imm; av_port_write(sys,1,c->P1); }
+OP(op_anl_p2)   { c->P2&=o->imm; av_port_write(sys,2,c->P2); }
+OP(op_orl_p1)   { c->P1|=o->imm; av_port_write(sys,1,c->P1); }
+OP(op_orl_p2)   { c->P2|=o->imm; av_port_write(sys,2,c->P2); }
+
+OP(op_movx_rd)  { (void)sys; c->A = xram_rd(c, *R(c, o->op&1)); }
+OP(op_movx_wr)  { (void)sys; xram_wr(c, *R(c, o->op&1), c->A); }
+OP(op_movp)     { (void)sys; (void)o; c->A=rom_rd(c,(c->PC&0xF00)|c->A); }
+OP(op_movp3)    { (void)sys; (void)o; c->A=rom_rd(c,0x300|c->A); }
+OP(op_movd_rd)  { (void)sys; (void)o; c->A=0x0F; }
+OP(op_unknown)  { (void)sys; (void)c;
+    fprintf(stderr,"[8048] Unknown opcode $%02X @ PC=$%03X\n",o->op,(o->next_pc-1)&0xFFF); }
+
+#undef OP_ARGS_UNUSED
+#undef OP
+
+/* Decode the instruction at `pc` as seen with P1.2 = `p12` */
+static void i8048_decode(I8048Op *o, const I8048Cache *k, uint16_t pc, int p12) {
+    #define DROM(a) (((a)&0xFFF) < IROM_SZ && !p12 ? k->irom[(a)&0xFFF] : k->erom[(a)&(EROM_SZ-1)])
+    uint8_t op = DROM(pc);
+    I8048Fn fn = op_unknown;
+    int len = 1, cy = 1, flags = 0;
+
+    switch (op) {
+    case 0x00: fn=op_nop; break;
+    case 0xF8:case 0xF9:case 0xFA:case 0xFB:case 0xFC:case 0xFD:case 0xFE:case 0xFF: fn=op_mov_a_r; break;
+    case 0xA8:case 0xA9:case 0xAA:case 0xAB:case 0xAC:case 0xAD:case 0xAE:case 0xAF: fn=op_mov_r_a; break;
+    case 0x23: fn=op_mov_a_i; len=2; cy=2; break;
+    case 0xB8:case 0xB9:case 0xBA:case 0xBB:case 0xBC:case 0xBD:case 0xBE:case 0xBF: fn=op_mov_r_i; len=2; cy=2; break;
+    case 0xF0:case 0xF1: fn=op_mov_a_m; break;
+    case 0xA0:case 0xA1: fn=op_mov_m_a; break;
+    case 0xB0:case 0xB1: fn=op_mov_m_i; len=2; cy=2; break;
+    case 0x28:case 0x29:case 0x2A:case 0x2B:case 0x2C:case 0x2D:case 0x2E:case 0x2F: fn=op_xch_r; break;
+    case 0x20:case 0x21: fn=op_xch_m; break;
+    case 0x30:case 0x31: fn=op_xchd_m; break;
+    case 0x68:case 0x69:case 0x6A:case 0x6B:case 0x6C:case 0x6D:case 0x6E:case 0x6F: fn=op_add_r; break;
+    case 0x03: fn=op_add_i; len=2; cy=2; break;
+    case 0x60:case 0x61: fn=op_add_m; break;
+    case 0x78:case 0x79:case 0x7A:case 0x7B:case 0x7C:case 0x7D:case 0x7E:case 0x7F: fn=op_addc_r; break;
+    case 0x13: fn=op_addc_i; len=2; cy=2; break;
+    case 0x70:case 0x71: fn=op_addc_m; break;
+    case 0x58:case 0x59:case 0x5A:case 0x5B:case 0x5C:case 0x5D:case 0x5E:case 0x5F: fn=op_anl_r; break;
+    case 0x53: fn=op_anl_i; len=2; cy=2; break;
+    case 0x50:case 0x51: fn=op_anl_m; break;
+    case 0x48:case 0x49:case 0x4A:case 0x4B:case 0x4C:case 0x4D:case 0x4E:case 0x4F: fn=op_orl_r; break;
+    case 0x43: fn=op_orl_i; len=2; cy=2; break;
+    case 0x40:case 0x41: fn=op_orl_m; break;
+    case 0xD8:case 0xD9:case 0xDA:case 0xDB:case 0xDC:case 0xDD:case 0xDE:case 0xDF: fn=op_xrl_r; break;
+    case 0xD3: fn=op_xrl_i; len=2; cy=2; break;
+    case 0xD0:case 0xD1: fn=op_xrl_m; break;
+    case 0x17: fn=op_inc_a; break;
+    case 0x18:case 0x19:case 0x1A:case 0x1B:case 0x1C:case 0x1D:case 0x1E:case 0x1F: fn=op_inc_r; break;
+    case 0x10:case 0x11: fn=op_inc_m; break;
+    case 0x07: fn=op_dec_a; break;
+    case 0xC8:case 0xC9:case 0xCA:case 0xCB:case 0xCC:case 0xCD:case 0xCE:case 0xCF: fn=op_dec_r; break;
+    case 0x27: fn=op_clr_a; break;
+    case 0x37: fn=op_cpl_a; break;
+    case 0x57: fn=op_da_a; break;
+    case 0x47: fn=op_swap_a; break;
+    case 0xE7: fn=op_rl_a; break;
+    case 0xF7: fn=op_rlc_a; break;
+    case 0x77: fn=op_rr_a; break;
+    case 0x67: fn=op_rrc_a; break;
+    case 0x97: fn=op_clr_c; break;
+    case 0xA7: fn=op_cpl_c; break;
+    case 0x85: fn=op_clr_f0; break;
+    case 0x95: fn=op_cpl_f0; break;
+    case 0xA5: fn=op_clr_f1; break;
+    case 0xB5: fn=op_cpl_f1; break;
+    case 0xC5: fn=op_sel_rb0; break;
+    case 0xD5: fn=op_sel_rb1; break;
+    case 0xE5: fn=op_sel_mb0; flags=OPF_MAP; break;
+    case 0xF5: fn=op_sel_mb1; flags=OPF_MAP; break;
+    case 0x04:case 0x24:case 0x44:case 0x64:case 0x84:case 0xA4:case 0xC4:case 0xE4:
+        fn=op_jmp; len=2; cy=2; flags=OPF_END; break;
+    case 0xB3: fn=op_jmpp; cy=2; flags=OPF_END; break;
+    case 0xE8:case 0xE9:case 0xEA:case 0xEB:case 0xEC:case 0xED:case 0xEE:case 0xEF:
+        fn=op_djnz; len=2; cy=2; flags=OPF_END; break;
+    case 0xF6: fn=op_jc;   len=2; cy=2; flags=OPF_END; break;
+    case 0xE6: fn=op_jnc;  len=2; cy=2; flags=OPF_END; break;
+    case 0xC6: fn=op_jz;   len=2; cy=2; flags=OPF_END; break;
+    case 0x96: fn=op_jnz;  len=2; cy=2; flags=OPF_END; break;
+    case 0x26: fn=op_jnt0; len=2; cy=2; flags=OPF_END; break;
+    case 0x36: fn=op_jt0;  len=2; cy=2; flags=OPF_END; break;
+    case 0x46: fn=op_jnt1; len=2; cy=2; flags=OPF_END; break;
+    case 0x56: fn=op_jt1;  len=2; cy=2; flags=OPF_END; break;
+    case 0xB6: fn=op_jf0;  len=2; cy=2; flags=OPF_END; break;
+    case 0x76: fn=op_jf1;  len=2; cy=2; flags=OPF_END; break;
+    case 0x16: fn=op_jtf;  len=2; cy=2; flags=OPF_END; break;
+    case 0x86: fn=op_nop;  len=2; cy=2; break; /* JNI — INT not connected in AV */
+    case 0x12:case 0x32:case 0x52:case 0x72:case 0x92:case 0xB2:case 0xD2:case 0xF2:
+        fn=op_jb; len=2; cy=2; flags=OPF_END; break;
+    case 0x14:case 0x34:case 0x54:case 0x74:case 0x94:case 0xB4:case 0xD4:case 0xF4:
+        fn=op_call; len=2; cy=2; flags=OPF_END; break;
+    case 0x83: fn=op_ret;  cy=2; flags=OPF_END; break;
+    case 0x93: fn=op_retr; cy=2; flags=OPF_END; break;
+    case 0x05: fn=op_en_i; break;
+    case 0x15: fn=op_dis_i; break;
+    case 0x25: fn=op_en_tcnti; break;
+    case 0x35: fn=op_dis_tcnti; break;
+    case 0x55: fn=op_strt_t; break;
+    case 0x45: fn=op_strt_cnt; break;
+    case 0x65: fn=op_stop_tcnt; break;
+    case 0x42: fn=op_mov_a_t; break;
+    case 0x62: fn=op_mov_t_a; break;
+    case 0xC7: fn=op_mov_a_psw; break;
+    case 0xD7: fn=op_mov_psw_a; break;
+    case 0x08: fn=op_ins_bus;  cy=2; break;
+    case 0x02: fn=op_outl_bus; cy=2; break;
+    case 0x88: fn=op_orl_bus;  len=2; cy=2; break;
+    case 0x98: fn=op_anl_bus;  len=2; cy=2; break;
+    case 0x09: fn=op_in_p1;    cy=2; break;
+    case 0x0A: fn=op_in_p2;    cy=2; break;
+    case 0x39: fn=op_outl_p1;  cy=2; flags=OPF_MAP; break;
+    case 0x3A: fn=op_outl_p2;  cy=2; break;
+    case 0x99: fn=op_anl_p1;   len=2; cy=2; flags=OPF_MAP; break;
+    case 0x9A: fn=op_anl_p2;   len=2; cy=2; break;
+    case 0x89: fn=op_orl_p1;   len=2; cy=2; flags=OPF_MAP; break;
+    case 0x8A: fn=op_orl_p2;   len=2; cy=2; break;
+    case 0x80:case 0x81: fn=op_movx_rd; cy=2; break;
+    case 0x90:case 0x91: fn=op_movx_wr; cy=2; break;
+    case 0xA3: fn=op_movp;  cy=2; break;
+    case 0xE3: fn=op_movp3; cy=2; break;
+    case 0x0C:case 0x0D:case 0x0E:case 0x0F: fn=op_movd_rd; cy=2; break;
+    case 0x3C:case 0x3D:case 0x3E:case 0x3F: fn=op_nop; cy=2; break;
+    case 0x8C:case 0x8D:case 0x8E:case 0x8F: fn=op_nop; cy=2; break;
+    case 0x9C:case 0x9D:case 0x9E:case 0x9F: fn=op_nop; cy=2; break;
+    case 0x75: fn=op_nop; break; /* ENT0 CLK */
+    default: break;
     }
 
-    return cy;
+    o->op = op;
+    o->imm = (len == 2) ? DROM(pc + 1) : 0;
+    o->next_pc = (uint16_t)((pc + len) & 0xFFF);
+    o->cy = (uint8_t)cy;
+    o->flags = (uint8_t)flags;
+    o->fn = fn;
+    #undef DROM
+}
+
+/* Drop every decoded op if the ROM images changed since they were decoded
+ * (BIOS/game load, drag & drop). Cheap enough to call once per frame. */
+static void i8048_cache_sync(I8048Cache *k, const I8048 *c) {
+    if (memcmp(k->irom, c->irom, IROM_SZ) == 0 &&
+        memcmp(k->erom, c->erom, EROM_SZ) == 0)
+        return;
+    memset(k->ops, 0, sizeof(k->ops));
+    memcpy(k->irom, c->irom, IROM_SZ);
+    memcpy(k->erom, c->erom, EROM_SZ);
+}
+
+/* Execute one straight-line run starting at PC. Always executes at least
+ * one instruction and stops once `budget` cycles have been consumed.
+ * Returns the number of cycles executed. */
+static int i8048_exec_block(I8048 *c, AV *sys, I8048Cache *k, int budget) {
+    int p12 = (c->P1 >> 2) & 1;
+    uint8_t map_key = (uint8_t)((c->P1 & 0x04) | c->MB);
+    I8048Op *map = k->ops[p12];
+    int used = 0;
+
+    for (;;) {
+        I8048Op *o = &map[c->PC & 0xFFF];
+        if (!o->fn) i8048_decode(o, k, c->PC & 0xFFF, p12);
+        c->PC = o->next_pc;
+        o->fn(c, sys, o);
+        used += o->cy;
+        if (i8048_retire(c, o->cy)) break;      /* IRQ vectored to $007 */
+        if (o->flags & OPF_END) break;
+        if ((o->flags & OPF_MAP) &&
+            (uint8_t)((c->P1 & 0x04) | c->MB) != map_key) break;
+        if (used >= budget) break;
+    }
+    return used;
 }
 
 /* ============================================================================
@@ -502,10 +914,6 @@ typedef struct {
     uint8_t  ctrl_vol;    /* bits 1-2: segment volume control */
     uint8_t  ctrl_fast;   /* bit 3: 0=slow, 1=fast */
 
-    /* Sound command protocol state */
-    uint8_t  proto_state; /* 0=idle, 1=got $C0, 2=got hi nib, 3=dispatched */
-    uint8_t  proto_hi;    /* high nibble captured from first P2 data write */
-
     /* Current effect playback */
     bool     active;
     bool     is_noise;
@@ -770,95 +1178,256 @@ static void cop411_command(COP411L *snd, uint8_t cmd_byte) {
     }
 }
 
-/* Generate one audio sample from the COP411L */
-static inline float cop411_sample(COP411L *snd) {
+/* End of the current sequencer step (SFX commands 1-D): next step, loop,
+ * chain or stop */
+static void cop411_step_end(COP411L *snd) {
+    snd->cur_step++;
+    if (snd->cur_step >= snd->step_count) {
+        /* Effect finished */
+        if (snd->chain_cmd) {
+            /* Chain to next command (e.g., cmd 3 → cmd 2) */
+            cop411_build_effect(snd, snd->chain_cmd, 0);
+            return;
+        }
+        bool should_loop = false;
+        if (snd->force_no_loop) should_loop = false;
+        else if (snd->force_loop) should_loop = true;
+        else should_loop = snd->ctrl_loop;
+
+        if (should_loop) {
+            /* For cmd 5: loop from last step only */
+            if (snd->command == 0x05) {
+                snd->cur_step = snd->step_count - 1;
+            } else {
+                snd->cur_step = 0;
+            }
+        } else {
+            snd->active = false;
+            return;
+        }
+    }
+    /* Load new step (bounds check: defensive against corruption) */
+    if (snd->cur_step < 0 || snd->cur_step >= MAX_SND_STEPS) {
+        snd->active = false; return;
+    }
+    SndStep *s = &snd->steps[snd->cur_step];
+    snd->cur_freq = s->freq;
+    snd->is_noise = s->noise;
+    snd->cur_vol = s->volume;
+    snd->phase_inc = freq_to_phase_inc(s->freq);
+    snd->step_samples_left = (s->dur_ms * AUDIO_RATE) / 1000;
+    if (snd->step_samples_left < 1) snd->step_samples_left = 1;
+}
+
+/* End of a pure tone segment: seg1 → seg2 → loop or stop */
+static void cop411_seg_end(COP411L *snd) {
+    if (snd->segment == 0) {
+        /* Transition to segment 2 */
+        snd->segment = 1;
+        snd->cur_vol = snd->seg2_vol;
+        /* Seg2 has its own duration (Doc §6.2) */
+        int seg2_ms = snd->ctrl_fast ? 104 : 240;
+        snd->seg_samples_left = (seg2_ms * AUDIO_RATE) / 1000;
+    } else {
+        /* Tone finished */
+        if (snd->ctrl_loop) {
+            snd->segment = 0;
+            snd->cur_vol = snd->seg1_vol;
+            snd->seg_samples_left = snd->seg_samples_total;
+        } else {
+            snd->active = false;
+        }
+    }
+}
+
+/* Phase increment with the RC oscillator jitter applied */
+static inline uint32_t cop411_inc(const COP411L *snd, float jitter) {
+    return jitter != 1.0f ? (uint32_t)((float)snd->phase_inc * jitter) : snd->phase_inc;
+}
+
+/* Generate one audio sample from the COP411L. Reference for
+ * cop411_render(), which must match it sample for sample (test 23). */
+static inline float cop411_sample(COP411L *snd, float jitter) {
     if (!snd->active) return 0.0f;
 
     float out;
+    uint32_t inc = cop411_inc(snd, jitter);
+    snd->phase_acc += inc;
     if (snd->is_noise) {
-        /* LFSR noise: clock at the current frequency rate */
-        snd->phase_acc += snd->phase_inc;
-        /* Clock LFSR on phase overflow (roughly at freq rate) */
-        if (snd->phase_acc < snd->phase_inc) {
-            lfsr_clock(snd);
-        }
+        /* LFSR noise: clock on phase overflow (roughly at freq rate) */
+        if (snd->phase_acc < inc) lfsr_clock(snd);
         out = (snd->lfsr & 1) ? 1.0f : -1.0f;
     } else {
         /* Square wave */
-        snd->phase_acc += snd->phase_inc;
         out = (snd->phase_acc & 0x80000000) ? 1.0f : -1.0f;
     }
-
     out *= snd->cur_vol;
 
-    /* Advance step sequencer (for SFX commands 1-D) */
+    /* Advance step sequencer (SFX commands 1-D) or tone segments */
     if (snd->step_count > 0) {
-        snd->step_samples_left--;
-        if (snd->step_samples_left <= 0) {
-            snd->cur_step++;
-            if (snd->cur_step >= snd->step_count) {
-                /* Effect finished */
-                if (snd->chain_cmd) {
-                    /* Chain to next command (e.g., cmd 3 → cmd 2) */
-                    cop411_build_effect(snd, snd->chain_cmd, 0);
-                    return out;
-                }
-                bool should_loop = false;
-                if (snd->force_no_loop) should_loop = false;
-                else if (snd->force_loop) should_loop = true;
-                else should_loop = snd->ctrl_loop;
-
-                if (should_loop) {
-                    /* For cmd 5: loop from last step only */
-                    if (snd->command == 0x05) {
-                        snd->cur_step = snd->step_count - 1;
-                    } else {
-                        snd->cur_step = 0;
-                    }
-                } else {
-                    snd->active = false;
-                    return out;
-                }
+        if (--snd->step_samples_left <= 0) cop411_step_end(snd);
+    } else {
+        if (--snd->seg_samples_left <= 0) cop411_seg_end(snd);
+    }
+    return out;
+}
+
+/* Render n samples: runs up to the next step/segment boundary are
+ * generated in one loop each (constant increment and volume), then the
+ * boundary is processed once. */
+static void cop411_render(COP411L *snd, float *out, int n, float jitter) {
+    int i = 0;
+    while (i < n) {
+        if (!snd->active) {
+            memset(out + i, 0, (size_t)(n - i) * sizeof(float));
+            return;
+        }
+        int *left = snd->step_count > 0 ? &snd->step_samples_left : &snd->seg_samples_left;
+        int run = *left < 1 ? 1 : *left;
+        if (run > n - i) run = n - i;
+
+        uint32_t inc = cop411_inc(snd, jitter), acc = snd->phase_acc;
+        float vol = snd->cur_vol, *o = out + i;
+        if (snd->is_noise) {
+            uint16_t lfsr = snd->lfsr;
+            for (int k = 0; k < run; k++) {
+                acc += inc;
+                if (acc < inc)  /* 15-bit LFSR, as lfsr_clock() */
+                    lfsr = (uint16_t)((lfsr >> 1) | (((lfsr ^ (lfsr >> 1)) & 1) << 14));
+                o[k] = (lfsr & 1) ? vol : -vol;
             }
-            /* Load new step (bounds check: defensive against corruption) */
-            if (snd->cur_step < 0 || snd->cur_step >= MAX_SND_STEPS) {
-                snd->active = false; return out;
+            snd->lfsr = lfsr;
+        } else {
+            for (int k = 0; k < run; k++) {
+                acc += inc;
+                o[k] = (acc & 0x80000000) ? vol : -vol;
             }
-            SndStep *s = &snd->steps[snd->cur_step];
-            snd->cur_freq = s->freq;
-            snd->is_noise = s->noise;
-            snd->cur_vol = s->volume;
-            snd->phase_inc = freq_to_phase_inc(s->freq);
-            snd->step_samples_left = (s->dur_ms * AUDIO_RATE) / 1000;
-            if (snd->step_samples_left < 1) snd->step_samples_left = 1;
         }
-    } else {
-        /* Pure tone: two-segment playback */
-        snd->seg_samples_left--;
-        if (snd->seg_samples_left <= 0) {
-            if (snd->segment == 0) {
-                /* Transition to segment 2 */
-                snd->segment = 1;
-                snd->cur_vol = snd->seg2_vol;
-                /* Seg2 has its own duration (Doc §6.2) */
-                    { int seg2_ms = snd->ctrl_fast ? 104 : 240;
-                      snd->seg_samples_left = (seg2_ms * AUDIO_RATE) / 1000; }
-            } else {
-                /* Tone finished */
-                if (snd->ctrl_loop) {
-                    snd->segment = 0;
-                    snd->cur_vol = snd->seg1_vol;
-                    snd->seg_samples_left = snd->seg_samples_total;
-                } else {
-                    snd->active = false;
-                }
-            }
+        snd->phase_acc = acc;
+        i += run;
+
+        *left -= run;
+        if (*left <= 0) {
+            if (snd->step_count > 0) cop411_step_end(snd);
+            else                     cop411_seg_end(snd);
         }
     }
+}
 
-    return out;
+/* ---- CPU → audio command queue ----
+ * The COP411L belongs to the audio callback. The emulation thread posts
+ * timestamped events into a single-producer/single-consumer ring; the
+ * callback applies each one at its sample offset inside the buffer and
+ * publishes a seqlock copy of the chip for savestates and rewind. */
+#define SNDQ_SZ     256                     /* must be power of 2 */
+#define SNDQ_SLACK  (AUDIO_SAMPLES / 2)     /* (re)anchored event lands this far in */
+#define SNDQ_AHEAD  (2 * AUDIO_RATE / FPS)  /* further ahead than this: re-anchor */
+
+enum { SND_EV_CMD, SND_EV_RESET, SND_EV_RESTORE, SND_EV_LOAD };
+
+typedef struct {
+    uint64_t t;       /* CPU time in samples (snd_now) */
+    uint8_t  kind;    /* SND_EV_* */
+    uint8_t  arg;     /* CMD: command byte, RESET: keep ctrl, RESTORE: ctrl bits */
+    uint16_t lfsr;    /* RESTORE */
+} SndEvent;
+
+typedef struct {
+    SndEvent ev[SNDQ_SZ];
+    uint32_t wr;          /* written by the producer only */
+    uint32_t rd;          /* written by the consumer only */
+    uint32_t load_at;     /* ring index of the last SND_EV_LOAD */
+    COP411L  load;        /* its payload (one load in flight at a time) */
+    uint32_t overflows;   /* backlogs run by the producer under the lock */
+    /* Consumer clock: queue time t plays at sample clk position t + skew */
+    uint64_t clk;
+    int64_t  skew;
+    bool     anchored;
+    /* Published by the consumer after each buffer */
+    uint32_t pub_seq;     /* odd while pub is being written */
+    uint32_t pub_rd;      /* rd that pub reflects */
+    uint64_t pub_clk;     /* samples played when pub was taken */
+    COP411L  pub;
+} SndQueue;
+
+/* RESTORE ctrl bits: loop, vol (2), fast */
+#define SND_CTRL_PACK(s) (uint8_t)((s)->ctrl_loop | (s)->ctrl_vol << 1 | (s)->ctrl_fast << 3)
+
+static void sndq_apply(COP411L *snd, const SndEvent *e, const COP411L *load) {
+    switch (e->kind) {
+    case SND_EV_CMD:
+        cop411_command(snd, e->arg);
+        break;
+    case SND_EV_RESET: {
+        /* Reset keeps the control register (COP411L RAM survives) */
+        uint8_t ctrl = SND_CTRL_PACK(snd);
+        cop411_init(snd);
+        if (e->arg) {
+            snd->ctrl_loop = ctrl & 1; snd->ctrl_vol = (ctrl >> 1) & 3;
+            snd->ctrl_fast = (ctrl >> 3) & 1;
+            cop411_update_ctrl_vol(snd);
+        }
+        break;
+    }
+    case SND_EV_RESTORE:
+        snd->ctrl_loop = e->arg & 1; snd->ctrl_vol = (e->arg >> 1) & 3;
+        snd->ctrl_fast = (e->arg >> 3) & 1; snd->lfsr = e->lfsr;
+        snd->active = false;
+        break;
+    case SND_EV_LOAD:
+        *snd = *load;
+        break;
+    }
+}
+
+static void sndq_publish(SndQueue *q, const COP411L *snd, uint32_t rd) {
+    uint32_t seq = q->pub_seq;
+    AV_STORE_REL(&q->pub_seq, seq + 1);
+    AV_FENCE();
+    q->pub = *snd;
+    q->pub_rd = rd;
+    q->pub_clk = q->clk;
+    AV_STORE_REL(&q->pub_seq, seq + 2);
+}
+
+/* Consumer: render n samples, applying each queued command at its offset.
+ * The first command after a state event anchors the queue clock SLACK
+ * samples in; a late command moves the anchor so it plays now, one too
+ * far ahead (the CPU ran away, e.g. after a pause) re-anchors. State
+ * events apply as they come and drop the anchor. */
+static void sndq_render(SndQueue *q, COP411L *snd, float *out, int n, float jitter) {
+    uint32_t wr = AV_LOAD_ACQ(&q->wr), rd = q->rd;
+    int pos = 0;
+    while (rd != wr) {
+        const SndEvent *e = &q->ev[rd & (SNDQ_SZ - 1)];
+        if (e->kind != SND_EV_CMD) {
+            sndq_apply(snd, e, &q->load);
+            q->anchored = false;
+            rd++;
+            continue;
+        }
+        int64_t now = (int64_t)(q->clk + (uint64_t)pos);
+        int64_t at = (int64_t)e->t + q->skew;
+        if (!q->anchored || at > now + SNDQ_AHEAD) {
+            q->skew = now + SNDQ_SLACK - (int64_t)e->t;
+            q->anchored = true;
+        } else if (at < now) {
+            q->skew = now - (int64_t)e->t;
+        }
+        int off = (int)((int64_t)e->t + q->skew - (int64_t)q->clk);
+        if (off >= n) break;
+        cop411_render(snd, out + pos, off - pos, jitter);
+        pos = off;
+        sndq_apply(snd, e, NULL);
+        rd++;
+    }
+    cop411_render(snd, out + pos, n - pos, jitter);
+    q->clk += (uint64_t)n;
+    AV_STORE_REL(&q->rd, rd);
+    sndq_publish(q, snd, rd);
 }
 
+
 /* ============================================================================
  *  DISPLAY (Column-by-column rendering)
  * ========================================================================== */
@@ -870,11 +1439,50 @@ static inline float cop411_sample(COP411L *snd) {
 /* PHOSPHOR_DECAY is now configurable via av->cfg_phosphor */
 #define PHOSPHOR_DECAY_DEFAULT  0.45f
 
+/* Phosphor buffer format (AV.phosphor_fmt). Q8 keeps 0-255 levels
+ * column-major and decays them through a 256-entry LUT; it tracks the
+ * float path within PHOSPHOR_Q8_TOL (test 21). */
+#define PHOSPHOR_FLOAT  0
+#define PHOSPHOR_Q8     1
+#define PHOSPHOR_Q8_TOL (4.0f / 255.0f)
+
+/* Render backend (AV.render_backend, SDL builds). GL uploads only the
+ * SW×SH intensities and draws the LED look in a fragment shader at
+ * output resolution; CPU is used when no OpenGL renderer is available. */
+#define RENDER_CPU      0
+#define RENDER_GL       1
+
+/* Frame pacing (AV.sync_mode, SDL builds). AUDIO keeps the emulated sound
+ * time audio_latency ms ahead of what the device has played, steering the
+ * frame clock by up to DRC_MAX; TIMER (or no audio device) sleeps to 15 fps. */
+#define SYNC_TIMER      0
+#define SYNC_AUDIO      1
+#define DEF_AUDIO_LATENCY 80     /* ms */
+#define DRC_MAX         0.005    /* ±0.5% frame clock tuning */
+
+/* Run-ahead (AV.runahead frames, AV.spec while speculating) */
+#define RUNAHEAD_MAX    4
+#define SPEC_NONE       0
+#define SPEC_HIDDEN     1   /* no sound, no rewind, no phosphor */
+#define SPEC_SHOWN      2   /* no sound, no rewind; phosphor for display */
+
+/* Fast-forward (held key): AV.ff_speed frames per host frame, 0 = as many
+ * as fit in one frame time, up to FF_MAX_FRAMES so input stays live */
+#define FF_SPEED_MAX    16
+#define FF_MAX_FRAMES   64
+
 typedef struct {
     float   phosphor[SW * SH]; /* 0.0-1.0, POV persistence per LED */
     /* Column snapshot buffer: holds VRAM data at time each column is scanned */
     uint8_t col_data[SW][5];   /* [column][byte 0-4] captured during frame */
     int     cols_captured;     /* how many columns captured this frame */
+    int     cols_shown;        /* columns lit by the last disp_update */
+    /* PHOSPHOR_Q8: phos8 replaces phosphor while q8 is set */
+    bool    q8;
+    uint8_t phos8[SW][SH];     /* [column][row] 0-255 */
+    uint8_t decay_lut[256];
+    float   lut_decay;         /* decay the LUT was built for */
+    bool    lut_ok;
 
     /* Hardware LED registers (Daniel Boris doc §4.3):
      * 5 registers x 8 bits = 40 LEDs. Written as a side-effect of MOVX
@@ -900,6 +1508,7 @@ static void disp_capture_column(AVDisp *d, const uint8_t *xram, int col) {
         d->cols_captured = col + 1;
 }
 
+#ifndef AV_LIB
 /* Decode P2 bits 5-7 to LED register index per hardware spec (§4.3):
  * P2.5 P2.6 P2.7 -> Register (LED numbers from top)
  *   1    0    0  -> 0 (LEDs 1-8)
@@ -919,20 +1528,74 @@ static int led_reg_decode(uint8_t p2) {
     if (sel >= 1 && sel <= 5) return (int)(sel - 1);
     return -1; /* 0, 6, 7 = unused / sound control */
 }
+#endif
 
-/* Latch LED registers to display column (called on P2.4 rising edge).
- * This is the hardware-accurate display path: the BIOS fills LED registers
- * via MOVX reads, then strobes P2.4 to advance to the next column. */
-static void disp_latch_led_column(AVDisp *d) {
-    int col = d->led_col;
-    if (col >= 0 && col < SW) {
-        for (int i = 0; i < 5; i++)
-            d->col_data[col][i] = d->led_reg[i];
-        if (col >= d->cols_captured)
-            d->cols_captured = col + 1;
+/* One frame of decay for a pixel at level p. Bright pixels decay faster
+ * (exponent increases with brightness): at p=1.0 decay^1.5, at p=0.1
+ * decay^1.05. This gives a lingering tail that looks like real LED
+ * phosphor afterglow. */
+static inline float disp_decay(float p, float decay) {
+    if (p < 0.01f) return 0.0f;
+    float exp = 1.0f + p * 0.5f;
+    p = p * powf(decay, exp);
+    return p < 0.01f ? 0.0f : p;
+}
+
+/* Rows (4-bi)*8 .. +7 lit by column byte val (active low, bit 7 = top),
+ * as 0xFF bytes in memory order */
+static inline uint64_t disp_lit_mask(uint8_t val) {
+    static const uint8_t sel[8] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 };
+    uint64_t s, m = (uint8_t)~val * 0x0101010101010101ULL;
+    memcpy(&s, sel, 8);
+    m &= s;                                     /* each byte keeps its bit */
+    m = ((m + 0x7F7F7F7F7F7F7F7FULL) | m) & 0x8080808080808080ULL;
+    return (m >> 7) * 0xFF;
+}
+
+/* Set pixels of the first cols columns of col_data (active low) to v */
+static void disp_light(AVDisp *d, const uint8_t (*col_data)[5], int cols, float v) {
+    if (d->q8) {
+        uint64_t q = (uint8_t)(v * 255.0f + 0.5f) * 0x0101010101010101ULL;
+        for (int col = 0; col < cols; col++) {
+            for (int bi = 0; bi < 5; bi++) {
+                uint64_t w, m = disp_lit_mask(col_data[col][bi]);
+                uint8_t *p = &d->phos8[col][(4 - bi) * 8];
+                memcpy(&w, p, 8);
+                w = (w & ~m) | (q & m);
+                memcpy(p, &w, 8);
+            }
+        }
+        return;
+    }
+    for (int col = 0; col < cols; col++) {
+        for (int bi = 0; bi < 5; bi++) {
+            uint8_t val = col_data[col][bi];
+            for (int bit = 0; bit < 8; bit++) {
+                int y = (4 - bi) * 8 + (7 - bit);
+                if ((unsigned)y >= (unsigned)SH) continue;
+                if (!(val & (1 << bit)))
+                    d->phosphor[col + y * SW] = v;
+            }
+        }
     }
-    d->led_col++;
-    d->led_active = true;
+}
+
+static void disp_clear(AVDisp *d) {
+    memset(d->phosphor, 0, sizeof(d->phosphor));
+    memset(d->phos8, 0, sizeof(d->phos8));
+}
+
+/* Switch buffer format, carrying the current image across */
+static void disp_set_q8(AVDisp *d, bool q8) {
+    if (d->q8 == q8) return;
+    for (int x = 0; x < SW; x++)
+        for (int y = 0; y < SH; y++) {
+            if (q8) d->phos8[x][y] = (uint8_t)(d->phosphor[x + y * SW] * 255.0f + 0.5f);
+            else d->phosphor[x + y * SW] = d->phos8[x][y] * (1.0f / 255.0f);
+        }
+    if (q8) memset(d->phosphor, 0, sizeof(d->phosphor));
+    else memset(d->phos8, 0, sizeof(d->phos8));
+    d->q8 = q8;
 }
 
 /* Update display from captured column data (called at end of frame)
@@ -940,81 +1603,273 @@ static void disp_latch_led_column(AVDisp *d) {
  * fast initially, then linger at low brightness (real LED afterimage).
  * Formula: new = old * decay^(1 + old*0.5)  — brightness-dependent. */
 static void disp_update(AVDisp *d, float decay) {
-    /* Non-linear phosphor decay */
-    for (int i = 0; i < SW * SH; i++) {
-        float p = d->phosphor[i];
-        if (p < 0.01f) { d->phosphor[i] = 0.0f; continue; }
-        /* Bright pixels decay faster (exponent increases with brightness).
-         * At p=1.0: decay^1.5, at p=0.1: decay^1.05. This gives a
-         * lingering tail that looks like real LED phosphor afterglow. */
-        float exp = 1.0f + p * 0.5f;
-        d->phosphor[i] = p * powf(decay, exp);
-        if (d->phosphor[i] < 0.01f) d->phosphor[i] = 0.0f;
+    if (d->q8) {
+        /* LUT decay, 8 levels per word; dark words (most of the screen)
+         * are skipped on a zero test */
+        if (!d->lut_ok || d->lut_decay != decay) {
+            for (int q = 0; q < 256; q++)
+                d->decay_lut[q] = (uint8_t)(disp_decay(q * (1.0f / 255.0f), decay) * 255.0f + 0.5f);
+            d->lut_decay = decay; d->lut_ok = true;
+        }
+        uint8_t *p = &d->phos8[0][0];
+        for (int i = 0; i < SW * SH; i += 8) {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            if (!w) continue;
+            for (int k = i; k < i + 8; k++) p[k] = d->decay_lut[p[k]];
+        }
+    } else {
+        for (int i = 0; i < SW * SH; i++)
+            d->phosphor[i] = disp_decay(d->phosphor[i], decay);
     }
 
     /* Light up pixels from captured column data */
     int cols = d->cols_captured;
     if (cols > SW) cols = SW;
-    for (int col = 0; col < cols; col++) {
-        for (int bi = 0; bi < 5; bi++) {
-            uint8_t val = d->col_data[col][bi];
-            for (int bit = 0; bit < 8; bit++) {
-                int y = (4 - bi) * 8 + (7 - bit);
-                if ((unsigned)y >= (unsigned)SH) continue;
-                if (!(val & (1 << bit)))
-                    d->phosphor[col + y * SW] = 1.0f;
-            }
-        }
-    }
+    disp_light(d, (const uint8_t (*)[5])d->col_data, cols, 1.0f);
+    d->cols_shown = cols;
     d->cols_captured = 0;
 }
 
 /* Get pixel intensity */
 static float disp_px(const AVDisp *d, int x, int y) {
     if ((unsigned)x >= (unsigned)SW || (unsigned)y >= (unsigned)SH) return 0.0f;
-    return d->phosphor[x + y * SW];
+    return d->q8 ? d->phos8[x][y] * (1.0f / 255.0f) : d->phosphor[x + y * SW];
+}
+
+#ifndef AV_LIB
+/* Pixels brighter than 0.1 (headless/batch summaries) */
+static int disp_lit_count(const AVDisp *d) {
+    int lit = 0;
+    for (int y = 0; y < SH; y++)
+        for (int x = 0; x < SW; x++) if (disp_px(d, x, y) > 0.1f) lit++;
+    return lit;
 }
+#endif
 
 /* ============================================================================
  *  SYSTEM
  * ========================================================================== */
 
-/* Rewind snapshot: CPU core + RAM (compact, ~1.2KB per frame) */
+/* Rewind snapshot: CPU core + RAM + the frame's lit columns (~1.9KB).
+ * Phosphor is not stored: rewind_pop rebuilds it from the columns. */
 typedef struct {
     uint8_t  A, PSW, SP, P1, P2, BUS, timer;
     uint16_t PC;
     uint8_t  flags;   /* MB,C,AC,F0,F1,BS,timer_en,counter_en */
     uint8_t  flags2;  /* timer_ovf,tcnti_en,irq_en,irq_pend,in_irq */
     int      tpre;
-    uint8_t  iram[IRAM_SZ];
-    uint8_t  xram[XRAM_SZ];
-    float    phosphor[SW * SH];
     /* COP411L essential state */
     uint8_t  snd_ctrl_loop, snd_ctrl_vol, snd_ctrl_fast;
     uint8_t  snd_proto_state, snd_proto_hi;
     uint16_t snd_lfsr;
+    uint8_t  cols;    /* disp.cols_shown */
+} RewindRegs;
+
+typedef struct {
+    RewindRegs r;
+    uint8_t  iram[IRAM_SZ];
+    uint8_t  xram[XRAM_SZ];
+    uint8_t  col_data[SW][5];
 } RewindSnap;
 
-/* WAV file writer state — ring buffer decouples audio thread from disk I/O */
-#define WAV_RING_SZ  8192  /* must be power of 2 */
+/* Rewind history. key is the newest snapshot; slot i of off/len holds
+ * snapshot i XOR snapshot i-1, zero-run-length coded, so popping walks back
+ * from the key and evicting the oldest frame just forgets its record. */
+typedef struct {
+    RewindSnap key;
+    uint32_t   off[REWIND_FRAMES];
+    uint16_t   len[REWIND_FRAMES];
+    uint32_t   wr;                   /* next write offset in data */
+    uint8_t    data[REWIND_BYTES];
+} Rewind;
+
+/* Recorder: WAV audio, or an A/V capture (REC_AVC: PCM + per-frame LED
+ * columns in one file). The audio callback and the main loop fill rings;
+ * a writer thread (SDL builds) drains them in large batches. */
+#define WAV_RING_SZ  (1 << 18)  /* samples (~6 s), must be power of 2 */
+#define REC_VID_SZ   128        /* frames (~8.5 s), must be power of 2 */
+#define REC_BATCH    16384      /* samples per audio write */
+#define REC_POLL_MS  20
+#define REC_WAV      0
+#define REC_AVC      1
+
+typedef struct {
+    uint32_t sample;            /* samples recorded when the frame ended */
+    uint8_t  cols;              /* disp.cols_shown */
+    uint8_t  col_data[SW][5];
+} RecFrame;
+
 typedef struct {
     FILE *fp;
+    int   fmt;                  /* REC_WAV / REC_AVC */
     uint32_t samples_written;
-    bool active;
-    /* Ring buffer: audio thread writes, main thread flushes */
-    int16_t ring[WAV_RING_SZ];
-    uint32_t ring_wr;            /* written by audio thread, read under AUDIO_LOCK */
-    uint32_t ring_rd;           /* read by main thread */
+    uint32_t frames_written;
+    bool active;                /* audio callback records (set under AUDIO_LOCK) */
+    /* Audio ring: the callback writes, the writer thread drains */
+    int16_t *ring;
+    uint32_t ring_wr;
+    uint32_t ring_rd;
+    uint32_t overruns;          /* samples dropped because the ring was full */
+    /* Video ring (REC_AVC): the main loop writes */
+    RecFrame *vid;
+    uint32_t vid_wr, vid_rd;
+    uint32_t vid_overruns;      /* frames dropped */
+    uint8_t  vid_key[SW][5];    /* last written frame, for the delta */
+    uint32_t stop;              /* asks the writer thread to finish */
+    void    *thread;            /* SDL_Thread */
 } WavWriter;
 
+/* Input movie being recorded or replayed, see movie_start */
+typedef struct {
+    FILE    *fp;
+    bool     play;              /* replaying rather than recording */
+    bool     err, desync;
+    uint8_t  mask;              /* input of the current run */
+    uint32_t run;               /* frames left (replay) or pending (record) */
+    uint32_t frames;            /* frames recorded / replayed */
+    uint32_t checks;            /* state hashes verified (replay) */
+} Movie;
+
+#if !defined(AV_LIB) || defined(AV_PROFILE)
+/* Monotonic wall clock in ns (profiler, --bench) */
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+#ifdef _MSC_VER
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* ---- Profiler (build with -DAV_PROFILE) ----
+ * Wall-clock spans of the hot paths, one ring per zone: the emulation
+ * zones are written by the main or emulation thread, the render zones by
+ * the main thread, the audio zones by the callback, so each ring has a
+ * single writer. A gap is a callback
+ * that came more than two buffers after the previous one (the device
+ * ran dry). Without AV_PROFILE the macros expand to nothing. */
+#ifdef AV_PROFILE
+enum { PROF_RUN, PROF_DISP, PROF_RENDER, PROF_UPLOAD, PROF_PRESENT,
+       PROF_AUDIO, PROF_GAP, PROF_ZONES };
+#ifndef AV_LIB
+static const char *prof_zone_names[PROF_ZONES] = {
+    "av_run_frame", "disp_update", "render", "SDL_UpdateTexture",
+    "SDL_RenderPresent", "audio_cb", "audio gap" };
+#endif
+#define PROF_RING       4096    /* spans kept per zone (~4.5 min of frames) */
+#define PROF_HIST_N     64      /* spans per overlay histogram */
+#define PROF_BUCKETS    16      /* log2 buckets, 1 us .. 32 ms and above */
+
+typedef struct { uint64_t t0, dur; } ProfSpan;  /* ns */
+typedef struct {
+    ProfSpan ring[PROF_ZONES][PROF_RING];
+    uint32_t head[PROF_ZONES];  /* spans pushed so far */
+    uint64_t origin;            /* trace time 0 */
+    uint64_t audio_prev;        /* start of the previous callback */
+} AVProf;
+
+static void prof_push(AVProf *p, int z, uint64_t t0, uint64_t t1) {
+    if (!p) return;
+    uint32_t h = p->head[z];
+    p->ring[z][h % PROF_RING] = (ProfSpan){ t0, t1 - t0 };
+    AV_STORE_REL(&p->head[z], h + 1);
+}
+
+#ifndef AV_LIB
+static AVProf *prof_create(void) {
+    AVProf *p = (AVProf *)calloc(1, sizeof(AVProf));
+    if (p) p->origin = mono_ns();
+    return p;
+}
+
+#ifdef USE_SDL
+/* Log2 histogram, mean and max (ns) of the last n spans of a zone, for
+ * the stats overlay. Returns the number of spans used. */
+static int prof_hist(const AVProf *p, int z, int n, uint32_t hist[PROF_BUCKETS],
+                     uint64_t *mean, uint64_t *max) {
+    uint32_t h = AV_LOAD_ACQ(&p->head[z]);
+    if (n > (int)h) n = (int)h;
+    if (n > PROF_RING) n = PROF_RING;
+    uint64_t sum = 0;
+    *max = 0;
+    memset(hist, 0, PROF_BUCKETS * sizeof(uint32_t));
+    for (int i = 0; i < n; i++) {
+        uint64_t d = p->ring[z][(h - 1 - (uint32_t)i) % PROF_RING].dur;
+        int b = 0;
+        for (uint64_t us = d / 1000; us > 1 && b < PROF_BUCKETS - 1; us >>= 1) b++;
+        hist[b]++;
+        sum += d;
+        if (d > *max) *max = d;
+    }
+    *mean = n ? sum / (uint64_t)n : 0;
+    return n;
+}
+#endif
+
+/* Chrome trace ("Trace Event Format", chrome://tracing or Perfetto):
+ * one complete event per span still in the rings, main thread tid 1,
+ * audio callback tid 2. */
+static bool prof_export(const AVProf *p, const char *fn) {
+    FILE *f = fopen(fn, "w");
+    if (!f) { fprintf(stderr, "Cannot write %s\n", fn); return false; }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}},\n"
+               "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"audio\"}}");
+    for (int z = 0; z < PROF_ZONES; z++) {
+        uint32_t h = p->head[z], n = h < PROF_RING ? h : PROF_RING;
+        for (uint32_t i = h - n; i != h; i++) {
+            const ProfSpan *s = &p->ring[z][i % PROF_RING];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%.3f,\"dur\":%.3f}", prof_zone_names[z],
+                    z >= PROF_AUDIO ? 2 : 1,
+                    (double)(s->t0 - p->origin) / 1000.0, (double)s->dur / 1000.0);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Write error on %s\n", fn);
+    return ok;
+}
+#endif
+
+#define PROF_BEGIN(av, z) uint64_t prof_t_##z = (av)->prof ? mono_ns() : 0
+#define PROF_END(av, z)   do { if ((av)->prof) prof_push((av)->prof, z, prof_t_##z, mono_ns()); } while (0)
+#else
+#define PROF_BEGIN(av, z) ((void)0)
+#define PROF_END(av, z)   ((void)0)
+#endif
+
+#define FRAME_SCHED_POLL  0   /* per-instruction T1/capture checks (reference) */
+#define FRAME_SCHED_EVENT 1   /* cycle event scheduler, see av_frame_events */
+
 struct AV {
     I8048   cpu;
     AVDisp  disp;
-    COP411L snd;
+    COP411L snd;                /* owned by the audio callback once adev is open */
+    SndQueue sndq;              /* CPU → audio events, see snd_post */
+    uint8_t snd_proto_state;    /* P2 protocol: 0=idle, 1=got $C0, 2=got hi nib, 3=dispatched */
+    uint8_t snd_proto_hi;       /* high nibble captured from first P2 data write */
     struct { bool u,d,l,r,b1,b2,b3,b4; } input;
     int snd_volume;             /* 0-10, default 7 — access under AUDIO_LOCK */
     uint32_t adev;              /* SDL audio device ID for thread-safe locking */
-    struct { bool active, stepping; uint16_t bp[MAX_BP]; int bp_count; } dbg;
+    bool snd_pull;              /* no device, queue drained by avl_step (libadvision) */
+    /* Debugger: PC breakpoint and XRAM read/write watch bitmaps. A stop
+     * mid-frame keeps its place (frame_at) so continuing or stepping
+     * finishes the same frame with the same T1 timing. */
+    struct {
+        bool     active, stepping;
+        bool     resume;            /* continuing: skip a breakpoint at PC once */
+        int      frame_at;          /* cycles into the stopped frame, 0 = at its start */
+        uint8_t  bp[PC_SPACE / 8];
+        uint8_t  watch[2 * XRAM_SZ / 8];
+        int      bps, watches;      /* bits set */
+        uint16_t hit_pc, hit;       /* last stop: instruction, watch_hit (0 = breakpoint) */
+        uint32_t stops;
+    } dbg;
     bool running;
     bool paused;
     bool back_to_menu;
@@ -1024,16 +1879,18 @@ struct AV {
     char osd_text[64];
     int  osd_timer;
     /* Rewind ring buffer */
-    RewindSnap *rewind_buf;  /* heap-allocated [REWIND_FRAMES] */
+    Rewind *rewind_buf;      /* heap-allocated */
     int  rewind_head;        /* next write position */
     int  rewind_count;       /* number of valid snapshots */
     /* WAV recording */
     WavWriter wav;
+    Movie     movie;
     /* Audio low-pass filter state (biquad: 2-pole for realistic speaker response) */
     float bq_x1, bq_x2;  /* input history */
     float bq_y1, bq_y2;  /* output history */
     float bq_b0, bq_b1, bq_b2, bq_a1, bq_a2;  /* biquad coefficients */
     int   bq_prof;        /* profile for which coefficients were computed */
+    float clip_lut[CLIP_LUT_N + 1];  /* speaker soft clip: 0.2*tanh over [0, 8) */
     /* RC oscillator jitter (COP411L ±15% clock variation) */
     float rc_jitter;      /* current pitch multiplier (0.85 - 1.15) */
     float rc_drift;       /* slow random walk velocity */
@@ -1063,21 +1920,115 @@ struct AV {
     int   stat_pixels;         /* lit pixel count */
     /* v15: debugger enhancements */
     uint16_t dbg_run_to;      /* run-to-address (-1 = disabled) */
-    uint16_t dbg_watch_addr;  /* XRAM watchpoint addr (-1 = none) */
-    bool     dbg_watch_en;
     /* Display timing: track T1 sync for accurate column capture */
     int      disp_sync_cycle;   /* cycle when T1 went high (sync end) */
     bool     disp_sync_seen;    /* true once T1 rising edge detected */
     /* P2 tracking for hardware display emulation */
     uint8_t  prev_p2;           /* previous P2 value for edge detection */
+    /* CPU execution engine (CPU_ENGINE_INTERP / CPU_ENGINE_BLOCK) */
+    int         cpu_engine;
+    I8048Cache *icache;         /* heap-allocated on first block-engine frame */
+    /* Frame loop (FRAME_SCHED_POLL / FRAME_SCHED_EVENT) */
+    int         frame_sched;
+    bool        idle_skip;      /* fast-forward BIOS wait loops (i8048_idle_skip) */
+    /* Phosphor buffer (PHOSPHOR_FLOAT / PHOSPHOR_Q8) */
+    int         phosphor_fmt;
+    /* Renderer (RENDER_CPU / RENDER_GL) */
+    int         render_backend;
+    /* Frame pacing (SYNC_TIMER / SYNC_AUDIO), latency target in ms */
+    int         sync_mode;
+    int         audio_latency;
+    float       stat_audio_lead;  /* measured ms ahead of the device (SYNC_AUDIO) */
+    /* Run-ahead: frames emulated past the real one (0 = off), and the
+     * kind of frame being run (SPEC_*, see av_runahead) */
+    int         runahead;
+    int         spec;
+    /* Fast-forward: key held, speed (0 = uncapped) */
+    bool        ff_held;
+    int         ff_speed;
+    /* Producer sound clock: CPU time in samples since snd_cyc0, divided by
+     * snd_div while fast-forwarding (see snd_now) */
+    uint64_t    snd_t0, snd_cyc0;
+    int         snd_div;
+    /* Per-instance scratch (no file-scope state, so AVs can run in parallel) */
+    uint32_t    audio_rng;      /* xorshift32 state for RC jitter */
+    AVRender   *rend;           /* render buffers/tables, SDL builds only */
+    NetLink    *net;            /* rollback netplay session, SDL builds only */
+    /* Emulation on its own thread (SDL builds), and the display render()
+     * draws: NULL = disp, else the emulation thread's latest frame */
+    bool           emu_thread;
+    const AVDisp  *disp_view;
+    /* Overlay stats published with disp_view (the live ones belong to the
+     * emulation thread) */
+    uint64_t       view_cycles;
+    float          view_audio_lead;
+#ifdef AV_PROFILE
+    AVProf     *prof;           /* span rings, NULL = not profiling */
+#endif
 };
 
-/* av_led_latch: called from MOVX read (i8048_exec) to latch data to LED reg.
- * Must be defined after AV struct is fully visible. */
-static void av_led_latch(AV *av, uint8_t p2, uint8_t data) {
-    if (!av) return;
-    int ri = led_reg_decode(p2);
-    if (ri >= 0) av->disp.led_reg[ri] = data;
+/* Queue time of the current cycle. Fast-forward divides elapsed CPU time
+ * by snd_div, so k frames of commands play (time-compressed) in one
+ * frame of audio instead of piling up ahead of the device. */
+static uint64_t snd_now(AV *av) {
+    if (av->cpu.cycles < av->snd_cyc0) av->snd_cyc0 = av->cpu.cycles;  /* reset/load */
+    uint64_t div = av->snd_div > 1 ? (uint64_t)av->snd_div : 1;
+    return av->snd_t0 + (av->cpu.cycles - av->snd_cyc0) * AUDIO_RATE / CPU_CLK / div;
+}
+
+#ifdef USE_SDL
+static void snd_set_div(AV *av, int div) {
+    if (div < 1) div = 1;
+    if (div == (av->snd_div > 1 ? av->snd_div : 1)) return;
+    av->snd_t0 = snd_now(av);
+    av->snd_cyc0 = av->cpu.cycles;
+    av->snd_div = div;
+}
+#endif
+
+/* Producer side of the sound queue. Without an audio device the chip is
+ * driven inline, so headless runs and the self-tests stay deterministic;
+ * libadvision queues too and renders each frame's audio after it. */
+static void snd_post(AV *av, uint8_t kind, uint8_t arg, uint16_t lfsr, const COP411L *load) {
+    if (av->spec) return;  /* run-ahead frames are silent */
+    SndEvent e = { snd_now(av), kind, arg, lfsr };
+    if (av->adev || av->snd_pull) {
+        SndQueue *q = &av->sndq;
+        uint32_t wr = q->wr, rd = AV_LOAD_ACQ(&q->rd);
+        /* Ring full or a load payload still in flight: the device is
+         * stalled, so run the backlog here while the callback is locked out */
+        if (wr - rd >= SNDQ_SZ || (kind == SND_EV_LOAD && q->load_at - rd < wr - rd)) {
+            AUDIO_LOCK(av);
+            for (rd = q->rd; rd != wr; rd++)
+                sndq_apply(&av->snd, &q->ev[rd & (SNDQ_SZ - 1)], &q->load);
+            q->anchored = false;
+            q->overflows++;
+            AV_STORE_REL(&q->rd, rd);
+            sndq_publish(q, &av->snd, rd);
+            AUDIO_UNLOCK(av);
+        }
+        if (kind == SND_EV_LOAD) { q->load = *load; q->load_at = wr; }
+        q->ev[wr & (SNDQ_SZ - 1)] = e;
+        AV_STORE_REL(&q->wr, wr + 1);
+        return;
+    }
+    sndq_apply(&av->snd, &e, load);
+}
+
+/* The chip as of the last posted event: the callback's published copy
+ * with the events it has not reached yet replayed on top */
+static void snd_snapshot(const AV *av, COP411L *out) {
+    const SndQueue *q = &av->sndq;
+    if (!av->adev && !av->snd_pull) { *out = av->snd; return; }
+    uint32_t seq, rd;
+    do {
+        seq = AV_LOAD_ACQ(&q->pub_seq);
+        *out = q->pub;
+        rd = q->pub_rd;
+        AV_FENCE();
+    } while ((seq & 1) || seq != AV_LOAD_ACQ(&q->pub_seq));
+    for (; rd != q->wr; rd++)
+        sndq_apply(out, &q->ev[rd & (SNDQ_SZ - 1)], &q->load);
 }
 
 static void av_port_write(AV *av, uint8_t port, uint8_t val) {
@@ -1113,45 +2064,32 @@ static void av_port_write(AV *av, uint8_t port, uint8_t val) {
          * The command byte is reconstructed: (hi_nib << 4) | lo_nib
          * P2 bits 0-3 carry ROM bank address, NOT sound data.
          *
-         * Lock audio device around cop411_command to prevent race
-         * with the audio callback thread reading COP411L state. */
+         * The command goes to the audio thread through the sound queue,
+         * stamped with the current cycle so it plays at that offset. */
         /* Sound protocol (BIOS routine at $03A9-$03CD):
          * 1. P2=$C0 → trigger reset latch via MOVX @R0
          * 2. Wait 33 cycles → release reset via MOVX
          * 3. P2=cmd_byte → upper nibble to COP411 (bits 4-7 of P2)
          * 4. P2=SWAP(cmd_byte) → lower nibble to COP411
          * 5. P2=$00 → clear */
-        if (av->snd.proto_state == 0 && val == 0xC0) {
-            av->snd.proto_state = 1;
-            av->snd.proto_hi = 0;
-        } else if (av->snd.proto_state == 1) {
+        if (av->snd_proto_state == 0 && val == 0xC0) {
+            av->snd_proto_state = 1;
+            av->snd_proto_hi = 0;
+        } else if (av->snd_proto_state == 1) {
             /* Accept ANY value — the BIOS OUTL P2,A with full cmd byte */
-            av->snd.proto_hi = (val >> 4) & 0x0F;
-            av->snd.proto_state = 2;
-        } else if (av->snd.proto_state == 2) {
+            av->snd_proto_hi = (val >> 4) & 0x0F;
+            av->snd_proto_state = 2;
+        } else if (av->snd_proto_state == 2) {
             if (val == 0x00) {
-#ifdef USE_SDL
-                if (av->adev) SDL_LockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
-                cop411_command(&av->snd, (uint8_t)(av->snd.proto_hi << 4));
-#ifdef USE_SDL
-                if (av->adev) SDL_UnlockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
-                av->snd.proto_state = 0;
+                snd_post(av, SND_EV_CMD, (uint8_t)(av->snd_proto_hi << 4), 0, NULL);
+                av->snd_proto_state = 0;
             } else {
                 uint8_t lo = (val >> 4) & 0x0F;
-                uint8_t cmd_byte = (uint8_t)(av->snd.proto_hi << 4) | lo;
-#ifdef USE_SDL
-                if (av->adev) SDL_LockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
-                cop411_command(&av->snd, cmd_byte);
-#ifdef USE_SDL
-                if (av->adev) SDL_UnlockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
-                av->snd.proto_state = 3;
+                snd_post(av, SND_EV_CMD, (uint8_t)(av->snd_proto_hi << 4) | lo, 0, NULL);
+                av->snd_proto_state = 3;
             }
-        } else if (av->snd.proto_state == 3) {
-            if (val == 0x00) av->snd.proto_state = 0;
+        } else if (av->snd_proto_state == 3) {
+            if (val == 0x00) av->snd_proto_state = 0;
         }
         break;
     }
@@ -1186,36 +2124,47 @@ static void av_init(AV *av) {
     av->cpu.t0 = true;  /* T0 = expansion port, always 1 (MEGA doc) */
     memset(av->cpu.xram + 0x100, 0xFF, 0x300);
     cop411_init(&av->snd);
+    av->sndq.pub = av->snd;
     snprintf(av->save_name, sizeof(av->save_name), "advision.sav");
     av->audio_profile = AUDIO_SPEAKER;
     av->cfg_gamma = DEF_LED_GAMMA;
     av->cfg_phosphor = DEF_PHOSPHOR;
     av->t1_pulse_start = DEF_T1_START;
     av->t1_pulse_end = DEF_T1_END;
+    av->audio_latency = DEF_AUDIO_LATENCY;
     av->prev_p2 = 0;
     av->cpu.ei_delay = 0;
     /* Audio filter state: will be computed on first audio callback */
     av->bq_prof = -1;  /* force coefficient recompute */
     av->rc_jitter = 1.0f;
     av->rc_drift = 0.0f;
+    av->audio_rng = 0xDEADBEEF;
     memset(av->disp.led_reg, 0xFF, sizeof(av->disp.led_reg));
     av->disp.led_col = 0;
     av->disp.led_active = false;
     av->midframe_scan = true;  /* Default: accurate mid-frame column capture */
+    av->idle_skip = true;      /* Default: skip JT1/JNT1/DJNZ self-loops */
     av->led_glow = true;       /* Default: LED bloom enabled */
     av->led_vignette = true;   /* Default: mirror vignette enabled */
     av->led_round = true;      /* Default: round LED dots */
     av->mirror_warp = true;    /* Default: barrel distortion enabled */
     av->led_pipeline = false;  /* Default: off (XRAM direct capture) */
     av->dbg_run_to = 0xFFFF;
-    av->dbg_watch_addr = 0xFFFF;
     /* Rewind buffer: allocate on first init, reuse afterwards */
     if (!av->rewind_buf)
-        av->rewind_buf = (RewindSnap *)calloc(REWIND_FRAMES, sizeof(RewindSnap));
+        av->rewind_buf = (Rewind *)calloc(1, sizeof(Rewind));
     av->rewind_head = 0;
     av->rewind_count = 0;
 }
 
+/* A new frame-aligned state (reset, loaded state, rewind) drops the
+ * debugger's place in the frame it stopped in: the next av_run_frame
+ * starts a frame */
+static void av_dbg_realign(AV *av) {
+    av->dbg.stepping = av->dbg.resume = false;
+    av->dbg.frame_at = 0;
+}
+
 static void av_reset(AV *av) {
     uint8_t irom_bak[IROM_SZ], erom_bak[EROM_SZ];
     memcpy(irom_bak, av->cpu.irom, IROM_SZ);
@@ -1223,10 +2172,6 @@ static void av_reset(AV *av) {
     AVDisp disp_bak = av->disp;
     int vol = av->snd_volume;
     char sname[128]; memcpy(sname, av->save_name, 128);
-    /* Preserve COP411L control register (RAM survives reset) */
-    uint8_t ctrl_loop = av->snd.ctrl_loop;
-    uint8_t ctrl_vol = av->snd.ctrl_vol;
-    uint8_t ctrl_fast = av->snd.ctrl_fast;
 
     memset(&av->cpu, 0, sizeof(I8048));
     memset(&av->input, 0, sizeof(av->input));
@@ -1237,56 +2182,28 @@ static void av_reset(AV *av) {
     memcpy(av->cpu.irom, irom_bak, IROM_SZ);
     memcpy(av->cpu.erom, erom_bak, EROM_SZ);
     av->disp = disp_bak;
-    memset(av->disp.phosphor, 0, sizeof(av->disp.phosphor));
+    disp_clear(&av->disp);
     av->snd_volume = vol;
-#ifdef USE_SDL
-    if (av->adev) SDL_LockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
-    cop411_init(&av->snd);
-    av->snd.ctrl_loop = ctrl_loop;
-    av->snd.ctrl_vol = ctrl_vol;
-    av->snd.ctrl_fast = ctrl_fast;
-    cop411_update_ctrl_vol(&av->snd);
-#ifdef USE_SDL
-    if (av->adev) SDL_UnlockAudioDevice((SDL_AudioDeviceID)av->adev);
-#endif
+    /* COP411L control register is preserved (RAM survives reset) */
+    av->snd_proto_state = av->snd_proto_hi = 0;
+    snd_post(av, SND_EV_RESET, 1, 0, NULL);
     av->frame_count = 0;
     av->paused = false;
     memcpy(av->save_name, sname, 128);
+    av_dbg_realign(av);
 }
 
+#ifdef USE_SDL
 static void osd_show(AV *av, const char *msg) {
     snprintf(av->osd_text, sizeof(av->osd_text), "%s", msg);
     av->osd_timer = FPS * 2;
 }
+#endif
 
 /* ---- Rewind ---- */
-static void rewind_push(AV *av) {
-    if (!av->rewind_buf) return;
-    RewindSnap *s = &av->rewind_buf[av->rewind_head];
-    s->A = av->cpu.A; s->PC = av->cpu.PC; s->PSW = av->cpu.PSW;
-    s->SP = av->cpu.SP; s->P1 = av->cpu.P1; s->P2 = av->cpu.P2;
-    s->BUS = av->cpu.BUS; s->timer = av->cpu.timer; s->tpre = av->cpu.tpre;
-    s->flags = (av->cpu.MB)|(av->cpu.C<<1)|(av->cpu.AC<<2)|
-              (av->cpu.F0<<3)|(av->cpu.F1<<4)|(av->cpu.BS<<5)|
-              (av->cpu.timer_en<<6)|(av->cpu.counter_en<<7);
-    s->flags2 = (av->cpu.timer_ovf)|(av->cpu.tcnti_en<<1)|
-               (av->cpu.irq_en<<2)|(av->cpu.irq_pend<<3)|(av->cpu.in_irq<<4);
-    memcpy(s->iram, av->cpu.iram, IRAM_SZ);
-    memcpy(s->xram, av->cpu.xram, XRAM_SZ);
-    memcpy(s->phosphor, av->disp.phosphor, sizeof(av->disp.phosphor));
-    s->snd_ctrl_loop = av->snd.ctrl_loop; s->snd_ctrl_vol = av->snd.ctrl_vol;
-    s->snd_ctrl_fast = av->snd.ctrl_fast; s->snd_proto_state = av->snd.proto_state;
-    s->snd_proto_hi = av->snd.proto_hi; s->snd_lfsr = av->snd.lfsr;
-    av->rewind_head = (av->rewind_head + 1) % REWIND_FRAMES;
-    if (av->rewind_count < REWIND_FRAMES) av->rewind_count++;
-}
-
-static bool rewind_pop(AV *av) {
-    if (!av->rewind_buf || av->rewind_count <= 0) return false;
-    av->rewind_head = (av->rewind_head - 1 + REWIND_FRAMES) % REWIND_FRAMES;
-    av->rewind_count--;
-    RewindSnap *s = &av->rewind_buf[av->rewind_head];
+#ifndef AV_LIB
+static void rewind_restore(AV *av, const RewindSnap *snap) {
+    const RewindRegs *s = &snap->r;
     av->cpu.A = s->A; av->cpu.PC = s->PC; av->cpu.PSW = s->PSW;
     av->cpu.SP = s->SP; av->cpu.P1 = s->P1; av->cpu.P2 = s->P2;
     av->cpu.BUS = s->BUS; av->cpu.timer = s->timer; av->cpu.tpre = s->tpre;
@@ -1297,123 +2214,725 @@ static bool rewind_pop(AV *av) {
     av->prev_p2 = av->cpu.P2; av->cpu.ei_delay = 0;
     av->cpu.irq_en=(s->flags2>>2)&1; av->cpu.irq_pend=(s->flags2>>3)&1;
     av->cpu.in_irq=(s->flags2>>4)&1;
-    memcpy(av->cpu.iram, s->iram, IRAM_SZ);
-    memcpy(av->cpu.xram, s->xram, XRAM_SZ);
-    memcpy(av->disp.phosphor, s->phosphor, sizeof(av->disp.phosphor));
-    av->snd.ctrl_loop = s->snd_ctrl_loop; av->snd.ctrl_vol = s->snd_ctrl_vol;
-    av->snd.ctrl_fast = s->snd_ctrl_fast; av->snd.proto_state = s->snd_proto_state;
-    av->snd.proto_hi = s->snd_proto_hi; av->snd.lfsr = s->snd_lfsr;
-    av->snd.active = false;
+    memcpy(av->cpu.iram, snap->iram, IRAM_SZ);
+    memcpy(av->cpu.xram, snap->xram, XRAM_SZ);
+    av->snd_proto_state = s->snd_proto_state; av->snd_proto_hi = s->snd_proto_hi;
+    snd_post(av, SND_EV_RESTORE, (uint8_t)((s->snd_ctrl_loop & 1) | (s->snd_ctrl_vol & 3) << 1 |
+             (s->snd_ctrl_fast & 1) << 3), s->snd_lfsr, NULL);
+}
+#endif
+
+/* Delta records code new ^ old as tokens: 0x00-0x7F = skip 1-128 equal
+ * bytes, 0x80-0xFF = 1-128 XOR bytes follow. Gaps of up to 3 equal bytes
+ * stay inside a literal; the trailing equal run is left implicit. */
+#define REWIND_DELTA_MAX  (2 * (int)sizeof(RewindSnap))
+
+typedef struct {
+    uint8_t *out;
+    int      o, pos;    /* output length, next uncoded snapshot offset */
+    int      lit, litn; /* open literal token index (-1 = none), its length */
+} RewindEnc;
+
+/* Append n XOR bytes for snapshot offsets at..at+n-1 */
+static void rewind_emit(RewindEnc *e, int at, const uint8_t *x, int n) {
+    int gap = at - e->pos;
+    if (e->lit >= 0 && gap <= 3 && e->litn + gap < 128) {
+        for (; gap > 0; gap--) { e->out[e->o++] = 0; e->litn++; }
+    } else {
+        for (e->lit = -1; gap > 0; gap -= 128)
+            e->out[e->o++] = (uint8_t)((gap > 128 ? 128 : gap) - 1);
+    }
+    e->pos = at + n;
+    while (n > 0) {
+        if (e->lit < 0) { e->lit = e->o++; e->litn = 0; }
+        int k = 128 - e->litn < n ? 128 - e->litn : n;
+        memcpy(e->out + e->o, x, k);
+        e->o += k; e->litn += k; x += k; n -= k;
+        e->out[e->lit] = (uint8_t)(0x80 | (e->litn - 1));
+        if (e->litn == 128) e->lit = -1;
+    }
+}
+
+/* Code src against the key bytes at snapshot offset base, updating the key.
+ * Whole words are compared; a changed word emits its first..last changed
+ * byte as one block. */
+static void rewind_diff(RewindEnc *e, int base, uint8_t *key, const uint8_t *src, int n) {
+    for (int i = 0; i < n; i += 8) {
+        int w = n - i < 8 ? n - i : 8;
+        if (memcmp(src + i, key + i, w) == 0) continue;
+        int lo = 0, hi = w - 1;
+        uint8_t x[8];
+        while (src[i+lo] == key[i+lo]) lo++;
+        while (src[i+hi] == key[i+hi]) hi--;
+        for (int k = lo; k <= hi; k++) x[k] = src[i+k] ^ key[i+k];
+        rewind_emit(e, base + i + lo, x + lo, hi - lo + 1);
+        memcpy(key + i, src + i, w);
+    }
+}
+
+#ifndef AV_LIB
+static void rewind_delta_apply(uint8_t *dst, int n, const uint8_t *in, int len) {
+    int o = 0;
+    for (int i = 0; i < len; ) {
+        int t = in[i++], k = (t & 0x7F) + 1;
+        if (!(t & 0x80)) { o += k; continue; }
+        for (; k > 0 && i < len && o < n; k--) dst[o++] ^= in[i++];
+    }
+}
+#endif
+
+/* Fold the current state into the key, coding what changed into out.
+ * Compares against the live arrays, so nothing is copied for unchanged
+ * words. Returns the record length. */
+static int rewind_encode(const AV *av, RewindSnap *key, uint8_t *out) {
+    RewindEnc e = { out, 0, 0, -1, 0 };
+    RewindRegs s;
+    memset(&s, 0, sizeof(s));  /* padding takes part in the diff */
+    s.A = av->cpu.A; s.PC = av->cpu.PC; s.PSW = av->cpu.PSW;
+    s.SP = av->cpu.SP; s.P1 = av->cpu.P1; s.P2 = av->cpu.P2;
+    s.BUS = av->cpu.BUS; s.timer = av->cpu.timer; s.tpre = av->cpu.tpre;
+    s.flags = (av->cpu.MB)|(av->cpu.C<<1)|(av->cpu.AC<<2)|
+              (av->cpu.F0<<3)|(av->cpu.F1<<4)|(av->cpu.BS<<5)|
+              (av->cpu.timer_en<<6)|(av->cpu.counter_en<<7);
+    s.flags2 = (av->cpu.timer_ovf)|(av->cpu.tcnti_en<<1)|
+               (av->cpu.irq_en<<2)|(av->cpu.irq_pend<<3)|(av->cpu.in_irq<<4);
+    COP411L snd; snd_snapshot(av, &snd);
+    s.snd_ctrl_loop = snd.ctrl_loop; s.snd_ctrl_vol = snd.ctrl_vol;
+    s.snd_ctrl_fast = snd.ctrl_fast; s.snd_proto_state = av->snd_proto_state;
+    s.snd_proto_hi = av->snd_proto_hi; s.snd_lfsr = snd.lfsr;
+    s.cols = (uint8_t)av->disp.cols_shown;
+    rewind_diff(&e, 0, (uint8_t *)&key->r, (const uint8_t *)&s, sizeof(s));
+    rewind_diff(&e, offsetof(RewindSnap, iram), key->iram, av->cpu.iram, IRAM_SZ);
+    rewind_diff(&e, offsetof(RewindSnap, xram), key->xram, av->cpu.xram, XRAM_SZ);
+    rewind_diff(&e, offsetof(RewindSnap, col_data), &key->col_data[0][0],
+                &av->disp.col_data[0][0], sizeof(key->col_data));
+    return e.o;
+}
+
+static void rewind_push(AV *av) {
+    Rewind *r = av->rewind_buf;
+    if (!r) return;
+    int h = av->rewind_head;
+    if (av->rewind_count == REWIND_FRAMES) av->rewind_count--;  /* drop oldest */
+    if (r->wr + REWIND_DELTA_MAX > REWIND_BYTES) {
+        /* Wrap: records of the last lap at or past the wrap point are the
+         * oldest ones left and the next lap never reaches them, so they go
+         * first (from the second-oldest on; the oldest needs no record) */
+        while (av->rewind_count > 1 &&
+               r->off[(h - av->rewind_count + 1 + REWIND_FRAMES) % REWIND_FRAMES] >= r->wr)
+            av->rewind_count--;
+        r->wr = 0;
+    }
+    int L = rewind_encode(av, &r->key, r->data + r->wr);
+    if (av->rewind_count == 0) L = 0;  /* first frame: key only */
+    /* Records now sit in age order from wr up to the newest: evict every
+     * frame whose record the new one overwrote */
+    while (av->rewind_count > 1) {
+        int o = (h - av->rewind_count + 1 + REWIND_FRAMES) % REWIND_FRAMES;
+        if (r->off[o] >= r->wr + L || r->off[o] + r->len[o] <= r->wr) break;
+        av->rewind_count--;
+    }
+    r->off[h] = r->wr; r->len[h] = (uint16_t)L;
+    r->wr += L;
+    av->rewind_head = (h + 1) % REWIND_FRAMES;
+    av->rewind_count++;
+}
+
+#ifndef AV_LIB
+static bool rewind_pop(AV *av) {
+    Rewind *r = av->rewind_buf;
+    if (!r || av->rewind_count <= 0) return false;
+    av->rewind_head = (av->rewind_head - 1 + REWIND_FRAMES) % REWIND_FRAMES;
+    av->rewind_count--;
+    rewind_restore(av, &r->key);
+    av_dbg_realign(av);
+    /* Phosphor: this frame's columns lit, the previous frame's one decay
+     * step behind it (older afterglow is below visibility anyway) */
+    uint8_t cols[SW][5];
+    int ncols = r->key.r.cols;
+    memcpy(cols, r->key.col_data, sizeof(cols));
+    disp_clear(&av->disp);
+    if (av->rewind_count > 0) {
+        int h = av->rewind_head;
+        rewind_delta_apply((uint8_t *)&r->key, sizeof(RewindSnap), r->data + r->off[h], r->len[h]);
+        r->wr = r->off[h];  /* newest record freed */
+        disp_light(&av->disp, (const uint8_t (*)[5])r->key.col_data, r->key.r.cols,
+                   powf(av->cfg_phosphor, 1.5f));
+    }
+    disp_light(&av->disp, (const uint8_t (*)[5])cols, ncols, 1.0f);
+    memcpy(av->disp.col_data, cols, sizeof(cols));
+    av->disp.cols_shown = ncols;
     return true;
 }
+#endif
 
 /* ---- WAV recording ---- */
 /* Write uint16/uint32 in little-endian (WAV format requires LE) */
 static void wav_le16(uint8_t *p, uint16_t v) { p[0]=v&0xFF; p[1]=(v>>8)&0xFF; }
 static void wav_le32(uint8_t *p, uint32_t v) { p[0]=v&0xFF; p[1]=(v>>8)&0xFF; p[2]=(v>>16)&0xFF; p[3]=(v>>24)&0xFF; }
+static void wav_le64(uint8_t *p, uint64_t v) { wav_le32(p, (uint32_t)v); wav_le32(p + 4, (uint32_t)(v >> 32)); }
+static uint32_t rd_le32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+#ifndef AV_LIB
+static uint64_t rd_le64(const uint8_t *p) { return rd_le32(p) | (uint64_t)rd_le32(p + 4) << 32; }
+#endif
 
-static void wav_start(WavWriter *w, const char *fn) {
-    w->fp = fopen(fn, "wb");
-    if (!w->fp) return;
-    /* Write placeholder header (44 bytes) in explicit LE */
-    uint8_t hdr[44] = {0};
-    memcpy(hdr, "RIFF", 4); memcpy(hdr+8, "WAVEfmt ", 8);
-    wav_le32(hdr+16, 16);                   /* chunk size */
-    wav_le16(hdr+20, 1);                    /* PCM */
-    wav_le16(hdr+22, 1);                    /* mono */
-    wav_le32(hdr+24, AUDIO_RATE);            /* sample rate */
-    wav_le32(hdr+28, AUDIO_RATE * 2);        /* byte rate */
-    wav_le16(hdr+32, 2);                    /* block align */
-    wav_le16(hdr+34, 16);                   /* bits/sample */
-    memcpy(hdr+36, "data", 4);
-    fwrite(hdr, 44, 1, w->fp);
-    w->samples_written = 0;
-    w->ring_wr = 0;
-    w->ring_rd = 0;
-    w->active = true;
-}
-
-/* Flush ring buffer to disk — non-locked version for shutdown/headless. */
-static void wav_flush(WavWriter *w) {
-    if (!w->fp) return;
-    uint32_t rd = w->ring_rd;
-    uint32_t wr = w->ring_wr;
-    if (rd == wr) return;
-    if ((wr - rd) > WAV_RING_SZ) rd = wr - WAV_RING_SZ;
-    while (rd != wr) {
-        uint32_t start = rd & (WAV_RING_SZ - 1);
-        uint32_t chunk = wr - rd;
-        uint32_t to_end = WAV_RING_SZ - start;
-        if (chunk > to_end) chunk = to_end;
-        fwrite(&w->ring[start], sizeof(int16_t), chunk, w->fp);
-        w->samples_written += chunk;
-        rd += chunk;
+#ifndef AV_LIB
+/* A/V capture (.avc), little-endian throughout:
+ *   header  "AVCAP1\0\0", u32 audio rate, u16 fps, u16 width, u16 height, u16 0
+ *   chunks  u8 tag, u32 payload length, payload
+ *     'A'   int16 mono PCM
+ *     'V'   u32 frame, u32 sample position, u8 columns lit, then col_data
+ *           (SW×5 bytes) against the previous frame in the rewind delta code
+ *     'E'   u32 samples, u32 frames, u32 samples dropped, u32 frames dropped */
+static bool rec_chunk(WavWriter *w, char tag, const void *p1, uint32_t n1,
+                      const void *p2, uint32_t n2) {
+    uint8_t h[5];
+    h[0] = (uint8_t)tag; wav_le32(h + 1, n1 + n2);
+    return fwrite(h, 5, 1, w->fp) == 1 && (!n1 || fwrite(p1, n1, 1, w->fp) == 1) &&
+           (!n2 || fwrite(p2, n2, 1, w->fp) == 1);
+}
+
+/* Write out what the rings hold; audio only in REC_BATCH runs unless
+ * final. Called by the writer thread, or by wav_stop without one. */
+static void rec_drain(WavWriter *w, bool final) {
+    uint32_t rd = w->ring_rd, wr = AV_LOAD_ACQ(&w->ring_wr);
+    while (wr - rd >= (final ? 1u : REC_BATCH)) {
+        uint32_t start = rd & (WAV_RING_SZ - 1), n = wr - rd;
+        if (n > WAV_RING_SZ - start) n = WAV_RING_SZ - start;
+        if (w->fmt == REC_AVC) rec_chunk(w, 'A', &w->ring[start], n * 2, NULL, 0);
+        else fwrite(&w->ring[start], sizeof(int16_t), n, w->fp);
+        w->samples_written += n;
+        rd += n;
+        AV_STORE_REL(&w->ring_rd, rd);
+    }
+    if (w->fmt != REC_AVC) return;
+    uint32_t vrd = w->vid_rd, vwr = AV_LOAD_ACQ(&w->vid_wr);
+    for (; vrd != vwr; vrd++) {
+        const RecFrame *f = &w->vid[vrd & (REC_VID_SZ - 1)];
+        uint8_t hd[9], out[2 * SW * 5 + 8];
+        RewindEnc e = { out, 0, 0, -1, 0 };
+        rewind_diff(&e, 0, &w->vid_key[0][0], &f->col_data[0][0], SW * 5);
+        wav_le32(hd, w->frames_written++); wav_le32(hd + 4, f->sample); hd[8] = f->cols;
+        rec_chunk(w, 'V', hd, 9, out, (uint32_t)e.o);
+        AV_STORE_REL(&w->vid_rd, vrd + 1);
     }
-    w->ring_rd = rd;
 }
 
 #ifdef USE_SDL
-/* Thread-safe flush: copy ring under audio lock, write to disk outside lock.
- * Prevents audio glitches from disk I/O blocking the audio callback. */
-static void wav_flush_safe(AV *av, WavWriter *w) {
-    if (!w->fp) return;
-    int16_t tmp[WAV_RING_SZ];
-    uint32_t rd, wr, avail;
+static int rec_thread(void *ud) {
+    WavWriter *w = (WavWriter *)ud;
+    for (;;) {
+        bool stop = AV_LOAD_ACQ(&w->stop) != 0;
+        rec_drain(w, stop);
+        if (stop) return 0;
+        SDL_Delay(REC_POLL_MS);
+    }
+}
+#endif
 
-    AUDIO_LOCK(av);
-    rd = w->ring_rd;
-    wr = w->ring_wr;
-    if (rd == wr) { AUDIO_UNLOCK(av); return; }
-    if ((wr - rd) > WAV_RING_SZ) {
-        fprintf(stderr, "[WAV] Ring buffer overflow, %u samples lost\n",
-                (wr - rd) - WAV_RING_SZ);
-        rd = wr - WAV_RING_SZ;
+/* Open fn and start the writer; the caller then sets active under the
+ * audio lock. fmt is REC_WAV or REC_AVC. */
+static void wav_start(WavWriter *w, const char *fn, int fmt) {
+    w->ring = (int16_t *)malloc(WAV_RING_SZ * sizeof(int16_t));
+    w->vid = fmt == REC_AVC ? (RecFrame *)malloc(REC_VID_SZ * sizeof(RecFrame)) : NULL;
+    w->fp = w->ring && (fmt != REC_AVC || w->vid) ? fopen(fn, "wb") : NULL;
+    if (!w->fp) { free(w->ring); free(w->vid); w->ring = NULL; w->vid = NULL; return; }
+    setvbuf(w->fp, NULL, _IOFBF, 1 << 16);  /* before any I/O on the stream */
+    w->fmt = fmt;
+    if (fmt == REC_AVC) {
+        uint8_t hdr[20] = "AVCAP1";
+        wav_le32(hdr + 8, AUDIO_RATE);
+        wav_le16(hdr + 12, FPS); wav_le16(hdr + 14, SW); wav_le16(hdr + 16, SH);
+        fwrite(hdr, sizeof(hdr), 1, w->fp);
+    } else {
+        /* Write placeholder header (44 bytes) in explicit LE */
+        uint8_t hdr[44] = {0};
+        memcpy(hdr, "RIFF", 4); memcpy(hdr+8, "WAVEfmt ", 8);
+        wav_le32(hdr+16, 16);                   /* chunk size */
+        wav_le16(hdr+20, 1);                    /* PCM */
+        wav_le16(hdr+22, 1);                    /* mono */
+        wav_le32(hdr+24, AUDIO_RATE);            /* sample rate */
+        wav_le32(hdr+28, AUDIO_RATE * 2);        /* byte rate */
+        wav_le16(hdr+32, 2);                    /* block align */
+        wav_le16(hdr+34, 16);                   /* bits/sample */
+        memcpy(hdr+36, "data", 4);
+        fwrite(hdr, 44, 1, w->fp);
     }
-    avail = wr - rd;
-    if (avail > WAV_RING_SZ) avail = WAV_RING_SZ;
-    for (uint32_t i = 0; i < avail; i++)
-        tmp[i] = w->ring[(rd + i) & (WAV_RING_SZ - 1)];
-    w->ring_rd = rd + avail;
-    AUDIO_UNLOCK(av);
+    w->samples_written = w->frames_written = 0;
+    w->ring_wr = w->ring_rd = w->overruns = 0;
+    w->vid_wr = w->vid_rd = w->vid_overruns = 0;
+    memset(w->vid_key, 0, sizeof(w->vid_key));
+    w->stop = 0;
+    w->thread = NULL;
+#ifdef USE_SDL
+    w->thread = SDL_CreateThread(rec_thread, "rec", w);  /* NULL: wav_stop drains */
+#endif
+}
 
-    size_t n = fwrite(tmp, sizeof(int16_t), avail, w->fp);
-    w->samples_written += (uint32_t)n;
+/* Audio callback side: append m samples, or count them as dropped */
+static void rec_audio(WavWriter *w, const int16_t *s, int m) {
+    uint32_t wi = w->ring_wr;
+    if (wi - AV_LOAD_ACQ(&w->ring_rd) + (uint32_t)m > WAV_RING_SZ) { w->overruns += (uint32_t)m; return; }
+    for (int i = 0; i < m; i++)
+        w->ring[(wi + (uint32_t)i) & (WAV_RING_SZ - 1)] = s[i];
+    AV_STORE_REL(&w->ring_wr, wi + (uint32_t)m);
 }
-#endif
 
+/* Main loop side (REC_AVC): queue the frame just emulated */
+static void rec_video(WavWriter *w, const AVDisp *d) {
+    if (!w->fp || w->fmt != REC_AVC) return;
+    uint32_t wi = w->vid_wr;
+    if (wi - AV_LOAD_ACQ(&w->vid_rd) >= REC_VID_SZ) { w->vid_overruns++; return; }
+    RecFrame *f = &w->vid[wi & (REC_VID_SZ - 1)];
+    f->sample = AV_LOAD_ACQ(&w->ring_wr);
+    f->cols = (uint8_t)d->cols_shown;
+    memcpy(f->col_data, d->col_data, sizeof(f->col_data));
+    AV_STORE_REL(&w->vid_wr, wi + 1);
+}
+
+/* Stop the writer (the caller has cleared active), drain, finish the file */
 static void wav_stop(WavWriter *w) {
     if (!w->fp) return;
-    wav_flush(w);  /* flush remaining (non-locked fallback for shutdown) */
-    uint32_t data_sz = w->samples_written * 2;
-    uint32_t riff_sz = data_sz + 36;
-    uint8_t le4[4];
-    wav_le32(le4, riff_sz); fseek(w->fp, 4, SEEK_SET); fwrite(le4, 4, 1, w->fp);
-    wav_le32(le4, data_sz); fseek(w->fp, 40, SEEK_SET); fwrite(le4, 4, 1, w->fp);
+    AV_STORE_REL(&w->stop, 1);
+#ifdef USE_SDL
+    if (w->thread) SDL_WaitThread((SDL_Thread *)w->thread, NULL);
+#endif
+    if (!w->thread) rec_drain(w, true);
+    w->thread = NULL;
+    if (w->fmt == REC_AVC) {
+        uint8_t e[16];
+        wav_le32(e, w->samples_written); wav_le32(e + 4, w->frames_written);
+        wav_le32(e + 8, w->overruns); wav_le32(e + 12, w->vid_overruns);
+        rec_chunk(w, 'E', e, 16, NULL, 0);
+    } else {
+        uint32_t data_sz = w->samples_written * 2;
+        uint32_t riff_sz = data_sz + 36;
+        uint8_t le4[4];
+        wav_le32(le4, riff_sz); fseek(w->fp, 4, SEEK_SET); fwrite(le4, 4, 1, w->fp);
+        wav_le32(le4, data_sz); fseek(w->fp, 40, SEEK_SET); fwrite(le4, 4, 1, w->fp);
+    }
+    if (w->overruns || w->vid_overruns)
+        fprintf(stderr, "[REC] %u samples, %u frames dropped (writer overrun)\n",
+                w->overruns, w->vid_overruns);
     fclose(w->fp);
+    free(w->ring); free(w->vid);
+    w->ring = NULL; w->vid = NULL;
     w->fp = NULL; w->active = false;
 }
+#endif
+
+/* ---- LED rasterizer: faithful red LED POV display ----
+ * Real hardware: 40 red LEDs + spinning mirror create discrete luminous
+ * dots viewed through persistence of vision. Display is dark, designed
+ * for dim rooms. Each LED appears as a round red dot with soft glow.
+ * Color: warm LED red (not pure #FF0000), slightly orange at high
+ * intensity, deep crimson when fading.
+ *
+ * Backend-neutral: av_raster() draws the WIN_W×WIN_H image as XRGB8888
+ * into a caller-supplied buffer. The SDL renderer, screenshots and the
+ * headless --png/--raw exporter all go through it. */
+
+/* Rasterizer state: glow scratch and precomputed effect tables, plus dirty
+ * tracking. Redrawing into the same buffer only touches the columns whose
+ * intensity changed (and their glow neighbours). */
+#define GLOW_W          (SW + 2)
+#define GLOW_IX(x, y)   ((x) + 1 + ((y) + 1) * GLOW_W)
+
+typedef struct {
+    /* Intensity at LED resolution (GLOW_IX) inside a border of zeros, so
+     * the 3×3 glow sum needs no edge tests */
+    float    glow_src[GLOW_W * (SH + 2)];
+    uint8_t  level[SW * SH];        /* its gamma_lut index: the dot sprite */
+    float    vignette[SW * SH];
+    float    warp_x[SW];
+    float    led_mask[SCALE * SCALE];
+    /* Gamma lookup table: maps [0..255] intensity to gamma-corrected value.
+     * Rebuilt when gamma setting changes. Eliminates powf() from render loop. */
+    float    gamma_lut[256];
+    float    gamma_lut_val;         /* current gamma, -1 = not initialized */
+    /* Dot sprite atlas: one SCALE×SCALE XRGB stamp per gamma_lut level,
+     * round or square, and the [x0, x1) span each stamp row draws */
+    uint32_t dot[256][SCALE * SCALE];
+    uint8_t  dot_x0[SCALE], dot_x1[SCALE];
+    float    dot_gamma;             /* gamma_lut the atlas was built from */
+    int      dot_round;             /* led_round it was built for, -1 = none */
+    float    shown[SW * SH];        /* intensity drawn last call */
+    int      dot_x[SW];             /* output x of each column's dot */
+    int      look;                  /* render settings drawn with, -1 = none */
+    const uint32_t *fb;             /* buffer drawn into last call */
+    /* Pixel column spans [span0, span1) redrawn by the last av_raster() */
+    int      nspan;
+    int      span0[SW], span1[SW];
+} AVRaster;
+
+static void rebuild_gamma_lut(AVRaster *R, float gamma) {
+    if (gamma == R->gamma_lut_val) return;
+    R->gamma_lut_val = gamma;
+    for (int i = 0; i < 256; i++) {
+        float I = (float)i / 255.0f;
+        R->gamma_lut[i] = (gamma != 1.0f) ? powf(I, gamma) : I;
+    }
+}
+
+/* Stamp every level's dot: LED red, warm at high intensity, orange tint,
+ * deep crimson at low, through the anti-aliased round mask (pixels under
+ * 1% left undrawn) or as a sharp LED_SIZE square */
+static void rebuild_dot_atlas(AVRaster *R, bool round_led) {
+    if (R->dot_gamma == R->gamma_lut_val && R->dot_round == (int)round_led) return;
+    R->dot_gamma = R->gamma_lut_val;
+    R->dot_round = round_led;
+    for (int q = 0; q < 256; q++) {
+        float Ig = R->gamma_lut[q];
+        uint8_t r = (uint8_t)(Ig * 255.0f);
+        uint8_t g = (uint8_t)(Ig * Ig * 30.0f);  /* slightly more orange */
+        uint8_t b = (uint8_t)(Ig * Ig * Ig * 6.0f);
+        uint32_t *spr = R->dot[q];
+        for (int i = 0; i < SCALE * SCALE; i++) {
+            float a = R->led_mask[i];
+            if (round_led)
+                spr[i] = a < 0.01f ? 0 : (uint32_t)((uint8_t)(r*a) << 16 | (uint8_t)(g*a) << 8 | (uint8_t)(b*a));
+            else
+                spr[i] = i % SCALE < LED_SIZE && i / SCALE < LED_SIZE ? (uint32_t)(r << 16 | g << 8 | b) : 0;
+        }
+    }
+    /* Drawn pixels of a row are contiguous (a disk or the square) */
+    for (int dy = 0; dy < SCALE; dy++) {
+        int x0 = SCALE, x1 = 0;
+        for (int dx = 0; dx < SCALE; dx++) {
+            bool on = round_led ? R->led_mask[dy * SCALE + dx] >= 0.01f : dx < LED_SIZE && dy < LED_SIZE;
+            if (on && dx < x0) x0 = dx;
+            if (on) x1 = dx + 1;
+        }
+        R->dot_x0[dy] = (uint8_t)(x1 ? x0 : 0);
+        R->dot_x1[dy] = (uint8_t)x1;
+    }
+}
+
+/* Per-channel min(a + b, 255) of two XRGB pixels */
+static inline uint32_t px_add_sat(uint32_t a, uint32_t b) {
+    uint32_t s = (a & 0x7F7F7F7F) + (b & 0x7F7F7F7F);
+    uint32_t c = ((a & b) | (s & (a ^ b))) & 0x80808080;  /* carry out of each byte */
+    return (s ^ ((a ^ b) & 0x80808080)) | (c >> 7) * 0xFF;
+}
+
+/* Per-channel c * 3 / 4 (rounded down), as c - ceil(c / 4) */
+static inline uint32_t px_dim(uint32_t c) {
+    return c - ((c >> 2) & 0x3F3F3F) - ((((c & 0x030303) + 0x030303) >> 2) & 0x010101);
+}
+
+/* Fill the effect tables; the first av_raster() then draws everything */
+static void av_raster_init(AVRaster *R) {
+    memset(R, 0, sizeof(*R));
+    R->gamma_lut_val = -1.0f;
+    R->dot_gamma = -1.0f;
+    R->dot_round = -1;
+    R->look = -1;
+
+    /* Vignette darkening LUT (simulates mirror viewing angle).
+     * Center of screen is full brightness, edges darken slightly. */
+    {
+        float cx = (float)SW * 0.5f, cy = (float)SH * 0.5f;
+        float max_r = sqrtf(cx*cx + cy*cy);
+        for (int y = 0; y < SH; y++) {
+            for (int x = 0; x < SW; x++) {
+                float dx = (float)x - cx, dy = (float)y - cy;
+                float r = sqrtf(dx*dx + dy*dy) / max_r;
+                /* Subtle vignette: 1.0 at center, ~0.82 at corners */
+                R->vignette[x + y * SW] = 1.0f - 0.18f * r * r;
+            }
+        }
+    }
+
+    /* Mirror barrel distortion warp table.
+     * The AV uses a rotating concave mirror that introduces slight barrel
+     * distortion: columns near the edges are compressed horizontally.
+     * warp_x[x] maps logical column x to a sub-pixel output x position. */
+    {
+        float half = (float)SW * 0.5f;
+        float k = 0.08f;  /* barrel distortion coefficient (subtle) */
+        for (int x = 0; x < SW; x++) {
+            float u = ((float)x - half) / half;  /* -1..+1 */
+            float u2 = u * u;
+            float warped = u * (1.0f + k * u2); /* barrel: expand center, compress edges */
+            R->warp_x[x] = half + warped * half;
+        }
+    }
+
+    /* Round LED dot mask (SCALE×SCALE alpha values).
+     * Real AV LEDs produce round dots, not squares. */
+    {
+        float cx = ((float)LED_SIZE - 1.0f) * 0.5f;
+        float r_sq = (cx + 0.5f) * (cx + 0.5f);
+        for (int dy = 0; dy < SCALE; dy++) {
+            for (int dx = 0; dx < SCALE; dx++) {
+                float *m = &R->led_mask[dy * SCALE + dx];
+                if (dx >= LED_SIZE || dy >= LED_SIZE) { *m = 0.0f; continue; } /* gap */
+                float fx = (float)dx - cx, fy = (float)dy - cx;
+                float d_sq = fx*fx + fy*fy;
+                if (d_sq <= r_sq * 0.5f)  *m = 1.0f;
+                else if (d_sq <= r_sq)    *m = 1.0f - (d_sq - r_sq*0.5f) / (r_sq*0.5f);
+                else                      *m = 0.0f;
+            }
+        }
+    }
+}
+
+/* Redraw framebuf pixel columns [x0, x1) from R->glow_src: sharp LED
+ * dots, additive glow, scanlines. Same per-pixel result as drawing the
+ * whole frame, since dots never overlap vertically and are drawn in the
+ * same column order. */
+static void raster_span(const AV *av, const AVRaster *R, uint32_t *framebuf, int x0, int x1) {
+    const float *glow_src = R->glow_src;
+
+    /* Render LED display into framebuffer with glow/bloom effect.
+     * Real AV LEDs bleed light through the red filter, creating a soft
+     * halo around each lit dot. We render in two passes:
+     * 1. Sharp LED dots (full intensity)
+     * 2. Additive glow pass (soft bloom around lit pixels) */
+    for (int py = 0; py < WIN_H; py++)  /* black background */
+        memset(&framebuf[py * WIN_W + x0], 0, (x1 - x0) * sizeof(uint32_t));
+
+    /* Pass 1: sharp LED dots, each row of the level's sprite copied in.
+     * Column by column: dots of one column never overlap, and a later
+     * column still wins where the warp packs dots closer than SCALE. */
+    for (int x = 0; x < SW; x++) {
+        int bx = R->dot_x[x];
+        if (bx >= x1 || bx + SCALE <= x0) continue;
+        int lo = x0 - bx, hi = (x1 < WIN_W ? x1 : WIN_W) - bx, a[SCALE], b[SCALE];
+        for (int dy = 0; dy < SCALE; dy++) {
+            a[dy] = R->dot_x0[dy] > lo ? R->dot_x0[dy] : lo;
+            b[dy] = R->dot_x1[dy] < hi ? R->dot_x1[dy] : hi;
+        }
+        for (int y = 0; y < SH; y++) {
+            if (R->shown[x + y * SW] < 0.01f) continue;
+            const uint32_t *spr = R->dot[R->level[x + y * SW]];
+            uint32_t *out = &framebuf[y * SCALE * WIN_W + bx];
+            for (int dy = 0; dy < SCALE; dy++, out += WIN_W, spr += SCALE)
+                for (int dx = a[dy]; dx < b[dy]; dx++) out[dx] = spr[dx];
+        }
+    }
+
+    /* Pass 2: LED glow/bloom — additive soft halo (toggle: 'g' key).
+     * Simple 3×3 box blur on glow_src at LED resolution, then add
+     * as a dim wide halo filling the full SCALE×SCALE cell. */
+    if (av->led_glow)
+    for (int y = 0; y < SH; y++) {
+        for (int x = x0 / SCALE; x <= (x1 - 1) / SCALE; x++) {
+            /* Sum 3×3 neighbors for bloom intensity */
+            const float *g = &glow_src[GLOW_IX(x, y)];
+            float bloom = 0.0f;
+            for (int ny = -1; ny <= 1; ny++)
+                for (int nx = -1; nx <= 1; nx++)
+                    bloom += g[nx + ny * GLOW_W];
+            bloom *= (1.0f / 9.0f) * 0.25f;  /* 25% of average neighbor intensity */
+            if (bloom < 0.005f) continue;
+
+            /* Bloom color: very dim red-orange */
+            uint8_t br = (uint8_t)(bloom * 90.0f);  /* dimmer than main dot */
+            uint8_t bg = (uint8_t)(bloom * bloom * 8.0f);
+            uint32_t bcol = (br << 16) | (bg << 8);
+            if (bcol == 0) continue;
+
+            /* Additive blend into the full SCALE×SCALE cell (including gap) */
+            int bx = x * SCALE, by = y * SCALE;
+            int dx0 = x0 - bx > 0 ? x0 - bx : 0, dx1 = x1 - bx < SCALE ? x1 - bx : SCALE;
+            for (int dy = 0; dy < SCALE; dy++) {
+                int py = by + dy;
+                if (py >= WIN_H) break;
+                uint32_t *row = &framebuf[py * WIN_W + bx];
+                for (int dx = dx0; dx < dx1 && bx + dx < WIN_W; dx++)
+                    row[dx] = px_add_sat(row[dx], bcol);  /* additive, saturates at 255 */
+            }
+        }
+    }
+
+    /* Scanline effect: darken every other LED row directly in framebuffer.
+     * Done before texture upload so scanlines align perfectly with pixels
+     * regardless of viewport centering math. */
+    if (av->scanlines) {
+        for (int sy = 0; sy < SH; sy += 2) {
+            int py = sy * SCALE;
+            for (int dy = 0; dy < SCALE && py + dy < WIN_H; dy++) {
+                uint32_t *row = &framebuf[(py + dy) * WIN_W];
+                for (int px = x0; px < x1; px++)
+                    row[px] = px_dim(row[px]);  /* darken: each channel × 3/4 */
+            }
+        }
+    }
+}
 
-/* ---- Screenshot (BMP) ---- */
+/* Draw av's display into fb (WIN_W×WIN_H, stride WIN_W). Only columns
+ * that changed since the last call on the same fb are redrawn; set
+ * R->look = -1 to force a full redraw. Returns the lit pixel count. */
+static int av_raster(AVRaster *R, const AV *av, uint32_t *fb) {
+    const AVDisp *d = av->disp_view ? av->disp_view : &av->disp;
+    /* Rebuild gamma LUT if setting changed; any look change redraws all */
+    bool full = R->gamma_lut_val != av->cfg_gamma || R->fb != fb;
+    rebuild_gamma_lut(R, av->cfg_gamma);
+    rebuild_dot_atlas(R, av->led_round);
+    int look = (av->led_vignette << 0) | (av->mirror_warp << 1) | (av->led_round << 2) |
+               (av->led_glow << 3) | (av->scanlines << 4);
+    if (look != R->look) full = true;
+    R->look = look;
+    R->fb = fb;
+
+    /* Compute output X (with optional barrel distortion from curved mirror) */
+    for (int x = 0; x < SW; x++) {
+        int bx = x * SCALE;
+        if (av->mirror_warp) {
+            bx = (int)(R->warp_x[x] * (float)SCALE);
+            if (bx < 0) bx = 0;
+            if (bx + SCALE > WIN_W) bx = WIN_W - SCALE;
+        }
+        R->dot_x[x] = bx;
+    }
+
+    /* Find changed columns; a column's pixels reach its dot and the glow
+     * cells of its neighbours, so that output x range gets redrawn */
+    int lit = 0;
+    int *span0 = R->span0, *span1 = R->span1, nspan = 0;
+    for (int x = 0; x < SW; x++) {
+        bool dirty = full;
+        for (int y = 0; y < SH; y++) {
+            float I = disp_px(d, x, y);
+            if (I >= 0.01f) lit++;
+            if (I == R->shown[x + y * SW]) continue;
+            R->shown[x + y * SW] = I;
+            dirty = true;
+        }
+        if (!dirty) continue;
+        for (int y = 0; y < SH; y++) {
+            float I = R->shown[x + y * SW];
+            if (I < 0.01f) { R->glow_src[GLOW_IX(x, y)] = 0.0f; continue; }
+            if (av->led_vignette) I *= R->vignette[x + y * SW];
+            int idx = (int)(I * 255.0f);
+            if (idx > 255) idx = 255;
+            R->glow_src[GLOW_IX(x, y)] = R->gamma_lut[idx];
+            R->level[x + y * SW] = (uint8_t)idx;
+        }
+        int a = (x - 1) * SCALE, b = (x + 2) * SCALE;
+        if (R->dot_x[x] < a) a = R->dot_x[x];
+        if (R->dot_x[x] + SCALE > b) b = R->dot_x[x] + SCALE;
+        if (a < 0) a = 0;
+        if (b > WIN_W) b = WIN_W;
+        if (nspan && a <= span1[nspan-1]) {
+            if (a < span0[nspan-1]) span0[nspan-1] = a;
+            if (b > span1[nspan-1]) span1[nspan-1] = b;
+        } else { span0[nspan] = a; span1[nspan] = b; nspan++; }
+    }
+    R->nspan = nspan;
+    for (int k = 0; k < nspan; k++)
+        raster_span(av, R, fb, span0[k], span1[k]);
+    return lit;
+}
+
+#ifndef AV_LIB
+/* ---- Frame export (PNG / raw RGB24) ----
+ * PNG uses stored deflate blocks: no zlib, pixel-exact, ~450 KB a frame.
+ * Raw frames are packed RGB24, WIN_W×WIN_H, appended back to back
+ * (ffmpeg -f rawvideo -pix_fmt rgb24 -s 750x200 -r 15). */
+static uint32_t png_crc(uint32_t crc, const uint8_t *p, size_t n) {
+    static const uint32_t tab[16] = {  /* CRC-32, one nibble at a time */
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+        0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+    while (n--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ tab[crc & 15];
+        crc = (crc >> 4) ^ tab[crc & 15];
+    }
+    return crc;
+}
+
+static void png_be32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t n) {
+    uint8_t b[4];
+    png_be32(b, n); fwrite(b, 4, 1, f);
+    fwrite(type, 4, 1, f);
+    if (n) fwrite(data, n, 1, f);
+    uint32_t crc = png_crc(0xFFFFFFFFu, (const uint8_t *)type, 4);
+    png_be32(b, ~png_crc(crc, data, n)); fwrite(b, 4, 1, f);
+}
+
+/* Write a WIN_W×WIN_H XRGB8888 buffer as an RGB PNG */
+static bool write_png(const char *fn, const uint32_t *fb) {
+    const size_t row = 1 + 3 * WIN_W, raw_sz = row * WIN_H;
+    const size_t nblk = (raw_sz + 65534) / 65535;
+    uint8_t *raw = (uint8_t *)malloc(raw_sz);
+    uint8_t *z = (uint8_t *)malloc(2 + raw_sz + 5 * nblk + 4);
+    FILE *f = (raw && z) ? fopen(fn, "wb") : NULL;
+    if (!f) { free(raw); free(z); return false; }
+    for (int y = 0; y < WIN_H; y++) {
+        uint8_t *o = raw + y * row;
+        *o++ = 0;  /* filter: none */
+        for (int x = 0; x < WIN_W; x++) {
+            uint32_t c = fb[y * WIN_W + x];
+            *o++ = (uint8_t)(c >> 16); *o++ = (uint8_t)(c >> 8); *o++ = (uint8_t)c;
+        }
+    }
+    /* zlib stream: header, stored blocks, Adler-32 */
+    size_t zn = 0;
+    uint32_t s1 = 1, s2 = 0;
+    z[zn++] = 0x78; z[zn++] = 0x01;
+    for (size_t at = 0; at < raw_sz; ) {
+        size_t n = raw_sz - at < 65535 ? raw_sz - at : 65535;
+        z[zn++] = (uint8_t)(at + n == raw_sz);  /* BFINAL, BTYPE=00 */
+        z[zn++] = (uint8_t)n; z[zn++] = (uint8_t)(n >> 8);
+        z[zn++] = (uint8_t)~n; z[zn++] = (uint8_t)(~n >> 8);
+        memcpy(z + zn, raw + at, n);
+        for (size_t i = 0; i < n; i++) {
+            s1 += raw[at + i]; if (s1 >= 65521) s1 -= 65521;
+            s2 += s1;          if (s2 >= 65521) s2 -= 65521;
+        }
+        zn += n; at += n;
+    }
+    png_be32(z + zn, (s2 << 16) | s1); zn += 4;
+
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t ihdr[13];
+    png_be32(ihdr, WIN_W); png_be32(ihdr + 4, WIN_H);
+    ihdr[8] = 8; ihdr[9] = 2; ihdr[10] = ihdr[11] = ihdr[12] = 0;  /* 8-bit RGB */
+    fwrite(sig, 8, 1, f);
+    png_chunk(f, "IHDR", ihdr, 13);
+    png_chunk(f, "IDAT", z, (uint32_t)zn);
+    png_chunk(f, "IEND", NULL, 0);
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    free(raw); free(z);
+    return ok;
+}
+#endif
+
+/* ---- Screenshot (PNG) ----
+ * Rasterized from the display state into a scratch buffer: pixel-exact
+ * WIN_W×WIN_H whatever the window size or backend, no GPU readback. */
 #ifdef USE_SDL
-static void screenshot_bmp(SDL_Renderer *rr) {
-    int w, h;
-    SDL_GetRendererOutputSize(rr, &w, &h);
-    SDL_Surface *surf = SDL_CreateRGBSurface(0, w, h, 32,
-        0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-    if (!surf) return;
-    SDL_RenderReadPixels(rr, NULL, SDL_PIXELFORMAT_ARGB8888, surf->pixels, surf->pitch);
-    /* Generate timestamped filename */
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char fn[128];
-    snprintf(fn, sizeof(fn), "advision_%04d%02d%02d_%02d%02d%02d.bmp",
-        t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-    SDL_SaveBMP(surf, fn);
-    SDL_FreeSurface(surf);
-    printf("Screenshot: %s\n", fn);
+static void screenshot_png(const AV *av) {
+    AVRaster *R = (AVRaster *)malloc(sizeof(AVRaster));
+    uint32_t *fb = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
+    if (R && fb) {
+        av_raster_init(R);
+        av_raster(R, av, fb);
+        /* Generate timestamped filename */
+        time_t now = time(NULL);
+        struct tm *t = localtime(&now);
+        char fn[128];
+        snprintf(fn, sizeof(fn), "advision_%04d%02d%02d_%02d%02d%02d.png",
+            t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+        if (write_png(fn, fb)) printf("Screenshot: %s\n", fn);
+        else fprintf(stderr, "Screenshot: cannot write %s\n", fn);
+    }
+    free(R);
+    free(fb);
 }
 #endif
 
+#ifdef USE_SDL
 /* ---- Config file (advision.ini) ---- */
 static void config_save(const AV *av, bool fullscreen) {
     FILE *f = fopen("advision.ini", "w");
@@ -1432,6 +2951,15 @@ static void config_save(const AV *av, bool fullscreen) {
     fprintf(f, "led_round=%d\n", av->led_round ? 1 : 0);
     fprintf(f, "mirror_warp=%d\n", av->mirror_warp ? 1 : 0);
     fprintf(f, "led_pipeline=%d\n", av->led_pipeline ? 1 : 0);
+    fprintf(f, "cpu_engine=%d\n", av->cpu_engine);
+    fprintf(f, "frame_sched=%d\n", av->frame_sched);
+    fprintf(f, "phosphor_fmt=%d\n", av->phosphor_fmt);
+    fprintf(f, "render_backend=%d\n", av->render_backend);
+    fprintf(f, "sync_mode=%d\n", av->sync_mode);
+    fprintf(f, "audio_latency=%d\n", av->audio_latency);
+    fprintf(f, "runahead=%d\n", av->runahead);
+    fprintf(f, "ff_speed=%d\n", av->ff_speed);
+    fprintf(f, "emu_thread=%d\n", av->emu_thread ? 1 : 0);
     fprintf(f, "# Timing (advanced)\n");
     fprintf(f, "t1_pulse_start=%d\n", av->t1_pulse_start);
     fprintf(f, "t1_pulse_end=%d\n", av->t1_pulse_end);
@@ -1470,6 +2998,23 @@ static void config_load(AV *av, bool *fullscreen) {
             av->mirror_warp = (v != 0);
         if (sscanf(line, "led_pipeline=%d", &v) == 1)
             av->led_pipeline = (v != 0);
+        if (sscanf(line, "cpu_engine=%d", &v) == 1 && (v == CPU_ENGINE_INTERP || v == CPU_ENGINE_BLOCK))
+            av->cpu_engine = v;
+        if (sscanf(line, "frame_sched=%d", &v) == 1 && (v == FRAME_SCHED_POLL || v == FRAME_SCHED_EVENT))
+            av->frame_sched = v;
+        if (sscanf(line, "phosphor_fmt=%d", &v) == 1 && (v == PHOSPHOR_FLOAT || v == PHOSPHOR_Q8))
+            av->phosphor_fmt = v;
+        if (sscanf(line, "render_backend=%d", &v) == 1 && (v == RENDER_CPU || v == RENDER_GL))
+            av->render_backend = v;
+        if (sscanf(line, "sync_mode=%d", &v) == 1 && (v == SYNC_TIMER || v == SYNC_AUDIO))
+            av->sync_mode = v;
+        if (sscanf(line, "audio_latency=%d", &v) == 1 && v >= 20 && v <= 500)
+            av->audio_latency = v;
+        if (sscanf(line, "runahead=%d", &v) == 1 && v >= 0 && v <= RUNAHEAD_MAX)
+            av->runahead = v;
+        if (sscanf(line, "ff_speed=%d", &v) == 1 && (v == 0 || (v >= 2 && v <= FF_SPEED_MAX)))
+            av->ff_speed = v;
+        if (sscanf(line, "emu_thread=%d", &v) == 1) av->emu_thread = v != 0;
         if (sscanf(line, "t1_pulse_start=%d", &v) == 1 && v >= 0 && v < 1000)
             av->t1_pulse_start = v;
         if (sscanf(line, "t1_pulse_end=%d", &v) == 1 && v >= 0 && v < 2000)
@@ -1484,6 +3029,61 @@ static void config_load(AV *av, bool *fullscreen) {
         av->t1_pulse_end = DEF_T1_END;
     }
 }
+#endif
+
+#ifndef AV_LIB
+/* Parse a --engine argument: "interp" or "block" (-1 if unknown) */
+static int parse_cpu_engine(const char *name) {
+    if (strcasecmp(name, "interp") == 0) return CPU_ENGINE_INTERP;
+    if (strcasecmp(name, "block") == 0)  return CPU_ENGINE_BLOCK;
+    return -1;
+}
+
+/* Parse a --sched argument: "poll" or "event" (-1 if unknown) */
+static int parse_frame_sched(const char *name) {
+    if (strcasecmp(name, "poll") == 0)  return FRAME_SCHED_POLL;
+    if (strcasecmp(name, "event") == 0) return FRAME_SCHED_EVENT;
+    return -1;
+}
+
+/* Parse a --phosphor-fmt argument: "float" or "q8" (-1 if unknown) */
+static int parse_phosphor_fmt(const char *name) {
+    if (strcasecmp(name, "float") == 0) return PHOSPHOR_FLOAT;
+    if (strcasecmp(name, "q8") == 0)    return PHOSPHOR_Q8;
+    return -1;
+}
+
+#ifdef USE_SDL
+/* Parse a --render argument: "cpu" or "gl" (-1 if unknown) */
+static int parse_render_backend(const char *name) {
+    if (strcasecmp(name, "cpu") == 0) return RENDER_CPU;
+    if (strcasecmp(name, "gl") == 0)  return RENDER_GL;
+    return -1;
+}
+
+/* Parse a --sync argument: "timer" or "audio" (-1 if unknown) */
+static int parse_sync_mode(const char *name) {
+    if (strcasecmp(name, "timer") == 0) return SYNC_TIMER;
+    if (strcasecmp(name, "audio") == 0) return SYNC_AUDIO;
+    return -1;
+}
+#endif
+
+/* Hold the buttons named in an --input string (U/D/L/R/1/2/3/4) */
+static void av_apply_input(AV *av, const char *s) {
+    for (const char *p = s; *p; p++) {
+        switch (*p) {
+        case 'U': case 'u': av->input.u = true; break;
+        case 'D': case 'd': av->input.d = true; break;
+        case 'L': case 'l': av->input.l = true; break;
+        case 'R': case 'r': av->input.r = true; break;
+        case '1': av->input.b1 = true; break;
+        case '2': av->input.b2 = true; break;
+        case '3': av->input.b3 = true; break;
+        case '4': av->input.b4 = true; break;
+        }
+    }
+}
 
 static bool load_file(uint8_t *dest, int max_sz, const char *fn) {
     FILE *f = fopen(fn, "rb");
@@ -1509,82 +3109,243 @@ static bool load_file(uint8_t *dest, int max_sz, const char *fn) {
     printf("Loaded %zu bytes from '%s'\n", n, fn);
     return true;
 }
+#endif
 
-/* Run one frame of CPU execution with T1 mirror timing */
-static void av_run_frame(AV *av) {
-    int total = CYCLES_PER_FR;
-    int elapsed = 0;
-    av->disp_sync_seen = false;
-    av->disp_sync_cycle = 0;
-    /* Reset LED display state for new frame */
-    memset(av->disp.led_reg, 0xFF, sizeof(av->disp.led_reg));
-    av->disp.led_col = 0;
-    av->disp.led_active = false;
-
-    /* BIOS display routine timing estimate:
-     * After T1 sync (rising edge), BIOS outputs 150 columns.
-     * Per column: P2 setup + 5× MOVX read + P2.4 strobe ≈ 17 cycles.
-     * 150 columns × 17 cycles ≈ 2550 cycles display window. */
-    #define DISP_OUTPUT_CYCLES 2550
-
-    while (elapsed < total) {
-        if (av->dbg.active) {
-            for (int i = 0; i < av->dbg.bp_count; i++)
-                if (av->dbg.bp[i] == av->cpu.PC) { av->dbg.stepping = true; break; }
-            if (av->dbg.stepping) return;
-        }
-
-        bool prev_t1 = av->cpu.t1;
-        int cy = i8048_exec(&av->cpu, av);
-        elapsed += cy;
-
-        /* T1 mirror position sensor:
-         * LOW pulse near start of frame to signal BIOS mirror sync.
-         * The BIOS loops on JNT1 waiting for T1=0, then on T1=1 */
-        bool new_t1 = !(elapsed >= av->t1_pulse_start && elapsed < av->t1_pulse_end);
+/* BIOS display routine timing estimate:
+ * After T1 sync (rising edge), BIOS outputs 150 columns.
+ * Per column: P2 setup + 5× MOVX read + P2.4 strobe ≈ 17 cycles.
+ * 150 columns × 17 cycles ≈ 2550 cycles display window. */
+#define DISP_OUTPUT_CYCLES 2550
+
+/* Cycles the block engine may run from `elapsed` before av_run_frame's
+ * per-instruction checks could observe anything: the next T1 edge, the
+ * end of the frame, or 1 (single-step) inside the mid-frame capture window
+ * or when T1 is out of step with the pulse window. */
+static int av_quiet_cycles(const AV *av, int elapsed, int total) {
+    bool t1_here = !(elapsed >= av->t1_pulse_start && elapsed < av->t1_pulse_end);
+    if (av->cpu.t1 != t1_here) return 1;
+    if (av->midframe_scan && !av->disp.led_active && av->disp_sync_seen &&
+        elapsed - av->disp_sync_cycle <= DISP_OUTPUT_CYCLES)
+        return 1;
+    int limit = total;
+    if (elapsed < av->t1_pulse_start) {
+        if (av->t1_pulse_start < limit) limit = av->t1_pulse_start;
+    } else if (elapsed < av->t1_pulse_end) {
+        if (av->t1_pulse_end < limit) limit = av->t1_pulse_end;
+    }
+    return limit - elapsed;
+}
 
-        /* Detect T1 rising edge (low→high = sync pulse ended) */
-        if (!prev_t1 && new_t1 && !av->disp_sync_seen) {
+/* T1 mirror position sensor, sampled at `elapsed` cycles into the frame:
+ * LOW pulse near start of frame to signal BIOS mirror sync.
+ * The BIOS loops on JNT1 waiting for T1=0, then on T1=1 */
+static inline void av_t1_sample(AV *av, int elapsed) {
+    bool new_t1 = !(elapsed >= av->t1_pulse_start && elapsed < av->t1_pulse_end);
+    if (new_t1 == av->cpu.t1) return;   /* no edge: nearly every instruction */
+    av->cpu.t1 = new_t1;
+
+    /* Detect T1 rising edge (low→high = sync pulse ended) */
+    if (new_t1) {
+        if (!av->disp_sync_seen) {
             av->disp_sync_cycle = elapsed;
             av->disp_sync_seen = true;
             /* Reset LED column counter: mirror reached start position.
              * BIOS will now output 150 columns via LED register + P2.4. */
             av->disp.led_col = 0;
         }
+        return;
+    }
 
-        /* Mid-frame column capture — sync-aware:
-         * Columns are captured within the display output window that
-         * starts immediately after T1 sync. Before sync, no columns
-         * are captured (game logic is running, VRAM may be updating). */
-        /* Legacy mid-frame scan: only used when LED register path inactive.
-         * With LED registers, columns are captured via P2.4 strobes instead. */
-        if (av->midframe_scan && !av->disp.led_active && av->disp_sync_seen) {
-            int disp_elapsed = elapsed - av->disp_sync_cycle;
-            if (disp_elapsed >= 0 && disp_elapsed <= DISP_OUTPUT_CYCLES) {
-                int col = (disp_elapsed * SW) / DISP_OUTPUT_CYCLES;
-                if (col >= 0 && col < SW)
-                    disp_capture_column(&av->disp, av->cpu.xram, col);
-            }
-        }
+    /* Counter mode: increment on T1 falling edge (1→0 transition).
+     * MCS-48 datasheet: "Subsequent high to low transitions on T1
+     * will cause the counter to increment." */
+    if (av->cpu.counter_en && ++av->cpu.timer == 0) {
+        av->cpu.timer_ovf = true;
+        if (av->cpu.tcnti_en && !av->cpu.in_irq)
+            av->cpu.irq_pend = true;
+    }
+}
 
-        /* XRAM watchpoint check */
-        if (av->dbg_watch_en && av->dbg.active) {
-            /* Simple: checked after each instruction */
+/* Mid-frame column capture — sync-aware:
+ * Columns are captured within the display output window that
+ * starts immediately after T1 sync. Before sync, no columns
+ * are captured (game logic is running, VRAM may be updating). */
+/* Legacy mid-frame scan: only used when LED register path inactive.
+ * With LED registers, columns are captured via P2.4 strobes instead. */
+static inline void av_midframe_capture(AV *av, int elapsed) {
+    if (av->midframe_scan && !av->disp.led_active && av->disp_sync_seen) {
+        int disp_elapsed = elapsed - av->disp_sync_cycle;
+        if (disp_elapsed >= 0 && disp_elapsed <= DISP_OUTPUT_CYCLES) {
+            int col = (disp_elapsed * SW) / DISP_OUTPUT_CYCLES;
+            if (col >= 0 && col < SW)
+                disp_capture_column(&av->disp, av->cpu.xram, col);
         }
+    }
+}
+
+/* True while a later instruction this frame may still take the legacy
+ * mid-frame capture path: both exits (LED strobes seen, window over)
+ * hold until av_frame_begin */
+static inline bool av_midframe_open(const AV *av, int elapsed) {
+    return !av->disp.led_active &&
+           !(av->disp_sync_seen && elapsed - av->disp_sync_cycle > DISP_OUTPUT_CYCLES);
+}
+
+/* Debugger stop at PC (breakpoint) or after the instruction at PC (watch) */
+static bool av_dbg_stop(AV *av, uint16_t pc, uint16_t hit) {
+    av->dbg.stepping = true;
+    av->dbg.hit_pc = pc;
+    av->dbg.hit = hit;
+    av->dbg.stops++;
+    av->cpu.watch_hit = 0;
+    return true;
+}
+
+/* One polled instruction (or block); false if the debugger stopped.
+ * A jump to itself may fast-forward up to the next T1 edge before T1 is
+ * sampled (i8048_idle_skip; av_quiet_cycles is 1 if this step crossed
+ * one); never under the debugger, which stops per step. */
+static AV_FORCE_INLINE bool av_poll_step(AV *av, int *elapsed, int total,
+                                         bool dbg, bool capture, bool block) {
+    uint16_t pc = av->cpu.PC;
+    if (dbg) {
+        bool skip = av->dbg.resume;
+        av->dbg.resume = false;
+        if (!skip && (av->dbg.bp[pc >> 3] >> (pc & 7) & 1)) return !av_dbg_stop(av, pc, 0);
+    }
+    *elapsed += block
+        ? i8048_exec_block(&av->cpu, av, av->icache, av_quiet_cycles(av, *elapsed, total))
+        : i8048_exec(&av->cpu, av);
+    if (!dbg && av->cpu.PC == pc && av->idle_skip)
+        *elapsed += i8048_idle_skip(&av->cpu, av_quiet_cycles(av, *elapsed, total));
+    av_t1_sample(av, *elapsed);
+    if (capture) av_midframe_capture(av, *elapsed);
+    return !(dbg && av->cpu.watch_hit && av_dbg_stop(av, pc, av->cpu.watch_hit));
+}
+
+/* Polling frame loop: T1, sync and capture checked after every instruction,
+ * from `elapsed` (non-zero when resuming a frame the debugger stopped).
+ * Instantiated per feature set (see av_frame_loops): breakpoint and watch
+ * checks only with dbg, and with mid the capture check only until
+ * av_midframe_open fails, after which the rest of the frame runs the
+ * plain loop. Returns false if the debugger stopped mid-frame. */
+static AV_FORCE_INLINE bool av_frame_poll(AV *av, int elapsed, int total,
+                                          bool dbg, bool mid, bool block) {
+    if (mid) {
+        while (elapsed < total && av_midframe_open(av, elapsed))
+            if (!av_poll_step(av, &elapsed, total, dbg, true, block)) goto stopped;
+    }
+    while (elapsed < total)
+        if (!av_poll_step(av, &elapsed, total, dbg, false, block)) goto stopped;
+    return true;
+stopped:
+    av->dbg.frame_at = elapsed;
+    return false;
+}
 
-        /* Counter mode: increment on T1 falling edge (1→0 transition).
-         * MCS-48 datasheet: "Subsequent high to low transitions on T1
-         * will cause the counter to increment." */
-        if (av->cpu.counter_en && prev_t1 && !new_t1) {
-            if (++av->cpu.timer == 0) {
-                av->cpu.timer_ovf = true;
-                if (av->cpu.tcnti_en && !av->cpu.in_irq)
-                    av->cpu.irq_pend = true;
+/* ---- Frame event scheduler ----
+ * Opt-in alternative to av_frame_poll. Everything the polling loop checks
+ * per instruction only changes at a few known cycles, so each one is
+ * queued as an event and the CPU runs in bursts up to the next one:
+ *   EV_T1        — next T1 sample: after the first instruction (resync if
+ *                  T1 is stale), pulse start (falling edge, counter
+ *                  increment) and pulse end (rising edge, display sync)
+ *   EV_DISP_END  — first cycle past the mid-frame capture window; while
+ *                  the window is open bursts are single instructions
+ *   EV_FRAME_END — frame boundary
+ * An event due at cycle N fires after the first instruction ending at or
+ * past N, exactly where the polling loop would first see the change.
+ * Outside the capture window a jump to itself fast-forwards the burst
+ * up to N (i8048_idle_skip), as the polling loop does up to its T1 edge.
+ * Timer overflow stays in i8048_retire: the CPU observes it per
+ * instruction (JTF, IRQ latency) so there is nothing to poll here. */
+
+enum { EV_T1, EV_DISP_END, EV_FRAME_END, EV_COUNT };
+#define EV_NEVER INT_MAX
+
+/* Next T1 boundary after `elapsed` (EV_NEVER once both are behind) */
+static int av_t1_next_due(const AV *av, int elapsed) {
+    if (av->t1_pulse_start > elapsed) return av->t1_pulse_start;
+    if (av->t1_pulse_end > elapsed) return av->t1_pulse_end;
+    return EV_NEVER;
+}
+
+static AV_FORCE_INLINE bool av_frame_events(AV *av, int total, bool mid, bool use_block) {
+    int due[EV_COUNT] = { 1, EV_NEVER, total };
+    bool window = false;
+    int elapsed = 0;
+    while (elapsed < total) {
+        int next = due[0];
+        for (int e = 1; e < EV_COUNT; e++) if (due[e] < next) next = due[e];
+
+        /* Burst: at least one instruction, then up to the next event */
+        do {
+            uint16_t pc = av->cpu.PC;
+            elapsed += use_block
+                ? i8048_exec_block(&av->cpu, av, av->icache, window ? 1 : next - elapsed)
+                : i8048_exec(&av->cpu, av);
+            if (window) av_midframe_capture(av, elapsed);
+            else if (av->cpu.PC == pc && av->idle_skip)
+                elapsed += i8048_idle_skip(&av->cpu, next - elapsed);
+        } while (elapsed < next);
+
+        if (elapsed >= due[EV_T1]) {
+            bool was_synced = av->disp_sync_seen;
+            av_t1_sample(av, elapsed);
+            due[EV_T1] = av_t1_next_due(av, elapsed);
+            if (mid && !was_synced && av->disp_sync_seen) {
+                /* Window opens on the instruction that saw the edge */
+                av_midframe_capture(av, elapsed);
+                window = true;
+                due[EV_DISP_END] = av->disp_sync_cycle + DISP_OUTPUT_CYCLES + 1;
             }
         }
-        av->cpu.t1 = new_t1;
+        if (elapsed >= due[EV_DISP_END]) {
+            window = false;
+            due[EV_DISP_END] = EV_NEVER;
+        }
     }
+    return true;
+}
 
+/* Frame loop instances, picked once per frame by av_run_frame from
+ * [event sched][debugger][midframe_scan][block engine]. The debugger
+ * forces polling and the interpreter, so those slots share its loops;
+ * a frame the debugger stopped always resumes in a polling loop. */
+typedef bool (*AVFrameLoop)(AV *av, int elapsed, int total);
+#define AV_FRAME_LOOP(name, call) \
+    static bool name(AV *av, int elapsed, int total) { (void)elapsed; return call; }
+AV_FRAME_LOOP(av_poll_i,     av_frame_poll(av, elapsed, total, false, false, false))
+AV_FRAME_LOOP(av_poll_b,     av_frame_poll(av, elapsed, total, false, false, true))
+AV_FRAME_LOOP(av_poll_mid_i, av_frame_poll(av, elapsed, total, false, true, false))
+AV_FRAME_LOOP(av_poll_mid_b, av_frame_poll(av, elapsed, total, false, true, true))
+AV_FRAME_LOOP(av_poll_dbg,   av_frame_poll(av, elapsed, total, true, false, false))
+AV_FRAME_LOOP(av_poll_dbg_mid, av_frame_poll(av, elapsed, total, true, true, false))
+AV_FRAME_LOOP(av_events_i,   av_frame_events(av, total, false, false))
+AV_FRAME_LOOP(av_events_b,   av_frame_events(av, total, false, true))
+AV_FRAME_LOOP(av_events_mid_i, av_frame_events(av, total, true, false))
+AV_FRAME_LOOP(av_events_mid_b, av_frame_events(av, total, true, true))
+#undef AV_FRAME_LOOP
+
+static const AVFrameLoop av_frame_loops[2][2][2][2] = {
+    { { { av_poll_i, av_poll_b }, { av_poll_mid_i, av_poll_mid_b } },
+      { { av_poll_dbg, av_poll_dbg }, { av_poll_dbg_mid, av_poll_dbg_mid } } },
+    { { { av_events_i, av_events_b }, { av_events_mid_i, av_events_mid_b } },
+      { { av_poll_dbg, av_poll_dbg }, { av_poll_dbg_mid, av_poll_dbg_mid } } },
+};
+
+/* Per-frame setup shared by av_run_frame and the wide interpreter */
+static void av_frame_begin(AV *av) {
+    av->disp_sync_seen = false;
+    av->disp_sync_cycle = 0;
+    /* Reset LED display state for new frame */
+    memset(av->disp.led_reg, 0xFF, sizeof(av->disp.led_reg));
+    av->disp.led_col = 0;
+    av->disp.led_active = false;
+}
+
+/* End of frame: column fallback, phosphor update, rewind snapshot */
+static void av_frame_end(AV *av) {
     /* Column capture — hybrid strategy:
      * If LED columns were captured via P2.4 strobes (hardware-accurate),
      * they are already in col_data[]. If not (homebrew without BIOS display
@@ -1594,235 +3355,2220 @@ static void av_run_frame(AV *av) {
             disp_capture_column(&av->disp, av->cpu.xram, col);
     }
 
+    av->frame_count++;
+    if (av->spec == SPEC_HIDDEN) { av->disp.cols_captured = 0; return; }
     /* Update display from captured columns */
+    disp_set_q8(&av->disp, av->phosphor_fmt == PHOSPHOR_Q8);
+    PROF_BEGIN(av, PROF_DISP);
     disp_update(&av->disp, av->cfg_phosphor);
-    av->frame_count++;
-    /* Push rewind snapshot every frame (lock to protect snd fields) */
-#ifdef USE_SDL
-    AUDIO_LOCK(av);
+    PROF_END(av, PROF_DISP);
+    /* Push rewind snapshot every frame (sound from snd_snapshot, no lock) */
+    if (!av->spec) rewind_push(av);
+    if (!av->spec && av->movie.fp && !av->movie.play) movie_frame(av);
+}
+
+/* Run one frame of CPU execution with T1 mirror timing (or the rest of
+ * the frame the debugger stopped in) */
+static void av_run_frame(AV *av) {
+    PROF_BEGIN(av, PROF_RUN);
+    int total = CYCLES_PER_FR, start = av->dbg.frame_at;
+    av->dbg.frame_at = 0;
+    if (!start) av_frame_begin(av);
+    av->cpu.watch = av->dbg.active && av->dbg.watches ? av->dbg.watch : NULL;
+    av->cpu.watch_hit = 0;
+
+    /* Block engine: sync decoded ops with the loaded ROMs. Falls back to
+     * the interpreter if the cache cannot be allocated or the debugger
+     * needs per-instruction breakpoint checks. */
+    bool use_block = av->cpu_engine == CPU_ENGINE_BLOCK && !av->dbg.active;
+    if (use_block && !av->icache)
+        av->icache = (I8048Cache *)calloc(1, sizeof(I8048Cache));
+    if (use_block && !av->icache) use_block = false;
+    if (use_block) i8048_cache_sync(av->icache, &av->cpu);
+
+    /* Event scheduler runs bursts, so the debugger forces polling */
+    bool done = av_frame_loops[av->frame_sched == FRAME_SCHED_EVENT && !start][av->dbg.active]
+                              [av->midframe_scan][use_block](av, start, total);
+    if (done) av_frame_end(av);
+    PROF_END(av, PROF_RUN);
+}
+
+#ifndef AV_LIB
+/* Debugger single step inside the stopped frame */
+static void av_dbg_step(AV *av) {
+    int elapsed = av->dbg.frame_at;
+    uint16_t pc = av->cpu.PC;
+    if (!elapsed) av_frame_begin(av);
+    elapsed += i8048_exec(&av->cpu, av);
+    av_t1_sample(av, elapsed);
+    av_midframe_capture(av, elapsed);
+    if (av->cpu.watch_hit) av_dbg_stop(av, pc, av->cpu.watch_hit);
+    if (elapsed >= CYCLES_PER_FR) { av_frame_end(av); elapsed = 0; }
+    av->dbg.frame_at = elapsed;
+}
+
+/* Leave a stop: run on, past a breakpoint at the current PC */
+static void av_dbg_continue(AV *av) {
+    av->dbg.stepping = false;
+    av->dbg.resume = true;
+}
+
+static void av_dbg_report(const AV *av) {
+    uint16_t h = av->dbg.hit, a = h & (XRAM_SZ - 1);
+    if (!h) printf("[DBG] break $%03X", av->dbg.hit_pc);
+    else printf("[DBG] watch %c $%03X = $%02X by $%03X", (h & WATCH_WR) ? 'W' : 'R',
+                a, av->cpu.xram[a], av->dbg.hit_pc);
+    printf(" (frame %d, cycle %d)\n", av->frame_count, av->dbg.frame_at);
+}
+
+/* "ADDR[-END]" in hex ($ or 0x optional), for --watch with ":r", ":w"
+ * (default) or ":rw" after it: sets the bits, false if malformed */
+static bool av_dbg_add(AV *av, const char *spec, bool watch) {
+    unsigned lim = watch ? XRAM_SZ : PC_SPACE, lo, hi;
+    const char *p = spec;
+    char *end;
+    if (*p == '$') p++;
+    lo = hi = (unsigned)strtoul(p, &end, 16);
+    if (end == p) return false;
+    if (*end == '-') {
+        p = end + 1;
+        if (*p == '$') p++;
+        hi = (unsigned)strtoul(p, &end, 16);
+        if (end == p) return false;
+    }
+    bool rd = false, wr = true;
+    if (watch && *end == ':') {
+        rd = strchr(end + 1, 'r') != NULL;
+        wr = strchr(end + 1, 'w') != NULL;
+        end += strlen(end);
+    }
+    if (*end || lo > hi || hi >= lim || !(rd || wr)) return false;
+    for (unsigned a = lo; a <= hi; a++) {
+        if (!watch) { av->dbg.bp[a >> 3] |= (uint8_t)(1u << (a & 7)); av->dbg.bps++; continue; }
+        if (rd) { av->dbg.watch[a >> 3] |= (uint8_t)(1u << (a & 7)); av->dbg.watches++; }
+        if (wr) { av->dbg.watch[XRAM_SZ / 8 + (a >> 3)] |= (uint8_t)(1u << (a & 7)); av->dbg.watches++; }
+    }
+    return true;
+}
+
+/* ---- In-memory state (run-ahead, netplay rollback) ----
+ * What a frame changes on the CPU side, copied raw: no FILE I/O, no
+ * validation, same process only. The COP411L is left out: speculative
+ * and re-run frames never post to it. */
+typedef struct {
+    I8048   cpu;
+    AVDisp  disp;
+    uint8_t snd_proto_state, snd_proto_hi, prev_p2;
+    int     disp_sync_cycle;
+    bool    disp_sync_seen;
+    int     frame_count;
+} AVMemState;
+
+static void av_mem_save(const AV *av, AVMemState *s) {
+    s->cpu = av->cpu; s->disp = av->disp;
+    s->snd_proto_state = av->snd_proto_state; s->snd_proto_hi = av->snd_proto_hi;
+    s->prev_p2 = av->prev_p2;
+    s->disp_sync_cycle = av->disp_sync_cycle; s->disp_sync_seen = av->disp_sync_seen;
+    s->frame_count = av->frame_count;
+}
+
+static void av_mem_load(AV *av, const AVMemState *s) {
+    av->cpu = s->cpu; av->disp = s->disp;
+    av->snd_proto_state = s->snd_proto_state; av->snd_proto_hi = s->snd_proto_hi;
+    av->prev_p2 = s->prev_p2;
+    av->disp_sync_cycle = s->disp_sync_cycle; av->disp_sync_seen = s->disp_sync_seen;
+    av->frame_count = s->frame_count;
+}
+
+/* Run-ahead host frame: the real frame (sound, rewind), a snapshot into
+ * *s, then n more frames with the same input of which only the last
+ * updates the phosphor. The machine is left n frames in the future for
+ * presentation; av_mem_load(av, s) afterwards returns to the real one.
+ * Input read on port 1 shows up n frames (n × 66 ms) sooner. */
+static void av_runahead(AV *av, int n, AVMemState *s) {
+    av_run_frame(av);
+    av_mem_save(av, s);
+    for (int i = 1; i <= n; i++) {
+        av->spec = i < n ? SPEC_HIDDEN : SPEC_SHOWN;
+        av_run_frame(av);
+    }
+    av->spec = SPEC_NONE;
+}
+
+/* ---- Frame triple buffer (emulation thread -> UI) ----
+ * The producer fills its back slot and swaps it with the middle one; the
+ * consumer swaps its front slot with the middle one when that holds a
+ * newer frame. Neither side waits and a slot is never read while written:
+ * the UI always draws the most recent complete frame, and frames it had
+ * no time to draw are simply replaced. The overlay stats of the frame
+ * travel in the same slot. */
+#define TB_FRESH        4u      /* mid: holds a frame not yet taken */
+
+typedef struct {
+    AVDisp   disp;
+    uint64_t cycles;            /* CPU cycle count after the frame */
+    float    audio_lead;        /* stat_audio_lead when it was published */
+} TBFrame;
+
+typedef struct {
+    TBFrame  slot[3];
+    uint32_t mid;               /* shared slot index | TB_FRESH */
+    uint32_t back, front;       /* owned by the producer / the consumer */
+} FrameTB;
+
+static void frame_tb_init(FrameTB *t) {
+    memset(t, 0, sizeof(*t));
+    t->back = 0; t->mid = 1; t->front = 2;
+}
+
+static void frame_tb_publish(FrameTB *t, const AVDisp *d, uint64_t cycles, float audio_lead) {
+    TBFrame *f = &t->slot[t->back];
+    f->disp = *d; f->cycles = cycles; f->audio_lead = audio_lead;
+    t->back = AV_XCHG(&t->mid, t->back | TB_FRESH) & 3u;
+}
+
+/* Newest frame, or NULL if nothing was published since the last take */
+static const TBFrame *frame_tb_take(FrameTB *t) {
+    if (!(AV_LOAD_ACQ(&t->mid) & TB_FRESH)) return NULL;
+    t->front = AV_XCHG(&t->mid, t->front) & 3u;
+    return &t->slot[t->front];
+}
+
+/* ============================================================================
+ *  LOCKSTEP WIDE INTERPRETER
+ * ============================================================================
+ *
+ *  Runs up to WIDE_LANES instances of the same ROM side by side (batch
+ *  --wide). Lanes at the same frame cycle, PC and bank state (P1.2, MB, BS,
+ *  in_irq) form a lockstep group: their register files are gathered into
+ *  structure-of-arrays form (I8048Wide), each instruction is fetched and
+ *  decoded once, and its effect is computed for every lane with fixed-width
+ *  loops that the compiler turns into SSE/AVX2/NEON code. A run ends when
+ *  lanes disagree on the next PC or register bank (branch on per-lane data,
+ *  MOV PSW,A), at an opcode outside the wide subset (timer/IRQ control,
+ *  RETR), or at the next cycle where the frame loop or the timer could observe something:
+ *  T1 boundary, timer overflow, deliverable IRQ, end of frame. Lanes out of
+ *  step, or stopped at such an opcode, go through scalar i8048_exec.
+ *
+ *  Cycle accounting and the timer prescaler are applied once per run with
+ *  the summed cycles (i8048_retire); a run never crosses an overflow nor a
+ *  point where an IRQ could be taken, so this is exact. XRAM, ports, T0/T1
+ *  and the timer stay in each lane's I8048 and are accessed per lane.
+ *  Lanes with the debugger or the LED pipeline active always run scalar.
+ *  Self-test 19 compares against av_run_frame lane by lane.
+ */
+
+#define WIDE_LANES 16
+
+typedef struct {
+    uint8_t A[WIDE_LANES], C[WIDE_LANES], AC[WIDE_LANES];
+    uint8_t F0[WIDE_LANES], F1[WIDE_LANES], SP[WIDE_LANES], PSW[WIDE_LANES];
+    uint8_t iram[IRAM_SZ][WIDE_LANES];  /* [address][lane] */
+    uint8_t BS, MB;                     /* uniform within a group */
+    uint8_t BSl[WIDE_LANES];            /* per-lane BS after a divergent MOV PSW,A */
+    bool    bs_split;
+    int     acc;                        /* cycles run so far, not yet retired */
+} I8048Wide;
+
+#define WL for (int k = 0; k < WIDE_LANES; k++)  /* vector: all lanes */
+#define WN for (int k = 0; k < n; k++)           /* per lane: AoS access */
+
+static void wide_gather(I8048Wide *W, AV **g, int n) {
+    memset(W, 0, sizeof(*W));
+    WN {
+        const I8048 *c = &g[k]->cpu;
+        W->A[k] = c->A; W->C[k] = c->C; W->AC[k] = c->AC;
+        W->F0[k] = c->F0; W->F1[k] = c->F1; W->SP[k] = c->SP; W->PSW[k] = c->PSW;
+        for (int i = 0; i < IRAM_SZ; i++) W->iram[i][k] = c->iram[i];
+    }
+    W->BS = g[0]->cpu.BS; W->MB = g[0]->cpu.MB;
+}
+
+static void wide_scatter(const I8048Wide *W, AV **g, int n) {
+    WN {
+        I8048 *c = &g[k]->cpu;
+        c->A = W->A[k]; c->C = W->C[k]; c->AC = W->AC[k];
+        c->F0 = W->F0[k]; c->F1 = W->F1[k]; c->SP = W->SP[k]; c->PSW = W->PSW[k];
+        c->BS = W->bs_split ? W->BSl[k] : W->BS; c->MB = W->MB;
+        for (int i = 0; i < IRAM_SZ; i++) c->iram[i] = W->iram[i][k];
+    }
+}
+
+/* Resolve per-lane next PCs: uniform → *pc, otherwise flag divergence */
+static void wide_resolve(int n, const uint16_t *lane_pc, uint16_t *pc, uint16_t *npc, bool *div) {
+    bool same = true;
+    WN { npc[k] = lane_pc[k]; if (lane_pc[k] != lane_pc[0]) same = false; }
+    if (same) *pc = lane_pc[0]; else *div = true;
+}
+static void wide_branch(int n, const uint8_t *take, uint16_t target, uint16_t fall,
+                        uint16_t *pc, uint16_t *npc, bool *div) {
+    uint16_t lp[WIDE_LANES] = {0};
+    WN lp[k] = take[k] ? target : fall;
+    wide_resolve(n, lp, pc, npc, div);
+}
+
+/* Execute the instruction at *pc for lanes 0..n-1. Returns its cycle count,
+ * or 0 without touching any state if the opcode is outside the subset. */
+static int wide_exec(I8048Wide *W, AV **g, int n, uint16_t *pc, uint16_t *npc, bool *div) {
+    I8048 *c0 = &g[0]->cpu;
+    uint8_t op = rom_rd(c0, *pc);
+    uint16_t p1 = (*pc + 1) & 0xFFF, p2 = (*pc + 2) & 0xFFF;
+    uint8_t imm = rom_rd(c0, p1);
+    uint8_t base = W->BS ? 24 : 0;
+    uint8_t *Rr = W->iram[base + (op & 7)], *Ri = W->iram[base + (op & 1)];
+    uint8_t t[WIDE_LANES], take[WIDE_LANES];
+    uint16_t lp[WIDE_LANES];
+    uint16_t tgt = (p2 & 0xF00) | imm;  /* conditional jump target */
+    uint16_t next = p1;
+    int cy = 1;
+#define AT(k) W->iram[Ri[k] & (IRAM_SZ-1)][k]   /* @Ri operand of lane k */
+#define ADD_FLAGS(val, cin) WL { uint16_t s16 = W->A[k] + (val) + (cin); \
+        W->AC[k] = ((W->A[k]&0xF) + ((val)&0xF) + (cin)) > 0xF; W->C[k] = s16 > 0xFF; W->A[k] = (uint8_t)s16; }
+#define IMM2 (next = p2, cy = 2)
+#define JCC(cond) do { WL take[k] = (cond); wide_branch(n, take, tgt, p2, pc, npc, div); return 2; } while (0)
+
+    switch (op) {
+    case 0x00: case 0x75: break;  /* NOP, ENT0 CLK */
+
+    /* MOV */
+    case 0xF8:case 0xF9:case 0xFA:case 0xFB:case 0xFC:case 0xFD:case 0xFE:case 0xFF: WL W->A[k] = Rr[k]; break;
+    case 0xA8:case 0xA9:case 0xAA:case 0xAB:case 0xAC:case 0xAD:case 0xAE:case 0xAF: WL Rr[k] = W->A[k]; break;
+    case 0x23: IMM2; WL W->A[k] = imm; break;
+    case 0xB8:case 0xB9:case 0xBA:case 0xBB:case 0xBC:case 0xBD:case 0xBE:case 0xBF: IMM2; WL Rr[k] = imm; break;
+    case 0xF0:case 0xF1: WL W->A[k] = AT(k); break;
+    case 0xA0:case 0xA1: WL AT(k) = W->A[k]; break;
+    case 0xB0:case 0xB1: IMM2; WL AT(k) = imm; break;
+
+    /* XCH / XCHD */
+    case 0x28:case 0x29:case 0x2A:case 0x2B:case 0x2C:case 0x2D:case 0x2E:case 0x2F:
+        WL { t[k] = W->A[k]; W->A[k] = Rr[k]; Rr[k] = t[k]; } break;
+    case 0x20:case 0x21: WL { t[k] = AT(k); AT(k) = W->A[k]; W->A[k] = t[k]; } break;
+    case 0x30:case 0x31: WL { t[k] = W->A[k] & 0xF; W->A[k] = (W->A[k] & 0xF0) | (AT(k) & 0xF); AT(k) = (AT(k) & 0xF0) | t[k]; } break;
+
+    /* ADD / ADDC */
+    case 0x68:case 0x69:case 0x6A:case 0x6B:case 0x6C:case 0x6D:case 0x6E:case 0x6F: ADD_FLAGS(Rr[k], 0); break;
+    case 0x03: IMM2; ADD_FLAGS(imm, 0); break;
+    case 0x60:case 0x61: WL t[k] = AT(k); ADD_FLAGS(t[k], 0); break;
+    case 0x78:case 0x79:case 0x7A:case 0x7B:case 0x7C:case 0x7D:case 0x7E:case 0x7F: ADD_FLAGS(Rr[k], W->C[k]); break;
+    case 0x13: IMM2; ADD_FLAGS(imm, W->C[k]); break;
+    case 0x70:case 0x71: WL t[k] = AT(k); ADD_FLAGS(t[k], W->C[k]); break;
+
+    /* Logic */
+    case 0x58:case 0x59:case 0x5A:case 0x5B:case 0x5C:case 0x5D:case 0x5E:case 0x5F: WL W->A[k] &= Rr[k]; break;
+    case 0x53: IMM2; WL W->A[k] &= imm; break;
+    case 0x50:case 0x51: WL W->A[k] &= AT(k); break;
+    case 0x48:case 0x49:case 0x4A:case 0x4B:case 0x4C:case 0x4D:case 0x4E:case 0x4F: WL W->A[k] |= Rr[k]; break;
+    case 0x43: IMM2; WL W->A[k] |= imm; break;
+    case 0x40:case 0x41: WL W->A[k] |= AT(k); break;
+    case 0xD8:case 0xD9:case 0xDA:case 0xDB:case 0xDC:case 0xDD:case 0xDE:case 0xDF: WL W->A[k] ^= Rr[k]; break;
+    case 0xD3: IMM2; WL W->A[k] ^= imm; break;
+    case 0xD0:case 0xD1: WL W->A[k] ^= AT(k); break;
+
+    /* INC / DEC / CLR / CPL / DA / SWAP / rotates */
+    case 0x17: WL W->A[k]++; break;
+    case 0x18:case 0x19:case 0x1A:case 0x1B:case 0x1C:case 0x1D:case 0x1E:case 0x1F: WL Rr[k]++; break;
+    case 0x10:case 0x11: WL AT(k)++; break;
+    case 0x07: WL W->A[k]--; break;
+    case 0xC8:case 0xC9:case 0xCA:case 0xCB:case 0xCC:case 0xCD:case 0xCE:case 0xCF: WL Rr[k]--; break;
+    case 0x27: WL W->A[k] = 0; break;
+    case 0x37: WL W->A[k] = ~W->A[k]; break;
+    case 0x57: WL {
+        if ((W->A[k]&0xF) > 9 || W->AC[k]) { t[k] = W->A[k]; W->A[k] += 6; if (W->A[k] < t[k]) W->C[k] = 1; }
+        if ((W->A[k]>>4) > 9 || W->C[k]) { W->A[k] += 0x60; W->C[k] = 1; }
+    } break;
+    case 0x47: WL W->A[k] = (uint8_t)((W->A[k] << 4) | (W->A[k] >> 4)); break;
+    case 0xE7: WL W->A[k] = (uint8_t)((W->A[k] << 1) | (W->A[k] >> 7)); break;
+    case 0xF7: WL { t[k] = W->C[k]; W->C[k] = W->A[k] >> 7; W->A[k] = (uint8_t)((W->A[k] << 1) | t[k]); } break;
+    case 0x77: WL W->A[k] = (uint8_t)((W->A[k] >> 1) | (W->A[k] << 7)); break;
+    case 0x67: WL { t[k] = W->C[k]; W->C[k] = W->A[k] & 1; W->A[k] = (uint8_t)((W->A[k] >> 1) | (t[k] << 7)); } break;
+
+    /* Flags, banks */
+    case 0x97: WL W->C[k] = 0; break;  case 0xA7: WL W->C[k] ^= 1; break;
+    case 0x85: WL W->F0[k] = 0; break; case 0x95: WL W->F0[k] ^= 1; break;
+    case 0xA5: WL W->F1[k] = 0; break; case 0xB5: WL W->F1[k] ^= 1; break;
+    case 0xC5: W->BS = 0; break;       case 0xD5: W->BS = 1; break;
+    case 0xE5: W->MB = 0; break;       case 0xF5: W->MB = 1; break;
+    case 0xD7: {
+        WL {
+            W->PSW[k] = W->A[k]; W->C[k] = W->A[k] >> 7; W->AC[k] = (W->A[k] >> 6) & 1;
+            W->F0[k] = (W->A[k] >> 5) & 1; W->BSl[k] = (W->A[k] >> 4) & 1; W->SP[k] = W->A[k] & 7;
+        }
+        bool same = true;
+        WN if (W->BSl[k] != W->BSl[0]) same = false;
+        if (same) W->BS = W->BSl[0];
+        else { W->bs_split = true; *div = true; WN npc[k] = next; }
+        break;
+    }
+    case 0xC7: WL { W->PSW[k] = (W->C[k]<<7)|(W->AC[k]<<6)|(W->F0[k]<<5)|(W->BS<<4)|0x08|(W->SP[k]&7); W->A[k] = W->PSW[k]; } break;
+
+    /* Jumps */
+    case 0x04:case 0x24:case 0x44:case 0x64:case 0x84:case 0xA4:case 0xC4:case 0xE4:
+        *pc = ((uint16_t)(op&0xE0)<<3) | imm;
+        if (W->MB && !c0->in_irq) *pc |= 0x800;
+        return 2;
+    case 0xB3: WN lp[k] = (p1 & 0xF00) | rom_rd(&g[k]->cpu, (p1 & 0xF00) | W->A[k]);
+        wide_resolve(n, lp, pc, npc, div); return 2;
+    case 0xE8:case 0xE9:case 0xEA:case 0xEB:case 0xEC:case 0xED:case 0xEE:case 0xEF:
+        WL Rr[k]--;
+        JCC(Rr[k] != 0);
+    case 0xF6: JCC(W->C[k]);
+    case 0xE6: JCC(!W->C[k]);
+    case 0xC6: JCC(!W->A[k]);
+    case 0x96: JCC(W->A[k] != 0);
+    case 0xB6: JCC(W->F0[k]);
+    case 0x76: JCC(W->F1[k]);
+    case 0x12:case 0x32:case 0x52:case 0x72:case 0x92:case 0xB2:case 0xD2:case 0xF2:
+        JCC((W->A[k] >> ((op>>5)&7)) & 1);
+    case 0x26: WN take[k] = !g[k]->cpu.t0; wide_branch(n, take, tgt, p2, pc, npc, div); return 2;
+    case 0x36: WN take[k] = g[k]->cpu.t0;  wide_branch(n, take, tgt, p2, pc, npc, div); return 2;
+    case 0x46: WN take[k] = !g[k]->cpu.t1; wide_branch(n, take, tgt, p2, pc, npc, div); return 2;
+    case 0x56: WN take[k] = g[k]->cpu.t1;  wide_branch(n, take, tgt, p2, pc, npc, div); return 2;
+    case 0x16: WN { take[k] = g[k]->cpu.timer_ovf; if (take[k]) g[k]->cpu.timer_ovf = 0; }
+        wide_branch(n, take, tgt, p2, pc, npc, div); return 2;
+    case 0x86: IMM2; break;  /* JNI — INT not connected in AV */
+
+    /* MOV A,T: prescaler is retired lazily, but never past an overflow */
+    case 0x42: WN { const I8048 *c = &g[k]->cpu;
+        W->A[k] = c->timer_en ? (uint8_t)(c->timer + (c->tpre + W->acc) / 32) : c->timer; } break;
+
+    /* CALL / RET (stack lives in iram) */
+    case 0x14:case 0x34:case 0x54:case 0x74:case 0x94:case 0xB4:case 0xD4:case 0xF4:
+        WL {
+            W->PSW[k] = (W->C[k]<<7)|(W->AC[k]<<6)|(W->F0[k]<<5)|(W->BS<<4)|0x08|(W->SP[k]&7);
+            uint8_t a = 8 + W->SP[k] * 2;
+            W->iram[a & (IRAM_SZ-1)][k] = p2 & 0xFF;
+            W->iram[(a+1) & (IRAM_SZ-1)][k] = ((p2>>8)&0x0F) | (W->PSW[k]&0xF0);
+            W->SP[k] = (W->SP[k] + 1) & 7;
+        }
+        *pc = ((uint16_t)(op&0xE0)<<3) | imm;
+        if (W->MB && !c0->in_irq) *pc |= 0x800;
+        return 2;
+    case 0x83: WL {
+            W->SP[k] = (W->SP[k] - 1) & 7;
+            uint8_t a = 8 + W->SP[k] * 2;
+            lp[k] = W->iram[a & (IRAM_SZ-1)][k] | ((W->iram[(a+1) & (IRAM_SZ-1)][k]&0x0F)<<8);
+        }
+        wide_resolve(n, lp, pc, npc, div); return 2;
+
+    /* Ports (P1/P2/BUS live in each lane's I8048) */
+    case 0x08: cy = 2; WN W->A[k] = av_port_read(g[k], 0); break;
+    case 0x09: cy = 2; WN W->A[k] = av_port_read(g[k], 1); break;
+    case 0x0A: cy = 2; WN W->A[k] = av_port_read(g[k], 2); break;
+    case 0x02: cy = 2; WN { g[k]->cpu.BUS = W->A[k]; av_port_write(g[k], 0, W->A[k]); } break;
+    case 0x88: IMM2; WN { g[k]->cpu.BUS |= imm; av_port_write(g[k], 0, g[k]->cpu.BUS); } break;
+    case 0x98: IMM2; WN { g[k]->cpu.BUS &= imm; av_port_write(g[k], 0, g[k]->cpu.BUS); } break;
+    case 0x39: cy = 2; WN { g[k]->cpu.P1 = W->A[k]; av_port_write(g[k], 1, W->A[k]); } break;
+    case 0x3A: cy = 2; WN { g[k]->cpu.P2 = W->A[k]; av_port_write(g[k], 2, W->A[k]); } break;
+    case 0x99: IMM2; WN { g[k]->cpu.P1 &= imm; av_port_write(g[k], 1, g[k]->cpu.P1); } break;
+    case 0x9A: IMM2; WN { g[k]->cpu.P2 &= imm; av_port_write(g[k], 2, g[k]->cpu.P2); } break;
+    case 0x89: IMM2; WN { g[k]->cpu.P1 |= imm; av_port_write(g[k], 1, g[k]->cpu.P1); } break;
+    case 0x8A: IMM2; WN { g[k]->cpu.P2 |= imm; av_port_write(g[k], 2, g[k]->cpu.P2); } break;
+
+    /* MOVX / MOVP / MOVD */
+    case 0x80:case 0x81: cy = 2; WN W->A[k] = xram_rd(&g[k]->cpu, Ri[k]); break;
+    case 0x90:case 0x91: cy = 2; WN xram_wr(&g[k]->cpu, Ri[k], W->A[k]); break;
+    case 0xA3: cy = 2; WN W->A[k] = rom_rd(&g[k]->cpu, (p1 & 0xF00) | W->A[k]); break;
+    case 0xE3: cy = 2; WN W->A[k] = rom_rd(&g[k]->cpu, 0x300 | W->A[k]); break;
+    case 0x0C:case 0x0D:case 0x0E:case 0x0F: cy = 2; WL W->A[k] = 0x0F; break;
+    case 0x3C:case 0x3D:case 0x3E:case 0x3F:
+    case 0x8C:case 0x8D:case 0x8E:case 0x8F:
+    case 0x9C:case 0x9D:case 0x9E:case 0x9F: cy = 2; break;
+
+    default: return 0;  /* timer/IRQ control, RETR, unknown: scalar */
+    }
+#undef AT
+#undef ADD_FLAGS
+#undef IMM2
+#undef JCC
+
+    *pc = next;
+    /* OUTL/ANL/ORL P1 may have switched lanes to different ROM banks */
+    if (op == 0x39 || op == 0x99 || op == 0x89) {
+        WN if ((g[k]->cpu.P1 ^ c0->P1) & 0x04) *div = true;
+        if (*div) WN npc[k] = next;
+    }
+    return cy;
+}
+
+/* Run the lockstep group g[0..n-1] (all at frame cycle *e with the same PC
+ * and bank state) until a stop condition. Returns instructions executed;
+ * 0 means the first opcode needs the scalar interpreter. */
+static int wide_run(I8048Wide *W, AV **g, int n, int *e, int total) {
+    const AV *a0 = g[0];
+    bool lvl = !(*e >= a0->t1_pulse_start && *e < a0->t1_pulse_end);
+    int stop = av_t1_next_due(a0, *e);
+    if (total < stop) stop = total;
+    int wend = -1;  /* last cycle any lane may still capture columns */
+    WN {
+        const AV *av = g[k]; const I8048 *c = &av->cpu;
+        if (c->t1 != lvl || c->ei_delay || (c->irq_pend && c->irq_en && !c->in_irq))
+            stop = *e + 1;  /* T1 resync or IRQ at the next retire: one step */
+        if (c->timer_en) {
+            int ovf = (256 - c->timer) * 32 - c->tpre;
+            if (*e + ovf < stop) stop = *e + ovf;
+        }
+        if (av->disp_sync_seen && av->disp_sync_cycle + DISP_OUTPUT_CYCLES > wend)
+            wend = av->disp_sync_cycle + DISP_OUTPUT_CYCLES;
+    }
+
+    wide_gather(W, g, n);
+    uint16_t pc = g[0]->cpu.PC, npc[WIDE_LANES];
+    bool div = false;
+    int ins = 0;
+    do {
+        int cy = wide_exec(W, g, n, &pc, npc, &div);
+        if (!cy) break;
+        ins++; W->acc += cy; *e += cy;
+        if (*e <= wend) WN av_midframe_capture(g[k], *e);
+    } while (!div && *e < stop);
+    if (!ins) return 0;
+
+    wide_scatter(W, g, n);
+    WN {
+        g[k]->cpu.PC = div ? npc[k] : pc;
+        i8048_retire(&g[k]->cpu, W->acc);
+        av_t1_sample(g[k], *e);
+    }
+    return ins;
+}
+
+/* Run one frame on lanes[0..n-1] (n <= WIDE_LANES), same result as calling
+ * av_run_frame on each. Lanes sharing lane 0's ROM and timing settings are
+ * grouped into lockstep runs whenever they line up. Returns the number of
+ * lane-instructions executed in lockstep (for stats and the self-test). */
+static long av_wide_run_frame(AV **lanes, int n) {
+    int total = CYCLES_PER_FR;
+    int e[WIDE_LANES];
+    bool ok[WIDE_LANES];
+    I8048Wide W;
+    long wide = 0;
+    const AV *l0 = lanes[0];
+    for (int l = 0; l < n; l++) {
+        AV *av = lanes[l];
+        av_frame_begin(av);
+        e[l] = 0;
+        ok[l] = !av->dbg.active && !av->led_pipeline &&
+                av->t1_pulse_start == l0->t1_pulse_start && av->t1_pulse_end == l0->t1_pulse_end &&
+                memcmp(av->cpu.irom, l0->cpu.irom, IROM_SZ) == 0 &&
+                memcmp(av->cpu.erom, l0->cpu.erom, EROM_SZ) == 0;
+    }
+    for (;;) {
+        /* Leader: the lane furthest behind (lowest index on ties) */
+        int L = -1;
+        for (int l = 0; l < n; l++)
+            if (e[l] < total && (L < 0 || e[l] < e[L])) L = l;
+        if (L < 0) break;
+
+        AV *g[WIDE_LANES];
+        int gi[WIDE_LANES], m = 0, ins = 0;
+        if (ok[L]) {
+            const I8048 *cl = &lanes[L]->cpu;
+            for (int l = L; l < n; l++) {
+                const I8048 *c = &lanes[l]->cpu;
+                if (ok[l] && e[l] == e[L] && c->PC == cl->PC && ((c->P1 ^ cl->P1) & 0x04) == 0 &&
+                    c->MB == cl->MB && c->BS == cl->BS && c->in_irq == cl->in_irq) {
+                    gi[m] = l; g[m++] = lanes[l];
+                }
+            }
+        }
+        if (m >= 2) {
+            int ee = e[L];
+            ins = wide_run(&W, g, m, &ee, total);
+            if (ins) { for (int j = 0; j < m; j++) e[gi[j]] = ee; wide += (long)ins * m; }
+        }
+        if (!ins) {
+            AV *av = lanes[L];
+            e[L] += i8048_exec(&av->cpu, av);
+            av_t1_sample(av, e[L]);
+            av_midframe_capture(av, e[L]);
+        }
+    }
+    for (int l = 0; l < n; l++) av_frame_end(lanes[l]);
+    return wide;
+}
+#undef WL
+#undef WN
 #endif
-    rewind_push(av);
-#ifdef USE_SDL
-    AUDIO_UNLOCK(av);
+
+/* ---- Save/Load with validation ----
+ * Chunked savestate blob (little-endian). 12-byte header: "AVSC", u16
+ * STATE_VER, u16 chunk count, u32 total size. Each chunk is a 4-char tag,
+ * a u32 payload length and the payload padded to 4 bytes:
+ *   CPU   registers, flags (T1 included), prescaler, cycles
+ *   IRAM  XRAM   raw memory, memcpy'd straight into I8048
+ *   DISP  col_data[SW][5] + cols_shown, memcpy'd into AVDisp
+ *   SND   full COP411L state and the P2 protocol latch
+ *   MACH  frame_count, prev_p2
+ * Readers skip unknown chunks and ignore bytes past the fields they know:
+ * new fields are appended to a chunk (or get a chunk of their own)
+ * without touching STATE_VER, which only moves when an existing field
+ * changes meaning. Register chunks go through fixed-width helpers since
+ * struct layout differs between compilers. save_state writes the blob
+ * with one fwrite and load_state maps the file; state_blob_save and
+ * state_blob_load are the in-memory entry points. Files in the v15.4
+ * field-by-field format (SAVE_MAGIC) still load. */
+#define STATE_MAGIC     "AVSC"
+#define STATE_VER       1
+#define STATE_HDR       12
+#define STATE_BLOB_MAX  4096   /* state_blob_save output is well below this */
+#define SAVE_MAGIC  0x41563133  /* "AV13": v15.4 format, read only */
+#define SAVE_VER    19
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define AV_STATE_MMAP
 #endif
+
+/* Writer: counts everything, stores only what fits in cap */
+typedef struct { uint8_t *p; size_t n, cap; } StW;
+static void stw_bytes(StW *w, const void *src, size_t n) {
+    if (w->p && w->n + n <= w->cap) memcpy(w->p + w->n, src, n);
+    w->n += n;
+}
+static void stw_u8(StW *w, uint8_t v) { stw_bytes(w, &v, 1); }
+static void stw_u16(StW *w, uint16_t v) { uint8_t b[2]; wav_le16(b, v); stw_bytes(w, b, 2); }
+static void stw_u32(StW *w, uint32_t v) { uint8_t b[4]; wav_le32(b, v); stw_bytes(w, b, 4); }
+static void stw_f32(StW *w, float v) { uint32_t u; memcpy(&u, &v, 4); stw_u32(w, u); }
+static void stw_u64(StW *w, uint64_t v) { stw_u32(w, (uint32_t)v); stw_u32(w, (uint32_t)(v >> 32)); }
+/* Open a chunk; st_end patches its length and pads */
+static size_t stw_begin(StW *w, const char *tag) { stw_bytes(w, tag, 4); stw_u32(w, 0); return w->n; }
+static void stw_end(StW *w, size_t at) {
+    uint32_t len = (uint32_t)(w->n - at);
+    if (w->p && at <= w->cap) wav_le32(w->p + at - 4, len);
+    while (w->n & 3) stw_u8(w, 0);
+}
+
+/* Reader over one chunk payload: reads past the end yield 0 and set
+ * short_, which callers treat as corruption for required fields */
+typedef struct { const uint8_t *p; size_t n, off; bool short_; } StR;
+static const uint8_t *str_bytes(StR *r, size_t n) {
+    if (r->off + n > r->n) { r->short_ = true; r->off = r->n; return NULL; }
+    r->off += n;
+    return r->p + r->off - n;
+}
+static uint8_t str_u8(StR *r) { const uint8_t *b = str_bytes(r, 1); return b ? b[0] : 0; }
+static uint16_t str_u16(StR *r) { const uint8_t *b = str_bytes(r, 2); return b ? (uint16_t)(b[0] | b[1] << 8) : 0; }
+static uint32_t str_u32(StR *r) { const uint8_t *b = str_bytes(r, 4); return b ? rd_le32(b) : 0; }
+static uint64_t str_u64(StR *r) { uint64_t lo = str_u32(r); return lo | (uint64_t)str_u32(r) << 32; }
+static float str_f32(StR *r) { uint32_t u = str_u32(r); float v; memcpy(&v, &u, 4); return v; }
+
+/* Clamp sound fields from a save file to values the renderer can use */
+static void snd_sanitize(COP411L *snd) {
+    /* Sanitize LFSR: zero is a stuck state */
+    if (snd->lfsr == 0) snd->lfsr = 0x7FFF;
+    /* Sanitize loaded sound fields to valid ranges */
+    snd->ctrl_loop &= 1;
+    snd->ctrl_vol &= 3;
+    snd->ctrl_fast &= 1;
+    snd->command &= 0x0F;
+    snd->chain_cmd &= 0x0F;
+    /* Sanitize COP411L playback fields — prevent OOB from crafted saves */
+    if (snd->step_count < 0 || snd->step_count > MAX_SND_STEPS)
+        snd->step_count = 0;
+    if (snd->cur_step < 0 || snd->cur_step >= snd->step_count)
+        snd->cur_step = 0;
+    if (snd->segment < 0 || snd->segment > 1)
+        snd->segment = 0;
+    if (snd->step_samples_left < 0) snd->step_samples_left = 0;
+    if (snd->seg_samples_left < 0) snd->seg_samples_left = 0;
+    if (snd->seg_samples_total < 0) snd->seg_samples_total = 0;
+    /* Reject NaN/Inf floats (isfinite returns 0 for NaN and Inf) */
+    if (!isfinite(snd->cur_freq) || snd->cur_freq < 0.0f)
+        snd->cur_freq = 0.0f;
+    if (!isfinite(snd->cur_vol) || snd->cur_vol < 0.0f)
+        snd->cur_vol = 0.0f;
+    if (snd->cur_vol > 2.0f) snd->cur_vol = 1.0f;
+    if (!isfinite(snd->seg1_vol)) snd->seg1_vol = 1.0f;
+    if (!isfinite(snd->seg2_vol)) snd->seg2_vol = 0.5f;
+    if (!isfinite(snd->slide_freq_start) || snd->slide_freq_start < 0.0f) snd->slide_freq_start = 0.0f;
+    if (!isfinite(snd->slide_freq_end) || snd->slide_freq_end < 0.0f) snd->slide_freq_end = 0.0f;
+    if (!(snd->slide_progress >= 0.0f && snd->slide_progress <= 1.0f)) snd->slide_progress = 0.0f;
+    /* Sanitize step frequencies/volumes in loaded steps array */
+    for (int si = 0; si < snd->step_count; si++) {
+        SndStep *st = &snd->steps[si];
+        if (!isfinite(st->freq) || st->freq < 0.0f) st->freq = 0.0f;
+        if (!isfinite(st->volume)) st->volume = 0.0f;
+        if (st->volume < 0.0f) st->volume = 0.0f;
+        if (st->volume > 2.0f) st->volume = 1.0f;
+        if (st->dur_ms < 0) st->dur_ms = 1;
+    }
+    cop411_update_ctrl_vol(snd);
+}
+
+/* Serialize the machine into buf. Returns the blob size; nothing past
+ * cap is written, so a NULL/short buffer gives the size to allocate. */
+static size_t state_blob_save(const AV *av, uint8_t *buf, size_t cap) {
+    const I8048 *c = &av->cpu;
+    COP411L snd; snd_snapshot(av, &snd);
+    StW w = { buf, 0, cap };
+    size_t k;
+    stw_bytes(&w, STATE_MAGIC, 4);
+    stw_u16(&w, STATE_VER);
+    stw_u16(&w, 6);
+    stw_u32(&w, 0);  /* total size, patched below */
+
+    k = stw_begin(&w, "CPU ");
+    stw_u8(&w, c->A); stw_u16(&w, c->PC); stw_u8(&w, c->PSW); stw_u8(&w, c->SP);
+    stw_u8(&w, c->timer); stw_u8(&w, c->P1); stw_u8(&w, c->P2); stw_u8(&w, c->BUS);
+    stw_u8(&w, c->ei_delay);
+    stw_u8(&w, (uint8_t)(c->MB | c->C << 1 | c->AC << 2 | c->F0 << 3 | c->F1 << 4 | c->BS << 5));
+    stw_u8(&w, (uint8_t)(c->timer_en | c->counter_en << 1 | c->timer_ovf << 2 | c->tcnti_en << 3 |
+                         c->irq_en << 4 | c->irq_pend << 5 | c->in_irq << 6 | c->t1 << 7));
+    stw_u32(&w, (uint32_t)c->tpre);
+    stw_u64(&w, c->cycles);
+    stw_end(&w, k);
+    k = stw_begin(&w, "IRAM"); stw_bytes(&w, c->iram, IRAM_SZ); stw_end(&w, k);
+    k = stw_begin(&w, "XRAM"); stw_bytes(&w, c->xram, XRAM_SZ); stw_end(&w, k);
+    k = stw_begin(&w, "DISP");
+    stw_bytes(&w, av->disp.col_data, sizeof(av->disp.col_data));
+    stw_u8(&w, (uint8_t)av->disp.cols_shown);
+    stw_end(&w, k);
+
+    k = stw_begin(&w, "SND ");
+    stw_u8(&w, snd.ctrl_loop); stw_u8(&w, snd.ctrl_vol); stw_u8(&w, snd.ctrl_fast);
+    stw_u8(&w, av->snd_proto_state); stw_u8(&w, av->snd_proto_hi);
+    stw_u8(&w, (uint8_t)(snd.active | snd.is_noise << 1 | snd.force_loop << 2 | snd.force_no_loop << 3));
+    stw_u8(&w, snd.command); stw_u8(&w, snd.chain_cmd);
+    stw_u16(&w, snd.lfsr);
+    stw_u32(&w, snd.phase_acc); stw_u32(&w, snd.phase_inc);
+    stw_f32(&w, snd.cur_freq); stw_f32(&w, snd.cur_vol);
+    stw_f32(&w, snd.seg1_vol); stw_f32(&w, snd.seg2_vol);
+    stw_f32(&w, snd.slide_freq_start); stw_f32(&w, snd.slide_freq_end); stw_f32(&w, snd.slide_progress);
+    stw_u32(&w, (uint32_t)snd.step_count); stw_u32(&w, (uint32_t)snd.cur_step);
+    stw_u32(&w, (uint32_t)snd.step_samples_left); stw_u32(&w, (uint32_t)snd.segment);
+    stw_u32(&w, (uint32_t)snd.seg_samples_total); stw_u32(&w, (uint32_t)snd.seg_samples_left);
+    stw_u8(&w, MAX_SND_STEPS);
+    for (int si = 0; si < MAX_SND_STEPS; si++) {
+        stw_f32(&w, snd.steps[si].freq); stw_u8(&w, snd.steps[si].noise);
+        stw_u32(&w, (uint32_t)snd.steps[si].dur_ms); stw_f32(&w, snd.steps[si].volume);
+    }
+    stw_end(&w, k);
+
+    k = stw_begin(&w, "MACH");
+    stw_u32(&w, (uint32_t)av->frame_count); stw_u8(&w, av->prev_p2);
+    stw_end(&w, k);
+    if (buf && w.n <= cap) wav_le32(buf + 8, (uint32_t)w.n);
+    return w.n;
+}
+
+/* Load a blob from state_blob_save (or a newer build). Everything is
+ * decoded into copies first: av is untouched on error. */
+static bool state_blob_load(AV *av, const uint8_t *p, size_t n) {
+    if (n < STATE_HDR || memcmp(p, STATE_MAGIC, 4) != 0) {
+        fprintf(stderr, "Invalid save file (bad magic)\n"); return false;
+    }
+    unsigned ver = p[4] | p[5] << 8;
+    size_t total = rd_le32(p + 8);
+    if (ver != STATE_VER) {
+        fprintf(stderr, "Save version mismatch (got %u, need %u)\n", ver, STATE_VER); return false;
+    }
+    if (total < STATE_HDR || total > n) { fprintf(stderr, "Corrupt save file\n"); return false; }
+
+    I8048 cpu = av->cpu;
+    COP411L snd; snd_snapshot(av, &snd);
+    uint8_t proto_state = 0, proto_hi = 0, prev_p2 = av->prev_p2;
+    uint8_t cols_shown = 0;
+    const uint8_t *col_data = NULL;
+    int frame_count = av->frame_count;
+    bool have_cpu = false, have_iram = false, have_xram = false, have_snd = false, ok = true;
+
+    for (size_t off = STATE_HDR; ok && off + 8 <= total; ) {
+        const uint8_t *tag = p + off;
+        size_t len = rd_le32(p + off + 4);
+        if (len > total - off - 8) { ok = false; break; }
+        StR r = { p + off + 8, len, 0, false };
+        if (memcmp(tag, "CPU ", 4) == 0) {
+            cpu.A = str_u8(&r); cpu.PC = str_u16(&r) & 0xFFF; cpu.PSW = str_u8(&r); cpu.SP = str_u8(&r) & 7;
+            cpu.timer = str_u8(&r); cpu.P1 = str_u8(&r); cpu.P2 = str_u8(&r); cpu.BUS = str_u8(&r);
+            cpu.ei_delay = str_u8(&r);
+            uint8_t f1 = str_u8(&r), f2 = str_u8(&r);
+            cpu.MB = f1 & 1; cpu.C = (f1 >> 1) & 1; cpu.AC = (f1 >> 2) & 1;
+            cpu.F0 = (f1 >> 3) & 1; cpu.F1 = (f1 >> 4) & 1; cpu.BS = (f1 >> 5) & 1;
+            cpu.timer_en = f2 & 1; cpu.counter_en = (f2 >> 1) & 1; cpu.timer_ovf = (f2 >> 2) & 1;
+            cpu.tcnti_en = (f2 >> 3) & 1; cpu.irq_en = (f2 >> 4) & 1; cpu.irq_pend = (f2 >> 5) & 1;
+            cpu.in_irq = (f2 >> 6) & 1; cpu.t1 = (f2 >> 7) & 1;
+            cpu.tpre = (int)(str_u32(&r) & 31);
+            cpu.cycles = str_u64(&r);
+            have_cpu = !r.short_;
+        } else if (memcmp(tag, "IRAM", 4) == 0 && len >= IRAM_SZ) {
+            memcpy(cpu.iram, r.p, IRAM_SZ); have_iram = true;
+        } else if (memcmp(tag, "XRAM", 4) == 0 && len >= XRAM_SZ) {
+            memcpy(cpu.xram, r.p, XRAM_SZ); have_xram = true;
+        } else if (memcmp(tag, "DISP", 4) == 0) {
+            col_data = str_bytes(&r, sizeof(av->disp.col_data));
+            cols_shown = str_u8(&r);
+            if (r.short_) col_data = NULL;
+        } else if (memcmp(tag, "SND ", 4) == 0) {
+            snd.ctrl_loop = str_u8(&r); snd.ctrl_vol = str_u8(&r); snd.ctrl_fast = str_u8(&r);
+            proto_state = str_u8(&r); proto_hi = str_u8(&r);
+            uint8_t fl = str_u8(&r);
+            snd.active = fl & 1; snd.is_noise = (fl >> 1) & 1;
+            snd.force_loop = (fl >> 2) & 1; snd.force_no_loop = (fl >> 3) & 1;
+            snd.command = str_u8(&r); snd.chain_cmd = str_u8(&r);
+            snd.lfsr = str_u16(&r);
+            snd.phase_acc = str_u32(&r); snd.phase_inc = str_u32(&r);
+            snd.cur_freq = str_f32(&r); snd.cur_vol = str_f32(&r);
+            snd.seg1_vol = str_f32(&r); snd.seg2_vol = str_f32(&r);
+            snd.slide_freq_start = str_f32(&r); snd.slide_freq_end = str_f32(&r);
+            snd.slide_progress = str_f32(&r);
+            snd.step_count = (int)str_u32(&r); snd.cur_step = (int)str_u32(&r);
+            snd.step_samples_left = (int)str_u32(&r); snd.segment = (int)str_u32(&r);
+            snd.seg_samples_total = (int)str_u32(&r); snd.seg_samples_left = (int)str_u32(&r);
+            int ns = str_u8(&r);
+            for (int si = 0; si < ns; si++) {
+                SndStep st;
+                st.freq = str_f32(&r); st.noise = str_u8(&r) != 0;
+                st.dur_ms = (int)str_u32(&r); st.volume = str_f32(&r);
+                if (si < MAX_SND_STEPS) snd.steps[si] = st;
+            }
+            have_snd = !r.short_;
+            if (!have_snd) ok = false;
+        } else if (memcmp(tag, "MACH", 4) == 0) {
+            frame_count = (int)str_u32(&r); prev_p2 = str_u8(&r);
+            if (r.short_) ok = false;
+        }
+        off += 8 + ((len + 3) & ~(size_t)3);
+    }
+    if (!ok || !have_cpu || !have_iram || !have_xram) {
+        fprintf(stderr, "Corrupt save file\n");
+        return false;
+    }
+    cpu.t0 = true;  /* T0 = expansion port, always 1 */
+    av->cpu = cpu;
+    av->prev_p2 = prev_p2;
+    av->frame_count = frame_count;
+    if (col_data) {
+        memcpy(av->disp.col_data, col_data, sizeof(av->disp.col_data));
+        av->disp.cols_shown = cols_shown > SW ? SW : cols_shown;
+    }
+    if (have_snd) {
+        snd_sanitize(&snd);
+        av->snd_proto_state = proto_state > 3 ? 0 : proto_state;
+        av->snd_proto_hi = proto_hi & 0x0F;
+        /* the audio thread picks the chip up from the sound queue */
+        snd_post(av, SND_EV_LOAD, 0, 0, &snd);
+    }
+    av_dbg_realign(av);
+    return true;
 }
 
-/* ---- Save/Load with validation ---- */
-#define SAVE_MAGIC  0x41563133  /* "AV13" */
-#define SAVE_VER    19  /* v15.4: field-by-field steps serialization */
+#ifndef AV_LIB
+/* Write the blob to f (input movies embed the same bytes) */
+static bool state_write(const AV *av, FILE *f) {
+    uint8_t buf[STATE_BLOB_MAX];
+    size_t n = state_blob_save(av, buf, sizeof(buf));
+    return n <= sizeof(buf) && fwrite(buf, 1, n, f) == n;
+}
 
 static bool save_state(const AV *av, const char *fn) {
+    if (av->dbg.frame_at) {  /* a state starts at a frame boundary */
+        fprintf(stderr, "Cannot save mid-frame: step or continue to the frame's end first\n");
+        return false;
+    }
     FILE *f = fopen(fn, "wb");
     if (!f) { fprintf(stderr, "Cannot save to '%s'\n", fn); return false; }
-    uint32_t magic = SAVE_MAGIC, ver = SAVE_VER;
+    bool ok = state_write(av, f);
+    if (fclose(f) != 0) ok = false;
+    if (ok) printf("State saved.\n");
+    else fprintf(stderr, "Write error saving state\n");
+    return ok;
+}
+
+/* v15.4 field-by-field format, after its SAVE_MAGIC */
+static bool state_read_v19(AV *av, FILE *f) {
+    uint32_t ver;
+    if (fread(&ver, 4, 1, f) != 1 || ver != SAVE_VER) {
+        fprintf(stderr, "Save version mismatch (got %u, need %u)\n", ver, SAVE_VER);
+        return false;
+    }
+
+    /* Backup CPU state before reading (restore on error); sound is read
+     * into a copy of the current chip and only posted on success */
+    I8048 cpu_bak = av->cpu;
+    COP411L snd; snd_snapshot(av, &snd);
+    uint8_t proto_state = 0, proto_hi = 0;
+
     bool ok = true;
-    ok = ok && fwrite(&magic, 4, 1, f) == 1;
-    ok = ok && fwrite(&ver, 4, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.A, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.PC, 2, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.PSW, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.SP, 1, 1, f) == 1;
-    uint8_t flags = (av->cpu.MB)|(av->cpu.C<<1)|(av->cpu.AC<<2)|
-                    (av->cpu.F0<<3)|(av->cpu.F1<<4)|(av->cpu.BS<<5)|
-                    (av->cpu.timer_en<<6)|(av->cpu.counter_en<<7);
-    ok = ok && fwrite(&flags, 1, 1, f) == 1;
-    uint8_t flags2 = (av->cpu.timer_ovf)|(av->cpu.tcnti_en<<1)|
-                     (av->cpu.irq_en<<2)|(av->cpu.irq_pend<<3)|(av->cpu.in_irq<<4);
-    ok = ok && fwrite(&flags2, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.timer, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.P1, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.P2, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->cpu.BUS, 1, 1, f) == 1;
-    ok = ok && fwrite(av->cpu.iram, IRAM_SZ, 1, f) == 1;
-    ok = ok && fwrite(av->cpu.xram, XRAM_SZ, 1, f) == 1;
-    /* tpre as fixed 32-bit for cross-platform save compatibility */
-    { uint32_t tpre32 = (uint32_t)av->cpu.tpre;
-      ok = ok && fwrite(&tpre32, sizeof(uint32_t), 1, f) == 1; }
-    ok = ok && fwrite(&av->cpu.cycles, sizeof(uint64_t), 1, f) == 1;
+    ok = ok && fread(&av->cpu.A, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.PC, 2, 1, f) == 1;
+    ok = ok && fread(&av->cpu.PSW, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.SP, 1, 1, f) == 1;
+    uint8_t flags, flags2;
+    ok = ok && fread(&flags, 1, 1, f) == 1;
+    ok = ok && fread(&flags2, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.timer, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.P1, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.P2, 1, 1, f) == 1;
+    ok = ok && fread(&av->cpu.BUS, 1, 1, f) == 1;
+    ok = ok && fread(av->cpu.iram, IRAM_SZ, 1, f) == 1;
+    ok = ok && fread(av->cpu.xram, XRAM_SZ, 1, f) == 1;
+    { uint32_t tpre32;
+      ok = ok && fread(&tpre32, sizeof(uint32_t), 1, f) == 1;
+      av->cpu.tpre = (int)tpre32; }
+    ok = ok && fread(&av->cpu.cycles, sizeof(uint64_t), 1, f) == 1;
     /* COP411L state */
-    ok = ok && fwrite(&av->snd.ctrl_loop, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.ctrl_vol, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.ctrl_fast, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.proto_state, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.proto_hi, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.lfsr, sizeof(uint16_t), 1, f) == 1;
+    ok = ok && fread(&snd.ctrl_loop, 1, 1, f) == 1;
+    ok = ok && fread(&snd.ctrl_vol, 1, 1, f) == 1;
+    ok = ok && fread(&snd.ctrl_fast, 1, 1, f) == 1;
+    ok = ok && fread(&proto_state, 1, 1, f) == 1;
+    ok = ok && fread(&proto_hi, 1, 1, f) == 1;
+    ok = ok && fread(&snd.lfsr, sizeof(uint16_t), 1, f) == 1;
     /* v15: full COP411L playback state (fixed-width for cross-platform portability) */
     { uint8_t b;
-      b = av->snd.active ? 1 : 0;   ok = ok && fwrite(&b, 1, 1, f) == 1;
-      b = av->snd.is_noise ? 1 : 0;  ok = ok && fwrite(&b, 1, 1, f) == 1; }
-    ok = ok && fwrite(&av->snd.command, 1, 1, f) == 1;
-    ok = ok && fwrite(&av->snd.cur_freq, sizeof(float), 1, f) == 1;
-    ok = ok && fwrite(&av->snd.cur_vol, sizeof(float), 1, f) == 1;
-    ok = ok && fwrite(&av->snd.phase_acc, sizeof(uint32_t), 1, f) == 1;
-    ok = ok && fwrite(&av->snd.phase_inc, sizeof(uint32_t), 1, f) == 1;
+      ok = ok && fread(&b, 1, 1, f) == 1; snd.active = (b != 0);
+      ok = ok && fread(&b, 1, 1, f) == 1; snd.is_noise = (b != 0); }
+    ok = ok && fread(&snd.command, 1, 1, f) == 1;
+    ok = ok && fread(&snd.cur_freq, sizeof(float), 1, f) == 1;
+    ok = ok && fread(&snd.cur_vol, sizeof(float), 1, f) == 1;
+    ok = ok && fread(&snd.phase_acc, sizeof(uint32_t), 1, f) == 1;
+    ok = ok && fread(&snd.phase_inc, sizeof(uint32_t), 1, f) == 1;
     { int32_t i32;
-      i32 = (int32_t)av->snd.cur_step;          ok = ok && fwrite(&i32, 4, 1, f) == 1;
-      i32 = (int32_t)av->snd.step_count;         ok = ok && fwrite(&i32, 4, 1, f) == 1;
-      i32 = (int32_t)av->snd.step_samples_left;  ok = ok && fwrite(&i32, 4, 1, f) == 1;
-      i32 = (int32_t)av->snd.segment;             ok = ok && fwrite(&i32, 4, 1, f) == 1;
-      i32 = (int32_t)av->snd.seg_samples_left;   ok = ok && fwrite(&i32, 4, 1, f) == 1;
-      i32 = (int32_t)av->snd.seg_samples_total;  ok = ok && fwrite(&i32, 4, 1, f) == 1; }
-    ok = ok && fwrite(&av->snd.seg1_vol, sizeof(float), 1, f) == 1;
-    ok = ok && fwrite(&av->snd.seg2_vol, sizeof(float), 1, f) == 1;
-    /* Write steps field-by-field for portability (no struct padding/endian issues) */
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.cur_step = (int)i32;
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.step_count = (int)i32;
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.step_samples_left = (int)i32;
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.segment = (int)i32;
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.seg_samples_left = (int)i32;
+      ok = ok && fread(&i32, 4, 1, f) == 1; snd.seg_samples_total = (int)i32; }
+    ok = ok && fread(&snd.seg1_vol, sizeof(float), 1, f) == 1;
+    ok = ok && fread(&snd.seg2_vol, sizeof(float), 1, f) == 1;
+    /* Read steps field-by-field (matches field-by-field write) */
     for (int si = 0; si < MAX_SND_STEPS; si++) {
-        ok = ok && fwrite(&av->snd.steps[si].freq, sizeof(float), 1, f) == 1;
-        { uint8_t bn = av->snd.steps[si].noise ? 1 : 0;
-          ok = ok && fwrite(&bn, 1, 1, f) == 1; }
-        { int32_t di = (int32_t)av->snd.steps[si].dur_ms;
-          ok = ok && fwrite(&di, 4, 1, f) == 1; }
-        ok = ok && fwrite(&av->snd.steps[si].volume, sizeof(float), 1, f) == 1;
+        ok = ok && fread(&snd.steps[si].freq, sizeof(float), 1, f) == 1;
+        { uint8_t bn; ok = ok && fread(&bn, 1, 1, f) == 1;
+          snd.steps[si].noise = (bn != 0); }
+        { int32_t di; ok = ok && fread(&di, 4, 1, f) == 1;
+          snd.steps[si].dur_ms = (int)di; }
+        ok = ok && fread(&snd.steps[si].volume, sizeof(float), 1, f) == 1;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Corrupt save file\n");
+        av->cpu = cpu_bak;
+        return false;
+    }
+
+    av->cpu.MB = flags&1; av->cpu.C = (flags>>1)&1; av->cpu.AC = (flags>>2)&1;
+    av->cpu.F0 = (flags>>3)&1; av->cpu.F1 = (flags>>4)&1; av->cpu.BS = (flags>>5)&1;
+    av->cpu.timer_en = (flags>>6)&1; av->cpu.counter_en = (flags>>7)&1;
+    av->cpu.timer_ovf = flags2&1; av->cpu.tcnti_en = (flags2>>1)&1;
+    av->cpu.irq_en = (flags2>>2)&1; av->cpu.irq_pend = (flags2>>3)&1;
+    av->cpu.in_irq = (flags2>>4)&1;
+    av->cpu.t1 = (flags2>>5)&1;  /* 0 in saves before v15.5 */
+
+    av->cpu.PC &= 0xFFF;
+    av->cpu.SP &= 7;
+    av->cpu.t0 = true;  /* T0 = expansion port, always 1 */
+
+    /* Preserve ROMs (not saved) */
+    memcpy(av->cpu.irom, cpu_bak.irom, IROM_SZ);
+    memcpy(av->cpu.erom, cpu_bak.erom, EROM_SZ);
+
+    snd_sanitize(&snd);
+    av->snd_proto_state = proto_state > 3 ? 0 : proto_state;
+    av->snd_proto_hi = proto_hi & 0x0F;
+    /* v15: full COP411L state is restored; the audio thread picks it up
+     * from the sound queue */
+    snd_post(av, SND_EV_LOAD, 0, 0, &snd);
+    av_dbg_realign(av);
+    return true;
+}
+
+/* Read one state from f, leaving f just past it; av is untouched on error */
+static bool state_read(AV *av, FILE *f) {
+    uint8_t hdr[STATE_HDR];
+    if (fread(hdr, 1, 4, f) != 4) { fprintf(stderr, "Invalid save file (bad magic)\n"); return false; }
+    if (rd_le32(hdr) == SAVE_MAGIC) return state_read_v19(av, f);
+    if (fread(hdr + 4, 1, STATE_HDR - 4, f) != STATE_HDR - 4 || memcmp(hdr, STATE_MAGIC, 4) != 0) {
+        fprintf(stderr, "Invalid save file (bad magic)\n"); return false;
     }
+    size_t total = rd_le32(hdr + 8);
+    if (total < STATE_HDR || total > (1u << 24)) { fprintf(stderr, "Corrupt save file\n"); return false; }
+    uint8_t *buf = (uint8_t *)malloc(total);
+    if (!buf) return false;
+    memcpy(buf, hdr, STATE_HDR);
+    bool ok = fread(buf + STATE_HDR, 1, total - STATE_HDR, f) == total - STATE_HDR;
+    if (!ok) fprintf(stderr, "Corrupt save file\n");
+    ok = ok && state_blob_load(av, buf, total);
+    free(buf);
+    return ok;
+}
+
+static bool load_state(AV *av, const char *fn) {
+    bool ok = false;
+#ifdef AV_STATE_MMAP
+    /* Map the file and decode the blob in place; v15.4 files (and files
+     * that cannot be mapped) go through state_read */
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) { fprintf(stderr, "Cannot load '%s'\n", fn); return false; }
+    struct stat sb;
+    void *map = fstat(fd, &sb) == 0 && sb.st_size >= STATE_HDR
+        ? mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map != MAP_FAILED && memcmp(map, STATE_MAGIC, 4) == 0) {
+        ok = state_blob_load(av, (const uint8_t *)map, (size_t)sb.st_size);
+        munmap(map, (size_t)sb.st_size);
+        if (ok) printf("State loaded.\n");
+        return ok;
+    }
+    if (map != MAP_FAILED) munmap(map, (size_t)sb.st_size);
+#endif
+    FILE *f = fopen(fn, "rb");
+    if (!f) { fprintf(stderr, "Cannot load '%s'\n", fn); return false; }
+    ok = state_read(av, f);
     fclose(f);
-    if (ok) printf("State saved.\n");
-    else fprintf(stderr, "Write error saving state\n");
+    if (ok) printf("State loaded.\n");
+    return ok;
+}
+#endif
+
+/* ---- Input movies (.avm) ----
+ * Per-frame AV.input log for deterministic replay. Header (36 bytes LE):
+ * "AVMOV1\0\0", FNV-1a of the BIOS and game ROMs (u64 each), frame count
+ * (u32), state check interval, T1 pulse window (u16 each), flags (bit 0:
+ * a state_write image follows and is the starting point, otherwise the
+ * movie starts at power-on), one reserved byte. Records follow:
+ *   'I' mask run    mask (U D L R 1 2 3 4 = bits 0-7) held for run frames,
+ *                   run in LEB128
+ *   'H' frame hash  av_state_hash after `frame` frames (u32, u64)
+ *   'E'             end of movie
+ * The recorder is fed by av_frame_end for real frames only (run-ahead
+ * speculation never reaches it). Headless --movie replays at full speed
+ * and compares every 'H' record, so a desync is caught within one check
+ * interval instead of at the final register dump. */
+#define MOVIE_MAGIC  "AVMOV1\0\0"
+#define MOVIE_HDR    36
+#define MOVIE_CHECK  60   /* frames between state hashes (4 s) */
+
+
+#define FNV_INIT 0xCBF29CE484222325ULL
+static uint64_t fnv1a(uint64_t h, const void *p, size_t n) {
+    const uint8_t *b = (const uint8_t *)p;
+    for (size_t i = 0; i < n; i++) { h ^= b[i]; h *= 0x100000001B3ULL; }
+    return h;
+}
+
+/* FNV-1a over everything that feeds back into emulation: CPU registers,
+ * flags, prescaler, cycle count, IRAM and XRAM (display and sound are
+ * outputs only) */
+static uint64_t av_state_hash(const AV *av) {
+    const I8048 *c = &av->cpu;
+    uint8_t r[24] = {
+        c->A, (uint8_t)c->PC, (uint8_t)(c->PC >> 8), c->PSW, c->SP, c->timer,
+        c->P1, c->P2, c->BUS, c->ei_delay,
+        (uint8_t)(c->MB | c->C << 1 | c->AC << 2 | c->F0 << 3 | c->F1 << 4 | c->BS << 5),
+        (uint8_t)(c->timer_en | c->counter_en << 1 | c->timer_ovf << 2 | c->tcnti_en << 3 |
+                  c->irq_en << 4 | c->irq_pend << 5 | c->in_irq << 6),
+    };
+    wav_le32(r + 12, (uint32_t)c->tpre);
+    wav_le64(r + 16, c->cycles);
+    uint64_t h = fnv1a(FNV_INIT, r, sizeof(r));
+    h = fnv1a(h, c->iram, IRAM_SZ);
+    return fnv1a(h, c->xram, XRAM_SZ);
+}
+
+static uint8_t input_mask(const AV *av) {
+    return (uint8_t)(av->input.u | av->input.d << 1 | av->input.l << 2 | av->input.r << 3 |
+                     av->input.b1 << 4 | av->input.b2 << 5 | av->input.b3 << 6 | av->input.b4 << 7);
+}
+
+static void input_set_mask(AV *av, uint8_t k) {
+    av->input.u = k & 1;          av->input.d = (k >> 1) & 1;
+    av->input.l = (k >> 2) & 1;   av->input.r = (k >> 3) & 1;
+    av->input.b1 = (k >> 4) & 1;  av->input.b2 = (k >> 5) & 1;
+    av->input.b3 = (k >> 6) & 1;  av->input.b4 = (k >> 7) & 1;
+}
+
+
+static void movie_put(Movie *m, const uint8_t *b, size_t n) {
+    if (fwrite(b, 1, n, m->fp) != n) m->err = true;
+}
+
+/* Flush the pending input run */
+static void movie_put_run(Movie *m) {
+    if (!m->run) return;
+    uint8_t b[8] = { 'I', m->mask };
+    size_t n = 2;
+    uint32_t v = m->run;
+    do { b[n++] = (uint8_t)((v & 0x7F) | (v > 0x7F ? 0x80 : 0)); v >>= 7; } while (v);
+    movie_put(m, b, n);
+    m->run = 0;
+}
+
+static void movie_put_hash(Movie *m, const AV *av) {
+    uint8_t b[13] = { 'H' };
+    wav_le32(b + 1, m->frames);
+    wav_le64(b + 5, av_state_hash(av));
+    movie_put(m, b, sizeof(b));
+}
+
+/* Recorder: called by av_frame_end after each real frame */
+static void movie_frame(AV *av) {
+    Movie *m = &av->movie;
+    uint8_t k = input_mask(av);
+    if (m->run && k != m->mask) movie_put_run(m);
+    m->mask = k;
+    m->run++;
+    if (++m->frames % MOVIE_CHECK == 0) { movie_put_run(m); movie_put_hash(m, av); }
+}
+
+#ifndef AV_LIB
+/* Start recording from the current state (embed) or from power-on */
+static bool movie_start(AV *av, const char *fn, bool embed) {
+    Movie *m = &av->movie;
+    memset(m, 0, sizeof(*m));
+    if (embed && av->dbg.frame_at) {
+        fprintf(stderr, "Cannot start a movie mid-frame: step or continue to the frame's end first\n");
+        return false;
+    }
+    if (!(m->fp = fopen(fn, "wb"))) { fprintf(stderr, "Cannot create '%s'\n", fn); return false; }
+    uint8_t h[MOVIE_HDR] = { 0 };
+    memcpy(h, MOVIE_MAGIC, 8);
+    wav_le64(h + 8, fnv1a(FNV_INIT, av->cpu.irom, IROM_SZ));
+    wav_le64(h + 16, fnv1a(FNV_INIT, av->cpu.erom, EROM_SZ));
+    wav_le16(h + 28, MOVIE_CHECK);
+    wav_le16(h + 30, (uint16_t)av->t1_pulse_start);
+    wav_le16(h + 32, (uint16_t)av->t1_pulse_end);
+    h[34] = embed ? 1 : 0;
+    movie_put(m, h, sizeof(h));
+    if (embed && !state_write(av, m->fp)) m->err = true;
+    movie_put_hash(m, av);  /* frame 0: verifies the starting state */
+    return true;
+}
+
+/* Stop recording (finishing the file) or playback. Returns false on a
+ * write error or, for playback, a desync. */
+static bool movie_stop(AV *av) {
+    Movie *m = &av->movie;
+    if (!m->fp) return false;
+    bool ok;
+    if (m->play) {
+        ok = !m->desync && !m->err;
+        fclose(m->fp);
+    } else {
+        movie_put_run(m);
+        if (m->frames % MOVIE_CHECK) movie_put_hash(m, av);
+        movie_put(m, (const uint8_t *)"E", 1);
+        uint8_t b[4];
+        wav_le32(b, m->frames);
+        if (fseek(m->fp, 24, SEEK_SET) != 0) m->err = true;
+        else movie_put(m, b, 4);
+        if (fclose(m->fp) != 0) m->err = true;
+        ok = !m->err;
+        if (!ok) fprintf(stderr, "Write error recording movie\n");
+    }
+    m->fp = NULL;
+    return ok;
+}
+
+#ifdef USE_SDL
+/* Reset, state load and rewind break the input timeline: end the
+ * recording at that point */
+static void movie_cut(AV *av) {
+    if (!av->movie.fp || av->movie.play) return;
+    osd_show(av, movie_stop(av) ? "Movie saved" : "Movie write error");
+}
+#endif
+
+/* Open a movie for replay: checks the ROMs, applies its T1 window and
+ * loads its starting state (power-on movies run from the state av_init
+ * leaves). Returns the recorded frame count, or -1. */
+static int movie_open(AV *av, const char *fn) {
+    Movie *m = &av->movie;
+    memset(m, 0, sizeof(*m));
+    uint8_t h[MOVIE_HDR];
+    FILE *f = fopen(fn, "rb");
+    if (!f) { fprintf(stderr, "Cannot open '%s'\n", fn); return -1; }
+    if (fread(h, 1, sizeof(h), f) != sizeof(h) || memcmp(h, MOVIE_MAGIC, 8) != 0) {
+        fprintf(stderr, "'%s' is not an input movie\n", fn); fclose(f); return -1;
+    }
+    if (rd_le64(h + 8) != fnv1a(FNV_INIT, av->cpu.irom, IROM_SZ) ||
+        rd_le64(h + 16) != fnv1a(FNV_INIT, av->cpu.erom, EROM_SZ)) {
+        fprintf(stderr, "Movie was recorded with different ROMs\n"); fclose(f); return -1;
+    }
+    av->t1_pulse_start = h[30] | h[31] << 8;
+    av->t1_pulse_end = h[32] | h[33] << 8;
+    if ((h[34] & 1) && !state_read(av, f)) { fclose(f); return -1; }
+    m->fp = f;
+    m->play = true;
+    return (int)rd_le32(h + 24);
+}
+
+/* Playback: check the state hashes recorded at this point, then set
+ * av->input for the next frame. False at the end of the movie, on a
+ * desync or a corrupt record. */
+static bool movie_next(AV *av) {
+    Movie *m = &av->movie;
+    while (m->run == 0) {
+        uint8_t b[12];
+        int tag = fgetc(m->fp);
+        if (tag == 'H') {
+            if (fread(b, 1, 12, m->fp) != 12 || rd_le32(b) != m->frames) { m->err = true; break; }
+            uint64_t want = rd_le64(b + 4), got = av_state_hash(av);
+            m->checks++;
+            if (got != want) {
+                fprintf(stderr, "Movie desync at frame %u: state %016llx, recorded %016llx\n",
+                        m->frames, (unsigned long long)got, (unsigned long long)want);
+                m->desync = true;
+                return false;
+            }
+        } else if (tag == 'I') {
+            int k = fgetc(m->fp), c, sh = 0;
+            uint32_t run = 0;
+            do { c = fgetc(m->fp); run |= (uint32_t)(c & 0x7F) << sh; sh += 7; } while (c >= 0x80 && sh < 35);
+            if (k < 0 || c < 0 || c >= 0x80) { m->err = true; break; }
+            m->mask = (uint8_t)k;
+            m->run = run;
+        } else {
+            if (tag != 'E') m->err = true;
+            break;
+        }
+    }
+    if (m->err) fprintf(stderr, "Corrupt movie at frame %u\n", m->frames);
+    if (m->run == 0) return false;
+    input_set_mask(av, m->mask);
+    m->run--;
+    m->frames++;
+    return true;
+}
+#endif
+
+#ifndef AV_LIB
+/* ---- Rollback netplay (core) ----
+ * Two peers run the same machine from the same state. The console has a
+ * single controller, so a frame's input is the OR of both players' masks.
+ * Local input applies at once; the peer's is predicted as its last
+ * received mask. When the real mask arrives and differs, the snapshot
+ * taken before the first wrong frame is restored and the frames up to the
+ * present re-run as SPEC_SHOWN: no sound, no rewind. A snapshot is the
+ * run-ahead one (av_mem_save: CPU and display copied raw, phosphor
+ * included), so there is one list of per-frame state to keep up to date.
+ * Spectators replay the confirmed merged masks, one byte per frame, and
+ * never roll back. Packets are transport-free here; the SDL build sends
+ * them over UDP. */
+#define NET_WINDOW      8       /* frames a peer may run past the other's input */
+#define NET_HIST        32      /* ring of inputs/snapshots, > 2 * NET_WINDOW, power of 2 */
+#define NET_FEED_MAX    240     /* masks per spectator packet */
+#define NET_HDR         5       /* "AVN1" + type */
+#define NET_PKT_MAX     (NET_HDR + 9 + NET_FEED_MAX)
+
+typedef struct {
+    bool      spectator;
+    uint32_t  frame;            /* next frame to run */
+    uint32_t  remote_n;         /* peer masks received for frames < remote_n */
+    uint32_t  peer_ack;         /* our masks the peer has for frames < peer_ack */
+    uint32_t  rollback;         /* earliest mispredicted frame, UINT32_MAX = none */
+    uint8_t   local[NET_HIST], remote[NET_HIST];
+    uint8_t   used[NET_HIST];   /* peer mask the frame last ran with */
+    AVMemState snap[NET_HIST];  /* state before the frame */
+    uint8_t  *log;              /* confirmed merged masks from frame 0 */
+    uint32_t  log_n, log_cap;
+    uint32_t  rollbacks, resims, stalls;
+} NetSession;
+
+static void net_session_init(NetSession *ns, bool spectator) {
+    memset(ns, 0, sizeof(*ns));
+    ns->spectator = spectator;
+    ns->rollback = UINT32_MAX;
+}
+
+static void net_session_free(NetSession *ns) {
+    free(ns->log);
+    ns->log = NULL;
+    ns->log_n = ns->log_cap = 0;
+}
+
+static bool net_log_push(NetSession *ns, uint8_t m) {
+    if (ns->log_n == ns->log_cap) {
+        uint32_t cap = ns->log_cap ? ns->log_cap * 2 : 4096;
+        uint8_t *l = (uint8_t *)realloc(ns->log, cap);
+        if (!l) return false;
+        ns->log = l; ns->log_cap = cap;
+    }
+    ns->log[ns->log_n++] = m;
+    return true;
+}
+
+/* Peer mask for frame f: received, else the last one received */
+static uint8_t net_remote(const NetSession *ns, uint32_t f) {
+    if (f < ns->remote_n) return ns->remote[f & (NET_HIST - 1)];
+    return ns->remote_n ? ns->remote[(ns->remote_n - 1) & (NET_HIST - 1)] : 0;
+}
+
+static void net_run(AV *av, NetSession *ns, uint32_t f) {
+    uint8_t r = net_remote(ns, f);
+    av_mem_save(av, &ns->snap[f & (NET_HIST - 1)]);
+    ns->used[f & (NET_HIST - 1)] = r;
+    input_set_mask(av, (uint8_t)(ns->local[f & (NET_HIST - 1)] | r));
+    av_run_frame(av);
+}
+
+/* Re-run from the first mispredicted frame, then extend the confirmed log */
+static void net_sync(AV *av, NetSession *ns) {
+    if (ns->rollback < ns->frame) {
+        uint8_t keep = input_mask(av);
+        av_mem_load(av, &ns->snap[ns->rollback & (NET_HIST - 1)]);
+        av->spec = SPEC_SHOWN;
+        for (uint32_t f = ns->rollback; f < ns->frame; f++) { net_run(av, ns, f); ns->resims++; }
+        av->spec = SPEC_NONE;
+        input_set_mask(av, keep);
+        ns->rollbacks++;
+    }
+    ns->rollback = UINT32_MAX;
+    uint32_t done = ns->frame < ns->remote_n ? ns->frame : ns->remote_n;
+    while (ns->log_n < done &&
+           net_log_push(ns, (uint8_t)(ns->local[ns->log_n & (NET_HIST - 1)] |
+                                      ns->remote[ns->log_n & (NET_HIST - 1)]))) {}
+}
+
+/* Run the next frame with local input mask; false = stalled, waiting for
+ * the peer (more than NET_WINDOW frames of its input are missing) */
+static bool net_step(AV *av, NetSession *ns, uint8_t mask) {
+    if (ns->frame >= ns->remote_n + NET_WINDOW) { ns->stalls++; return false; }
+    ns->local[ns->frame & (NET_HIST - 1)] = mask;
+    net_run(av, ns, ns->frame++);
+    input_set_mask(av, mask);
+    return true;
+}
+
+/* Spectator: next confirmed frame, if it has arrived */
+static bool net_watch_step(AV *av, NetSession *ns) {
+    if (ns->frame >= ns->log_n) { ns->stalls++; return false; }
+    input_set_mask(av, ns->log[ns->frame++]);
+    av_run_frame(av);
+    return true;
+}
+
+static int net_hdr(uint8_t *p, char type) {
+    memcpy(p, "AVN1", 4);
+    p[4] = (uint8_t)type;
+    return NET_HDR;
+}
+
+/* 'I': our masks from the first the peer lacks, plus what we have of its */
+static int net_build_input(const NetSession *ns, uint8_t *p) {
+    uint32_t first = ns->peer_ack, n = ns->frame - first;
+    if (n > NET_HIST) { first = ns->frame - NET_HIST; n = NET_HIST; }
+    int o = net_hdr(p, 'I');
+    wav_le32(p + o, first); wav_le32(p + o + 4, ns->remote_n); p[o + 8] = (uint8_t)n;
+    for (uint32_t i = 0; i < n; i++) p[o + 9 + i] = ns->local[(first + i) & (NET_HIST - 1)];
+    return o + 9 + (int)n;
+}
+
+static bool net_recv_input(NetSession *ns, const uint8_t *p, int len) {
+    if (len < NET_HDR + 9 || memcmp(p, "AVN1", 4) != 0 || p[4] != 'I') return false;
+    uint32_t first = rd_le32(p + NET_HDR), ack = rd_le32(p + NET_HDR + 4), n = p[NET_HDR + 8];
+    if (len < NET_HDR + 9 + (int)n || n > NET_HIST) return false;
+    if (ack > ns->peer_ack && ack <= ns->frame) ns->peer_ack = ack;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t f = first + i;
+        if (f != ns->remote_n || f >= ns->frame + NET_HIST - NET_WINDOW) continue;
+        uint8_t m = p[NET_HDR + 9 + i];
+        ns->remote[f & (NET_HIST - 1)] = m;
+        ns->remote_n++;
+        if (f < ns->frame && m != ns->used[f & (NET_HIST - 1)] && f < ns->rollback) ns->rollback = f;
+    }
+    return true;
+}
+
+/* 'C': confirmed masks for a spectator from frame want */
+static int net_build_feed(const NetSession *ns, uint32_t want, uint8_t *p) {
+    uint32_t n = want < ns->log_n ? ns->log_n - want : 0;
+    if (n > NET_FEED_MAX) n = NET_FEED_MAX;
+    int o = net_hdr(p, 'C');
+    wav_le32(p + o, want); p[o + 4] = (uint8_t)n;
+    if (n) memcpy(p + o + 5, ns->log + want, n);
+    return o + 5 + (int)n;
+}
+
+static bool net_recv_feed(NetSession *ns, const uint8_t *p, int len) {
+    if (len < NET_HDR + 5 || memcmp(p, "AVN1", 4) != 0 || p[4] != 'C') return false;
+    uint32_t first = rd_le32(p + NET_HDR), n = p[NET_HDR + 4];
+    if (len < NET_HDR + 5 + (int)n) return false;
+    for (uint32_t i = 0; i < n; i++)
+        if (first + i == ns->log_n && !net_log_push(ns, p[NET_HDR + 5 + i])) break;
+    return true;
+}
+
+/* ---- Frame export (--shm NAME / --pipe FILE) ----
+ * Fixed-size binary records for external consumers (analysis, ML), one
+ * per frame, little-endian (seq and head are stored natively, x86/ARM):
+ *   0    u32 seq (1, 2, ...; 0 while the slot is being rewritten)
+ *   4    u32 frame_count        8  u64 cycles
+ *   16   u16 PC  18 A  19 PSW  20 SP  21 P1  22 P2  23 BUS  24 timer
+ *   25   flags: C F0 F1 BS MB T1 irq_en in_irq (bits 0-7)
+ *   26   input mask (U D L R 1 2 3 4)   27 columns lit this frame
+ *   64   IRAM[64]
+ *   128  bitplane [150 columns][5 bytes], col_data inverted: 1 = LED on
+ *   880  phosphor [40 rows][150 columns], 0-255
+ * A ring is a 64-byte header ("AVFX", version, record size, slot count,
+ * head = last complete seq, width, height) then the slots; record seq
+ * lives in slot (seq - 1) % slots. The writer zeroes the slot's seq,
+ * fills it, then publishes seq and head, so a reader that sees the same
+ * seq before and after its copy has a whole record (fx_ring_read). A
+ * stream (--pipe) is the same header with 0 slots, then the records. */
+#define FX_VERSION      1
+#define FX_RING_HDR     64
+#define FX_BITS_OFF     128
+#define FX_PHOS_OFF     (FX_BITS_OFF + SW * 5 + 2)  /* 8-aligned */
+#define FX_REC_SZ       (FX_PHOS_OFF + SW * SH)
+#define FX_SLOTS        64
+
+static void fx_header(uint8_t *h, uint32_t slots) {
+    memset(h, 0, FX_RING_HDR);
+    memcpy(h, "AVFX", 4);
+    wav_le32(h + 4, FX_VERSION);
+    wav_le32(h + 8, FX_REC_SZ);
+    wav_le32(h + 12, slots);
+    wav_le32(h + 20, SW);
+    wav_le32(h + 24, SH);
+}
+
+/* Everything but the seq word */
+static void fx_build(const AV *av, uint8_t *r) {
+    const I8048 *c = &av->cpu;
+    const AVDisp *d = &av->disp;
+    memset(r + 4, 0, FX_BITS_OFF - 4);
+    wav_le32(r + 4, (uint32_t)av->frame_count);
+    wav_le64(r + 8, c->cycles);
+    wav_le16(r + 16, c->PC);
+    uint8_t b[] = { c->A, c->PSW, c->SP, c->P1, c->P2, c->BUS, c->timer,
+        (uint8_t)(c->C | c->F0 << 1 | c->F1 << 2 | c->BS << 3 | c->MB << 4 | c->t1 << 5 |
+                  c->irq_en << 6 | c->in_irq << 7),
+        input_mask(av), (uint8_t)d->cols_shown };
+    memcpy(r + 18, b, sizeof(b));
+    memcpy(r + 64, c->iram, IRAM_SZ);
+    uint8_t *bits = r + FX_BITS_OFF;
+    for (int col = 0; col < SW; col++)
+        for (int i = 0; i < 5; i++)
+            bits[col * 5 + i] = col < d->cols_shown ? (uint8_t)~d->col_data[col][i] : 0;
+    bits[SW * 5] = bits[SW * 5 + 1] = 0;
+    uint8_t *ph = r + FX_PHOS_OFF;
+    for (int y = 0; y < SH; y++)
+        for (int x = 0; x < SW; x++)
+            ph[y * SW + x] = d->q8 ? d->phos8[x][y] : (uint8_t)(d->phosphor[x + y * SW] * 255.0f + 0.5f);
+}
+
+static void fx_ring_push(uint8_t *ring, const AV *av) {
+    uint32_t slots = rd_le32(ring + 12), seq = *(uint32_t *)(ring + 16) + 1;
+    if (!seq) seq = 1;
+    uint8_t *r = ring + FX_RING_HDR + (size_t)((seq - 1) % slots) * FX_REC_SZ;
+    AV_STORE_REL((uint32_t *)r, 0);
+    AV_FENCE();
+    fx_build(av, r);
+    AV_STORE_REL((uint32_t *)r, seq);
+    AV_STORE_REL((uint32_t *)(ring + 16), seq);
+}
+
+/* Copy record seq into out; false if it was overwritten or is being written */
+static bool fx_ring_read(const uint8_t *ring, uint32_t seq, uint8_t *out) {
+    uint32_t slots = rd_le32(ring + 12);
+    const uint8_t *r = ring + FX_RING_HDR + (size_t)((seq - 1) % slots) * FX_REC_SZ;
+    if (!seq || AV_LOAD_ACQ((const uint32_t *)r) != seq) return false;
+    memcpy(out, r, FX_REC_SZ);
+    AV_FENCE();
+    return AV_LOAD_ACQ((const uint32_t *)r) == seq;
+}
+#endif
+
+/* ---- libadvision (libadvision.h) ----
+ * The public API over one AV per instance. Sound goes through the event
+ * queue as with a device (snd_pull) and each stepped frame renders its
+ * AVL_FRAME_SAMPLES right after, so audio lands at the same offsets the
+ * audio callback would play it. Rewind is a frontend feature: its ring
+ * is dropped. avl_step_many hands instances to a pool of workers that
+ * wait on a condition variable between calls; each claims the next
+ * unstarted instance until none are left. Without pthreads (MSVC) the
+ * caller runs them all. */
+#if !defined(_MSC_VER)
+#include <pthread.h>
+#include <unistd.h>
+#define AVL_THREADS
+#endif
+
+struct avl {
+    AV        av;
+    float    *audio;        /* last avl_step's samples */
+    int       audio_n, audio_cap;
+    uint8_t   frame[SW * SH];
+    AVRaster *ras;          /* avl_frame_rgb, allocated on first use */
+    uint32_t *rgb;
+};
+
+struct avl_pool {
+    int          workers;   /* not counting the caller */
+    /* Current call, written under lock before gen is bumped */
+    avl *const  *envs;
+    const uint8_t *masks;
+    int          n, frames;
+    uint32_t     next;      /* next instance to claim */
+#ifdef AVL_THREADS
+    pthread_t   *tid;
+    pthread_mutex_t lock;
+    pthread_cond_t  go, done;
+    unsigned     gen;       /* bumped per call */
+    int          busy;      /* workers not yet done with this call */
+    bool         quit;
+#endif
+};
+
+avl *avl_create(void) {
+    avl *e = (avl *)calloc(1, sizeof(avl));
+    if (!e) return NULL;
+    av_init(&e->av);
+    free(e->av.rewind_buf);
+    e->av.rewind_buf = NULL;
+    e->av.cpu_engine = CPU_ENGINE_BLOCK;
+    e->av.frame_sched = FRAME_SCHED_EVENT;
+    e->av.phosphor_fmt = PHOSPHOR_Q8;
+    e->av.snd_pull = true;
+    return e;
+}
+
+void avl_destroy(avl *e) {
+    if (!e) return;
+    free(e->av.icache);
+    free(e->audio);
+    free(e->ras);
+    free(e->rgb);
+    free(e);
+}
+
+int avl_load_rom(avl *e, const void *bios, size_t bios_len, const void *game, size_t game_len) {
+    if (!bios || !game || !bios_len || !game_len || bios_len > IROM_SZ || game_len > EROM_SZ) return -1;
+    memset(e->av.cpu.irom, 0xFF, IROM_SZ);
+    memset(e->av.cpu.erom, 0xFF, EROM_SZ);
+    memcpy(e->av.cpu.irom, bios, bios_len);
+    memcpy(e->av.cpu.erom, game, game_len);
+    av_reset(&e->av);
+    return 0;
+}
+
+void avl_reset(avl *e) { av_reset(&e->av); }
+
+void avl_step(avl *e, uint8_t mask, int frames) {
+    AV *av = &e->av;
+    e->audio_n = 0;
+    if (frames <= 0) return;
+    if (frames > INT_MAX / AVL_FRAME_SAMPLES) frames = INT_MAX / AVL_FRAME_SAMPLES;
+    if (frames * AVL_FRAME_SAMPLES > e->audio_cap) {
+        float *a = (float *)realloc(e->audio, (size_t)frames * AVL_FRAME_SAMPLES * sizeof(float));
+        if (a) { e->audio = a; e->audio_cap = frames * AVL_FRAME_SAMPLES; }
+    }
+    input_set_mask(av, mask);
+    for (int f = 0; f < frames; f++) {
+        av_run_frame(av);
+        if (e->audio_n + AVL_FRAME_SAMPLES <= e->audio_cap) {
+            sndq_render(&av->sndq, &av->snd, e->audio + e->audio_n, AVL_FRAME_SAMPLES, 1.0f);
+            e->audio_n += AVL_FRAME_SAMPLES;
+        } else {
+            float drop[256];  /* no buffer: keep the queue moving */
+            for (int i = 0; i < AVL_FRAME_SAMPLES; i += 256)
+                sndq_render(&av->sndq, &av->snd, drop,
+                            AVL_FRAME_SAMPLES - i < 256 ? AVL_FRAME_SAMPLES - i : 256, 1.0f);
+        }
+    }
+}
+
+const uint8_t *avl_frame(avl *e) {
+    const AVDisp *d = &e->av.disp;
+    for (int y = 0; y < SH; y++)
+        for (int x = 0; x < SW; x++)
+            e->frame[y * SW + x] = d->q8 ? d->phos8[x][y]
+                                         : (uint8_t)(d->phosphor[x + y * SW] * 255.0f + 0.5f);
+    return e->frame;
+}
+
+const uint32_t *avl_frame_rgb(avl *e) {
+    if (!e->ras) {
+        e->ras = (AVRaster *)malloc(sizeof(AVRaster));
+        e->rgb = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
+        if (!e->ras || !e->rgb) { free(e->ras); free(e->rgb); e->ras = NULL; e->rgb = NULL; return NULL; }
+        av_raster_init(e->ras);
+    }
+    av_raster(e->ras, &e->av, e->rgb);
+    return e->rgb;
+}
+
+const float *avl_audio(const avl *e, int *count) {
+    if (count) *count = e->audio_n;
+    return e->audio;
+}
+
+uint64_t avl_frame_count(const avl *e) { return (uint64_t)e->av.frame_count; }
+
+size_t avl_save_state(const avl *e, void *buf, size_t cap) {
+    return state_blob_save(&e->av, (uint8_t *)buf, cap);
+}
+
+int avl_load_state(avl *e, const void *buf, size_t len) {
+    return buf && state_blob_load(&e->av, (const uint8_t *)buf, len) ? 0 : -1;
+}
+
+#ifdef AVL_THREADS
+/* Claim and step instances until the call has none left */
+static void avl_pool_drain(avl_pool *p) {
+    for (;;) {
+        int i = (int)__atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+        if (i >= p->n) break;
+        avl_step(p->envs[i], p->masks ? p->masks[i] : 0, p->frames);
+    }
+}
+
+static void *avl_pool_worker(void *arg) {
+    avl_pool *p = (avl_pool *)arg;
+    unsigned seen = 0;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->gen == seen && !p->quit) pthread_cond_wait(&p->go, &p->lock);
+        if (p->quit) break;
+        seen = p->gen;
+        pthread_mutex_unlock(&p->lock);
+        avl_pool_drain(p);
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0) pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+#endif
+
+avl_pool *avl_pool_create(int threads) {
+    avl_pool *p = (avl_pool *)calloc(1, sizeof(avl_pool));
+    if (!p) return NULL;
+#ifdef AVL_THREADS
+#ifdef _WIN32
+    if (threads <= 0) threads = pthread_num_processors_np();  /* MinGW: no sysconf */
+#else
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (threads > 256) threads = 256;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->go, NULL);
+    pthread_cond_init(&p->done, NULL);
+    if (threads > 1 && (p->tid = (pthread_t *)calloc((size_t)threads - 1, sizeof(pthread_t))))
+        for (; p->workers < threads - 1; p->workers++)
+            if (pthread_create(&p->tid[p->workers], NULL, avl_pool_worker, p) != 0) break;
+#else
+    (void)threads;
+#endif
+    return p;
+}
+
+void avl_pool_destroy(avl_pool *p) {
+    if (!p) return;
+#ifdef AVL_THREADS
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_broadcast(&p->go);
+    pthread_mutex_unlock(&p->lock);
+    for (int t = 0; t < p->workers; t++) pthread_join(p->tid[t], NULL);
+    free(p->tid);
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->go);
+    pthread_mutex_destroy(&p->lock);
+#endif
+    free(p);
+}
+
+void avl_step_many(avl_pool *p, avl *const *envs, const uint8_t *masks, int n, int frames) {
+    if (!p || !p->workers || n < 2) {
+        for (int i = 0; i < n; i++) avl_step(envs[i], masks ? masks[i] : 0, frames);
+        return;
+    }
+#ifdef AVL_THREADS
+    pthread_mutex_lock(&p->lock);
+    p->envs = envs; p->masks = masks; p->n = n; p->frames = frames;
+    p->next = 0;
+    p->busy = p->workers;
+    p->gen++;
+    pthread_cond_broadcast(&p->go);
+    pthread_mutex_unlock(&p->lock);
+    avl_pool_drain(p);
+    pthread_mutex_lock(&p->lock);
+    while (p->busy) pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+#endif
+}
+
+/* ============================================================================
+ *  FRONTEND TOOLS: ROM library, state print, resource packs, self-test,
+ *  benchmark (everything down to the frontends is left out of -DAV_LIB)
+ * ========================================================================== */
+#ifndef AV_LIB
+/* ---- ROM library index ----
+ * What the menu knows about a ROM directory. Files are keyed by path,
+ * size and mtime and carry an FNV-1a hash of their contents, so a rescan
+ * only reads files that are new or changed. The index persists as text
+ * in advision.idx, one "hash size mtime path" line per file. Titles (and
+ * through them GameInfo and covers) come from the hash via rom_db; the
+ * filename patterns are only a fallback for dumps it does not know. */
+#define PATH_MAX_LEN    512
+#define ROM_INDEX_FILE  "advision.idx"
+#define ROM_HASH_MAX    (64 * 1024)   /* larger files are not AV ROMs: not read */
+
+typedef struct {
+    char      path[PATH_MAX_LEN];
+    char      name[128];        /* file name part of path */
+    long      size;
+    long long mtime;
+    uint64_t  hash;             /* FNV-1a of the contents, 0 = not read */
+    bool      seen;             /* present in the last scan */
+} RomEntry;
+
+typedef struct {
+    RomEntry *v;
+    int       n, cap;
+    int      *slot;             /* open-addressing path table, -1 = empty */
+    int       nslot;            /* power of two, > 2 * n */
+    int       hashed;           /* files read by the last scan */
+    bool      dirty;            /* differs from advision.idx */
+} RomList;
+
+/* Known dumps; titles match game_db */
+static const struct { uint64_t hash; const char *title; bool bios; } rom_db[] = {
+    { 0xa9dcb1a9a4a8bf96ULL, "BIOS",         true  },
+    { 0x34f32c96ff8c4023ULL, "Defender",     false },
+    { 0x6d7d26c46cb25d08ULL, "Super Cobra",  false },
+    { 0x8d811c3ec5d2976eULL, "Space Force",  false },
+    { 0x939ada3991c49498ULL, "Turtles",      false },
+    { 0xcac2e3700285b068ULL, "Table Tennis", false },
+    { 0x01c849db807ac399ULL, "Code Red",     false },
+    { 0, NULL, false }
+};
+
+static int rom_db_find(uint64_t hash) {
+    for (int i = 0; hash && rom_db[i].title; i++)
+        if (rom_db[i].hash == hash) return i;
+    return -1;
+}
+
+static void rom_list_free(RomList *l) {
+    free(l->v); free(l->slot);
+    memset(l, 0, sizeof(*l));
+}
+
+static int *rom_list_slot(const RomList *l, const char *path) {
+    uint32_t h = (uint32_t)fnv1a(FNV_INIT, path, strlen(path));
+    for (int i = (int)(h & (uint32_t)(l->nslot - 1)); ; i = (i + 1) & (l->nslot - 1))
+        if (l->slot[i] < 0 || strcmp(l->v[l->slot[i]].path, path) == 0) return &l->slot[i];
+}
+
+static RomEntry *rom_list_find(const RomList *l, const char *path) {
+    if (!l->nslot) return NULL;
+    int k = *rom_list_slot(l, path);
+    return k >= 0 ? &l->v[k] : NULL;
+}
+
+/* Append an entry for path (not already listed); NULL if out of memory */
+static RomEntry *rom_list_add(RomList *l, const char *path) {
+    if (l->n == l->cap) {
+        int cap = l->cap ? l->cap * 2 : 64;
+        RomEntry *v = (RomEntry *)realloc(l->v, (size_t)cap * sizeof(RomEntry));
+        if (!v) return NULL;
+        l->v = v; l->cap = cap;
+    }
+    if (2 * (l->n + 1) >= l->nslot) {
+        int ns = l->nslot ? l->nslot * 2 : 256;
+        int *s = (int *)malloc((size_t)ns * sizeof(int));
+        if (!s) return NULL;
+        free(l->slot);
+        l->slot = s; l->nslot = ns;
+        memset(s, 0xFF, (size_t)ns * sizeof(int));
+        for (int i = 0; i < l->n; i++) *rom_list_slot(l, l->v[i].path) = i;
+    }
+    RomEntry *e = &l->v[l->n];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->path, PATH_MAX_LEN, "%s", path);
+    const char *base = strrchr(e->path, '/');
+    snprintf(e->name, sizeof(e->name), "%.127s", base ? base + 1 : e->path);
+    *rom_list_slot(l, e->path) = l->n++;
+    return e;
+}
+
+static void rom_index_load(RomList *l, const char *fn) {
+    FILE *f = fopen(fn, "r");
+    if (!f) return;
+    char line[PATH_MAX_LEN + 64];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long h; long sz; long long mt; int pos = 0;
+        if (line[0] == '#' || sscanf(line, "%llx %ld %lld %n", &h, &sz, &mt, &pos) != 3 || !pos) continue;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[pos] || rom_list_find(l, line + pos)) continue;
+        RomEntry *e = rom_list_add(l, line + pos);
+        if (!e) break;
+        e->hash = h; e->size = sz; e->mtime = mt;
+    }
+    fclose(f);
+}
+
+/* Write the entries seen by the last scan (vanished files drop out) */
+static bool rom_index_save(RomList *l, const char *fn) {
+    FILE *f = fopen(fn, "w");
+    if (!f) return false;
+    fprintf(f, "# Adventure Vision ROM library: hash size mtime path\n");
+    for (int i = 0; i < l->n; i++)
+        if (l->v[i].seen)
+            fprintf(f, "%016llx %ld %lld %s\n", (unsigned long long)l->v[i].hash,
+                    l->v[i].size, l->v[i].mtime, l->v[i].path);
+    bool ok = fclose(f) == 0;
+    if (ok) l->dirty = false;
     return ok;
 }
 
-static bool load_state(AV *av, const char *fn) {
-    FILE *f = fopen(fn, "rb");
-    if (!f) { fprintf(stderr, "Cannot load '%s'\n", fn); return false; }
+/* Record a file found by a scan: reuse the indexed hash when size and
+ * mtime are unchanged, otherwise read the file */
+static RomEntry *rom_index_update(RomList *l, const char *path, long size, long long mtime) {
+    RomEntry *e = rom_list_find(l, path);
+    if (e && e->size == size && e->mtime == mtime) { e->seen = true; return e; }
+    if (!e && !(e = rom_list_add(l, path))) return NULL;
+    e->size = size; e->mtime = mtime; e->hash = 0; e->seen = true;
+    l->dirty = true;
+    if (size > 0 && size <= ROM_HASH_MAX) {
+        static uint8_t buf[ROM_HASH_MAX];
+        FILE *f = fopen(path, "rb");
+        size_t n = f ? fread(buf, 1, sizeof(buf), f) : 0;
+        if (f) fclose(f);
+        if (n == (size_t)size) e->hash = fnv1a(FNV_INIT, buf, n);
+        l->hashed++;
+    }
+    return e;
+}
+
+static void dbg_print(const I8048 *c) {
+    printf("PC=%03X A=%02X C=%d F0=%d F1=%d BS=%d SP=%d MB=%d T=%02X P1=%02X P2=%02X\n",
+           c->PC, c->A, c->C, c->F0, c->F1, c->BS, c->SP, c->MB, c->timer, c->P1, c->P2);
+    printf("R0=%02X R1=%02X R2=%02X R3=%02X R4=%02X R5=%02X R6=%02X R7=%02X\n",
+           c->iram[c->BS?24:0], c->iram[(c->BS?24:0)+1],
+           c->iram[(c->BS?24:0)+2], c->iram[(c->BS?24:0)+3],
+           c->iram[(c->BS?24:0)+4], c->iram[(c->BS?24:0)+5],
+           c->iram[(c->BS?24:0)+6], c->iram[(c->BS?24:0)+7]);
+}
+
+/* ---- Resource pack (.avpk) ----
+ * The BIOS, games and cover photos in one binary file, instead of the
+ * xxd arrays of embedded_roms.h / cover_art.h. Built by --make-pack, then
+ * either assembled into the binary (-DEMBED_PACK='"file.avpk"', .incbin,
+ * GCC/Clang) or mapped at runtime (--pack FILE). Little-endian:
+ *   header  "AVPK", u32 version, u32 entry count
+ *   entry   u8 kind, u8 codec, u16 width, u16 height, u16 reserved,
+ *           u32 offset (from the start of the file), u32 stored size,
+ *           u32 decoded size, char name[PACK_NAME] (NUL-terminated)
+ *   data    at the offsets
+ * ROMs are stored raw and used in place. A cover is RGB rows with each
+ * byte replaced by its difference to the pixel on its left (PNG's Sub
+ * filter), then LZ-compressed; it is decoded to ARGB only when the menu
+ * makes its texture. Everything is validated once when the pack opens. */
+#define PACK_MAGIC      "AVPK"
+#define PACK_VER        1
+#define PACK_HDR        12
+#define PACK_NAME       48
+#define PACK_ENT        (20 + PACK_NAME)
+#define PACK_MAX_ENT    4096
+#define PACK_COVER_MAX  (2048 * 2048)   /* pixels */
+enum { PACK_BIOS, PACK_GAME, PACK_COVER };
+enum { PACK_RAW, PACK_LZ_SUB };
+
+typedef struct {
+    const uint8_t *base;        /* NULL = no pack */
+    size_t         len;
+    int            count;
+    void          *own;         /* pack_load's mapping or buffer */
+    bool           mapped;
+} AVPack;
+
+typedef struct {
+    int            kind, codec, w, h;
+    const uint8_t *data;
+    uint32_t       size, raw_size;
+    const char    *name;
+} PackEntry;
+
+#ifdef EMBED_PACK
+/* The pack file, assembled into read-only data */
+#if defined(_MSC_VER)
+#error "EMBED_PACK needs .incbin (GCC/Clang); with MSVC use --pack FILE"
+#endif
+#ifdef __APPLE__
+#define PACK_SYM(s)     "_" #s
+#define PACK_SECT       ".const\n"
+#define PACK_SECT_END   ".text\n"
+#else
+#define PACK_SYM(s)     #s
+#define PACK_SECT       ".pushsection .rodata\n"
+#define PACK_SECT_END   ".popsection\n"
+#endif
+__asm__(PACK_SECT ".balign 16\n"
+        ".globl " PACK_SYM(av_pack_blob) "\n" PACK_SYM(av_pack_blob) ":\n"
+        ".incbin \"" EMBED_PACK "\"\n"
+        ".globl " PACK_SYM(av_pack_blob_end) "\n" PACK_SYM(av_pack_blob_end) ":\n"
+        ".byte 0\n" PACK_SECT_END);
+extern const uint8_t av_pack_blob[], av_pack_blob_end[];
+#endif
+
+/* LZ block: sequences of a token (literal count << 4 | match length - 4,
+ * 15 = more in 255-continued bytes), the literals, and a u16 distance
+ * back into the output; the last sequence is literals only (LZ4's block
+ * layout). Greedy compression over a hash of 4-byte prefixes. */
+#define PACK_LZ_HASH    13
+#define PACK_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static void pack_lz_len(uint8_t **o, size_t v) {
+    for (; v >= 255; v -= 255) *(*o)++ = 255;
+    *(*o)++ = (uint8_t)v;
+}
+
+static void pack_lz_seq(uint8_t **o, const uint8_t *lit, size_t ll, size_t ml, size_t dist) {
+    uint8_t *tok = (*o)++;
+    *tok = (uint8_t)((ll < 15 ? ll : 15) << 4);
+    if (ll >= 15) pack_lz_len(o, ll - 15);
+    memcpy(*o, lit, ll);
+    *o += ll;
+    if (!ml) return;
+    *(*o)++ = (uint8_t)dist;
+    *(*o)++ = (uint8_t)(dist >> 8);
+    *tok |= (uint8_t)(ml - 4 < 15 ? ml - 4 : 15);
+    if (ml - 4 >= 15) pack_lz_len(o, ml - 4 - 15);
+}
+
+/* dst holds PACK_LZ_BOUND(n) bytes; returns the compressed size */
+static size_t pack_lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t tab[1 << PACK_LZ_HASH] = { 0 };   /* position + 1, 0 = none */
+    uint8_t *o = dst;
+    size_t i = 0, lit = 0;
+    while (i + 4 <= n) {
+        uint32_t v = rd_le32(src + i), h = (v * 2654435761u) >> (32 - PACK_LZ_HASH);
+        size_t m = tab[h];
+        tab[h] = (uint32_t)i + 1;
+        if (m-- && i - m <= 0xFFFF && rd_le32(src + m) == v) {
+            size_t len = 4;
+            while (i + len < n && src[m + len] == src[i + len]) len++;
+            pack_lz_seq(&o, src + lit, i - lit, len, i - m);
+            i += len;
+            lit = i;
+        } else i++;
+    }
+    pack_lz_seq(&o, src + lit, n - lit, 0, 0);
+    return (size_t)(o - dst);
+}
+
+/* Exactly `out` bytes or false; never reads or writes out of bounds */
+static bool pack_lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t out) {
+    const uint8_t *s = src, *end = src + n;
+    size_t o = 0;
+    while (s < end) {
+        uint8_t t = *s++, b;
+        size_t ll = t >> 4, ml = t & 15;
+        if (ll == 15) do { if (s == end) return false; ll += b = *s++; } while (b == 255);
+        if ((size_t)(end - s) < ll || out - o < ll) return false;
+        memcpy(dst + o, s, ll);
+        s += ll; o += ll;
+        if (s == end) break;
+        if (end - s < 2) return false;
+        size_t dist = s[0] | s[1] << 8;
+        s += 2;
+        if (ml == 15) do { if (s == end) return false; ml += b = *s++; } while (b == 255);
+        ml += 4;
+        if (!dist || dist > o || out - o < ml) return false;
+        for (size_t k = 0; k < ml; k++, o++) dst[o] = dst[o - dist];
+    }
+    return o == out;
+}
+
+/* Cover payload from RGB pixels (malloc'd, *len bytes) */
+static uint8_t *pack_cover_encode(const uint8_t *rgb, int w, int h, size_t *len) {
+    size_t n = (size_t)w * h * 3, row = (size_t)w * 3;
+    uint8_t *d = (uint8_t *)malloc(n ? n : 1), *z = (uint8_t *)malloc(PACK_LZ_BOUND(n));
+    if (d && z) {
+        for (size_t i = 0; i < n; i++)
+            d[i] = (uint8_t)(i % row >= 3 ? rgb[i] - rgb[i - 3] : rgb[i]);
+        *len = pack_lz_compress(d, n, z);
+    } else { free(z); z = NULL; }
+    free(d);
+    return z;
+}
+
+/* Validate the header and every entry */
+static bool pack_open_mem(AVPack *p, const uint8_t *b, size_t len) {
+    memset(p, 0, sizeof(*p));
+    if (len < PACK_HDR || memcmp(b, PACK_MAGIC, 4) != 0 || rd_le32(b + 4) != PACK_VER) return false;
+    uint32_t n = rd_le32(b + 8);
+    if (n > PACK_MAX_ENT || (len - PACK_HDR) / PACK_ENT < n) return false;
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t *e = b + PACK_HDR + (size_t)i * PACK_ENT;
+        uint32_t w = e[2] | e[3] << 8, h = e[4] | e[5] << 8;
+        uint32_t off = rd_le32(e + 8), sz = rd_le32(e + 12), raw = rd_le32(e + 16);
+        if (off > len || sz > len - off || !memchr(e + 20, 0, PACK_NAME)) return false;
+        switch (e[0]) {
+        case PACK_BIOS: case PACK_GAME:
+            if (e[1] != PACK_RAW || !sz || sz > (e[0] == PACK_BIOS ? IROM_SZ : EROM_SZ) || raw != sz)
+                return false;
+            break;
+        case PACK_COVER:
+            if (e[1] != PACK_LZ_SUB || !w || !h || w * h > PACK_COVER_MAX || raw != w * h * 3)
+                return false;
+            break;
+        default: return false;
+        }
+    }
+    p->base = b; p->len = len; p->count = (int)n;
+    return true;
+}
+
+static PackEntry pack_entry(const AVPack *p, int i) {
+    const uint8_t *e = p->base + PACK_HDR + (size_t)i * PACK_ENT;
+    PackEntry r = { e[0], e[1], e[2] | e[3] << 8, e[4] | e[5] << 8,
+                    p->base + rd_le32(e + 8), rd_le32(e + 12), rd_le32(e + 16),
+                    (const char *)e + 20 };
+    return r;
+}
 
-    uint32_t magic, ver;
-    if (fread(&magic, 4, 1, f) != 1 || magic != SAVE_MAGIC) {
-        fprintf(stderr, "Invalid save file (bad magic)\n"); fclose(f); return false;
-    }
-    if (fread(&ver, 4, 1, f) != 1 || ver != SAVE_VER) {
-        fprintf(stderr, "Save version mismatch (got %u, need %u)\n", ver, SAVE_VER);
-        fclose(f); return false;
+/* First entry of `kind`, or with a name: the first whose name is part of
+ * it ("Super Cobra" covers "Super Cobra (USA, Europe)"); -1 = none */
+static int pack_find(const AVPack *p, int kind, const char *name) {
+    for (int i = 0; i < p->count; i++) {
+        PackEntry e = pack_entry(p, i);
+        if (e.kind == kind && (!name || (e.name[0] && strcasestr(name, e.name)))) return i;
     }
+    return -1;
+}
 
-    /* Backup entire CPU + sound state before reading (restore on error) */
-    I8048 cpu_bak = av->cpu;
-    COP411L snd_bak = av->snd;
+/* Decode cover entry i to ARGB (malloc'd, w × h), NULL on a bad payload */
+static uint32_t *pack_cover_argb(const AVPack *p, int i) {
+    PackEntry e = pack_entry(p, i);
+    size_t n = e.raw_size, row = (size_t)e.w * 3;
+    uint8_t *rgb = (uint8_t *)malloc(n);
+    uint32_t *argb = (uint32_t *)malloc(n / 3 * sizeof(uint32_t));
+    if (rgb && argb && pack_lz_decompress(e.data, e.size, rgb, n)) {
+        for (size_t k = 0; k < n; k++)
+            if (k % row >= 3) rgb[k] = (uint8_t)(rgb[k] + rgb[k - 3]);
+        for (size_t k = 0; k < n / 3; k++)
+            argb[k] = 0xFF000000u | (uint32_t)rgb[3 * k] << 16 | rgb[3 * k + 1] << 8 | rgb[3 * k + 2];
+    } else { free(argb); argb = NULL; }
+    free(rgb);
+    return argb;
+}
 
-    bool ok = true;
-    ok = ok && fread(&av->cpu.A, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.PC, 2, 1, f) == 1;
-    ok = ok && fread(&av->cpu.PSW, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.SP, 1, 1, f) == 1;
-    uint8_t flags, flags2;
-    ok = ok && fread(&flags, 1, 1, f) == 1;
-    ok = ok && fread(&flags2, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.timer, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.P1, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.P2, 1, 1, f) == 1;
-    ok = ok && fread(&av->cpu.BUS, 1, 1, f) == 1;
-    ok = ok && fread(av->cpu.iram, IRAM_SZ, 1, f) == 1;
-    ok = ok && fread(av->cpu.xram, XRAM_SZ, 1, f) == 1;
-    { uint32_t tpre32;
-      ok = ok && fread(&tpre32, sizeof(uint32_t), 1, f) == 1;
-      av->cpu.tpre = (int)tpre32; }
-    ok = ok && fread(&av->cpu.cycles, sizeof(uint64_t), 1, f) == 1;
-    /* COP411L state */
-    ok = ok && fread(&av->snd.ctrl_loop, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.ctrl_vol, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.ctrl_fast, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.proto_state, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.proto_hi, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.lfsr, sizeof(uint16_t), 1, f) == 1;
-    /* v15: full COP411L playback state (fixed-width for cross-platform portability) */
-    { uint8_t b;
-      ok = ok && fread(&b, 1, 1, f) == 1; av->snd.active = (b != 0);
-      ok = ok && fread(&b, 1, 1, f) == 1; av->snd.is_noise = (b != 0); }
-    ok = ok && fread(&av->snd.command, 1, 1, f) == 1;
-    ok = ok && fread(&av->snd.cur_freq, sizeof(float), 1, f) == 1;
-    ok = ok && fread(&av->snd.cur_vol, sizeof(float), 1, f) == 1;
-    ok = ok && fread(&av->snd.phase_acc, sizeof(uint32_t), 1, f) == 1;
-    ok = ok && fread(&av->snd.phase_inc, sizeof(uint32_t), 1, f) == 1;
-    { int32_t i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.cur_step = (int)i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.step_count = (int)i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.step_samples_left = (int)i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.segment = (int)i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.seg_samples_left = (int)i32;
-      ok = ok && fread(&i32, 4, 1, f) == 1; av->snd.seg_samples_total = (int)i32; }
-    ok = ok && fread(&av->snd.seg1_vol, sizeof(float), 1, f) == 1;
-    ok = ok && fread(&av->snd.seg2_vol, sizeof(float), 1, f) == 1;
-    /* Read steps field-by-field (matches field-by-field write) */
-    for (int si = 0; si < MAX_SND_STEPS; si++) {
-        ok = ok && fread(&av->snd.steps[si].freq, sizeof(float), 1, f) == 1;
-        { uint8_t bn; ok = ok && fread(&bn, 1, 1, f) == 1;
-          av->snd.steps[si].noise = (bn != 0); }
-        { int32_t di; ok = ok && fread(&di, 4, 1, f) == 1;
-          av->snd.steps[si].dur_ms = (int)di; }
-        ok = ok && fread(&av->snd.steps[si].volume, sizeof(float), 1, f) == 1;
+static void pack_close(AVPack *p) {
+#ifdef AV_STATE_MMAP
+    if (p->mapped) munmap(p->own, p->len);
+    else
+#endif
+    free(p->own);
+    memset(p, 0, sizeof(*p));
+}
+
+/* Map a pack file (read into memory where mmap is missing); replaces *p
+ * only if the file is a valid pack */
+static bool pack_load(AVPack *p, const char *fn) {
+    AVPack np;
+    void *buf = NULL;
+    size_t len = 0;
+    bool mapped = false;
+#ifdef AV_STATE_MMAP
+    int fd = open(fn, O_RDONLY);
+    struct stat sb;
+    if (fd >= 0 && fstat(fd, &sb) == 0 && sb.st_size > 0) {
+        len = (size_t)sb.st_size;
+        buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf == MAP_FAILED) buf = NULL;
+        mapped = buf != NULL;
     }
-    fclose(f);
+    if (fd >= 0) close(fd);
+#endif
+    if (!buf) {
+        FILE *f = fopen(fn, "rb");
+        long sz = -1;
+        if (f && fseek(f, 0, SEEK_END) == 0) sz = ftell(f);
+        if (sz > 0 && (buf = malloc((size_t)sz)) && (fseek(f, 0, SEEK_SET) != 0 ||
+                                                     fread(buf, 1, (size_t)sz, f) != (size_t)sz)) {
+            free(buf);
+            buf = NULL;
+        }
+        if (f) fclose(f);
+        len = sz > 0 ? (size_t)sz : 0;
+    }
+    if (!buf || !pack_open_mem(&np, (const uint8_t *)buf, len)) {
+        fprintf(stderr, "%s: %s\n", fn, buf ? "not a resource pack" : "cannot read");
+#ifdef AV_STATE_MMAP
+        if (mapped) munmap(buf, len);
+        else
+#endif
+        free(buf);
+        return false;
+    }
+    pack_close(p);
+    *p = np;
+    p->own = buf;
+    p->mapped = mapped;
+    return true;
+}
 
-    if (!ok) {
-        fprintf(stderr, "Corrupt save file\n");
-        av->cpu = cpu_bak;
-        av->snd = snd_bak;  /* caller holds audio lock */
+/* The BIOS and a game into irom/erom (0xFF-padded): the first game whose
+ * name contains `game`, or the first game; false if either is missing */
+static bool pack_load_roms(const AVPack *p, const char *game, uint8_t *irom, uint8_t *erom) {
+    int b = pack_find(p, PACK_BIOS, NULL), g = -1;
+    for (int i = 0; i < p->count && g < 0; i++) {
+        PackEntry e = pack_entry(p, i);
+        if (e.kind == PACK_GAME && (!game || strcasestr(e.name, game))) g = i;
+    }
+    if (b < 0 || g < 0) {
+        fprintf(stderr, "Pack: no %s\n", b < 0 ? "BIOS" : game ? game : "game");
         return false;
     }
+    PackEntry eb = pack_entry(p, b), eg = pack_entry(p, g);
+    memset(irom, 0xFF, IROM_SZ);
+    memcpy(irom, eb.data, eb.size);
+    memset(erom, 0xFF, EROM_SZ);
+    memcpy(erom, eg.data, eg.size);
+    printf("[PACK] BIOS %s, game %s (%u bytes)\n", eb.name, eg.name, eg.size);
+    return true;
+}
 
-    av->cpu.MB = flags&1; av->cpu.C = (flags>>1)&1; av->cpu.AC = (flags>>2)&1;
-    av->cpu.F0 = (flags>>3)&1; av->cpu.F1 = (flags>>4)&1; av->cpu.BS = (flags>>5)&1;
-    av->cpu.timer_en = (flags>>6)&1; av->cpu.counter_en = (flags>>7)&1;
-    av->cpu.timer_ovf = flags2&1; av->cpu.tcnti_en = (flags2>>1)&1;
-    av->cpu.irq_en = (flags2>>2)&1; av->cpu.irq_pend = (flags2>>3)&1;
-    av->cpu.in_irq = (flags2>>4)&1;
+/* ---- Pack builder (--make-pack) ---- */
+typedef struct {
+    int       kind, codec, w, h;
+    char      name[PACK_NAME];
+    uint8_t  *data;
+    uint32_t  size, raw_size;
+} PackItem;
+
+typedef struct { PackItem *v; int n, cap; } PackBuild;
+
+/* Takes ownership of data (malloc'd) */
+static bool pack_add(PackBuild *b, int kind, int codec, int w, int h, const char *name,
+                     uint8_t *data, size_t size, size_t raw_size) {
+    if (b->n == b->cap) {
+        int cap = b->cap ? b->cap * 2 : 16;
+        PackItem *v = (PackItem *)realloc(b->v, (size_t)cap * sizeof(PackItem));
+        if (!v) { free(data); return false; }
+        b->v = v; b->cap = cap;
+    }
+    PackItem *it = &b->v[b->n++];
+    it->kind = kind; it->codec = codec; it->w = w; it->h = h;
+    snprintf(it->name, PACK_NAME, "%s", name);
+    it->data = data;
+    it->size = (uint32_t)size; it->raw_size = (uint32_t)raw_size;
+    return true;
+}
 
-    av->cpu.PC &= 0xFFF;
-    av->cpu.SP &= 7;
-    av->cpu.t0 = true;  /* T0 = expansion port, always 1 */
+/* The whole pack (malloc'd, *len bytes), entries in order added */
+static uint8_t *pack_write(const PackBuild *b, size_t *len) {
+    size_t n = PACK_HDR + (size_t)b->n * PACK_ENT;
+    for (int i = 0; i < b->n; i++) n += b->v[i].size;
+    uint8_t *o = (uint8_t *)calloc(1, n);
+    if (!o) return NULL;
+    memcpy(o, PACK_MAGIC, 4);
+    wav_le32(o + 4, PACK_VER);
+    wav_le32(o + 8, (uint32_t)b->n);
+    size_t off = PACK_HDR + (size_t)b->n * PACK_ENT;
+    for (int i = 0; i < b->n; i++) {
+        const PackItem *it = &b->v[i];
+        uint8_t *e = o + PACK_HDR + (size_t)i * PACK_ENT;
+        e[0] = (uint8_t)it->kind; e[1] = (uint8_t)it->codec;
+        wav_le16(e + 2, (uint16_t)it->w); wav_le16(e + 4, (uint16_t)it->h);
+        wav_le32(e + 8, (uint32_t)off); wav_le32(e + 12, it->size); wav_le32(e + 16, it->raw_size);
+        memcpy(e + 20, it->name, PACK_NAME);
+        memcpy(o + off, it->data, it->size);
+        off += it->size;
+    }
+    *len = n;
+    return o;
+}
 
-    /* Preserve ROMs (not saved) */
-    memcpy(av->cpu.irom, cpu_bak.irom, IROM_SZ);
-    memcpy(av->cpu.erom, cpu_bak.erom, EROM_SZ);
+static void pack_build_free(PackBuild *b) {
+    for (int i = 0; i < b->n; i++) free(b->v[i].data);
+    free(b->v);
+    memset(b, 0, sizeof(*b));
+}
 
-    /* Sanitize LFSR: zero is a stuck state */
-    if (av->snd.lfsr == 0) av->snd.lfsr = 0x7FFF;
-    /* Sanitize loaded sound fields to valid ranges */
-    av->snd.ctrl_loop &= 1;
-    av->snd.ctrl_vol &= 3;
-    av->snd.ctrl_fast &= 1;
-    if (av->snd.proto_state > 3) av->snd.proto_state = 0;
-    av->snd.proto_hi &= 0x0F;
-    /* Sanitize COP411L playback fields — prevent OOB from crafted saves */
-    if (av->snd.step_count < 0 || av->snd.step_count > MAX_SND_STEPS)
-        av->snd.step_count = 0;
-    if (av->snd.cur_step < 0 || av->snd.cur_step >= av->snd.step_count)
-        av->snd.cur_step = 0;
-    if (av->snd.segment < 0 || av->snd.segment > 1)
-        av->snd.segment = 0;
-    if (av->snd.step_samples_left < 0) av->snd.step_samples_left = 0;
-    if (av->snd.seg_samples_left < 0) av->snd.seg_samples_left = 0;
-    if (av->snd.seg_samples_total < 0) av->snd.seg_samples_total = 0;
-    /* Reject NaN/Inf floats (isfinite returns 0 for NaN and Inf) */
-    if (!isfinite(av->snd.cur_freq) || av->snd.cur_freq < 0.0f)
-        av->snd.cur_freq = 0.0f;
-    if (!isfinite(av->snd.cur_vol) || av->snd.cur_vol < 0.0f)
-        av->snd.cur_vol = 0.0f;
-    if (av->snd.cur_vol > 2.0f) av->snd.cur_vol = 1.0f;
-    if (!isfinite(av->snd.seg1_vol)) av->snd.seg1_vol = 1.0f;
-    if (!isfinite(av->snd.seg2_vol)) av->snd.seg2_vol = 0.5f;
-    /* Sanitize step frequencies/volumes in loaded steps array */
-    for (int si = 0; si < av->snd.step_count; si++) {
-        SndStep *st = &av->snd.steps[si];
-        if (!isfinite(st->freq) || st->freq < 0.0f) st->freq = 0.0f;
-        if (!isfinite(st->volume)) st->volume = 0.0f;
-        if (st->volume < 0.0f) st->volume = 0.0f;
-        if (st->volume > 2.0f) st->volume = 1.0f;
-        if (st->dur_ms < 0) st->dur_ms = 1;
+/* Binary PPM (P6, maxval 255: `convert cover.jpg -resize 252x360 x.ppm`),
+ * RGB malloc'd */
+static uint8_t *ppm_read(const char *fn, int *w, int *h) {
+    FILE *f = fopen(fn, "rb");
+    if (!f) return NULL;
+    long v[3];
+    int n = 0, c = 0;
+    uint8_t *rgb = NULL;
+    if (fgetc(f) != 'P' || fgetc(f) != '6') goto done;
+    while (n < 3) {
+        c = fgetc(f);
+        if (c == '#') { while ((c = fgetc(f)) != EOF && c != '\n') {} continue; }
+        if (isspace(c)) continue;
+        if (!isdigit(c)) goto done;
+        for (v[n] = 0; isdigit(c) && v[n] <= 65535; c = fgetc(f)) v[n] = v[n] * 10 + (c - '0');
+        n++;
+        if (!isspace(c)) goto done;
     }
-
-    cop411_update_ctrl_vol(&av->snd);
-    /* v15: full COP411L state is now restored from savestate.
-     * Caller holds audio lock (no deadlock). */
-    printf("State loaded.\n");
-    return true;
+    if (v[0] < 1 || v[1] < 1 || v[0] > 65535 || v[1] > 65535 || v[0] * v[1] > PACK_COVER_MAX || v[2] != 255)
+        goto done;
+    size_t sz = (size_t)v[0] * (size_t)v[1] * 3;
+    if ((rgb = (uint8_t *)malloc(sz)) && fread(rgb, 1, sz, f) != sz) { free(rgb); rgb = NULL; }
+    *w = (int)v[0]; *h = (int)v[1];
+done:
+    fclose(f);
+    return rgb;
 }
 
-static void dbg_print(const I8048 *c) {
-    printf("PC=%03X A=%02X C=%d F0=%d F1=%d BS=%d SP=%d MB=%d T=%02X P1=%02X P2=%02X\n",
-           c->PC, c->A, c->C, c->F0, c->F1, c->BS, c->SP, c->MB, c->timer, c->P1, c->P2);
-    printf("R0=%02X R1=%02X R2=%02X R3=%02X R4=%02X R5=%02X R6=%02X R7=%02X\n",
-           c->iram[c->BS?24:0], c->iram[(c->BS?24:0)+1],
-           c->iram[(c->BS?24:0)+2], c->iram[(c->BS?24:0)+3],
-           c->iram[(c->BS?24:0)+4], c->iram[(c->BS?24:0)+5],
-           c->iram[(c->BS?24:0)+6], c->iram[(c->BS?24:0)+7]);
+/* --make-pack OUT bios.rom game.bin... [cover.ppm...]: the first ROM is
+ * the BIOS, every .ppm a cover; names are the file names without their
+ * extension (a cover's name must be part of its game's title) */
+static int run_make_pack(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: --make-pack OUT.avpk bios.rom game.bin... [cover.ppm...]\n");
+        return 1;
+    }
+    PackBuild b = { 0 };
+    size_t cover_raw = 0, cover_packed = 0;
+    int games = 0, covers = 0;
+    bool ok = true, have_bios = false;
+    for (int i = 1; i < argc && ok; i++) {
+        const char *slash = strrchr(argv[i], '/'), *base = slash ? slash + 1 : argv[i];
+        const char *dot = strrchr(base, '.');
+        char name[PACK_NAME];
+        snprintf(name, sizeof(name), "%.*s", (int)(dot ? dot - base : (ptrdiff_t)strlen(base)), base);
+        if (dot && strcasecmp(dot, ".ppm") == 0) {
+            int w = 0, h = 0;
+            size_t len = 0;
+            uint8_t *rgb = ppm_read(argv[i], &w, &h), *z = rgb ? pack_cover_encode(rgb, w, h, &len) : NULL;
+            free(rgb);
+            if (!z) { fprintf(stderr, "%s: not a binary PPM (P6, 255)\n", argv[i]); ok = false; break; }
+            ok = pack_add(&b, PACK_COVER, PACK_LZ_SUB, w, h, name, z, len, (size_t)w * h * 3);
+            cover_raw += (size_t)w * h * 4;
+            cover_packed += len;
+            covers++;
+        } else {
+            bool bios = !have_bios;
+            int max = bios ? IROM_SZ : EROM_SZ;
+            uint8_t *d = (uint8_t *)malloc((size_t)max + 1);
+            FILE *f = fopen(argv[i], "rb");
+            size_t n = f && d ? fread(d, 1, (size_t)max + 1, f) : 0;
+            if (f) fclose(f);
+            if (!n || n > (size_t)max) {
+                fprintf(stderr, "%s: %s\n", argv[i], !f ? "cannot open" : n ? "too large" : "empty");
+                free(d);
+                ok = false;
+                break;
+            }
+            ok = pack_add(&b, bios ? PACK_BIOS : PACK_GAME, PACK_RAW, 0, 0, name, d, n, n);
+            have_bios = true;
+            games += !bios;
+        }
+    }
+    size_t len = 0;
+    uint8_t *out = ok ? pack_write(&b, &len) : NULL;
+    FILE *f = out ? fopen(argv[0], "wb") : NULL;
+    ok = f && fwrite(out, 1, len, f) == len;
+    if (f && fclose(f) != 0) ok = false;
+    if (ok)
+        printf("[PACK] %s: BIOS + %d game(s) + %d cover(s), %zu bytes (covers %zu -> %zu)\n",
+               argv[0], games, covers, len, cover_raw, cover_packed);
+    else if (out) fprintf(stderr, "Cannot write '%s'\n", argv[0]);
+    free(out);
+    pack_build_free(&b);
+    return ok ? 0 : 1;
 }
 
 /* ---- Built-in self-test (available in all builds) ---- */
@@ -1984,59 +5730,1300 @@ static int run_self_test(void) {
         else { fail++; printf("FAIL: timer IRQ latch pend=%d (expected 1 when irq_en=0)\n", c.irq_pend); }
     }
 
-    /* Test 15a: Timer overflow does NOT latch irq_pend during ISR (Figure 11 Note 1) */
+    /* Test 15a: Timer overflow does NOT latch irq_pend during ISR (Figure 11 Note 1) */
+    {
+        I8048 c; memset(&c, 0, sizeof(c));
+        c.timer = 0xFF; c.timer_en = true; c.tcnti_en = true;
+        c.irq_en = true; c.in_irq = true; /* IN ISR */
+        for (int i = 0; i < 100; i++) c.irom[i] = 0x00;
+        c.P1 = 0xFB; c.P2 = 0xFF; c.t0 = true;
+        for (int i = 0; i < 32; i++) i8048_exec(&c, NULL);
+        if (!c.irq_pend && c.timer_ovf) pass++;
+        else { fail++; printf("FAIL: ISR overflow pend=%d ovf=%d (expected 0,1)\n", c.irq_pend, c.timer_ovf); }
+    }
+
+    /* Test 15: JMP does not set bit 11 during ISR */
+    {
+        I8048 c; memset(&c, 0, sizeof(c));
+        c.MB = true; c.in_irq = true;
+        c.irom[0] = 0x04; c.irom[1] = 0x50; /* JMP $050 */
+        c.P1 = 0xFB; c.P2 = 0xFF; c.t0 = true;
+        i8048_exec(&c, NULL);
+        if (c.PC == 0x050 && !(c.PC & 0x800)) pass++;
+        else { fail++; printf("FAIL: JMP in ISR PC=%03X (expected $050)\n", c.PC); }
+    }
+
+    /* Test 16: LED register decode matches BIOS P2 values */
+    {
+        int ok = 1;
+        /* BIOS uses P2=0x20,0x40,0x60,0x80,0xA0 for regs 0-4 */
+        if (led_reg_decode(0x20) != 0) ok = 0;
+        if (led_reg_decode(0x40) != 1) ok = 0;
+        if (led_reg_decode(0x60) != 2) ok = 0;
+        if (led_reg_decode(0x80) != 3) ok = 0;
+        if (led_reg_decode(0xA0) != 4) ok = 0;
+        if (led_reg_decode(0x00) != -1) ok = 0; /* unused */
+        if (led_reg_decode(0xC0) != -1) ok = 0; /* sound control */
+        if (ok) pass++; else { fail++; printf("FAIL: LED decode table\n"); }
+    }
+
+    /* Test 17: block engine matches the interpreter cycle for cycle.
+     * Program: timer IRQ (ISR counts in R7), MOVX loop, JNT1 poll, and a
+     * P1.2 IROM→EROM→IROM round trip mid-run (ORL/ANL P1). */
+    {
+        static const uint8_t prog[] = {
+            0x04,0x10,                 /* 000: JMP $010 */
+            0,0,0,0,0,
+            0x1F,0x93,                 /* 007: INC R7 ; RETR */
+            0,0,0,0,0,0,0,
+            0x23,0xF0,0x62,0x55,0x25,0x05, /* 010: MOV A,#F0 MOV T,A STRT T EN TCNTI EN I */
+            0xB8,0x20,                 /* 016: MOV R0,#20 */
+            0xF8,0x90,0xE8,0x18,       /* 018: MOV A,R0 MOVX @R0,A DJNZ R0,$018 */
+            0x46,0x20,                 /* 01C: JNT1 $020 */
+            0x04,0x16,                 /* 01E: JMP $016 */
+            0x09,0x89,0x04,            /* 020: IN A,P1 ORL P1,#04 -> EROM */
+        };
+        AV a[2];
+        for (int e = 0; e < 2; e++) {
+            av_init(&a[e]);
+            memcpy(a[e].cpu.irom, prog, sizeof(prog));
+            a[e].cpu.erom[0x23] = 0x1E;                               /* INC R6 */
+            a[e].cpu.erom[0x24] = 0x99; a[e].cpu.erom[0x25] = 0xFB;   /* ANL P1,#FB */
+            a[e].cpu.irom[0x26] = 0x04; a[e].cpu.irom[0x27] = 0x16;   /* JMP $016 */
+            a[e].cpu_engine = e ? CPU_ENGINE_BLOCK : CPU_ENGINE_INTERP;
+            for (int f = 0; f < 4; f++) av_run_frame(&a[e]);
+        }
+        const I8048 *c0 = &a[0].cpu, *c1 = &a[1].cpu;
+        if (c0->cycles == c1->cycles && c0->PC == c1->PC && c0->A == c1->A &&
+            c0->timer == c1->timer && c0->tpre == c1->tpre && c0->P1 == c1->P1 &&
+            c0->iram[7] > 0 && c0->iram[6] > 0 && memcmp(c0->iram, c1->iram, IRAM_SZ) == 0 &&
+            memcmp(c0->xram, c1->xram, XRAM_SZ) == 0 &&
+            memcmp(a[0].disp.phosphor, a[1].disp.phosphor, sizeof(a[0].disp.phosphor)) == 0)
+            pass++;
+        else { fail++; printf("FAIL: block engine diverged (cy %llu/%llu PC %03X/%03X)\n",
+                   (unsigned long long)c0->cycles, (unsigned long long)c1->cycles, c0->PC, c1->PC); }
+        for (int e = 0; e < 2; e++) {
+            free(a[e].rewind_buf);
+            free(a[e].icache);
+        }
+    }
+
+    /* Test 18: event scheduler matches the polling loop cycle for cycle,
+     * with both CPU engines, with and without mid-frame capture, and the
+     * debugger's loop (no breakpoints) matches too. Program: T1 counter
+     * IRQ (ISR counts in R7 and reloads), XRAM writes during the capture
+     * window, JT1 poll. T1 starts stale (low) so the first frame syncs on
+     * the first instruction. */
+    {
+        static const uint8_t prog[] = {
+            0x04,0x10,                 /* 000: JMP $010 */
+            0,0,0,0,0,
+            0x1F,0x23,0xFE,0x62,0x93,  /* 007: INC R7 MOV A,#FE MOV T,A RETR */
+            0,0,0,0,
+            0x23,0xFE,0x62,0x45,0x25,0x05, /* 010: MOV A,#FE MOV T,A STRT CNT EN TCNTI EN I */
+            0xB8,0x40,                 /* 016: MOV R0,#40 */
+            0xFE,0xD8,0x90,0xE8,0x18,  /* 018: MOV A,R6 XRL A,R0 MOVX @R0,A DJNZ R0,$018 */
+            0x1E,0x56,0x16,0x04,0x16,  /* 01D: INC R6 JT1 $016 JMP $016 */
+        };
+        static AV a[9];           /* bit 0 event, bit 1 block, bit 2 no mid; 8 debugger */
+        for (int m = 0; m < 9; m++) {
+            av_init(&a[m]);
+            memcpy(a[m].cpu.irom, prog, sizeof(prog));
+            a[m].cpu.t1 = false;
+            a[m].frame_sched = (m & 1) ? FRAME_SCHED_EVENT : FRAME_SCHED_POLL;
+            a[m].cpu_engine  = (m & 2) ? CPU_ENGINE_BLOCK : CPU_ENGINE_INTERP;
+            a[m].midframe_scan = m == 8 || !(m & 4);
+            a[m].dbg.active = m == 8;
+            for (int f = 0; f < 5; f++) av_run_frame(&a[m]);
+        }
+        int ok = a[0].cpu.iram[7] > 0 &&
+                 memcmp(a[0].disp.phosphor, a[4].disp.phosphor, sizeof(a[0].disp.phosphor)) != 0;
+        for (int m = 1; m < 9; m++) {
+            const AV *r = &a[m & 4];
+            const I8048 *c0 = &r->cpu, *c1 = &a[m].cpu;
+            if (m == 4) continue;
+            if (c0->cycles != c1->cycles || c0->PC != c1->PC || c0->A != c1->A ||
+                c0->timer != c1->timer || c0->t1 != c1->t1 ||
+                r->disp_sync_cycle != a[m].disp_sync_cycle ||
+                memcmp(c0->iram, c1->iram, IRAM_SZ) != 0 ||
+                memcmp(r->disp.phosphor, a[m].disp.phosphor, sizeof(r->disp.phosphor)) != 0) {
+                ok = 0;
+                printf("FAIL: frame loop mode %d diverged (cy %llu/%llu PC %03X/%03X)\n", m,
+                       (unsigned long long)c0->cycles, (unsigned long long)c1->cycles, c0->PC, c1->PC);
+            }
+        }
+        if (ok) pass++; else { fail++; if (!a[0].cpu.iram[7]) printf("FAIL: counter IRQ never fired\n"); }
+        for (int m = 0; m < 9; m++) {
+            free(a[m].rewind_buf);
+            free(a[m].icache);
+        }
+    }
+
+    /* Test 19: lockstep wide interpreter matches av_run_frame per lane.
+     * Program: timer IRQ (ISR counts in R7), input-dependent JZ (lanes split
+     * and rejoin), CALL/RET, MOVX loop, MOV PSW,A giving lanes different
+     * register banks, JT1 poll. T1 starts stale so the first step is single
+     * and the JNT1 after it must see the resynced level. */
+    {
+        static const uint8_t prog[] = {
+            0x04,0x0A,                      /* 000: JMP $00A */
+            0,0,0,0,0,
+            0x1F,0x93,                      /* 007: INC R7 RETR */
+            0x00,0x46,0x0E,0x1C,0x00,0,0,   /* 009: JNT1 $00E INC R4 */
+            0x23,0xC0,0x62,0x55,0x25,0x05,  /* 010: MOV A,#C0 MOV T,A STRT T EN TCNTI EN I */
+            0xB8,0x2F,                      /* 016: MOV R0,#2F */
+            0x09,0x53,0x30,0xC6,0x22,       /* 018: IN A,P1 ANL A,#30 JZ $022 */
+            0x14,0x40,0x04,0x24,0x00,       /* 01D: CALL $040 JMP $024 */
+            0x1D,0x00,                      /* 022: INC R5 NOP */
+            0xF8,0xDD,0x90,0xE8,0x18,       /* 024: MOV A,R0 XRL A,R5 MOVX @R0,A DJNZ R0,$018 */
+            0x09,0xE7,0x53,0x90,0xD7,0x00,  /* 029: IN A,P1 RL A ANL A,#90 MOV PSW,A NOP */
+            0x1A,0xC5,                      /* 02F: INC R2 SEL RB0 */
+            0x56,0x16,0x04,0x16,            /* 031: JT1 $016 JMP $016 */
+        };
+        static const char *in[8] = { "", "1", "", "2", "1", "", "3", "4" };
+        AV *sc = (AV *)calloc(8, sizeof(AV)), *wd = (AV *)calloc(8, sizeof(AV));
+        AV *lanes[8];
+        long wide = 0;
+        int ok = sc && wd;
+        for (int l = 0; ok && l < 8; l++) {
+            AV *x[2] = { &sc[l], &wd[l] };
+            for (int v = 0; v < 2; v++) {
+                av_init(x[v]);
+                memcpy(x[v]->cpu.irom, prog, sizeof(prog));
+                static const uint8_t sub[] = { 0xF7,0x13,0xF3,0xAE,0x83 }; /* 040: RLC A ADDC A,#F3 MOV R6,A RET */
+                memcpy(x[v]->cpu.irom + 0x40, sub, sizeof(sub));
+                av_apply_input(x[v], in[l]);
+            }
+            lanes[l] = &wd[l];
+        }
+        for (int f = 0; ok && f < 6; f++) {
+            for (int l = 0; l < 8; l++) av_run_frame(&sc[l]);
+            wide += av_wide_run_frame(lanes, 8);
+        }
+        for (int l = 0; ok && l < 8; l++) {
+            const I8048 *c0 = &sc[l].cpu, *c1 = &wd[l].cpu;
+            if (memcmp(c0, c1, sizeof(I8048)) != 0 || sc[l].disp_sync_cycle != wd[l].disp_sync_cycle ||
+                memcmp(&sc[l].disp, &wd[l].disp, sizeof(AVDisp)) != 0) {
+                ok = 0;
+                printf("FAIL: wide lane %d diverged (cy %llu/%llu PC %03X/%03X)\n", l,
+                       (unsigned long long)c0->cycles, (unsigned long long)c1->cycles, c0->PC, c1->PC);
+            }
+        }
+        if (ok && (wide == 0 || sc[0].cpu.iram[7] == 0 || sc[0].cpu.iram[5] == sc[1].cpu.iram[5])) {
+            ok = 0; printf("FAIL: wide test lost coverage (lockstep %ld)\n", wide);
+        }
+        if (ok) pass++; else fail++;
+        for (int l = 0; sc && wd && l < 8; l++) {
+            free(sc[l].rewind_buf); free(wd[l].rewind_buf);
+        }
+        free(sc); free(wd);
+    }
+
+    /* Test 20: delta rewind restores every recorded frame exactly (CPU,
+     * IRAM, XRAM, lit pixels), including after popping part way and
+     * pushing new frames over the freed records. */
+    {
+        static const uint8_t prog[] = {
+            0xB8,0x00,                      /* 000: MOV R0,#00 */
+            0x80,0x68,0x90,0xE8,0x02,       /* 002: MOVX A,@R0 ADD A,R0 MOVX @R0,A DJNZ R0,$002 */
+            0x19,0xF9,0xA0,0x04,0x02,       /* 007: INC R1 MOV A,R1 MOV @R0,A JMP $002 */
+        };
+        enum { N = 40 };
+        AV *a = (AV *)calloc(1, sizeof(AV));
+        I8048 *rec = (I8048 *)calloc(N, sizeof(I8048));
+        uint8_t (*lit)[SW * SH] = (uint8_t (*)[SW * SH])calloc(N, SW * SH);
+        int ok = a && rec && lit && (av_init(a), a->rewind_buf != NULL);
+        if (ok) memcpy(a->cpu.irom, prog, sizeof(prog));
+        int f = 0, bad = -1;
+        #define RW_RUN(k) for (int q = 0; q < (k) && f < N; q++, f++) { \
+            av_run_frame(a); rec[f] = a->cpu; \
+            for (int i = 0; i < SW * SH; i++) lit[f][i] = a->disp.phosphor[i] == 1.0f; }
+        #define RW_POP(k) for (int q = 0; q < (k) && bad < 0; q++) { \
+            const I8048 *c = &rec[--f]; \
+            if (!rewind_pop(a) || a->cpu.A != c->A || a->cpu.PC != c->PC || a->cpu.SP != c->SP || \
+                a->cpu.C != c->C || a->cpu.timer != c->timer || a->cpu.tpre != c->tpre || \
+                memcmp(a->cpu.iram, c->iram, IRAM_SZ) || memcmp(a->cpu.xram, c->xram, XRAM_SZ)) bad = f; \
+            for (int i = 0; i < SW * SH && bad < 0; i++) \
+                if ((a->disp.phosphor[i] == 1.0f) != lit[f][i]) bad = f; }
+        if (ok) {
+            RW_RUN(N - 10); RW_POP(10); RW_RUN(20); RW_POP(N);
+            if (bad >= 0 || rewind_pop(a) || rec[N-1].xram[0x380] == rec[N-2].xram[0x380]) {
+                ok = 0; printf("FAIL: rewind frame %d not restored\n", bad);
+            }
+        }
+        #undef RW_RUN
+        #undef RW_POP
+        if (ok) pass++; else fail++;
+        if (a) free(a->rewind_buf);
+        free(a); free(rec); free(lit);
+    }
+
+    /* Test 21: Q8 phosphor (LUT decay, word-wise lit expansion) tracks the
+     * float path within PHOSPHOR_Q8_TOL over random frames, at the default
+     * decay and a slow one where rounding accumulates most */
+    {
+        static AVDisp df, dq;
+        float worst = 0.0f;
+        uint32_t rng = 0x2545F491;
+        for (int t = 0; t < 2; t++) {
+            float decay = t ? 0.85f : 0.45f;
+            memset(&df, 0, sizeof(df)); memset(&dq, 0, sizeof(dq));
+            disp_set_q8(&dq, true);
+            for (int f = 0; f < 300; f++) {
+                int cols = (f % 7 == 6) ? 0 : SW;  /* some frames only decay */
+                for (int c = 0; c < SW; c++)
+                    for (int b = 0; b < 5; b++) {
+                        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+                        df.col_data[c][b] = dq.col_data[c][b] = (uint8_t)(rng | (rng >> 8));  /* ~25% lit */
+                    }
+                df.cols_captured = dq.cols_captured = cols;
+                disp_update(&df, decay); disp_update(&dq, decay);
+                for (int y = 0; y < SH; y++)
+                    for (int x = 0; x < SW; x++) {
+                        float e = fabsf(disp_px(&df, x, y) - disp_px(&dq, x, y));
+                        if (e > worst) worst = e;
+                    }
+            }
+        }
+        memset(&dq, 0, sizeof(dq)); disp_set_q8(&dq, true);
+        dq.phos8[0][0] = 255;
+        disp_update(&dq, 0.45f);
+        float p0 = disp_px(&dq, 0, 0);
+        if (worst <= PHOSPHOR_Q8_TOL && p0 > 0.29f && p0 < 0.31f) pass++;
+        else { fail++; printf("FAIL: q8 phosphor error %.4f (tol %.4f), decay %.3f\n", worst, PHOSPHOR_Q8_TOL, p0); }
+    }
+
+    /* Test 22: rasterizer — redrawing the same buffer incrementally gives
+     * the same image as a fresh full raster across display and look
+     * changes; a full-on centre LED draws warm red (255,30,6) */
+    {
+        static AV ta;
+        static AVRaster ri, rf;
+        static uint32_t fi[WIN_W * WIN_H], ff[WIN_W * WIN_H];
+        av_init(&ta);
+        av_raster_init(&ri);
+        uint32_t rng = 0x9E3779B9;
+        int bad = 0;
+        for (int step = 0; step < 12; step++) {
+            for (int k = 0; k < 40; k++) {
+                rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+                ta.disp.phosphor[(rng >> 8) % (SW * SH)] = (float)(rng & 255) / 255.0f;
+            }
+            if (step == 4)  ta.mirror_warp = !ta.mirror_warp;
+            if (step == 6)  ta.led_glow = !ta.led_glow;
+            if (step == 8)  ta.scanlines = !ta.scanlines;
+            if (step == 10) ta.cfg_gamma = 1.3f;
+            av_raster(&ri, &ta, fi);
+            av_raster_init(&rf);
+            av_raster(&rf, &ta, ff);
+            if (memcmp(fi, ff, sizeof(fi)) != 0) bad++;
+        }
+        av_init(&ta);
+        ta.led_glow = false;
+        ta.disp.phosphor[SW / 2 + (SH / 2) * SW] = 1.0f;
+        av_raster_init(&rf);
+        int lit = av_raster(&rf, &ta, ff);
+        uint32_t c = ff[((SH / 2) * SCALE + 1) * WIN_W + (SW / 2) * SCALE + 1];
+        if (bad == 0 && lit == 1 && c == 0xFF1E06) pass++;
+        else { fail++; printf("FAIL: rasterizer: %d incremental mismatches, lit %d, colour %06X\n", bad, lit, (unsigned)c); }
+    }
+
+    /* Test 23: block COP411L synthesis (cop411_render) matches the
+     * per-sample reference bit for bit — every command, loop/fast
+     * control, with and without RC jitter, across odd block sizes */
+    {
+        static const uint8_t cmds[] = {
+            0x10, 0x23, 0x31, 0x45, 0x52, 0x67, 0x70, 0x84, 0x99, 0xA1, 0xD2, 0xE5, 0xFC
+        };
+        static const int blks[] = { 1, 7, 256, 511, 1000, 3 };
+        static float ref[4096], blk[4096];
+        int bad = 0, steps = 0;
+        for (int v = 0; v < 4; v++) {
+            float jitter = (v & 1) ? 1.037f : 1.0f;
+            for (size_t c = 0; c < sizeof(cmds); c++) {
+                COP411L a, b;
+                cop411_init(&a);
+                cop411_command(&a, (uint8_t)((v & 2) ? 0x09 : 0x00)); /* loop+fast or once */
+                cop411_command(&a, cmds[c]);
+                memcpy(&b, &a, sizeof(b));
+                for (int k = 0, total = 0; total < 60000; k++) {
+                    int m = blks[k % 6];
+                    for (int i = 0; i < m; i++) ref[i] = cop411_sample(&a, jitter);
+                    cop411_render(&b, blk, m, jitter);
+                    if (memcmp(ref, blk, (size_t)m * sizeof(float)) != 0) bad++;
+                    total += m;
+                }
+                if (memcmp(&a, &b, sizeof(a)) != 0) bad++;
+                steps += a.cur_step != 0 || a.segment != 0;
+            }
+        }
+        if (bad == 0 && steps > 0) pass++;
+        else { fail++; printf("FAIL: block COP411L synthesis: %d mismatches\n", bad); }
+    }
+
+    /* Test 24: sound queue — commands posted up front play at their
+     * timestamps' sample offsets (anchor, spacing, late clamp, runaway
+     * re-anchor, state events), bit-exact against applying them by hand;
+     * the producer's snapshot replays what the consumer hasn't reached */
+    {
+        static AV x;
+        static float got[2048], ref[2048];
+        static const SndEvent evs[] = {
+            { 1000, SND_EV_CMD, 0x09, 0 }, { 1100, SND_EV_CMD, 0x23, 0 },
+            { 1900, SND_EV_CMD, 0xE5, 0 }, { 0, SND_EV_RESET, 1, 0 },
+            { 5, SND_EV_CMD, 0x67, 0 },    { 3, SND_EV_CMD, 0x31, 0 },
+            { 1000000, SND_EV_CMD, 0xFC, 0 }
+        };
+        /* Expected consumer positions: SLACK after the anchor, +100, +900,
+         * same sample, re-anchored SLACK later, late -> clamped, runaway */
+        const int S = SNDQ_SLACK;
+        const int at[] = { S, S + 100, S + 900, S + 900, S + 900 + S, S + 900 + S, S + 900 + 2 * S };
+        const int nev = (int)(sizeof(evs) / sizeof(evs[0]));
+        SndQueue *q = &x.sndq;
+        COP411L a, b, c;
+        memset(&x, 0, sizeof(x));
+        cop411_init(&a); b = a; c = a;
+        q->pub = a;
+        for (int i = 0; i < nev; i++) q->ev[q->wr++] = evs[i];
+        x.adev = 1;  /* snd_snapshot takes the published path */
+        COP411L snap; snd_snapshot(&x, &snap);
+        x.adev = 0;
+        for (int i = 0; i < nev; i++) sndq_apply(&c, &evs[i], NULL);
+        int pos = 0;
+        for (int i = 0; i < nev; i++) {
+            cop411_render(&b, ref + pos, at[i] - pos, 1.0f);
+            pos = at[i];
+            sndq_apply(&b, &evs[i], NULL);
+        }
+        cop411_render(&b, ref + pos, 2048 - pos, 1.0f);
+        for (int i0 = 0; i0 < 2048; i0 += 512)
+            sndq_render(q, &a, got + i0, 512, 1.0f);
+        if (memcmp(got, ref, sizeof(got)) == 0 && memcmp(&a, &b, sizeof(a)) == 0 &&
+            memcmp(&snap, &c, sizeof(c)) == 0 && memcmp(&q->pub, &a, sizeof(a)) == 0 &&
+            q->rd == q->wr && q->pub_rd == q->wr && q->pub_seq == 8) pass++;
+        else { fail++; printf("FAIL: sound queue timing (rd %u/%u)\n", q->rd, q->wr); }
+    }
+
+    /* Test 25: run-ahead — the presented frame is the machine n frames
+     * ahead, restoring gives back exactly the plain run (CPU, display,
+     * sound, rewind), and speculative frames post no sound commands */
+    {
+        static const uint8_t prog[] = {
+            0xB8,0x00,                      /* 000: MOV R0,#00 */
+            0x80,0x68,0x90,0xE8,0x02,       /* 002: MOVX A,@R0 ADD A,R0 MOVX @R0,A DJNZ R0,$002 */
+            0x19,0xF9,0xA0,                 /* 007: INC R1 MOV A,R1 MOV @R0,A */
+            0x23,0xC0,0x3A,0xF9,0x47,0x3A,  /* 00A: MOV A,#C0 OUTL P2,A MOV A,R1 SWAP A OUTL P2,A */
+            0x23,0x32,0x3A,0x27,0x3A,       /* 010: MOV A,#32 OUTL P2,A CLR A OUTL P2,A */
+            0x04,0x02,                      /* 015: JMP $002 */
+        };
+        static AV a, b, c;
+        static AVMemState st;
+        AV *v[3] = { &a, &b, &c };
+        for (int k = 0; k < 3; k++) { av_init(v[k]); memcpy(v[k]->cpu.irom, prog, sizeof(prog)); }
+        int ok = 1;
+        for (int f = 0; f < 2; f++) av_run_frame(&c);
+        for (int f = 0; f < 12 && ok; f++) {
+            av_runahead(&a, 2, &st);
+            av_run_frame(&b); av_run_frame(&c);
+            if (a.cpu.cycles != c.cpu.cycles || a.cpu.PC != c.cpu.PC ||
+                memcmp(a.cpu.xram, c.cpu.xram, XRAM_SZ) != 0 ||
+                memcmp(a.disp.col_data, c.disp.col_data, sizeof(a.disp.col_data)) != 0) ok = 0;
+            av_mem_load(&a, &st);
+            if (memcmp(&a.cpu, &b.cpu, sizeof(a.cpu)) != 0 || memcmp(&a.disp, &b.disp, sizeof(a.disp)) != 0 ||
+                memcmp(&a.snd, &b.snd, sizeof(a.snd)) != 0 || a.frame_count != b.frame_count ||
+                a.rewind_count != b.rewind_count || a.snd_proto_state != b.snd_proto_state) ok = 0;
+        }
+        if (ok && b.snd.command != 0) pass++;
+        else { fail++; printf("FAIL: run-ahead diverged from the plain run (cmd %d)\n", b.snd.command); }
+        for (int k = 0; k < 3; k++) { free(v[k]->rewind_buf); free(v[k]->icache); }
+    }
+
+    /* Test 26: A/V capture — PCM and delta-coded LED frames read back
+     * exactly, frames carry their sample position, a push that does not
+     * fit the ring is counted as dropped */
+    {
+        static WavWriter w;
+        static AVDisp d;
+        static int16_t pcm[3000], back[3000];
+        static uint8_t key[SW][5], fr[3][SW][5];
+        static uint8_t buf[1 << 16];
+        for (int i = 0; i < 3000; i++) pcm[i] = (int16_t)(i * 37 - 20000);
+        memset(&w, 0, sizeof(w));
+        wav_start(&w, "av_test_tmp.avc", REC_AVC);
+        int ok = w.fp != NULL;
+        for (int f = 0; f < 3 && ok; f++) {
+            rec_audio(&w, pcm + f * 1000, 1000);
+            for (int c = 0; c < SW; c++)
+                for (int b = 0; b < 5; b++)
+                    d.col_data[c][b] = fr[f][c][b] = (uint8_t)(f == 1 && c > 20 ? 0 : c * 7 + b + f);
+            d.cols_shown = SW - f;
+            rec_video(&w, &d);
+        }
+        if (ok) rec_audio(&w, pcm, WAV_RING_SZ);  /* does not fit: dropped */
+        if (ok) wav_stop(&w);
+        FILE *f = fopen("av_test_tmp.avc", "rb");
+        size_t len = f ? fread(buf, 1, sizeof(buf), f) : 0;
+        if (f) fclose(f);
+        int na = 0, nv = 0, end = 0;
+        ok = ok && len > 20 && memcmp(buf, "AVCAP1", 6) == 0;
+        for (size_t p = 20; ok && p + 5 <= len; ) {
+            uint32_t n = buf[p+1] | buf[p+2] << 8 | buf[p+3] << 16 | (uint32_t)buf[p+4] << 24;
+            const uint8_t *q = buf + p + 5;
+            if (p + 5 + n > len) { ok = 0; break; }
+            if (buf[p] == 'A' && na * 2 + n <= sizeof(back)) { memcpy(back + na, q, n); na += (int)n / 2; }
+            else if (buf[p] == 'V' && nv < 3) {
+                rewind_delta_apply(&key[0][0], SW * 5, q + 9, (int)n - 9);
+                uint32_t smp = q[4] | q[5] << 8 | q[6] << 16 | (uint32_t)q[7] << 24;
+                if (q[0] != nv || smp != (uint32_t)(nv + 1) * 1000 || q[8] != SW - nv ||
+                    memcmp(key, fr[nv], sizeof(key)) != 0) ok = 0;
+                nv++;
+            } else if (buf[p] == 'E' && n == 16)
+                end = q[0] + (q[1] << 8) == 3000 && q[4] == 3 && q[8] == (WAV_RING_SZ & 0xFF) &&
+                      (q[9] | q[10] << 8 | q[11] << 16) == WAV_RING_SZ >> 8 && q[12] == 0;
+            else ok = 0;
+            p += 5 + n;
+        }
+        remove("av_test_tmp.avc");
+        if (ok && end && na == 3000 && nv == 3 && memcmp(back, pcm, sizeof(pcm)) == 0) pass++;
+        else { fail++; printf("FAIL: A/V capture readback (%d samples, %d frames, end %d)\n", na, nv, end); }
+    }
+
+    /* Test 27: input movie — a recording made mid-game replays in sync
+     * from its embedded state with every check passing, and a state
+     * perturbed mid-run is reported at the next check */
+    {
+        static const uint8_t prog[] = {
+            0x09,0x6A,0xAA,       /* 000: IN A,P1 ADD A,R2 MOV R2,A */
+            0xFA,0xE7,0x90,       /* 003: MOV A,R2 RL A MOVX @R0,A */
+            0x18,0x04,0x00,       /* 006: INC R0 JMP $000 */
+        };
+        static AV a, b;
+        AV *v[2] = { &a, &b };
+        int ok = 1, n = -1;
+        for (int k = 0; k < 2; k++) { av_init(v[k]); memcpy(v[k]->cpu.irom, prog, sizeof(prog)); }
+        for (int f = 0; f < 5; f++) av_run_frame(&a);
+        ok = movie_start(&a, "av_test_tmp.avm", true);
+        for (int f = 0; f < 150 && ok; f++) {
+            input_set_mask(&a, (uint8_t)((f / 9) * 0x35 ^ (f > 100 ? 0x80 : 0)));
+            av_run_frame(&a);
+        }
+        ok = ok && movie_stop(&a);
+        for (int pass2 = 0; pass2 < 2 && ok; pass2++) {
+            av_init(&b); memcpy(b.cpu.irom, prog, sizeof(prog));
+            n = movie_open(&b, "av_test_tmp.avm");
+            int f = 0;
+            for (; f < n && movie_next(&b); f++) {
+                if (pass2 && f == 30) b.cpu.iram[2] ^= 1;  /* R2 */
+                av_run_frame(&b);
+            }
+            if (f == n) movie_next(&b);
+            if (pass2 == 0)
+                ok = n == 150 && f == n && b.movie.checks == 4 && !b.movie.desync && movie_stop(&b) &&
+                     av_state_hash(&a) == av_state_hash(&b) && input_mask(&b) == input_mask(&a);
+            else
+                ok = b.movie.desync && b.movie.frames == 60 && !movie_stop(&b);
+        }
+        remove("av_test_tmp.avm");
+        if (ok) pass++;
+        else { fail++; printf("FAIL: input movie replay (%d frames, %u checks, desync %d)\n",
+                              n, b.movie.checks, b.movie.desync); }
+        for (int k = 0; k < 2; k++) { free(v[k]->rewind_buf); free(v[k]->icache); }
+    }
+
+    /* Test 28: chunked savestate blob — round-trip through memory, an
+     * unknown chunk is skipped, a truncated blob is rejected untouched */
+    {
+        static AV a, b;
+        static uint8_t blob[STATE_BLOB_MAX], ext[STATE_BLOB_MAX + 16];
+        av_init(&a); av_init(&b);
+        for (int i = 0; i < IRAM_SZ; i++) a.cpu.iram[i] = (uint8_t)(i * 5 + 1);
+        for (int i = 0; i < XRAM_SZ; i++) a.cpu.xram[i] = (uint8_t)(i * 7 + 3);
+        a.cpu.A = 0x5A; a.cpu.PC = 0x7C3; a.cpu.F1 = true; a.cpu.t1 = true; a.cpu.irq_pend = true;
+        a.cpu.tpre = 17; a.cpu.cycles = 0x123456789ULL; a.frame_count = 4321; a.prev_p2 = 0x9C;
+        a.disp.col_data[149][4] = 0xA5; a.disp.cols_shown = 120;
+        a.snd.active = true; a.snd.command = 9; a.snd.chain_cmd = 2; a.snd.force_loop = true;
+        a.snd.slide_progress = 0.25f; a.snd.step_count = 3; a.snd.cur_step = 2;
+        a.snd.steps[2].dur_ms = 77; a.snd.lfsr = 0x2345;
+        a.sndq.pub = a.snd;
+        a.snd_proto_state = 2; a.snd_proto_hi = 0xB;
+        size_t n = state_blob_save(&a, blob, sizeof(blob));
+        int ok = n == state_blob_save(&a, NULL, 0) && n <= sizeof(blob) && state_blob_load(&b, blob, n);
+        ok = ok && memcmp(b.cpu.iram, a.cpu.iram, IRAM_SZ) == 0 && memcmp(b.cpu.xram, a.cpu.xram, XRAM_SZ) == 0 &&
+             av_state_hash(&a) == av_state_hash(&b) && b.cpu.t1 && b.frame_count == 4321 && b.prev_p2 == 0x9C &&
+             b.disp.col_data[149][4] == 0xA5 && b.disp.cols_shown == 120 &&
+             b.snd.active && b.snd.chain_cmd == 2 && b.snd.force_loop && b.snd.slide_progress == 0.25f &&
+             b.snd.cur_step == 2 && b.snd.steps[2].dur_ms == 77 && b.snd.lfsr == 0x2345 &&
+             b.snd_proto_state == 2 && b.snd_proto_hi == 0xB;
+        /* A newer writer's extra chunk right after the header */
+        memcpy(ext, blob, STATE_HDR);
+        memcpy(ext + STATE_HDR, "ZZZZ\x04\0\0\0\xDE\xAD\xBE\xEF", 12);
+        memcpy(ext + STATE_HDR + 12, blob + STATE_HDR, n - STATE_HDR);
+        wav_le32(ext + 8, (uint32_t)(n + 12));
+        av_init(&b);
+        ok = ok && state_blob_load(&b, ext, n + 12) && av_state_hash(&a) == av_state_hash(&b);
+        av_init(&b); b.cpu.A = 0x11;
+        ok = ok && !state_blob_load(&b, blob, n - 8) && b.cpu.A == 0x11 && b.frame_count == 0;
+        if (ok) pass++;
+        else { fail++; printf("FAIL: chunked savestate blob (%u bytes)\n", (unsigned)n); }
+        free(a.rewind_buf); free(b.rewind_buf);
+    }
+
+    /* Test 29: ROM library index — growable list with path lookup, a
+     * rescan reads only new or changed files, the index file round-trips
+     * and known dumps are identified by content hash */
+    {
+        static RomList l, l2;
+        static uint8_t rom[1024];
+        char path[64];
+        int ok = 1;
+        memset(&l, 0, sizeof(l)); memset(&l2, 0, sizeof(l2));
+        for (int i = 0; i < 300 && ok; i++) {
+            snprintf(path, sizeof(path), "lib/rom%03d.bin", i);
+            RomEntry *e = rom_list_add(&l, path);
+            if (!e) ok = 0; else { e->size = i; e->seen = true; }
+        }
+        for (int i = 0; i < 300 && ok; i++) {
+            snprintf(path, sizeof(path), "lib/rom%03d.bin", i);
+            const RomEntry *e = rom_list_find(&l, path);
+            if (!e || e->size != i || strcmp(e->name, path + 4) != 0) ok = 0;
+        }
+        ok = ok && l.n == 300 && !rom_list_find(&l, "lib/rom300.bin");
+        rom_list_free(&l);
+        for (int i = 0; i < 1024; i++) rom[i] = (uint8_t)(i * 13);
+        FILE *f = fopen("av_test_tmp.rom", "wb");
+        ok = ok && f && fwrite(rom, 1, sizeof(rom), f) == sizeof(rom);
+        if (f) fclose(f);
+        const RomEntry *e = ok ? rom_index_update(&l, "av_test_tmp.rom", 1024, 111) : NULL;
+        ok = ok && e && e->hash == fnv1a(FNV_INIT, rom, sizeof(rom)) && l.hashed == 1 && l.dirty;
+        ok = ok && rom_index_save(&l, "av_test_tmp.idx") && !l.dirty;
+        rom_index_load(&l2, "av_test_tmp.idx");
+        e = rom_index_update(&l2, "av_test_tmp.rom", 1024, 111);          /* unchanged: cached */
+        ok = ok && l2.n == 1 && e && e->hash == l.v[0].hash && l2.hashed == 0 && !l2.dirty;
+        e = rom_index_update(&l2, "av_test_tmp.rom", 1024, 222);          /* touched: re-read */
+        ok = ok && e && e->hash == l.v[0].hash && l2.hashed == 1 && l2.dirty;
+        ok = ok && rom_db_find(0x34f32c96ff8c4023ULL) >= 0 && !rom_db[rom_db_find(0x34f32c96ff8c4023ULL)].bios &&
+             rom_db_find(e ? e->hash : 0) < 0 && rom_db_find(0) < 0;
+        remove("av_test_tmp.rom"); remove("av_test_tmp.idx");
+        rom_list_free(&l); rom_list_free(&l2);
+        if (ok) pass++;
+        else { fail++; printf("FAIL: ROM library index\n"); }
+    }
+
+    /* Test 30: frame triple buffer: the consumer gets the newest published
+     * frame, nothing when none is new, and never the slot being written */
+    {
+        static FrameTB tb;
+        static AVDisp d;
+        frame_tb_init(&tb);
+        memset(&d, 0, sizeof(d));
+        bool ok = frame_tb_take(&tb) == NULL;
+        for (int f = 1; f <= 5; f++) {
+            d.col_data[0][0] = (uint8_t)f;
+            frame_tb_publish(&tb, &d, (uint64_t)f, 0.0f);
+            if (f == 2 || f == 5) {  /* 1 and 3-4 are dropped unseen */
+                const TBFrame *g = frame_tb_take(&tb);
+                ok = ok && g && g->disp.col_data[0][0] == f && g->cycles == (uint64_t)f &&
+                     frame_tb_take(&tb) == NULL &&
+                     tb.front != tb.back && (tb.mid & 3u) != tb.front && (tb.mid & 3u) != tb.back;
+            }
+        }
+        d.col_data[0][0] = 9;
+        frame_tb_publish(&tb, &d, 9, 0.0f);
+        const TBFrame *g = frame_tb_take(&tb);
+        ok = ok && g && g->disp.col_data[0][0] == 9 && tb.slot[tb.back].disp.col_data[0][0] != 9;
+        if (ok) pass++;
+        else { fail++; printf("FAIL: frame triple buffer\n"); }
+    }
+
+    /* Test 31: rollback netplay — two peers trading input through a lossy,
+     * delayed link (B slower, so A predicts and stalls) end on the state
+     * of a plain run with the merged input, A having rolled back on the
+     * way, and a spectator fed the confirmed stream ends there too */
+    {
+        static const uint8_t prog[] = {
+            0x09,0x6A,0xAA,       /* 000: IN A,P1 ADD A,R2 MOV R2,A */
+            0xFA,0xE7,0x90,       /* 003: MOV A,R2 RL A MOVX @R0,A */
+            0x18,0x04,0x00,       /* 006: INC R0 JMP $000 */
+        };
+        enum { N = 120, LAT = 3, QN = 64 };
+        static AV a[4];           /* peer A, peer B, reference, spectator */
+        static NetSession ns[3];
+        static struct { int due, to, len; uint8_t d[NET_PKT_MAX]; } q[QN];
+        int qn = 0, sent = 0, tick = 0;
+        for (int k = 0; k < 4; k++) { av_init(&a[k]); memcpy(a[k].cpu.irom, prog, sizeof(prog)); }
+        for (int k = 0; k < 3; k++) net_session_init(&ns[k], k == 2);
+        #define T31_MASK(k, f) ((k) ? (uint8_t)(((f) / 11 & 3) << 2) : (uint8_t)(((f) / 7) * 0x31))
+        for (; tick < 2000 && (ns[0].log_n < N || ns[1].log_n < N); tick++) {
+            for (int i = 0; i < qn; ) {
+                if (q[i].due > tick) { i++; continue; }
+                net_recv_input(&ns[q[i].to], q[i].d, q[i].len);
+                q[i] = q[--qn];
+            }
+            for (int k = 0; k < 2; k++) {
+                net_sync(&a[k], &ns[k]);
+                if (ns[k].frame < N && (k == 0 || tick % 3))
+                    net_step(&a[k], &ns[k], T31_MASK(k, ns[k].frame));
+                if (++sent % 5 && qn < QN) {
+                    q[qn].len = net_build_input(&ns[k], q[qn].d);
+                    q[qn].due = tick + LAT; q[qn].to = !k; qn++;
+                }
+            }
+        }
+        for (int f = 0; f < N; f++) { input_set_mask(&a[2], (uint8_t)(T31_MASK(0, f) | T31_MASK(1, f))); av_run_frame(&a[2]); }
+        #undef T31_MASK
+        uint8_t pkt[NET_PKT_MAX];
+        for (uint32_t w = 0; w < ns[0].log_n; w = ns[2].log_n)
+            if (!net_recv_feed(&ns[2], pkt, net_build_feed(&ns[0], w, pkt)) || ns[2].log_n == w) break;
+        while (net_watch_step(&a[3], &ns[2])) {}
+        uint64_t h = av_state_hash(&a[2]);
+        bool ok = ns[0].frame == N && ns[1].frame == N && ns[2].frame == N &&
+                  av_state_hash(&a[0]) == h && av_state_hash(&a[1]) == h && av_state_hash(&a[3]) == h &&
+                  ns[0].rollbacks > 0 && ns[0].stalls > 0 &&
+                  memcmp(ns[0].log, ns[1].log, N) == 0;
+        if (ok) pass++;
+        else { fail++; printf("FAIL: rollback netplay (tick %d, frames %u/%u, rollbacks %u/%u)\n",
+                              tick, ns[0].frame, ns[1].frame, ns[0].rollbacks, ns[1].rollbacks); }
+        for (int k = 0; k < 3; k++) net_session_free(&ns[k]);
+        for (int k = 0; k < 4; k++) { free(a[k].rewind_buf); free(a[k].icache); }
+    }
+
+    /* Test 32: debugger bitmaps — breakpoints and an XRAM write watch
+     * stop at the right instruction, and continuing or single-stepping
+     * from each stop ends on the state of a run without the debugger */
+    {
+        static const uint8_t prog[] = {    /* test 18's program */
+            0x04,0x10,                 /* 000: JMP $010 */
+            0,0,0,0,0,
+            0x1F,0x23,0xFE,0x62,0x93,  /* 007: INC R7 MOV A,#FE MOV T,A RETR */
+            0,0,0,0,
+            0x23,0xFE,0x62,0x45,0x25,0x05, /* 010: MOV A,#FE MOV T,A STRT CNT EN TCNTI EN I */
+            0xB8,0x40,                 /* 016: MOV R0,#40 */
+            0xFE,0xD8,0x90,0xE8,0x18,  /* 018: MOV A,R6 XRL A,R0 MOVX @R0,A DJNZ R0,$018 */
+            0x1E,0x56,0x16,0x04,0x16,  /* 01D: INC R6 JT1 $016 JMP $016 */
+        };
+        static AV a[2];
+        for (int k = 0; k < 2; k++) { av_init(&a[k]); memcpy(a[k].cpu.irom, prog, sizeof(prog)); }
+        bool ok = av_dbg_add(&a[1], "$007", false) && av_dbg_add(&a[1], "1D", false) &&
+                  av_dbg_add(&a[1], "320-321:w", true) && av_dbg_add(&a[1], "0x3F0", true) &&
+                  !av_dbg_add(&a[1], "1000", false) && !av_dbg_add(&a[1], "400", true) &&
+                  !av_dbg_add(&a[1], "20:x", true) && !av_dbg_add(&a[1], "30-20", false) &&
+                  a[1].dbg.bps == 2 && a[1].dbg.watches == 3;
+        a[1].dbg.active = true;
+        for (int f = 0; f < 5; f++) av_run_frame(&a[0]);
+        int bp = 0, watch = 0, steps = 0;
+        uint64_t last = UINT64_MAX;    /* a stop never repeats in place */
+        while (ok && a[1].frame_count < 5) {
+            av_run_frame(&a[1]);
+            if (!a[1].dbg.stepping) continue;
+            uint16_t h = a[1].dbg.hit, pc = a[1].dbg.hit_pc;
+            ok = a[1].cpu.cycles != last;
+            last = a[1].cpu.cycles;
+            if (!h) { bp++; ok = ok && (pc == 0x007 || pc == 0x01D) && a[1].cpu.PC == pc; }
+            else { watch++; ok = ok && pc == 0x01A && (h & WATCH_WR) && (h & 0x3FF) >= 0x320 && (h & 0x3FF) <= 0x321; }
+            if ((bp + watch) % 3 == 0) { av_dbg_step(&a[1]); av_dbg_step(&a[1]); steps += 2; }
+            av_dbg_continue(&a[1]);
+        }
+        ok = ok && bp > 5 && watch > 5 && a[1].dbg.stops == (uint32_t)(bp + watch) &&
+             av_state_hash(&a[0]) == av_state_hash(&a[1]) && a[0].disp_sync_cycle == a[1].disp_sync_cycle &&
+             memcmp(a[0].disp.phosphor, a[1].disp.phosphor, sizeof(a[0].disp.phosphor)) == 0;
+        /* A reset after a mid-frame stop starts a fresh frame */
+        for (int f = 0; ok && f < 3 && !a[1].dbg.stepping; f++) av_run_frame(&a[1]);
+        ok = ok && a[1].dbg.stepping && a[1].dbg.frame_at > 0;
+        av_reset(&a[1]);
+        ok = ok && !a[1].dbg.stepping && !a[1].dbg.resume && a[1].dbg.frame_at == 0;
+        if (ok) pass++;
+        else { fail++; printf("FAIL: debugger bitmaps (%d breaks, %d watches, %d steps)\n", bp, watch, steps); }
+        for (int k = 0; k < 2; k++) { free(a[k].rewind_buf); free(a[k].icache); }
+    }
+
+    /* Test 33: frame export ring — the last `slots` records read back
+     * whole with their frame and display, older ones and a slot being
+     * rewritten are refused, and the bitplane and phosphor follow disp */
+    {
+        static const uint8_t prog[] = {    /* test 27's program */
+            0x09,0x6A,0xAA, 0xFA,0xE7,0x90, 0x18,0x04,0x00,
+        };
+        enum { SLOTS = 8, N = 20 };
+        static AV a;
+        static uint8_t ring[FX_RING_HDR + SLOTS * FX_REC_SZ], rec[FX_REC_SZ], want[FX_REC_SZ];
+        av_init(&a);
+        memcpy(a.cpu.irom, prog, sizeof(prog));
+        fx_header(ring, SLOTS);
+        bool ok = true;
+        for (int f = 1; f <= N; f++) {
+            input_set_mask(&a, (uint8_t)(f * 0x11));
+            av_run_frame(&a);
+            fx_ring_push(ring, &a);
+            ok = ok && fx_ring_read(ring, (uint32_t)f, rec) && rd_le32(rec + 4) == (uint32_t)f;
+        }
+        fx_build(&a, want);
+        ok = ok && fx_ring_read(ring, N, rec) && memcmp(rec + 4, want + 4, FX_REC_SZ - 4) == 0 &&
+             rd_le32(ring + 16) == N && rec[26] == (uint8_t)(N * 0x11) && rec[27] == a.disp.cols_shown;
+        for (uint32_t q = 1; q <= N; q++)
+            ok = ok && fx_ring_read(ring, q, rec) == (q > N - SLOTS);
+        for (int k = 0; k < SW * SH && ok; k++) {
+            int x = k % SW, y = k / SW;
+            bool on = x < a.disp.cols_shown && !(a.disp.col_data[x][4 - y / 8] >> (y % 8) & 1);
+            ok = (want[FX_PHOS_OFF + k] == 255) == (disp_px(&a.disp, x, y) == 1.0f) &&
+                 (want[FX_BITS_OFF + x * 5 + 4 - y / 8] >> (y % 8) & 1) == on;
+        }
+        uint8_t *slot = ring + FX_RING_HDR + (size_t)((N - 1) % SLOTS) * FX_REC_SZ;
+        wav_le32(slot, 0);
+        ok = ok && !fx_ring_read(ring, N, rec) && disp_lit_count(&a.disp) > 0;
+        if (ok) pass++;
+        else { fail++; printf("FAIL: frame export ring\n"); }
+        free(a.rewind_buf); free(a.icache);
+    }
+
+    /* Test 34: libadvision — instances advanced by avl_step_many on a
+     * pool end where avl_step leaves them one by one (machine, frame and
+     * audio, a tone starting at its queue offset), a save takes a command
+     * still queued, and a saved state steps to the same frame and audio */
+    {
+        static const uint8_t prog[] = {    /* test 27's program */
+            0x09,0x6A,0xAA, 0xFA,0xE7,0x90, 0x18,0x04,0x00,
+        };
+        enum { N = 6, F = 8 };
+        static uint8_t blob[STATE_BLOB_MAX], frame[SW * SH];
+        static float snd[F * AVL_FRAME_SAMPLES];
+        avl *s[N], *m[N];
+        uint8_t masks[N];
+        avl_pool *p = avl_pool_create(3);
+        bool ok = p != NULL, quiet = true, loud = false;
+        for (int i = 0; i < N; i++) {
+            s[i] = avl_create(); m[i] = avl_create();
+            ok = ok && s[i] && m[i] && avl_load_rom(s[i], prog, sizeof(prog), prog, 1) == 0 &&
+                 avl_load_rom(m[i], prog, sizeof(prog), prog, 1) == 0;
+            masks[i] = (uint8_t)(i * 0x25);
+        }
+        ok = ok && avl_load_rom(s[0], prog, IROM_SZ + 1, prog, 1) == -1;
+        for (int r = 0; r < 3 && ok; r++) {
+            for (int i = 0; i < N; i++) {
+                if (r == 0) {
+                    snd_post(&s[i]->av, SND_EV_CMD, 0xE5, 0, NULL);
+                    snd_post(&m[i]->av, SND_EV_CMD, 0xE5, 0, NULL);
+                }
+                avl_step(s[i], masks[i], F);
+            }
+            avl_step_many(p, m, masks, N, F);
+            for (int i = 0; i < N && ok; i++) {
+                int na, nb;
+                const float *a = avl_audio(s[i], &na), *b = avl_audio(m[i], &nb);
+                ok = na == F * AVL_FRAME_SAMPLES && nb == na && memcmp(a, b, (size_t)na * sizeof(float)) == 0 &&
+                     av_state_hash(&s[i]->av) == av_state_hash(&m[i]->av) &&
+                     memcmp(avl_frame(s[i]), avl_frame(m[i]), SW * SH) == 0 &&
+                     avl_frame_count(m[i]) == (uint64_t)(r + 1) * F;
+                if (r == 0)
+                    for (int k = 0; k < na; k++) {
+                        if (k < SNDQ_SLACK) quiet = quiet && a[k] == 0.0f;
+                        else loud = loud || a[k] != 0.0f;
+                    }
+            }
+        }
+        snd_post(&m[0]->av, SND_EV_CMD, 0xE5, 0, NULL);  /* plays SLACK into the next step */
+        size_t n = ok ? avl_save_state(m[0], NULL, 0) : 0;
+        COP411L c;
+        ok = ok && quiet && loud && n > 0 && n <= sizeof(blob) && avl_save_state(m[0], blob, sizeof(blob)) == n &&
+             !m[0]->av.snd.active && avl_load_state(s[0], blob, n) == 0 && avl_frame_count(s[0]) == 3 * F &&
+             avl_load_state(s[0], blob, 8) == -1;
+        if (ok) {
+            snd_snapshot(&s[0]->av, &c);
+            avl_step(s[0], 0x11, F);
+            memcpy(frame, avl_frame(s[0]), sizeof(frame));
+            memcpy(snd, avl_audio(s[0], NULL), sizeof(snd));
+            uint64_t h = av_state_hash(&s[0]->av);
+            ok = c.active && avl_load_state(s[0], blob, n) == 0;
+            avl_step(s[0], 0x11, F);
+            ok = ok && av_state_hash(&s[0]->av) == h && memcmp(avl_frame(s[0]), frame, sizeof(frame)) == 0 &&
+                 memcmp(avl_audio(s[0], NULL), snd, sizeof(snd)) == 0 && disp_lit_count(&s[0]->av.disp) > 0 &&
+                 avl_frame_rgb(s[0]) != NULL;
+        }
+        if (ok) pass++;
+        else { fail++; printf("FAIL: libadvision step_many / state\n"); }
+        for (int i = 0; i < N; i++) { avl_destroy(s[i]); avl_destroy(m[i]); }
+        avl_pool_destroy(p);
+    }
+
+    /* Test 35: dot atlas — a stamp is the level's LED colour through the
+     * round mask (or the square), visible rows are its spans, the packed
+     * saturating add and 3/4 dim match per-channel arithmetic for every
+     * byte, and a gamma change restamps */
     {
-        I8048 c; memset(&c, 0, sizeof(c));
-        c.timer = 0xFF; c.timer_en = true; c.tcnti_en = true;
-        c.irq_en = true; c.in_irq = true; /* IN ISR */
-        for (int i = 0; i < 100; i++) c.irom[i] = 0x00;
-        c.P1 = 0xFB; c.P2 = 0xFF; c.t0 = true;
-        for (int i = 0; i < 32; i++) i8048_exec(&c, NULL);
-        if (!c.irq_pend && c.timer_ovf) pass++;
-        else { fail++; printf("FAIL: ISR overflow pend=%d ovf=%d (expected 0,1)\n", c.irq_pend, c.timer_ovf); }
+        static AVRaster R;
+        av_raster_init(&R);
+        rebuild_gamma_lut(&R, 2.2f);
+        bool ok = true;
+        for (int round_led = 0; round_led < 2; round_led++) {
+            rebuild_dot_atlas(&R, round_led);
+            for (int q = 0; q < 256 && ok; q += 15) {
+                float Ig = R.gamma_lut[q];
+                uint8_t r = (uint8_t)(Ig * 255.0f), g = (uint8_t)(Ig * Ig * 30.0f);
+                for (int dy = 0; dy < SCALE; dy++)
+                    for (int dx = 0; dx < SCALE; dx++) {
+                        float a = round_led ? R.led_mask[dy * SCALE + dx] : dx < LED_SIZE && dy < LED_SIZE;
+                        uint32_t want = a < 0.01f ? 0 : (uint32_t)((uint8_t)(r * a) << 16 | (uint8_t)(g * a) << 8 |
+                                                                   (uint8_t)((uint8_t)(Ig * Ig * Ig * 6.0f) * a));
+                        bool in = dx >= R.dot_x0[dy] && dx < R.dot_x1[dy];
+                        ok = ok && R.dot[q][dy * SCALE + dx] == want && in == (a >= 0.01f);
+                    }
+            }
+        }
+        uint32_t mid = R.dot[128][2 * SCALE + 2];
+        rebuild_gamma_lut(&R, 1.0f);
+        rebuild_dot_atlas(&R, true);
+        ok = ok && R.dot[128][2 * SCALE + 2] != mid && (R.dot[128][2 * SCALE + 2] >> 16) == 128;
+        for (uint32_t a = 0; a < 256 && ok; a++) {
+            ok = px_dim(a << 16 | a << 8 | a) == (a * 3 / 4) * 0x010101u;
+            for (uint32_t b = 0; b < 256 && ok; b++) {
+                uint32_t sum = a + b > 255 ? 255 : a + b;
+                ok = px_add_sat(a << 16 | b << 8 | a, b << 16 | a << 8 | 0) == (sum << 16 | sum << 8 | a);
+            }
+        }
+        if (ok) pass++;
+        else { fail++; printf("FAIL: dot atlas / packed pixel ops\n"); }
     }
 
-    /* Test 15: JMP does not set bit 11 during ISR */
+    /* Test 36: idle-loop skip is invisible. Direct: a DJNZ self-loop with
+     * the timer 251 cycles from overflow skips 125 iterations and lands
+     * where the interpreter does; a JNT1 wait takes the whole budget; an
+     * exiting JNT1 or JT1, an IRQ due or an EI pending skip nothing.
+     * Frames: JT1/JNT1 sync waits, DJNZ delays (one of 256 iterations)
+     * and a timer IRQ firing inside them, with each frame loop, skip on
+     * against off, compared frame by frame (sync cycle included: the waits
+     * reconverge). */
     {
-        I8048 c; memset(&c, 0, sizeof(c));
-        c.MB = true; c.in_irq = true;
-        c.irom[0] = 0x04; c.irom[1] = 0x50; /* JMP $050 */
-        c.P1 = 0xFB; c.P2 = 0xFF; c.t0 = true;
-        i8048_exec(&c, NULL);
-        if (c.PC == 0x050 && !(c.PC & 0x800)) pass++;
-        else { fail++; printf("FAIL: JMP in ISR PC=%03X (expected $050)\n", c.PC); }
+        static const uint8_t prog[] = {
+            0x04,0x10,                      /* 000: JMP $010 */
+            0,0,0,0,0,
+            0x1F,0x23,0xF0,0x62,0x93,       /* 007: INC R7 MOV A,#F0 MOV T,A RETR */
+            0,0,0,0,
+            0x23,0xF0,0x62,0x55,0x25,0x05,  /* 010: MOV A,#F0 MOV T,A STRT T EN TCNTI EN I */
+            0x56,0x16,0x46,0x18,            /* 016: JT1 $016 JNT1 $018 */
+            0xBA,0x00,0xEA,0x1C,            /* 01A: MOV R2,#00 DJNZ R2,$01C */
+            0x1E,0xFE,0xB8,0x10,0x90,       /* 01E: INC R6 MOV A,R6 MOV R0,#10 MOVX @R0,A */
+            0xBB,0x50,0xEB,0x25,0xE8,0x22,  /* 023: MOV R3,#50 DJNZ R3,$025 DJNZ R0,$022 */
+            0x04,0x16,                      /* 029: JMP $016 */
+        };
+        static AV a[16];          /* bit 0 event, bit 1 block, bit 2 no mid, bit 3 skip */
+        int ok = 1;
+        av_init(&a[0]);
+        memcpy(a[0].cpu.irom, prog, sizeof(prog));
+        I8048 *c = &a[0].cpu;
+        c->PC = 0x01C; c->iram[2] = 200;
+        c->timer_en = true; c->timer = 0xF8; c->tpre = 5;
+        I8048 ref = *c;
+        int k = i8048_idle_skip(c, 10000);
+        while (ref.cycles < c->cycles) i8048_exec(&ref, &a[0]);
+        ok = k == 250 && ref.cycles == c->cycles && ref.PC == c->PC && ref.timer == c->timer &&
+             ref.tpre == c->tpre && ref.iram[2] == c->iram[2] && c->iram[2] == 75 &&
+             !ref.timer_ovf && i8048_idle_skip(c, 10000) == 0;
+        c->PC = 0x018; c->timer_en = false; c->t1 = false;
+        ok = ok && i8048_idle_skip(c, 101) == 100 && c->PC == 0x018;
+        c->t1 = true;
+        ok = ok && i8048_idle_skip(c, 101) == 0;
+        c->t1 = false; c->ei_delay = 1;
+        ok = ok && i8048_idle_skip(c, 101) == 0;
+        c->ei_delay = 0; c->irq_pend = c->irq_en = true;
+        ok = ok && i8048_idle_skip(c, 101) == 0;
+        c->PC = 0x016; c->irq_pend = false;
+        ok = ok && i8048_idle_skip(c, 101) == 0;
+        free(a[0].rewind_buf);
+        for (int m = 0; m < 16; m++) {
+            av_init(&a[m]);
+            memcpy(a[m].cpu.irom, prog, sizeof(prog));
+            a[m].frame_sched = (m & 1) ? FRAME_SCHED_EVENT : FRAME_SCHED_POLL;
+            a[m].cpu_engine  = (m & 2) ? CPU_ENGINE_BLOCK : CPU_ENGINE_INTERP;
+            a[m].midframe_scan = !(m & 4);
+            a[m].idle_skip = m & 8;
+        }
+        for (int f = 0; f < 6; f++)
+            for (int m = 0; m < 16; m++) {
+                av_run_frame(&a[m]);
+                ok = ok && a[m].disp_sync_cycle == a[m & 4].disp_sync_cycle &&
+                     a[m].cpu.cycles == a[m & 4].cpu.cycles;
+            }
+        ok = ok && a[0].cpu.iram[7] > 0 && a[0].cpu.iram[6] > 0;
+        for (int m = 1; m < 16; m++) {
+            const I8048 *c0 = &a[m & 4].cpu, *c1 = &a[m].cpu;
+            if (c0->cycles != c1->cycles || c0->PC != c1->PC || c0->A != c1->A ||
+                c0->timer != c1->timer || c0->tpre != c1->tpre || c0->t1 != c1->t1 ||
+                memcmp(c0->iram, c1->iram, IRAM_SZ) != 0 || memcmp(c0->xram, c1->xram, XRAM_SZ) != 0 ||
+                memcmp(a[m & 4].disp.phosphor, a[m].disp.phosphor, sizeof(a[m].disp.phosphor)) != 0) {
+                ok = 0;
+                printf("FAIL: idle skip mode %d diverged (cy %llu/%llu PC %03X/%03X)\n", m,
+                       (unsigned long long)c0->cycles, (unsigned long long)c1->cycles, c0->PC, c1->PC);
+            }
+        }
+        if (ok) pass++;
+        else { fail++; printf("FAIL: idle-loop skip\n"); }
+        for (int m = 0; m < 16; m++) {
+            free(a[m].rewind_buf);
+            free(a[m].icache);
+        }
     }
 
-    /* Test 16: LED register decode matches BIOS P2 values */
+    /* Test 37: resource pack — ROMs come back byte for byte and in place,
+     * a cover decodes to its exact ARGB and compresses, covers and games
+     * are found by name, and truncated packs, out-of-range entries and
+     * cut LZ payloads are refused */
     {
-        int ok = 1;
-        /* BIOS uses P2=0x20,0x40,0x60,0x80,0xA0 for regs 0-4 */
-        if (led_reg_decode(0x20) != 0) ok = 0;
-        if (led_reg_decode(0x40) != 1) ok = 0;
-        if (led_reg_decode(0x60) != 2) ok = 0;
-        if (led_reg_decode(0x80) != 3) ok = 0;
-        if (led_reg_decode(0xA0) != 4) ok = 0;
-        if (led_reg_decode(0x00) != -1) ok = 0; /* unused */
-        if (led_reg_decode(0xC0) != -1) ok = 0; /* sound control */
-        if (ok) pass++; else { fail++; printf("FAIL: LED decode table\n"); }
+        enum { CW = 60, CH = 40 };
+        static uint8_t rgb[CW * CH * 3], game[EROM_SZ], irom[IROM_SZ], erom[EROM_SZ];
+        uint8_t *bios = (uint8_t *)malloc(IROM_SZ), *rom = (uint8_t *)malloc(sizeof(game));
+        for (int i = 0; i < IROM_SZ; i++) bios[i] = (uint8_t)(i * 7 + 1);
+        for (int i = 0; i < (int)sizeof(game); i++) game[i] = (uint8_t)(i ^ i >> 3);
+        for (int y = 0; y < CH; y++)
+            for (int x = 0; x < CW; x++) {
+                uint8_t *p = &rgb[(y * CW + x) * 3];
+                p[0] = (uint8_t)(x * 4); p[1] = (uint8_t)(y * 6); p[2] = (uint8_t)(x < 30 ? 200 : x ^ y);
+            }
+        memcpy(rom, game, sizeof(game));
+        PackBuild b = { 0 };
+        size_t zlen = 0, len = 0;
+        uint8_t *z = pack_cover_encode(rgb, CW, CH, &zlen);
+        bool ok = bios && rom && z && zlen < sizeof(rgb) / 2 &&
+                  pack_add(&b, PACK_BIOS, PACK_RAW, 0, 0, "bios", bios, IROM_SZ, IROM_SZ) &&
+                  pack_add(&b, PACK_GAME, PACK_RAW, 0, 0, "Test Game (USA)", rom, 2048, 2048) &&
+                  pack_add(&b, PACK_COVER, PACK_LZ_SUB, CW, CH, "Test Game", z, zlen, sizeof(rgb));
+        uint8_t *pk = ok ? pack_write(&b, &len) : NULL;
+        AVPack p;
+        ok = ok && pk && pack_open_mem(&p, pk, len) && p.count == 3;
+        int ci = ok ? pack_find(&p, PACK_COVER, "Test Game (USA)") : -1;
+        uint32_t *argb = ci >= 0 ? pack_cover_argb(&p, ci) : NULL;
+        ok = ok && ci == 2 && argb && pack_find(&p, PACK_COVER, "Other") < 0;
+        for (int i = 0; ok && i < CW * CH; i++)
+            ok = argb[i] == (0xFF000000u | (uint32_t)rgb[3 * i] << 16 | rgb[3 * i + 1] << 8 | rgb[3 * i + 2]);
+        free(argb);
+        ok = ok && pack_entry(&p, 1).data == pk + PACK_HDR + 3 * PACK_ENT + IROM_SZ &&
+             pack_load_roms(&p, "test game", irom, erom) &&
+             memcmp(irom, pk + PACK_HDR + 3 * PACK_ENT, IROM_SZ) == 0 &&
+             memcmp(erom, game, 2048) == 0 && erom[2048] == 0xFF && erom[EROM_SZ - 1] == 0xFF;
+        AVPack q;
+        ok = ok && !pack_open_mem(&q, pk, len - 1) && !pack_open_mem(&q, pk, PACK_HDR + PACK_ENT);
+        if (ok) {
+            uint8_t *e = pk + PACK_HDR + PACK_ENT;   /* game entry: offset past the end */
+            uint32_t off = rd_le32(e + 8);
+            wav_le32(e + 8, (uint32_t)len - 100);
+            ok = !pack_open_mem(&q, pk, len);
+            wav_le32(e + 8, off);
+            PackEntry c = pack_entry(&p, 2);
+            uint8_t *out = (uint8_t *)malloc(sizeof(rgb));
+            ok = ok && out && pack_lz_decompress(c.data, c.size, out, sizeof(rgb)) &&
+                 !pack_lz_decompress(c.data, c.size / 2, out, sizeof(rgb)) &&
+                 !pack_lz_decompress(c.data, c.size, out, sizeof(rgb) - 1);
+            free(out);
+        }
+        if (ok) pass++;
+        else { fail++; printf("FAIL: resource pack\n"); }
+        free(pk);
+        pack_build_free(&b);
+    }
+
+    /* Test 41: the rewind ring survives wraps. Random-length XRAM churn
+     * moves the wrap point from lap to lap and pop bursts free records
+     * before new ones are written; for each seed, every frame still counted
+     * pops back exactly, down to the oldest one. */
+    {
+        enum { N = 12000, SEEDS = 8 };
+        uint64_t *h = (uint64_t *)calloc(N, sizeof(uint64_t));
+        int ok = h != NULL, seed = 1, f = 0;
+        #define RW_RNG() (x ^= x << 13, x ^= x >> 17, x ^= x << 5)
+        #define RW_HASH() fnv1a(fnv1a(fnv1a(a->cpu.A, a->cpu.iram, IRAM_SZ), \
+                                      a->cpu.xram, XRAM_SZ), a->disp.col_data, sizeof(a->disp.col_data))
+        for (; ok && seed <= SEEDS; seed++) {
+            AV *a = (AV *)calloc(1, sizeof(AV));
+            uint32_t x = 0x9E3779B9u * (uint32_t)seed;
+            ok = a && (av_init(a), a->rewind_buf != NULL);
+            for (f = 0; ok && f < N; ) {
+                uint32_t v = RW_RNG();
+                if ((v & 0x3F) == 0) {   /* pop a few, keeping the oldest */
+                    for (int k = (int)(v >> 6) % 16; ok && k > 0 && a->rewind_count > 1; k--)
+                        ok = rewind_pop(a) && RW_HASH() == h[--f];
+                    continue;
+                }
+                int n = (v & 0x40) ? XRAM_SZ : (int)((v >> 8) % XRAM_SZ), at = (int)(v >> 20);
+                for (; n > 0; n--) a->cpu.xram[at++ % XRAM_SZ] = (uint8_t)RW_RNG();
+                v = RW_RNG();
+                a->cpu.iram[v % IRAM_SZ] = (uint8_t)(v >> 8);
+                a->disp.col_data[(v >> 16) % SW][v % 5] = (uint8_t)(v >> 24);
+                a->disp.cols_shown = SW;
+                a->cpu.A = (uint8_t)f;
+                rewind_push(a);
+                h[f++] = RW_HASH();
+            }
+            while (ok && rewind_pop(a)) ok = f > 0 && RW_HASH() == h[--f];
+            ok = ok && a->rewind_count == 0 && f > 0;   /* older frames evicted */
+            if (a) free(a->rewind_buf);
+            free(a);
+        }
+        #undef RW_RNG
+        #undef RW_HASH
+        if (ok) pass++;
+        else { fail++; printf("FAIL: rewind ring wrap (seed %d, frame %d)\n", seed - 1, f); }
+        free(h);
     }
 
     printf("\n%d passed, %d failed (%d total)\n", pass, fail, pass+fail);
     return fail > 0 ? 1 : 0;
 }
 
-/* ---- VRAM ASCII dump ---- */
-static void dump_vram_ascii(const AVDisp *d) {
-    for (int y = 0; y < SH; y++) {
-        for (int x = 0; x < SW; x++) {
-            float v = d->phosphor[x + y * SW];
-            putchar(v > 0.7f ? '#' : v > 0.3f ? '*' : v > 0.05f ? '.' : ' ');
-        }
-        putchar('\n');
+/* ---- Benchmark suite (--bench) ----
+ * Fixed workloads, one warmup run then BENCH_RUNS timed runs, median
+ * reported: BIOS boot + N frames of each ROM under the reference
+ * (interp/poll) and fastest (block/event) engines, a COP411L sweep over
+ * the sound commands of test 23, and full-frame av_raster() with each
+ * effect alone, none and all. ROMs are the bios/game paths given after
+ * the options, else the embedded set (EMBED_PACK, then EMBED_ROMS);
+ * without any, the CPU rows are skipped. --json FILE also writes the
+ * results as one object. */
+#define BENCH_RUNS      5
+#define BENCH_FRAMES    600     /* 40 s of emulated time per run */
+#define BENCH_SAMPLES   (AUDIO_RATE * 2)
+#define BENCH_RENDERS   100
+
+typedef struct {
+    const char    *name;
+    const uint8_t *data;        /* NULL = loaded into rom */
+    int            size;
+    uint8_t        rom[EROM_SZ];
+} BenchRom;
+
+static int bench_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Median of the timed runs, in ns */
+static uint64_t bench_median(uint64_t *t, int n) {
+    qsort(t, (size_t)n, sizeof(uint64_t), bench_cmp_u64);
+    return t[n / 2];
+}
+
+/* s as a JSON string: quotes, backslashes and control characters escaped */
+static void bench_json_str(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* One ROM, one engine: ns per run (median), cycles and frames per run */
+static uint64_t bench_cpu(const uint8_t *bios, const uint8_t *game, int engine, int sched,
+                          int frames, uint64_t *cycles) {
+    AV *av = (AV *)malloc(sizeof(AV));
+    uint64_t t[BENCH_RUNS];
+    if (!av) return 0;
+    for (int r = -1; r < BENCH_RUNS; r++) {
+        av_init(av);
+        av->cpu_engine = engine;
+        av->frame_sched = sched;
+        memcpy(av->cpu.irom, bios, IROM_SZ);
+        memcpy(av->cpu.erom, game, EROM_SZ);
+        uint64_t t0 = mono_ns();
+        for (int f = 0; f < frames; f++) av_run_frame(av);
+        uint64_t dt = mono_ns() - t0;
+        if (r >= 0) t[r] = dt;
+        *cycles = av->cpu.cycles;
+        free(av->rewind_buf);
+        free(av->icache);
     }
+    free(av);
+    return bench_median(t, BENCH_RUNS);
 }
 
+static int run_bench(int argc, char **argv) {
+    static const uint8_t cmds[] = {
+        0x10, 0x23, 0x31, 0x45, 0x52, 0x67, 0x70, 0x84, 0x99, 0xA1, 0xD2, 0xE5, 0xFC
+    };
+    static const struct { const char *name; int vign, warp, round, glow, scan; } looks[] = {
+        { "none",      0, 0, 0, 0, 0 }, { "vignette",  1, 0, 0, 0, 0 },
+        { "warp",      0, 1, 0, 0, 0 }, { "round",     0, 0, 1, 0, 0 },
+        { "glow",      0, 0, 0, 1, 0 }, { "scanlines", 0, 0, 0, 0, 1 },
+        { "default",   1, 1, 1, 1, 0 }, { "all",       1, 1, 1, 1, 1 },
+    };
+    static const struct { const char *name; int engine, sched; } engines[] = {
+        { "interp/poll",  CPU_ENGINE_INTERP, FRAME_SCHED_POLL },
+        { "block/event",  CPU_ENGINE_BLOCK,  FRAME_SCHED_EVENT },
+    };
+    const char *json_path = NULL, *bios_path = NULL;
+    int frames = BENCH_FRAMES, ngames = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) continue;
+        if (strcmp(argv[i], "--json") == 0 && i+1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i+1 < argc) {
+            char *end; long lv = strtol(argv[++i], &end, 10);
+            if (*end == '\0' && lv > 0 && lv < 1000000) frames = (int)lv;
+            else fprintf(stderr, "Invalid --frames value, ignoring\n");
+        }
+        else if (argv[i][0] == '-') fprintf(stderr, "Unknown --bench option %s, ignoring\n", argv[i]);
+        else if (!bios_path) bios_path = argv[i];
+        else ngames++;
+    }
+
+    /* Collect the ROMs (file paths win over the embedded set) */
+    uint8_t bios[IROM_SZ];
+#ifdef EMBED_PACK
+    AVPack pack;
+#endif
+    BenchRom *roms = NULL;
+    int nroms = 0;
+    if (bios_path && ngames) {
+        roms = (BenchRom *)calloc((size_t)ngames, sizeof(BenchRom));
+        if (!roms || !load_file(bios, IROM_SZ, bios_path)) { free(roms); return 1; }
+        for (int i = 1, seen = 0; i < argc; i++) {
+            if (strcmp(argv[i], "--frames") == 0 || strcmp(argv[i], "--json") == 0) { i++; continue; }
+            if (argv[i][0] == '-' || seen++ == 0) continue;
+            const char *base = argv[i];
+            for (const char *c = argv[i]; *c; c++)
+                if (*c == '/' || *c == '\\') base = c + 1;
+            roms[nroms].name = base;
+            if (!load_file(roms[nroms].rom, EROM_SZ, argv[i])) { free(roms); return 1; }
+            nroms++;
+        }
+    }
+#ifdef EMBED_PACK
+    else if (pack_open_mem(&pack, av_pack_blob, (size_t)(av_pack_blob_end - av_pack_blob)) &&
+             pack_find(&pack, PACK_BIOS, NULL) >= 0 && pack_find(&pack, PACK_GAME, NULL) >= 0) {
+        PackEntry e = pack_entry(&pack, pack_find(&pack, PACK_BIOS, NULL));
+        memset(bios, 0xFF, sizeof(bios));
+        memcpy(bios, e.data, e.size);
+        roms = (BenchRom *)calloc((size_t)pack.count, sizeof(BenchRom));
+        if (!roms) return 1;
+        for (int i = 0; i < pack.count; i++) {
+            if ((e = pack_entry(&pack, i)).kind != PACK_GAME) continue;
+            roms[nroms].name = e.name;
+            memset(roms[nroms].rom, 0xFF, EROM_SZ);
+            memcpy(roms[nroms].rom, e.data, e.size);
+            nroms++;
+        }
+    }
+#endif
+#ifdef EMBED_ROMS
+    else {
+        memset(bios, 0xFF, sizeof(bios));
+        memcpy(bios, embedded_bios, sizeof(embedded_bios) < IROM_SZ ? sizeof(embedded_bios) : IROM_SZ);
+        roms = (BenchRom *)calloc(EMBEDDED_GAME_COUNT, sizeof(BenchRom));
+        if (!roms) return 1;
+        for (; nroms < EMBEDDED_GAME_COUNT; nroms++) {
+            const EmbeddedRom *e = &embedded_games[nroms];
+            roms[nroms].name = e->name;
+            memset(roms[nroms].rom, 0xFF, EROM_SZ);
+            memcpy(roms[nroms].rom, e->data, (size_t)(e->size < EROM_SZ ? e->size : EROM_SZ));
+        }
+    }
+#else
+    else fprintf(stderr, "--bench: no ROMs (pass bios.rom game.rom...), skipping CPU runs\n");
+#endif
+
+    FILE *js = NULL;
+    if (json_path && !(js = fopen(json_path, "w"))) {
+        fprintf(stderr, "Cannot write %s\n", json_path);
+        free(roms);
+        return 1;
+    }
+    printf("=== Adventure Vision Benchmark (%d runs + warmup, median) ===\n", BENCH_RUNS);
+    if (js) fprintf(js, "{\"runs\":%d,\"frames\":%d,\"cpu\":[", BENCH_RUNS, frames);
+
+    /* CPU + frame loop: emulated MHz and frames/s */
+    for (int g = 0; g < nroms; g++) {
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            uint64_t cycles = 0;
+            uint64_t ns = bench_cpu(bios, roms[g].rom, engines[e].engine, engines[e].sched,
+                                    frames, &cycles);
+            double s = ns > 0 ? (double)ns * 1e-9 : 1e-9;
+            double mhz = (double)cycles / s * 1e-6, fps = frames / s;
+            printf("cpu     %-32.32s %-12s %8.2f MHz %9.1f fps (%.1fx real time)\n",
+                   roms[g].name, engines[e].name, mhz, fps, mhz / (CPU_CLK * 1e-6));
+            if (js) {
+                fprintf(js, "%s\n {\"rom\":", g || e ? "," : "");
+                bench_json_str(js, roms[g].name);
+                fprintf(js, ",\"engine\":\"%s\",\"cycles\":%llu,\"ns\":%llu,\"mhz\":%.3f,\"fps\":%.1f}",
+                        engines[e].name, (unsigned long long)cycles, (unsigned long long)ns, mhz, fps);
+            }
+        }
+    }
+    free(roms);
+
+    /* COP411L: every command of test 23, looping, rendered in callback-sized blocks */
+    {
+        static float blk[AUDIO_SAMPLES];
+        uint64_t t[BENCH_RUNS];
+        volatile float sink = 0.0f;  /* keeps the renders observable */
+        for (int r = -1; r < BENCH_RUNS; r++) {
+            uint64_t t0 = mono_ns();
+            for (size_t c = 0; c < sizeof(cmds); c++) {
+                COP411L s;
+                cop411_init(&s);
+                cop411_command(&s, 0x09);  /* loop + fast */
+                cop411_command(&s, cmds[c]);
+                for (int k = 0; k < BENCH_SAMPLES; k += AUDIO_SAMPLES) {
+                    cop411_render(&s, blk, AUDIO_SAMPLES, 1.02f);
+                    sink = blk[AUDIO_SAMPLES - 1];
+                }
+            }
+            uint64_t dt = mono_ns() - t0;
+            if (r >= 0) t[r] = dt;
+        }
+        (void)sink;
+        double ns = (double)bench_median(t, BENCH_RUNS) / ((double)sizeof(cmds) * BENCH_SAMPLES);
+        printf("audio   COP411L sweep (%2d effects)%19s %8.2f ns/sample (%.0fx real time)\n",
+               (int)sizeof(cmds), "", ns, 1e9 / AUDIO_RATE / ns);
+        if (js) fprintf(js, "\n],\"audio\":{\"effects\":%d,\"samples\":%d,\"ns_per_sample\":%.3f},\"render\":[",
+                        (int)sizeof(cmds), BENCH_SAMPLES, ns);
+    }
 
+    /* Rasterizer: full redraw of a fixed half-lit screen per effect set */
+    AV *av = (AV *)malloc(sizeof(AV));
+    AVRaster *ras = (AVRaster *)malloc(sizeof(AVRaster));
+    uint32_t *fb = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
+    bool ok = av && ras && fb;
+    if (ok) {
+        av_init(av);
+        uint32_t x = 0x12345678u;
+        for (int i = 0x100; i < XRAM_SZ; i++) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            av->cpu.xram[i] = (uint8_t)x;
+        }
+        for (int col = 0; col < SW; col++) disp_capture_column(&av->disp, av->cpu.xram, col);
+        for (int k = 0; k < 4; k++) disp_update(&av->disp, av->cfg_phosphor);
+        av_raster_init(ras);
+        for (size_t l = 0; l < sizeof(looks) / sizeof(looks[0]); l++) {
+            av->led_vignette = looks[l].vign;
+            av->mirror_warp = looks[l].warp;
+            av->led_round = looks[l].round;
+            av->led_glow = looks[l].glow;
+            av->scanlines = looks[l].scan;
+            uint64_t t[BENCH_RUNS];
+            for (int r = -1; r < BENCH_RUNS; r++) {
+                uint64_t t0 = mono_ns();
+                for (int k = 0; k < BENCH_RENDERS; k++) {
+                    ras->look = -1;  /* full frame, not the incremental path */
+                    av_raster(ras, av, fb);
+                }
+                uint64_t dt = mono_ns() - t0;
+                if (r >= 0) t[r] = dt;
+            }
+            double ns = (double)bench_median(t, BENCH_RUNS) / BENCH_RENDERS;
+            printf("render  %-45s %8.0f ns/frame (%.0f fps)\n", looks[l].name, ns, 1e9 / ns);
+            if (js) fprintf(js, "%s\n {\"effects\":\"%s\",\"ns_per_frame\":%.0f}",
+                            l ? "," : "", looks[l].name, ns);
+        }
+        free(av->rewind_buf);
+    } else fprintf(stderr, "Out of memory\n");
+    free(av); free(ras); free(fb);
+
+    if (js) {
+        fprintf(js, "\n]}\n");
+        bool wok = !ferror(js);
+        if (fclose(js) != 0 || !wok) { fprintf(stderr, "Write error on %s\n", json_path); ok = false; }
+    }
+    return ok ? 0 : 1;
+}
+#endif /* !AV_LIB */
 
 /* ============================================================================
  *  SDL FRONTEND + GAME SELECTOR
@@ -2169,22 +7156,17 @@ static void draw_text(SDL_Renderer *rr, int x, int y, const char *s, int sc,
 
 static int text_width(const char *s, int sc) { return (int)strlen(s) * 7 * sc; }
 
-/* ---- ROM scanner ---- */
-#define MAX_ROMS 64
-#define PATH_MAX_LEN 512
-
-typedef struct {
-    char path[PATH_MAX_LEN];
-    char name[128];
-    long size;
-} RomEntry;
-
-static int scan_roms(const char *dir, RomEntry *out, int max) {
+/* ---- ROM scanner ----
+ * Walks dir (readdir + stat only) and refreshes the library index: only
+ * new or modified files are read. Returns the number of ROM files. */
+static int scan_roms(const char *dir, RomList *lib) {
+    for (int i = 0; i < lib->n; i++) lib->v[i].seen = false;
+    lib->hashed = 0;
     DIR *d = opendir(dir);
     if (!d) return 0;
     int n = 0;
     struct dirent *ent;
-    while ((ent = readdir(d)) != NULL && n < max) {
+    while ((ent = readdir(d)) != NULL) {
         const char *name = ent->d_name;
         size_t len = strlen(name);
         if (len < 3 || len >= 128) continue;
@@ -2201,32 +7183,61 @@ static int scan_roms(const char *dir, RomEntry *out, int max) {
                 ext_ok = true;
         }
         if (!ext_ok) continue;
-        snprintf(out[n].path, PATH_MAX_LEN, "%s/%s", dir, name);
+        char path[PATH_MAX_LEN];
+        snprintf(path, PATH_MAX_LEN, "%s/%s", dir, name);
         struct stat st;
-        if (stat(out[n].path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
-        out[n].size = (long)st.st_size;
-        snprintf(out[n].name, 128, "%s", name);
-        printf("[SCAN] Found: %s (%ld bytes)\n", name, out[n].size);
-        n++;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (rom_index_update(lib, path, (long)st.st_size, (long long)st.st_mtime)) n++;
     }
     closedir(d);
+    for (int i = 0; i < lib->n && !lib->dirty; i++)
+        if (!lib->v[i].seen) lib->dirty = true;  /* a file went away */
+    printf("[SCAN] %d ROM files, %d read, %d from %s\n", n, lib->hashed, n - lib->hashed, ROM_INDEX_FILE);
     return n;
 }
 
 /* ---- Game selector ---- */
-#define MAX_GAMES 16
+typedef struct {
+    char     path[PATH_MAX_LEN];
+    char     name[128];         /* list entry and save file name */
+    const char *title;          /* metadata/cover key: rom_db title or name */
+    int      embed_idx;         /* embedded_games index, -1 = file */
+    int      pack_idx;          /* resource pack entry, -1 = none */
+    uint64_t hash;
+} MenuGame;
 
 typedef struct {
     char bios_path[PATH_MAX_LEN];
-    char game_paths[MAX_GAMES][PATH_MAX_LEN];
-    char game_names[MAX_GAMES][128];
-    int  game_embed_idx[MAX_GAMES];
-    int  game_count;
+    MenuGame *games;            /* growable, game_count used */
+    int  game_count, game_cap;
     int  selected;
+    int  top;                   /* first row shown in the list */
     bool has_bios;
     bool bios_embedded;
+    const AVPack *pack;         /* set by the caller, NULL = none */
+    int  bios_pack;             /* pack entry of the BIOS, -1 = none */
 } GameMenu;
 
+static MenuGame *menu_add(GameMenu *m) {
+    if (m->game_count == m->game_cap) {
+        int cap = m->game_cap ? m->game_cap * 2 : 16;
+        MenuGame *g = (MenuGame *)realloc(m->games, (size_t)cap * sizeof(MenuGame));
+        if (!g) return NULL;
+        m->games = g; m->game_cap = cap;
+    }
+    MenuGame *g = &m->games[m->game_count++];
+    memset(g, 0, sizeof(*g));
+    g->embed_idx = -1;
+    g->pack_idx = -1;
+    return g;
+}
+
+static void menu_free(GameMenu *m) {
+    free(m->games);
+    m->games = NULL;
+    m->game_count = m->game_cap = 0;
+}
+
 static const struct { const char *pat; const char *title; } known_games[] = {
     {"defender","Defender"},{"turtles","Turtles"},
     {"super_cobra","Super Cobra"},{"supercobra","Super Cobra"},
@@ -2488,6 +7499,8 @@ static const char *prettify_name(const char *filename) {
 }
 
 static bool is_bios(const RomEntry *r) {
+    int k = rom_db_find(r->hash);
+    if (k >= 0) return rom_db[k].bios;
     if (r->size == 1024) return true;  /* exact BIOS size */
     if (strcasestr(r->name, "bios")) return true;
     if (strcasestr(r->name, "ins8048")) return true;
@@ -2501,83 +7514,117 @@ static bool is_game(const RomEntry *r) {
     return r->size >= 512 && r->size <= 8192;
 }
 
+static int menu_game_cmp(const void *a, const void *b) {
+    return strcasecmp(((const MenuGame *)a)->name, ((const MenuGame *)b)->name);
+}
+
 static void menu_scan(GameMenu *m, const char *dir) {
     m->game_count = 0;
     m->has_bios = false;
     m->bios_embedded = false;
+    m->bios_pack = -1;
     m->selected = 0;
+    m->top = 0;
+    int embedded = 0;
+
+    /* Resource pack first: its ROMs are used in place */
+    if (m->pack && (m->bios_pack = pack_find(m->pack, PACK_BIOS, NULL)) >= 0) {
+        m->has_bios = true;
+        printf("[MENU] BIOS: pack \"%s\"\n", pack_entry(m->pack, m->bios_pack).name);
+    }
+    for (int i = 0; m->pack && i < m->pack->count; i++) {
+        PackEntry e = pack_entry(m->pack, i);
+        if (e.kind != PACK_GAME) continue;
+        MenuGame *g = menu_add(m);
+        if (!g) break;
+        g->pack_idx = i;
+        g->hash = fnv1a(FNV_INIT, e.data, e.size);
+        snprintf(g->name, 128, "%s", e.name);
+        printf("[MENU] Game: pack[%d] \"%s\" (%u bytes)\n", i, e.name, e.size);
+    }
 
 #ifdef EMBED_ROMS
-    m->has_bios = true;
-    m->bios_embedded = true;
-    printf("[MENU] BIOS: embedded (%d bytes)\n", (int)sizeof(embedded_bios));
-    for (int i = 0; i < EMBEDDED_GAME_COUNT && m->game_count < MAX_GAMES; i++) {
-        m->game_embed_idx[m->game_count] = i;
-        m->game_paths[m->game_count][0] = '\0';
-        snprintf(m->game_names[m->game_count], 128, "%s", embedded_games[i].name);
+    if (!m->has_bios) {
+        m->has_bios = true;
+        m->bios_embedded = true;
+        printf("[MENU] BIOS: embedded (%d bytes)\n", (int)sizeof(embedded_bios));
+    }
+    for (int i = 0; i < EMBEDDED_GAME_COUNT; i++) {
+        uint64_t h = fnv1a(FNV_INIT, embedded_games[i].data, (size_t)embedded_games[i].size);
+        bool dup = false;
+        for (int j = 0; j < m->game_count && !dup; j++) dup = m->games[j].hash == h;
+        if (dup) continue;
+        MenuGame *g = menu_add(m);
+        if (!g) break;
+        g->embed_idx = i;
+        g->hash = h;
+        snprintf(g->name, 128, "%s", embedded_games[i].name);
         printf("[MENU] Game: embedded[%d] \"%s\" (%d bytes)\n",
                i, embedded_games[i].name, embedded_games[i].size);
-        m->game_count++;
     }
 #endif
+    embedded = m->game_count;
 
-    RomEntry roms[MAX_ROMS];
-    int n = scan_roms(dir, roms, MAX_ROMS);
+    RomList lib;
+    memset(&lib, 0, sizeof(lib));
+    rom_index_load(&lib, ROM_INDEX_FILE);
+    scan_roms(dir, &lib);
+    if (lib.dirty && !rom_index_save(&lib, ROM_INDEX_FILE))
+        fprintf(stderr, "Cannot write %s\n", ROM_INDEX_FILE);
 
     if (!m->has_bios) {
-        for (int i = 0; i < n; i++) {
-            if (is_bios(&roms[i])) {
-                snprintf(m->bios_path, PATH_MAX_LEN, "%s", roms[i].path);
+        for (int i = 0; i < lib.n; i++) {
+            if (lib.v[i].seen && is_bios(&lib.v[i])) {
+                snprintf(m->bios_path, PATH_MAX_LEN, "%s", lib.v[i].path);
                 m->has_bios = true;
-                printf("[MENU] BIOS: %s (%ld bytes)\n", roms[i].name, roms[i].size);
+                printf("[MENU] BIOS: %s (%ld bytes)\n", lib.v[i].name, lib.v[i].size);
                 break;
             }
         }
     }
-    for (int i = 0; i < n && m->game_count < MAX_GAMES; i++) {
-        if (is_game(&roms[i])) {
-            const char *pretty = prettify_name(roms[i].name);
-            /* Skip if a game with a matching name is already listed (e.g. embedded).
-             * Use substring match: "Super Cobra" matches "Super Cobra (USA, Europe)" */
-            bool dup = false;
-            for (int j = 0; j < m->game_count; j++) {
-                if (strcasestr(m->game_names[j], pretty) ||
-                    strcasestr(pretty, m->game_names[j])) { dup = true; break; }
-            }
-            if (dup) {
-                printf("[MENU] Skip duplicate: %s\n", roms[i].name);
-                continue;
-            }
-            m->game_embed_idx[m->game_count] = -1;
-            snprintf(m->game_paths[m->game_count], PATH_MAX_LEN, "%s", roms[i].path);
-            snprintf(m->game_names[m->game_count], 128, "%s", pretty);
-            printf("[MENU] Game: %s (%ld bytes) -> \"%s\"\n",
-                   roms[i].name, roms[i].size, m->game_names[m->game_count]);
-            m->game_count++;
-        }
-    }
-
-    /* Sort games alphabetically (simple bubble sort, max 16 games) */
-    for (int i = 0; i < m->game_count - 1; i++) {
-        for (int j = i + 1; j < m->game_count; j++) {
-            if (strcasecmp(m->game_names[i], m->game_names[j]) > 0) {
-                char tmp_path[PATH_MAX_LEN], tmp_name[128];
-                int tmp_idx;
-                memcpy(tmp_path, m->game_paths[i], PATH_MAX_LEN);
-                memcpy(tmp_name, m->game_names[i], 128);
-                tmp_idx = m->game_embed_idx[i];
-                memcpy(m->game_paths[i], m->game_paths[j], PATH_MAX_LEN);
-                memcpy(m->game_names[i], m->game_names[j], 128);
-                m->game_embed_idx[i] = m->game_embed_idx[j];
-                memcpy(m->game_paths[j], tmp_path, PATH_MAX_LEN);
-                memcpy(m->game_names[j], tmp_name, 128);
-                m->game_embed_idx[j] = tmp_idx;
-            }
+    for (int i = 0; i < lib.n; i++) {
+        const RomEntry *r = &lib.v[i];
+        if (!r->seen || !is_game(r)) continue;
+        const char *pretty = prettify_name(r->name);
+        /* Skip dumps already listed, and files named like an embedded game
+         * (substring: "Super Cobra" matches "Super Cobra (USA, Europe)") */
+        bool dup = false;
+        for (int j = 0; j < m->game_count && !dup; j++)
+            dup = (r->hash && m->games[j].hash == r->hash) ||
+                  (j < embedded && (strcasestr(m->games[j].name, pretty) || strcasestr(pretty, m->games[j].name)));
+        if (dup) {
+            printf("[MENU] Skip duplicate: %s\n", r->name);
+            continue;
         }
+        MenuGame *g = menu_add(m);
+        if (!g) break;
+        snprintf(g->path, PATH_MAX_LEN, "%s", r->path);
+        snprintf(g->name, 128, "%s", pretty);
+        g->hash = r->hash;
     }
+    rom_list_free(&lib);
+    printf("[MENU] %d games\n", m->game_count);
+
+    /* Titles after sorting: an unknown dump's title points at its own name */
+    qsort(m->games, (size_t)m->game_count, sizeof(MenuGame), menu_game_cmp);
+    for (int i = 0; i < m->game_count; i++) {
+        int k = rom_db_find(m->games[i].hash);
+        m->games[i].title = k >= 0 ? rom_db[k].title : m->games[i].name;
+    }
+}
+
+/* ---- Cover texture from pixel data (pack or embedded) ---- */
+static SDL_Texture *create_cover_texture(SDL_Renderer *rr, const uint32_t *argb, int w, int h) {
+    /* Enable bilinear filtering for this texture */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+    SDL_Texture *tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STATIC, w, h);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0"); /* restore nearest for pixel art */
+    if (!tex) return NULL;
+    SDL_UpdateTexture(tex, NULL, argb, w * (int)sizeof(uint32_t));
+    return tex;
 }
 
-/* ---- Cover texture from embedded pixel data ---- */
 #ifdef EMBED_COVERS
 typedef struct { const char *name; const uint32_t *data; } CoverEntry;
 static const CoverEntry cover_entries[] = {
@@ -2588,17 +7635,6 @@ static const CoverEntry cover_entries[] = {
     { NULL, NULL }
 };
 
-static SDL_Texture *create_cover_texture(SDL_Renderer *rr, const uint32_t *argb) {
-    /* Enable bilinear filtering for this texture */
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
-    SDL_Texture *tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_ARGB8888,
-        SDL_TEXTUREACCESS_STATIC, COVER_THUMB_W, COVER_THUMB_H);
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0"); /* restore nearest for pixel art */
-    if (!tex) return NULL;
-    SDL_UpdateTexture(tex, NULL, argb, COVER_THUMB_W * sizeof(uint32_t));
-    return tex;
-}
-
 static const uint32_t *find_cover_data(const char *name) {
     for (int i = 0; cover_entries[i].name; i++)
         if (strcasestr(name, cover_entries[i].name))
@@ -2607,6 +7643,92 @@ static const uint32_t *find_cover_data(const char *name) {
 }
 #endif
 
+/* ---- Menu cover cache ----
+ * Cover textures are made on demand and kept in a small LRU cache (the
+ * selection and its neighbours, not the whole library). Pack photos are
+ * decompressed into a scratch ARGB buffer, uploaded and dropped; embedded
+ * photos are uploaded from their ARGB arrays; procedural covers are drawn
+ * once into a render-target texture at the menu's output scale instead of
+ * every frame. Textures belong to the renderer's thread and a pack cover
+ * decodes in about a millisecond, so loading stays on the menu thread with
+ * a budget of one texture per menu frame: the selection first, then a
+ * neighbour. */
+#define MENU_COVER_W   126
+#define MENU_COVER_H   180
+#define COVER_CACHE_N  8
+
+typedef struct {
+    int          game;          /* MenuGame index, -1 = free */
+    int          scale;         /* output scale of a procedural cover, 0 = photo */
+    unsigned     used;          /* LRU stamp */
+    SDL_Texture *tex;
+} CoverSlot;
+
+typedef struct { CoverSlot s[COVER_CACHE_N]; unsigned clock; } CoverCache;
+
+static void cover_cache_init(CoverCache *c) {
+    memset(c, 0, sizeof(*c));
+    for (int i = 0; i < COVER_CACHE_N; i++) c->s[i].game = -1;
+}
+
+static void cover_cache_free(CoverCache *c) {
+    for (int i = 0; i < COVER_CACHE_N; i++)
+        if (c->s[i].tex) SDL_DestroyTexture(c->s[i].tex);
+    cover_cache_init(c);
+}
+
+/* Texture for game idx, or NULL when it is not cached and *budget is 0.
+ * Drawing a procedural cover changes the render target and scale: the
+ * caller sets its own afterwards. */
+static SDL_Texture *cover_cache_get(CoverCache *c, const GameMenu *m, int idx,
+                                    SDL_Renderer *rr, int scale, int *budget) {
+    const char *title = m->games[idx].title;
+    const uint32_t *photo = NULL;
+    int packed = m->pack ? pack_find(m->pack, PACK_COVER, title) : -1;
+#ifdef EMBED_COVERS
+    if (packed < 0) photo = find_cover_data(title);
+#endif
+    bool is_photo = packed >= 0 || photo;
+    int want = is_photo ? 0 : scale;
+    CoverSlot *v = &c->s[0];
+    for (int i = 0; i < COVER_CACHE_N; i++) {
+        CoverSlot *s = &c->s[i];
+        if (s->game == idx && s->scale == want) { s->used = ++c->clock; return s->tex; }
+        if (s->game == idx || (v->game >= 0 && (s->game < 0 || s->used < v->used))) v = s;
+    }
+    if (*budget <= 0) return NULL;
+    (*budget)--;
+    if (v->tex) SDL_DestroyTexture(v->tex);
+    v->tex = NULL;
+    if (packed >= 0) {
+        PackEntry e = pack_entry(m->pack, packed);
+        uint32_t *argb = pack_cover_argb(m->pack, packed);
+        if (argb) v->tex = create_cover_texture(rr, argb, e.w, e.h);
+        free(argb);
+    }
+#ifdef EMBED_COVERS
+    if (photo) v->tex = create_cover_texture(rr, photo, COVER_THUMB_W, COVER_THUMB_H);
+#endif
+    if (!is_photo) {
+        v->tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                   MENU_COVER_W * scale, MENU_COVER_H * scale);
+        if (v->tex && SDL_SetRenderTarget(rr, v->tex) == 0) {
+            SDL_RenderSetViewport(rr, NULL);
+            SDL_RenderSetScale(rr, (float)scale, (float)scale);
+            SDL_SetRenderDrawColor(rr, 0, 0, 0, 255);
+            SDL_RenderClear(rr);
+            draw_cover(rr, 0, 0, MENU_COVER_W, MENU_COVER_H, title);
+        } else if (v->tex) {
+            SDL_DestroyTexture(v->tex);
+            v->tex = NULL;
+        }
+    }
+    v->game = idx;
+    v->scale = want;
+    v->used = ++c->clock;
+    return v->tex;
+}
+
 
 
 
@@ -2616,20 +7738,16 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
     const int LIST_Y0 = 68, LIST_ROW_H = 18;
     const int PANEL_X = 340;
     const int COVER_X = PANEL_X + 8, COVER_Y = 56;
-    const int COVER_W = 126, COVER_H = 180;
+    const int COVER_W = MENU_COVER_W, COVER_H = MENU_COVER_H;
     const int TEXT_X  = COVER_X + COVER_W + 14;
 
     Uint32 last_click_time = 0;
     int last_click_idx = -1;
 
-#ifdef EMBED_COVERS
-    SDL_Texture *cover_tex[MAX_GAMES];
-    memset(cover_tex, 0, sizeof(cover_tex));
-    for (int i = 0; i < m->game_count; i++) {
-        const uint32_t *data = find_cover_data(m->game_names[i]);
-        if (data) cover_tex[i] = create_cover_texture(rr, data);
-    }
-#endif
+    const int LIST_ROWS = (MENU_LH - 25 - 14 - LIST_Y0) / LIST_ROW_H + 1;
+
+    CoverCache covers;
+    cover_cache_init(&covers);
 
     SDL_RenderSetLogicalSize(rr, 0, 0);
 
@@ -2710,7 +7828,7 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
 
                 if (mx >= LIST_X - 5 && mx < LIST_X + LIST_W + 5 &&
                     my >= LIST_Y0 && m->game_count > 0) {
-                    int idx = (my - LIST_Y0) / LIST_ROW_H;
+                    int idx = m->top + (my - LIST_Y0) / LIST_ROW_H;
                     if (idx >= 0 && idx < m->game_count) {
                         Uint32 now = SDL_GetTicks();
                         if (idx == last_click_idx && (now - last_click_time) < 500) {
@@ -2741,6 +7859,18 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
             }
         }
 
+        /* Cover of the selection, then warm a neighbour with what is left
+         * of this frame's budget */
+        SDL_Texture *cover = NULL;
+        if (m->game_count > 0 && m->selected >= 0 && m->selected < m->game_count) {
+            int budget = 1, cs = (int)ceilf(osc);
+            if (cs < 1) cs = 1;
+            if (cs > 8) cs = 8;
+            cover = cover_cache_get(&covers, m, m->selected, rr, cs, &budget);
+            cover_cache_get(&covers, m, (m->selected + 1) % m->game_count, rr, cs, &budget);
+            cover_cache_get(&covers, m, (m->selected - 1 + m->game_count) % m->game_count, rr, cs, &budget);
+        }
+
         /* ---- Draw into high-res render target ---- */
         SDL_SetRenderTarget(rr, rt);
         SDL_RenderSetViewport(rr, NULL);
@@ -2779,17 +7909,20 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
         if (m->game_count > 0) {
             draw_text(rr, LIST_X, 52, "Select game:", 1, 120, 100, 85);
 
-            for (int i = 0; i < m->game_count; i++) {
-                int gy = LIST_Y0 + i * LIST_ROW_H;
+            /* Scroll so the selection stays visible */
+            if (m->selected < m->top) m->top = m->selected;
+            if (m->selected >= m->top + LIST_ROWS) m->top = m->selected - LIST_ROWS + 1;
+            for (int i = m->top; i < m->game_count; i++) {
+                int gy = LIST_Y0 + (i - m->top) * LIST_ROW_H;
                 if (gy + 14 > MENU_LH - 25) break;
                 if (i == m->selected) {
                     SDL_SetRenderDrawColor(rr, 40, 10, 8, 255);
                     { SDL_Rect r = { LIST_X - 2, gy, LIST_W, LIST_ROW_H - 2 }; SDL_RenderFillRect(rr, &r); }
                     SDL_SetRenderDrawColor(rr, 200, 50, 18, 255);
                     { SDL_Rect r = { LIST_X, gy + 2, 2, 12 }; SDL_RenderFillRect(rr, &r); }
-                    draw_text(rr, LIST_X + 10, gy + 3, m->game_names[i], 1, 255, 230, 210);
+                    draw_text(rr, LIST_X + 10, gy + 3, m->games[i].name, 1, 255, 230, 210);
                 } else {
-                    draw_text(rr, LIST_X + 10, gy + 3, m->game_names[i], 1, 130, 95, 75);
+                    draw_text(rr, LIST_X + 10, gy + 3, m->games[i].name, 1, 130, 95, 75);
                 }
             }
         }
@@ -2798,23 +7931,19 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
         { SDL_Rect r = { PANEL_X - 10, 48, 1, MENU_LH - 75 }; SDL_RenderFillRect(rr, &r); }
 
         if (m->game_count > 0 && m->selected >= 0 && m->selected < m->game_count) {
-            const char *gname = m->game_names[m->selected];
+            const char *gname = m->games[m->selected].name;
 
-            bool drew_photo = false;
-#ifdef EMBED_COVERS
-            if (m->selected < MAX_GAMES && cover_tex[m->selected]) {
+            if (cover) {
                 SDL_Rect dst = { COVER_X, COVER_Y, COVER_W, COVER_H };
-                SDL_RenderCopy(rr, cover_tex[m->selected], NULL, &dst);
-                drew_photo = true;
+                SDL_RenderCopy(rr, cover, NULL, &dst);
+            } else {
+                draw_cover(rr, COVER_X, COVER_Y, COVER_W, COVER_H, m->games[m->selected].title);
             }
-#endif
-            if (!drew_photo)
-                draw_cover(rr, COVER_X, COVER_Y, COVER_W, COVER_H, gname);
 
             SDL_SetRenderDrawColor(rr, 80, 35, 18, 255);
             { SDL_Rect r = {COVER_X-1, COVER_Y-1, COVER_W+2, COVER_H+2}; SDL_RenderDrawRect(rr, &r); }
 
-            const GameInfo *gi = find_game_info(gname);
+            const GameInfo *gi = find_game_info(m->games[m->selected].title);
             int iy = COVER_Y + 2;
             draw_text(rr, TEXT_X, iy, gname, 1, 220, 180, 150);
             iy += 16;
@@ -2868,10 +7997,7 @@ static int menu_run(GameMenu *m, SDL_Renderer *rr, SDL_Window *win) {
 menu_exit_play:
     {
         int result = m->selected;
-#ifdef EMBED_COVERS
-        for (int i = 0; i < m->game_count; i++)
-            if (cover_tex[i]) SDL_DestroyTexture(cover_tex[i]);
-#endif
+        cover_cache_free(&covers);
         if (rt) SDL_DestroyTexture(rt);
         SDL_RenderSetViewport(rr, NULL);
         SDL_RenderSetScale(rr, 1.0f, 1.0f);
@@ -2880,10 +8006,7 @@ menu_exit_play:
     }
 
 menu_exit_quit:
-#ifdef EMBED_COVERS
-    for (int i = 0; i < m->game_count; i++)
-        if (cover_tex[i]) SDL_DestroyTexture(cover_tex[i]);
-#endif
+    cover_cache_free(&covers);
     if (rt) SDL_DestroyTexture(rt);
     SDL_RenderSetViewport(rr, NULL);
     SDL_RenderSetScale(rr, 1.0f, 1.0f);
@@ -2907,19 +8030,37 @@ static void biquad_lp_compute(AV *av, float cutoff_hz, float Q) {
     av->bq_a2 = (1.0f - alpha) / a0;
 }
 
-/* Simple xorshift32 PRNG for RC jitter (fast, no state beyond one uint32) */
-static uint32_t audio_rng_state = 0xDEADBEEF;
-static float audio_randf(void) {
-    audio_rng_state ^= audio_rng_state << 13;
-    audio_rng_state ^= audio_rng_state >> 17;
-    audio_rng_state ^= audio_rng_state << 5;
-    return (float)(audio_rng_state & 0xFFFF) / 65535.0f; /* 0.0 - 1.0 */
+/* Speaker soft clip above |0.8|: 0.8 + 0.2*tanh((|f|-0.8)*5), linearly
+ * interpolated from clip_lut (within 1 LSB of tanhf at full volume) */
+static inline float audio_soft_clip(const float *lut, float f) {
+    float a = (fabsf(f) - 0.8f) * (5.0f * CLIP_LUT_N / 8.0f), c;
+    if (a >= (float)CLIP_LUT_N) c = lut[CLIP_LUT_N];
+    else { int k = (int)a; c = lut[k] + (lut[k+1] - lut[k]) * (a - (float)k); }
+    return f > 0 ? 0.8f + c : -0.8f - c;
+}
+
+/* Simple xorshift32 PRNG for RC jitter (fast, one uint32 per AV) */
+static float audio_randf(AV *av) {
+    av->audio_rng ^= av->audio_rng << 13;
+    av->audio_rng ^= av->audio_rng >> 17;
+    av->audio_rng ^= av->audio_rng << 5;
+    return (float)(av->audio_rng & 0xFFFF) / 65535.0f; /* 0.0 - 1.0 */
 }
 
 static void audio_cb(void *ud, uint8_t *stream, int len) {
     AV *av = (AV *)ud;
     int16_t *out = (int16_t *)stream;
     int n = len / (int)sizeof(int16_t);
+    PROF_BEGIN(av, PROF_AUDIO);
+#ifdef AV_PROFILE
+    if (av->prof) {
+        AVProf *pf = av->prof;
+        if (pf->audio_prev && prof_t_PROF_AUDIO - pf->audio_prev >
+                2 * (uint64_t)n * 1000000000u / AUDIO_RATE)
+            prof_push(pf, PROF_GAP, pf->audio_prev, prof_t_PROF_AUDIO);
+        pf->audio_prev = prof_t_PROF_AUDIO;
+    }
+#endif
     int vol = av->snd_volume;
     int amplitude = 300 * vol;  /* max 3000 at vol=10 */
     int prof = av->audio_profile;
@@ -2933,6 +8074,8 @@ static void audio_cb(void *ud, uint8_t *stream, int len) {
             /* Small speaker: LP ~3.5kHz with slight resonance (Q=0.9).
              * Simulates the tiny AV internal speaker's bandwidth. */
             biquad_lp_compute(av, 3500.0f, 0.9f);
+            for (int i = 0; i <= CLIP_LUT_N; i++)
+                av->clip_lut[i] = 0.2f * tanhf((float)i * (8.0f / CLIP_LUT_N));
             break;
         case AUDIO_HEADPHONE:
             /* Headphone: gentle LP ~8kHz, flat response (Q=0.707 = Butterworth) */
@@ -2949,7 +8092,7 @@ static void audio_cb(void *ud, uint8_t *stream, int len) {
      * Real hardware varies ±15%, we use a subtler effect for playability.
      * Drift is per-buffer (~11ms chunks) for a slow, organic wobble. */
     if (prof == AUDIO_SPEAKER) {
-        av->rc_drift += (audio_randf() - 0.5f) * 0.002f;
+        av->rc_drift += (audio_randf(av) - 0.5f) * 0.002f;
         /* Dampen drift back toward center */
         av->rc_drift *= 0.98f;
         av->rc_jitter += av->rc_drift;
@@ -2966,280 +8109,782 @@ static void audio_cb(void *ud, uint8_t *stream, int len) {
     float a1 = av->bq_a1, a2 = av->bq_a2;
     float jitter = av->rc_jitter;
 
-    for (int i = 0; i < n; i++) {
-        /* Apply RC jitter: temporarily scale phase_inc */
-        uint32_t orig_inc = av->snd.phase_inc;
-        if (jitter != 1.0f)
-            av->snd.phase_inc = (uint32_t)((float)orig_inc * jitter);
-        float s = cop411_sample(&av->snd);
-        av->snd.phase_inc = orig_inc;  /* restore */
+    /* Per block: COP411L runs, then the biquad, then clip + output */
+    float blk[256];
+    for (int i0 = 0; i0 < n; i0 += 256) {
+        int m = n - i0 < 256 ? n - i0 : 256;
+        sndq_render(&av->sndq, &av->snd, blk, m, jitter);
 
         /* Biquad filter: y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2]
-         *                     - a1*y[n-1] - a2*y[n-2] */
-        float y = b0*s + b1*x1 + b2*x2 - a1*y1 - a2*y2;
-        x2 = x1; x1 = s;
-        y2 = y1; y1 = y;
-
-        float fout = y;
-
-        /* Soft clip for speaker profile (simulates small speaker distortion) */
-        if (prof == AUDIO_SPEAKER && (fout > 0.8f || fout < -0.8f))
-            fout = fout > 0 ? 0.8f + 0.2f * tanhf((fout-0.8f)*5.0f)
-                            : -0.8f + 0.2f * tanhf((fout+0.8f)*5.0f);
+         *                     - a1*y[n-1] - a2*y[n-2]
+         * The 1e-20 DC offset keeps the decay after a sound ends out of
+         * denormals (very slow on x86 and soft-float-ish ARM VFP); it is
+         * absorbed by any nonzero input and far below one LSB. */
+        for (int i = 0; i < m; i++) {
+            float s = blk[i] + 1e-20f;
+            float y = b0*s + b1*x1 + b2*x2 - a1*y1 - a2*y2;
+            x2 = x1; x1 = s;
+            y2 = y1; y1 = y;
+            blk[i] = y;
+        }
 
-        int16_t sample = (int16_t)(fout * (float)amplitude);
-        out[i] = sample;
-        /* Enqueue to WAV ring buffer (lock-free: single writer) */
-        if (av->wav.active) {
-            uint32_t wi = av->wav.ring_wr;
-            av->wav.ring[wi & (WAV_RING_SZ - 1)] = sample;
-            av->wav.ring_wr = wi + 1;
+        int16_t *o = out + i0;
+        for (int i = 0; i < m; i++) {
+            float fout = blk[i];
+            /* Soft clip for speaker profile (simulates small speaker distortion) */
+            if (prof == AUDIO_SPEAKER && (fout > 0.8f || fout < -0.8f))
+                fout = audio_soft_clip(av->clip_lut, fout);
+            o[i] = (int16_t)(fout * (float)amplitude);
         }
+        /* Enqueue to the recorder ring (lock-free: single writer) */
+        if (av->wav.active) rec_audio(&av->wav, o, m);
     }
     av->bq_x1 = x1; av->bq_x2 = x2;
     av->bq_y1 = y1; av->bq_y2 = y2;
+    PROF_END(av, PROF_AUDIO);
 }
 
-/* ---- Render: faithful red LED POV display ----
- * Real hardware: 40 red LEDs + spinning mirror create discrete luminous
- * dots viewed through persistence of vision. Display is dark, designed
- * for dim rooms. Each LED appears as a round red dot with soft glow.
- * Color: warm LED red (not pure #FF0000), slightly orange at high
- * intensity, deep crimson when fading. */
-static uint32_t framebuf[WIN_W * WIN_H];
-
-/* Gamma lookup table: maps [0..255] intensity to gamma-corrected value.
- * Rebuilt when gamma setting changes. Eliminates powf() from render loop. */
-static float gamma_lut[256];
-static float gamma_lut_val = -1.0f;  /* current gamma, -1 = not initialized */
+/* Samples the device has played, from the callback's published snapshot */
+static uint64_t snd_played(const AV *av) {
+    const SndQueue *q = &av->sndq;
+    uint32_t seq;
+    uint64_t clk;
+    do {
+        seq = AV_LOAD_ACQ(&q->pub_seq);
+        clk = q->pub_clk;
+        AV_FENCE();
+    } while ((seq & 1) || seq != AV_LOAD_ACQ(&q->pub_seq));
+    return clk;
+}
 
-static void rebuild_gamma_lut(float gamma) {
-    if (gamma == gamma_lut_val) return;
-    gamma_lut_val = gamma;
-    for (int i = 0; i < 256; i++) {
-        float I = (float)i / 255.0f;
-        gamma_lut[i] = (gamma != 1.0f) ? powf(I, gamma) : I;
+/* SYNC_AUDIO pacer state (main loop) */
+typedef struct {
+    double emu;      /* emulated sound time, samples */
+    double lead;     /* smoothed emu - played after each frame, samples */
+    double next_ms;  /* wall-clock deadline of the next frame */
+    double trim;     /* integral term: learned timer/device clock ratio - 1 */
+    bool   locked;
+} AudioPace;
+
+/* Audio-clock pacing. Frames are still spaced by the wall clock, but its
+ * period is trimmed (dynamic rate control, PI on the lead, at most
+ * DRC_MAX) so the lead over the device settles on audio_latency: no drift
+ * between the 15 fps timer and the 44.1 kHz device, and no dependence on
+ * the display rate. Underruns, stalls and pauses re-lock one target ahead
+ * of the device; the learned trim is kept. */
+static void pace_audio(AV *av, AudioPace *p, bool ran) {
+    const double fr = (double)AUDIO_RATE / FPS;
+    double target = av->audio_latency * (AUDIO_RATE / 1000.0);
+    double played = (double)snd_played(av);
+    double now = (double)SDL_GetTicks();
+    if (ran) p->emu += fr;
+    double lead = p->emu - played;
+    if (!p->locked || !ran || lead < 0.0 || lead > target + 2.0 * fr) {
+        p->emu = played + target;
+        p->lead = lead = target;
+        p->next_ms = now;
+        p->locked = true;
     }
+    p->lead += (lead - p->lead) * 0.1;
+    double err = (target - p->lead) / fr;
+    if (err > 1.0) err = 1.0;
+    if (err < -1.0) err = -1.0;
+    p->trim += 1e-4 * err;
+    if (p->trim > DRC_MAX) p->trim = DRC_MAX;
+    if (p->trim < -DRC_MAX) p->trim = -DRC_MAX;
+    double r = p->trim + DRC_MAX * err;
+    if (r > DRC_MAX) r = DRC_MAX;
+    if (r < -DRC_MAX) r = -DRC_MAX;
+    p->next_ms += 1000.0 / FPS / (1.0 + r);
+    av->stat_audio_lead = (float)(p->lead * 1000.0 / AUDIO_RATE);
+    if (p->next_ms < now - 100.0) p->next_ms = now;
+    if (p->next_ms > now) SDL_Delay((Uint32)(p->next_ms - now));
 }
 
-static void render(SDL_Renderer *rr, AV *av) {
-    const AVDisp *d = &av->disp;
+/* ---- Netplay transport (UDP) ----
+ * One non-blocking datagram socket per session, IPv4. The host binds a
+ * port and takes the first joiner whose ROMs and timing match (hello 'H'
+ * carries their hash), plus up to NET_WATCHERS spectators ('S': hash and
+ * the first confirmed frame wanted, answered with a 'C' feed). Nothing
+ * runs until the handshake completes, so both machines start from the
+ * state the game loop opened with. Every host frame sends all the input
+ * the peer has not acknowledged, so lost datagrams need no retransmit. */
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+typedef SOCKET NetSock;
+#define NET_BAD_SOCK    INVALID_SOCKET
+#define net_sock_close  closesocket
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int NetSock;
+#define NET_BAD_SOCK    (-1)
+#define net_sock_close  close
+#endif
 
-    /* Rebuild gamma LUT if setting changed */
-    rebuild_gamma_lut(av->cfg_gamma);
+#define NET_WATCHERS    4
+#define NET_HELLO_EVERY 10      /* host frames between join/watch requests */
+#define NET_TIMEOUT_MS  5000    /* peer silent this long = lost */
+
+enum { NET_HOST, NET_JOIN, NET_WATCH };
+
+struct NetLink {
+    NetSock     s;
+    int         role;
+    bool        ready, lost, mismatch;
+    struct sockaddr_in peer;
+    struct sockaddr_in watch[NET_WATCHERS];
+    int         watchers;
+    uint64_t    hash;           /* ROMs + timing config, must match the peer's */
+    Uint32      last_rx;
+    uint32_t    tick;
+    const char *osd;            /* status message for the UI thread, NULL = none */
+    NetSession  ns;
+};
 
-    /* Count lit pixels for stats */
-    int lit = 0;
+/* What both ends must share to stay in lockstep */
+static uint64_t net_cfg_hash(const AV *av) {
+    int32_t cfg[4] = { av->t1_pulse_start, av->t1_pulse_end, av->midframe_scan, av->led_pipeline };
+    uint64_t h = fnv1a(FNV_INIT, av->cpu.irom, IROM_SZ);
+    h = fnv1a(h, av->cpu.erom, EROM_SZ);
+    return fnv1a(h, cfg, sizeof(cfg));
+}
 
-    /* Render LED display into framebuffer with glow/bloom effect.
-     * Real AV LEDs bleed light through the red filter, creating a soft
-     * halo around each lit dot. We render in two passes:
-     * 1. Sharp LED dots (full intensity)
-     * 2. Additive glow pass (soft bloom around lit pixels) */
-    memset(framebuf, 0, sizeof(framebuf)); /* black background */
+static bool net_addr_eq(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+}
 
-    /* Precompute vignette darkening LUT (simulates mirror viewing angle).
-     * Center of screen is full brightness, edges darken slightly. */
-    static float vignette[SW * SH];
-    static bool vignette_init = false;
-    if (!vignette_init) {
-        float cx = (float)SW * 0.5f, cy = (float)SH * 0.5f;
-        float max_r = sqrtf(cx*cx + cy*cy);
-        for (int y = 0; y < SH; y++) {
-            for (int x = 0; x < SW; x++) {
-                float dx = (float)x - cx, dy = (float)y - cy;
-                float r = sqrtf(dx*dx + dy*dy) / max_r;
-                /* Subtle vignette: 1.0 at center, ~0.82 at corners */
-                vignette[x + y * SW] = 1.0f - 0.18f * r * r;
+static void net_send(NetLink *l, const struct sockaddr_in *to, const uint8_t *p, int n) {
+    sendto(l->s, (const char *)p, n, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+/* 'H' (role) or 'S' (want): our hash, then a role byte or a frame */
+static void net_send_hello(NetLink *l, const struct sockaddr_in *to) {
+    uint8_t p[NET_HDR + 12];
+    int o = net_hdr(p, l->role == NET_WATCH ? 'S' : 'H');
+    wav_le64(p + o, l->hash);
+    wav_le32(p + o + 8, l->role == NET_WATCH ? l->ns.log_n : (uint32_t)l->role);
+    net_send(l, to, p, o + 12);
+}
+
+/* addr: "PORT" to host, "HOST:PORT" to join or watch */
+static NetLink *net_link_open(AV *av, int role, const char *addr) {
+    char host[256] = "";
+    const char *port = addr, *colon = strrchr(addr, ':');
+    if (role != NET_HOST) {
+        if (!colon || colon == addr || colon - addr >= (ptrdiff_t)sizeof(host)) {
+            fprintf(stderr, "Netplay: expected HOST:PORT, got '%s'\n", addr);
+            return NULL;
+        }
+        memcpy(host, addr, (size_t)(colon - addr));
+        host[colon - addr] = '\0';
+        port = colon + 1;
+    }
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return NULL;
+#endif
+    struct addrinfo hints, *ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = role == NET_HOST ? AI_PASSIVE : 0;
+    if (getaddrinfo(role == NET_HOST ? NULL : host, port, &hints, &ai) != 0 || !ai) {
+        fprintf(stderr, "Netplay: cannot resolve '%s'\n", addr);
+        return NULL;
+    }
+    NetLink *l = (NetLink *)calloc(1, sizeof(NetLink));
+    NetSock s = socket(AF_INET, SOCK_DGRAM, 0);
+    bool ok = l && s != NET_BAD_SOCK &&
+              (role != NET_HOST || bind(s, ai->ai_addr, (int)ai->ai_addrlen) == 0);
+    if (ok) {
+#ifdef _WIN32
+        u_long nb = 1;
+        ok = ioctlsocket(s, FIONBIO, &nb) == 0;
+#else
+        ok = fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+    }
+    if (!ok) {
+        fprintf(stderr, "Netplay: cannot open a socket on '%s'\n", addr);
+        if (s != NET_BAD_SOCK) net_sock_close(s);
+        freeaddrinfo(ai);
+        free(l);
+        return NULL;
+    }
+    l->s = s;
+    l->role = role;
+    if (role != NET_HOST) memcpy(&l->peer, ai->ai_addr, sizeof(l->peer));
+    freeaddrinfo(ai);
+    l->hash = net_cfg_hash(av);
+    l->last_rx = SDL_GetTicks();
+    net_session_init(&l->ns, role == NET_WATCH);
+    printf("Netplay: %s %s\n", role == NET_HOST ? "hosting on port" :
+           role == NET_JOIN ? "joining" : "watching", addr);
+    return l;
+}
+
+static void net_link_close(NetLink *l) {
+    if (!l) return;
+    printf("Netplay: %u frames, %u rollbacks (%u re-run), %u stalls\n",
+           l->ns.frame, l->ns.rollbacks, l->ns.resims, l->ns.stalls);
+    net_session_free(&l->ns);
+    net_sock_close(l->s);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    free(l);
+}
+
+/* Drain the socket */
+static void net_link_poll(NetLink *l) {
+    uint8_t p[NET_PKT_MAX + 16];
+    struct sockaddr_in from;
+    for (;;) {
+        socklen_t fl = sizeof(from);
+        int n = (int)recvfrom(l->s, (char *)p, sizeof(p), 0, (struct sockaddr *)&from, &fl);
+        if (n < NET_HDR) break;
+        if (memcmp(p, "AVN1", 4) != 0) continue;
+        char type = (char)p[4];
+        if ((type == 'H' || type == 'S') && n >= NET_HDR + 12 && rd_le64(p + NET_HDR) != l->hash) {
+            if (!l->mismatch) {
+                fprintf(stderr, "Netplay: peer has different ROMs or timing settings\n");
+                l->osd = "Netplay: ROM mismatch";
+            }
+            l->mismatch = true;
+            continue;
+        }
+        if (l->role == NET_HOST && type == 'H' && n >= NET_HDR + 12) {
+            if (l->ready && !net_addr_eq(&from, &l->peer)) continue;  /* one player */
+            if (!l->ready) l->osd = "Netplay: peer joined";
+            l->peer = from; l->ready = true; l->last_rx = SDL_GetTicks();
+            net_send_hello(l, &from);
+        } else if (l->role == NET_HOST && type == 'S' && n >= NET_HDR + 12) {
+            int w = 0;
+            while (w < l->watchers && !net_addr_eq(&from, &l->watch[w])) w++;
+            if (w == l->watchers && w < NET_WATCHERS) l->watch[l->watchers++] = from;
+            if (w < l->watchers) {
+                uint8_t f[NET_PKT_MAX];
+                net_send(l, &from, f, net_build_feed(&l->ns, rd_le32(p + NET_HDR + 8), f));
+            }
+        } else if (net_addr_eq(&from, &l->peer)) {
+            bool got = l->role == NET_WATCH ? net_recv_feed(&l->ns, p, n)
+                     : type == 'H' ? l->role == NET_JOIN : net_recv_input(&l->ns, p, n);
+            if (got) {
+                if (!l->ready) l->osd = l->role == NET_WATCH ? "Netplay: watching" : "Netplay: connected";
+                l->ready = true; l->lost = false; l->last_rx = SDL_GetTicks();
             }
         }
-        vignette_init = true;
     }
+}
 
-    /* Precompute mirror barrel distortion warp table.
-     * The AV uses a rotating concave mirror that introduces slight barrel
-     * distortion: columns near the edges are compressed horizontally.
-     * warp_x[x] maps logical column x to a sub-pixel output x position. */
-    static float warp_x[SW];
-    static bool warp_init = false;
-    if (!warp_init) {
-        float half = (float)SW * 0.5f;
-        float k = 0.08f;  /* barrel distortion coefficient (subtle) */
-        for (int x = 0; x < SW; x++) {
-            float u = ((float)x - half) / half;  /* -1..+1 */
-            float u2 = u * u;
-            float warped = u * (1.0f + k * u2); /* barrel: expand center, compress edges */
-            warp_x[x] = half + warped * half;
+/* Netplay host frame: returns true if a frame ran */
+static bool net_link_frame(NetLink *l, AV *av) {
+    net_link_poll(l);
+    if (l->ready && !l->lost && SDL_GetTicks() - l->last_rx > NET_TIMEOUT_MS) {
+        l->lost = true;
+        l->osd = "Netplay: peer lost";
+    }
+    bool ran = false;
+    if (l->role == NET_WATCH) {
+        /* Catch up to the live edge without drawing, then one per frame */
+        int n = 0;
+        while (n < FF_MAX_FRAMES && l->ns.log_n - l->ns.frame > NET_WINDOW) {
+            av->spec = SPEC_HIDDEN;
+            net_watch_step(av, &l->ns);
+            n++;
         }
-        warp_init = true;
+        av->spec = SPEC_NONE;
+        ran = net_watch_step(av, &l->ns) || n;
+        net_send_hello(l, &l->peer);
+    } else if (l->ready) {
+        net_sync(av, &l->ns);
+        ran = !av->paused && net_step(av, &l->ns, input_mask(av));
+        uint8_t p[NET_PKT_MAX];
+        net_send(l, &l->peer, p, net_build_input(&l->ns, p));
+    } else if (l->role == NET_JOIN && l->tick % NET_HELLO_EVERY == 0) {
+        net_send_hello(l, &l->peer);
+    }
+    l->tick++;
+    return ran;
+}
+
+/* State-changing actions that would fork the two machines: reset, load,
+ * rewind, fast-forward, movies, the LED pipeline (part of net_cfg_hash)
+ * and the debugger, whose stops split a frame in two */
+static bool net_key_blocked(const SDL_Keysym *k) {
+    return k->sym == SDLK_r || k->sym == SDLK_F7 || k->sym == SDLK_F8 || k->sym == SDLK_TAB ||
+           k->sym == SDLK_F3 || k->sym == SDLK_F1 || k->sym == SDLK_F9 || k->sym == SDLK_F10 ||
+           (k->sym == SDLK_F5 && (k->mod & KMOD_SHIFT));
+}
+
+/* ---- Host frame ----
+ * One iteration of the game loop's emulation side: run the frame(s)
+ * (fast-forward batch, run-ahead or a single frame), then pace. Called
+ * from the main loop, or from the emulation thread with emu_thread. */
+typedef struct {
+    bool        ran, ahead, ff_free;
+    int         ff_last;        /* frames in the last uncapped fast-forward batch */
+    AVMemState  ra_state;       /* run-ahead: the real frame */
+    Uint32      last_tick;      /* SYNC_TIMER: end of the previous frame */
+    AudioPace   pace;           /* SYNC_AUDIO */
+} HostFrame;
+
+static void host_frame_run(AV *av, HostFrame *h) {
+    /* Netplay: one frame per host frame, no fast-forward or run-ahead */
+    if (av->net) {
+        h->ff_free = h->ahead = false;
+        snd_set_div(av, 1);
+        h->ran = net_link_frame(av->net, av);
+        if (h->ran) rec_video(&av->wav, &av->disp);
+        return;
+    }
+    h->ran = !av->paused && !av->dbg.stepping;
+    /* Fast-forward: a batch of frames per host frame, rendered once;
+     * sound time is divided by the batch size (last one if uncapped) */
+    if (h->ff_last < 1) h->ff_last = 1;
+    bool ff = h->ran && av->ff_held && !av->dbg.active;
+    h->ff_free = ff && av->ff_speed == 0;
+    snd_set_div(av, ff ? (av->ff_speed ? av->ff_speed : h->ff_last) : 1);
+    if (ff) {
+        Uint32 t0 = SDL_GetTicks();
+        int n = 0;
+        do { av_run_frame(av); rec_video(&av->wav, &av->disp); n++; }
+        while (av->ff_speed ? n < av->ff_speed
+                            : n < FF_MAX_FRAMES && SDL_GetTicks() - t0 < 1000 / FPS);
+        h->ff_last = n;
     }
+    /* Run-ahead: present the future frame, then rewind to the real one */
+    h->ahead = h->ran && !ff && av->runahead > 0 && !av->dbg.active;
+    if (h->ahead) av_runahead(av, av->runahead, &h->ra_state);
+    else if (h->ran && !ff) {
+        av_run_frame(av);
+        if (av->dbg.stepping) { av_dbg_report(av); dbg_print(&av->cpu); }
+        else rec_video(&av->wav, &av->disp);
+    }
+}
 
-    /* Precompute round LED dot mask (SCALE×SCALE alpha values).
-     * Real AV LEDs produce round dots, not squares. */
-    static float led_mask[SCALE * SCALE];
-    static bool mask_init = false;
-    if (!mask_init) {
-        float cx = ((float)LED_SIZE - 1.0f) * 0.5f;
-        float cy = cx;
-        float r_sq = (cx + 0.5f) * (cx + 0.5f);
-        for (int dy = 0; dy < SCALE; dy++) {
-            for (int dx = 0; dx < SCALE; dx++) {
-                if (dx >= LED_SIZE || dy >= LED_SIZE) {
-                    led_mask[dy * SCALE + dx] = 0.0f;  /* gap */
-                    continue;
-                }
-                float fx = (float)dx - cx, fy = (float)dy - cy;
-                float d_sq = fx*fx + fy*fy;
-                if (d_sq <= r_sq * 0.5f)
-                    led_mask[dy * SCALE + dx] = 1.0f;
-                else if (d_sq <= r_sq)
-                    led_mask[dy * SCALE + dx] = 1.0f - (d_sq - r_sq*0.5f) / (r_sq*0.5f);
-                else
-                    led_mask[dy * SCALE + dx] = 0.0f;
-            }
-        }
-        mask_init = true;
+/* After the frame has been presented (or published) */
+static void host_frame_done(AV *av, HostFrame *h) {
+    if (h->ahead) { av_mem_load(av, &h->ra_state); rec_video(&av->wav, &av->disp); }
+}
+
+static void host_frame_pace(AV *av, HostFrame *h) {
+    Uint32 now = SDL_GetTicks();
+    if (!h->last_tick || (now - h->last_tick) > 500)
+        h->last_tick = now;
+    if (av->sync_mode == SYNC_AUDIO && av->adev) {
+        if (h->ff_free) h->pace.locked = false;  /* no sleep, re-lock after */
+        else pace_audio(av, &h->pace, h->ran);
+    } else if (!h->ff_free) {
+        Uint32 target = h->last_tick + (1000 / FPS);
+        if (now < target)
+            SDL_Delay(target - now);
     }
+    h->last_tick = SDL_GetTicks();
+}
 
-    /* Pass 1: sharp LED dots + accumulate glow source */
-    static float glow_src[SW * SH]; /* intensity at LED resolution */
-    memset(glow_src, 0, sizeof(glow_src));
+/* ---- Emulation thread (emu_thread) ----
+ * Runs host frames at the emulated rate, publishing each displayed frame
+ * into a triple buffer, so a slow present, a compositor hiccup or a window
+ * drag no longer holds up the CPU and the COP411L command stream, and the
+ * UI thread's rendering overlaps the next frame on another core. The UI
+ * takes lock around every event it handles (input, keys, menus all write
+ * AV directly) and draws the latest published frame without it; the lock
+ * is held for one host frame at a time, pacing sleeps outside it. */
+typedef struct {
+    AV          *av;
+    SDL_mutex   *lock;
+    SDL_Thread  *thread;
+    uint32_t     quit;
+    HostFrame    hf;
+    FrameTB      tb;
+} EmuThread;
+
+static int emu_thread_main(void *ud) {
+    EmuThread *t = (EmuThread *)ud;
+    while (!AV_LOAD_ACQ(&t->quit)) {
+        SDL_LockMutex(t->lock);
+        host_frame_run(t->av, &t->hf);
+        frame_tb_publish(&t->tb, &t->av->disp, t->av->cpu.cycles, t->av->stat_audio_lead);
+        host_frame_done(t->av, &t->hf);
+        SDL_UnlockMutex(t->lock);
+        host_frame_pace(t->av, &t->hf);
+        /* Uncapped fast-forward never sleeps in pace, and the mutex is not
+         * fair: give the UI's pending lock a chance */
+        if (t->hf.ff_free) SDL_Delay(1);
+    }
+    return 0;
+}
 
-    for (int y = 0; y < SH; y++) {
-        for (int x = 0; x < SW; x++) {
-            float I = d->phosphor[x + y * SW];
-            if (I < 0.01f) continue;
-            lit++;
+/* NULL (run on the main loop) if the thread cannot be started */
+static EmuThread *emu_thread_start(AV *av) {
+    EmuThread *t = (EmuThread *)calloc(1, sizeof(EmuThread));
+    if (!t) return NULL;
+    t->av = av;
+    t->hf.ff_last = 1;
+    frame_tb_init(&t->tb);
+    t->lock = SDL_CreateMutex();
+    if (t->lock) t->thread = SDL_CreateThread(emu_thread_main, "emu", t);
+    if (!t->thread) {
+        fprintf(stderr, "Emulation thread: %s, running on the main loop\n", SDL_GetError());
+        if (t->lock) SDL_DestroyMutex(t->lock);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
 
-            /* Apply vignette */
-            if (av->led_vignette) I *= vignette[x + y * SW];
+static void emu_thread_stop(EmuThread *t, AV *av) {
+    if (!t) return;
+    AV_STORE_REL(&t->quit, 1);
+    SDL_WaitThread(t->thread, NULL);
+    SDL_DestroyMutex(t->lock);
+    av->disp_view = NULL;
+    free(t);
+}
 
-            /* Apply gamma via LUT */
-            int idx = (int)(I * 255.0f);
-            if (idx > 255) idx = 255;
-            float Ig = gamma_lut[idx];
+/* GL entry points used by the RENDER_GL path, loaded per context */
+#define AV_GL_FUNCS(X) \
+    X(void,      GetIntegerv,   (GLenum, GLint *)) \
+    X(GLboolean, IsEnabled,     (GLenum)) \
+    X(void,      Enable,        (GLenum)) \
+    X(void,      Disable,       (GLenum)) \
+    X(void,      Viewport,      (GLint, GLint, GLsizei, GLsizei)) \
+    X(void,      GenTextures,   (GLsizei, GLuint *)) \
+    X(void,      BindTexture,   (GLenum, GLuint)) \
+    X(void,      ActiveTexture, (GLenum)) \
+    X(void,      TexParameteri, (GLenum, GLenum, GLint)) \
+    X(void,      PixelStorei,   (GLenum, GLint)) \
+    X(void,      TexImage2D,    (GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *)) \
+    X(void,      TexSubImage2D, (GLenum, GLint, GLint, GLint, GLsizei, GLsizei, GLenum, GLenum, const void *)) \
+    X(void,      Begin,         (GLenum)) \
+    X(void,      End,           (void)) \
+    X(void,      Vertex2f,      (GLfloat, GLfloat)) \
+    X(GLuint,    CreateShader,  (GLenum)) \
+    X(void,      ShaderSource,  (GLuint, GLsizei, const GLchar *const *, const GLint *)) \
+    X(void,      CompileShader, (GLuint)) \
+    X(void,      GetShaderiv,   (GLuint, GLenum, GLint *)) \
+    X(void,      GetShaderInfoLog, (GLuint, GLsizei, GLsizei *, GLchar *)) \
+    X(void,      DeleteShader,  (GLuint)) \
+    X(GLuint,    CreateProgram, (void)) \
+    X(void,      AttachShader,  (GLuint, GLuint)) \
+    X(void,      LinkProgram,   (GLuint)) \
+    X(void,      GetProgramiv,  (GLuint, GLenum, GLint *)) \
+    X(void,      UseProgram,    (GLuint)) \
+    X(GLint,     GetUniformLocation, (GLuint, const GLchar *)) \
+    X(void,      Uniform1i,     (GLint, GLint)) \
+    X(void,      Uniform1f,     (GLint, GLfloat))
 
-            glow_src[x + y * SW] = Ig;
+typedef struct {
+#define X(ret, name, args) ret (APIENTRY *name) args;
+    AV_GL_FUNCS(X)
+#undef X
+} AVGLApi;
+
+/* Shader uniforms, in gl_u[] order */
+static const char *const gl_uniform_names[] = {
+    "u_int", "u_gamma", "u_vignette", "u_warp", "u_round", "u_glow", "u_scanlines"
+};
+#define GL_NUNIFORMS ((int)(sizeof(gl_uniform_names) / sizeof(gl_uniform_names[0])))
+
+/* Per-instance render state: rasterizer, framebuffer, the streaming
+ * texture and GL objects. Allocated on the first render() of an AV, so
+ * no two instances share buffers. */
+struct AVRender {
+    AVRaster ras;
+    uint32_t framebuf[WIN_W * WIN_H];  /* persists: ras redraws it in place */
+    SDL_Texture  *tex;
+    SDL_Renderer *tex_rr;           /* track renderer for invalidation */
+    /* RENDER_GL: program and intensity texture live in gl_rr's context */
+    int      gl_state;              /* 0 = not tried, 1 = ready, -1 = unavailable */
+    SDL_Renderer *gl_rr;
+    AVGLApi  gl;
+    GLuint   gl_prog, gl_tex;
+    GLint    gl_u[GL_NUNIFORMS];
+    uint8_t  gl_int[SW * SH];       /* intensities as uploaded, 0..255 */
+};
 
-            /* LED red color: warm at high intensity, orange tint, deep crimson at low. */
-            uint8_t r = (uint8_t)(Ig * 255.0f);
-            uint8_t g = (uint8_t)(Ig * Ig * 30.0f);  /* slightly more orange */
-            uint8_t b = (uint8_t)(Ig * Ig * Ig * 6.0f);
+static AVRender *av_render_state(AV *av) {
+    if (av->rend) return av->rend;
+    AVRender *R = (AVRender *)calloc(1, sizeof(AVRender));
+    if (!R) return NULL;
+    av_raster_init(&R->ras);
+    av->rend = R;
+    return R;
+}
 
-            /* Compute output X (with optional barrel distortion from curved mirror) */
-            int bx, by;
-            if (av->mirror_warp) {
-                bx = (int)(warp_x[x] * (float)SCALE);
-                if (bx < 0) bx = 0;
-                if (bx + SCALE > WIN_W) bx = WIN_W - SCALE;
-            } else {
-                bx = x * SCALE;
-            }
-            by = y * SCALE;
+static void av_render_free(AV *av) {
+    if (!av->rend) return;
+    if (av->rend->tex) SDL_DestroyTexture(av->rend->tex);
+    free(av->rend);
+    av->rend = NULL;
+}
 
-            /* Fill LED dot: round (anti-aliased disk) or sharp square */
-            if (av->led_round) {
-                for (int dy = 0; dy < SCALE; dy++) {
-                    if (by + dy >= WIN_H) break;
-                    uint32_t *row = &framebuf[(by + dy) * WIN_W + bx];
-                    for (int dx = 0; dx < SCALE; dx++) {
-                        if (bx + dx >= WIN_W) break;
-                        float a = led_mask[dy * SCALE + dx];
-                        if (a < 0.01f) continue;
-                        row[dx] = ((uint8_t)(r*a)<<16)|((uint8_t)(g*a)<<8)|(uint8_t)(b*a);
-                    }
-                }
-            } else {
-                uint32_t col = (r << 16) | (g << 8) | b;
-                for (int dy = 0; dy < LED_SIZE; dy++) {
-                    if (by + dy >= WIN_H) break;
-                    uint32_t *row = &framebuf[(by + dy) * WIN_W + bx];
-                    for (int dx = 0; dx < LED_SIZE; dx++)
-                        row[dx] = col;
-                }
-            }
-        }
+/* ---- RENDER_GL: LED look in a fragment shader ----
+ * Same model as raster_span(), evaluated per output pixel from a SW×SH
+ * luminance texture, so window size costs the CPU nothing. Drawing
+ * happens in the SDL renderer's own GL context after SDL_RenderFlush();
+ * every piece of GL state touched is saved and restored, so SDL's state
+ * cache stays valid for the OSD drawn afterwards. */
+static const char gl_vs_src[] =
+    "varying vec2 p;\n"                 /* CPU framebuffer pixel coords */
+    "void main() {\n"
+    "    p = (gl_Vertex.xy * vec2(0.5, -0.5) + 0.5) * GRID * SCALE;\n"
+    "    gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);\n"
+    "}\n";
+
+static const char gl_fs_src[] =
+    "uniform sampler2D u_int;\n"
+    "uniform float u_gamma, u_vignette, u_warp, u_round, u_glow, u_scanlines;\n"
+    "varying vec2 p;\n"
+    /* glow_src: gamma of vignetted intensity, 0 below the lit threshold */
+    "float led(vec2 c) {\n"
+    "    if (c.x < 0.0 || c.y < 0.0 || c.x >= GRID.x || c.y >= GRID.y) return 0.0;\n"
+    "    float I = texture2D(u_int, (c + 0.5) / GRID).r;\n"
+    "    if (I < 0.01) return 0.0;\n"
+    "    vec2 d = c - GRID * 0.5;\n"
+    "    I *= mix(1.0, 1.0 - 0.18 * dot(d, d) / dot(GRID * 0.5, GRID * 0.5), u_vignette);\n"
+    "    return pow(I, u_gamma);\n"
+    "}\n"
+    /* dot_x of av_raster(): column origin, barrel-warped and clamped */
+    "float dot_x(float x) {\n"
+    "    if (u_warp < 0.5) return x * SCALE;\n"
+    "    float h = GRID.x * 0.5, u = (x - h) / h;\n"
+    "    return clamp(floor((h + u * (1.0 + WARP_K * u * u) * h) * SCALE), 0.0, (GRID.x - 1.0) * SCALE);\n"
+    "}\n"
+    /* led_mask, continuous: flat disk core with a linear rim */
+    "float mask(vec2 d) {\n"
+    "    if (d.x >= LED || d.y >= LED) return 0.0;\n"
+    "    if (u_round < 0.5) return 1.0;\n"
+    "    vec2 f = d - LED * 0.5;\n"
+    "    float r = LED * LED * 0.25, q = dot(f, f);\n"
+    "    return q <= r * 0.5 ? 1.0 : max(0.0, 1.0 - (q - r * 0.5) / (r * 0.5));\n"
+    "}\n"
+    "void main() {\n"
+    "    float y = floor(p.y / SCALE), dy = p.y - y * SCALE;\n"
+    "    float xe = p.x / SCALE;\n"
+    "    if (u_warp > 0.5) {\n"         /* invert the warp (Newton) */
+    "        float h = GRID.x * 0.5, v = (xe - h) / h, u = v;\n"
+    "        for (int i = 0; i < 3; i++)\n"
+    "            u -= (u + WARP_K * u * u * u - v) / (1.0 + 3.0 * WARP_K * u * u);\n"
+    "        xe = h + u * h;\n"
+    "    }\n"
+    /* walk down from the last column that may cover p.x: later columns
+     * drew over earlier ones, and warp clamps several onto each edge */
+    "    xe = p.x >= (GRID.x - 1.0) * SCALE ? GRID.x - 1.0 : floor(xe) + 1.0;\n"
+    "    vec3 c = vec3(0.0);\n"
+    "    for (int i = 0; i < 10; i++) {\n"
+    "        float x = xe - float(i), dx = p.x - dot_x(x);\n"
+    "        if (dx >= SCALE) break;\n"
+    "        if (dx < 0.0) continue;\n"
+    "        float Ig = led(vec2(x, y)), a = mask(vec2(dx, dy));\n"
+    "        if (Ig <= 0.0 || a < 0.01) continue;\n"
+    "        c = vec3(Ig, Ig * Ig * 30.0 / 255.0, Ig * Ig * Ig * 6.0 / 255.0) * a;\n"
+    "        break;\n"
+    "    }\n"
+    "    if (u_glow > 0.5) {\n"
+    "        vec2 g = vec2(floor(p.x / SCALE), y);\n"
+    "        float b = 0.0;\n"
+    "        for (int j = -1; j <= 1; j++)\n"
+    "            for (int i = -1; i <= 1; i++) b += led(g + vec2(float(i), float(j)));\n"
+    "        b *= 0.25 / 9.0;\n"
+    "        if (b >= 0.005) c = min(c + vec3(b * 90.0, b * b * 8.0, 0.0) / 255.0, 1.0);\n"
+    "    }\n"
+    "    if (u_scanlines > 0.5 && mod(y, 2.0) < 0.5) c *= 0.75;\n"
+    "    gl_FragColor = vec4(c, 1.0);\n"
+    "}\n";
+
+static GLuint gl_compile(const AVGLApi *gl, GLenum type, const char *src) {
+    char head[192];
+    snprintf(head, sizeof(head), "#version 110\n"
+             "const vec2 GRID = vec2(%d.0, %d.0);\n"
+             "const float SCALE = %d.0, LED = %d.0, WARP_K = 0.08;\n",
+             SW, SH, SCALE, LED_SIZE);
+    const GLchar *parts[2] = { head, src };
+    GLuint sh = gl->CreateShader(type);
+    gl->ShaderSource(sh, 2, parts, NULL);
+    gl->CompileShader(sh);
+    GLint ok = 0;
+    gl->GetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[512] = "";
+        gl->GetShaderInfoLog(sh, sizeof(log), NULL, log);
+        fprintf(stderr, "GL shader: %s\n", log);
+        gl->DeleteShader(sh);
+        return 0;
     }
+    return sh;
+}
 
-    /* Pass 2: LED glow/bloom — additive soft halo (toggle: 'g' key).
-     * Simple 3×3 box blur on glow_src at LED resolution, then add
-     * as a dim wide halo filling the full SCALE×SCALE cell. */
-    if (av->led_glow)
-    for (int y = 0; y < SH; y++) {
-        for (int x = 0; x < SW; x++) {
-            /* Sum 3×3 neighbors for bloom intensity */
-            float bloom = 0.0f;
-            for (int ny = y-1; ny <= y+1; ny++) {
-                if ((unsigned)ny >= (unsigned)SH) continue;
-                for (int nx = x-1; nx <= x+1; nx++) {
-                    if ((unsigned)nx >= (unsigned)SW) continue;
-                    bloom += glow_src[nx + ny * SW];
-                }
-            }
-            bloom *= (1.0f / 9.0f) * 0.25f;  /* 25% of average neighbor intensity */
-            if (bloom < 0.005f) continue;
+/* Load entry points, build the program and texture. False = stay on CPU. */
+static bool render_gl_init(AVRender *R, SDL_Renderer *rr) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(rr, &info) != 0 || strcmp(info.name, "opengl") != 0) {
+        fprintf(stderr, "GL render: renderer is '%s', using CPU\n",
+                SDL_GetRendererInfo(rr, &info) == 0 ? info.name : "?");
+        return false;
+    }
+    AVGLApi *gl = &R->gl;
+#define X(ret, name, args) \
+    if (!(*(void **)&gl->name = SDL_GL_GetProcAddress("gl" #name))) { \
+        fprintf(stderr, "GL render: missing gl" #name ", using CPU\n"); \
+        return false; \
+    }
+    AV_GL_FUNCS(X)
+#undef X
+    GLuint vs = gl_compile(gl, GL_VERTEX_SHADER, gl_vs_src);
+    GLuint fs = vs ? gl_compile(gl, GL_FRAGMENT_SHADER, gl_fs_src) : 0;
+    if (!fs) {
+        if (vs) gl->DeleteShader(vs);
+        return false;
+    }
+    R->gl_prog = gl->CreateProgram();
+    gl->AttachShader(R->gl_prog, vs);
+    gl->AttachShader(R->gl_prog, fs);
+    gl->LinkProgram(R->gl_prog);
+    gl->DeleteShader(vs);  /* flagged; freed with the program */
+    gl->DeleteShader(fs);
+    GLint ok = 0;
+    gl->GetProgramiv(R->gl_prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        fprintf(stderr, "GL render: link failed, using CPU\n");
+        return false;
+    }
+    for (int i = 0; i < GL_NUNIFORMS; i++)
+        R->gl_u[i] = gl->GetUniformLocation(R->gl_prog, gl_uniform_names[i]);
+
+    GLint tex0, unit, align;
+    gl->GetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+    gl->ActiveTexture(GL_TEXTURE0);
+    gl->GetIntegerv(GL_TEXTURE_BINDING_2D, &tex0);
+    gl->GetIntegerv(GL_UNPACK_ALIGNMENT, &align);
+    gl->GenTextures(1, &R->gl_tex);
+    gl->BindTexture(GL_TEXTURE_2D, R->gl_tex);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl->TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    gl->TexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, SW, SH, 0,
+                   GL_LUMINANCE, GL_UNSIGNED_BYTE, R->gl_int);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, align);
+    gl->BindTexture(GL_TEXTURE_2D, (GLuint)tex0);
+    gl->ActiveTexture((GLenum)unit);
+    return true;
+}
 
-            /* Bloom color: very dim red-orange */
-            uint8_t br = (uint8_t)(bloom * 90.0f);  /* dimmer than main dot */
-            uint8_t bg = (uint8_t)(bloom * bloom * 8.0f);
-            uint32_t bcol = (br << 16) | (bg << 8);
-            if (bcol == 0) continue;
+/* Draw the LED display into dst (output pixels, top-left origin) of an
+ * output oh pixels tall. Returns lit pixel count, or -1 if GL is unavailable. */
+static int render_gl(SDL_Renderer *rr, const AV *av, AVRender *R,
+                     const SDL_Rect *dst, int oh) {
+    if (R->gl_rr != rr) { R->gl_state = 0; R->gl_rr = rr; }
+    if (R->gl_state == 0) R->gl_state = render_gl_init(R, rr) ? 1 : -1;
+    if (R->gl_state < 0) return -1;
 
-            /* Additive blend into the full SCALE×SCALE cell (including gap) */
-            int bx = x * SCALE, by = y * SCALE;
-            for (int dy = 0; dy < SCALE; dy++) {
-                int py = by + dy;
-                if (py >= WIN_H) break;
-                uint32_t *row = &framebuf[py * WIN_W + bx];
-                for (int dx = 0; dx < SCALE; dx++) {
-                    if (bx + dx >= WIN_W) break;
-                    uint32_t existing = row[dx];
-                    /* Additive blend (saturate at 255) */
-                    uint32_t er = (existing >> 16) & 0xFF;
-                    uint32_t eg = (existing >> 8) & 0xFF;
-                    uint32_t eb = existing & 0xFF;
-                    er += br; if (er > 255) er = 255;
-                    eg += bg; if (eg > 255) eg = 255;
-                    row[dx] = (er << 16) | (eg << 8) | eb;
-                }
-            }
+    const AVDisp *d = av->disp_view ? av->disp_view : &av->disp;
+    int lit = 0;
+    for (int y = 0; y < SH; y++)
+        for (int x = 0; x < SW; x++) {
+            float I = disp_px(d, x, y);
+            uint8_t v = 0;
+            if (I >= 0.01f) { lit++; v = I >= 1.0f ? 255 : (uint8_t)(I * 255.0f + 0.5f); }
+            R->gl_int[x + y * SW] = v;
         }
-    }
 
-    /* Scanline effect: darken every other LED row directly in framebuffer.
-     * Done before texture upload so scanlines align perfectly with pixels
-     * regardless of viewport centering math. */
-    if (av->scanlines) {
-        for (int sy = 0; sy < SH; sy += 2) {
-            int py = sy * SCALE;
-            for (int dy = 0; dy < SCALE && py + dy < WIN_H; dy++) {
-                uint32_t *row = &framebuf[(py + dy) * WIN_W];
-                for (int px = 0; px < WIN_W; px++) {
-                    /* Darken: multiply each channel by ~0.75 */
-                    uint32_t c = row[px];
-                    uint32_t r = ((c >> 16) & 0xFF) * 3 / 4;
-                    uint32_t g = ((c >> 8)  & 0xFF) * 3 / 4;
-                    uint32_t b = (c         & 0xFF) * 3 / 4;
-                    row[px] = (r << 16) | (g << 8) | b;
-                }
-            }
-        }
+    const AVGLApi *gl = &R->gl;
+    SDL_RenderFlush(rr);
+    GLint prog, unit, tex0, align, vp[4];
+    GLboolean blend = gl->IsEnabled(GL_BLEND), scissor = gl->IsEnabled(GL_SCISSOR_TEST);
+    gl->GetIntegerv(GL_CURRENT_PROGRAM, &prog);
+    gl->GetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+    gl->ActiveTexture(GL_TEXTURE0);
+    gl->GetIntegerv(GL_TEXTURE_BINDING_2D, &tex0);
+    gl->GetIntegerv(GL_UNPACK_ALIGNMENT, &align);
+    gl->GetIntegerv(GL_VIEWPORT, vp);
+
+    gl->BindTexture(GL_TEXTURE_2D, R->gl_tex);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    PROF_BEGIN(av, PROF_UPLOAD);
+    gl->TexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SW, SH,
+                      GL_LUMINANCE, GL_UNSIGNED_BYTE, R->gl_int);
+    PROF_END(av, PROF_UPLOAD);
+    gl->Disable(GL_BLEND);
+    gl->Disable(GL_SCISSOR_TEST);
+    gl->Viewport(dst->x, oh - dst->y - dst->h, dst->w, dst->h);
+    gl->UseProgram(R->gl_prog);
+    gl->Uniform1i(R->gl_u[0], 0);
+    gl->Uniform1f(R->gl_u[1], av->cfg_gamma);
+    gl->Uniform1f(R->gl_u[2], av->led_vignette ? 1.0f : 0.0f);
+    gl->Uniform1f(R->gl_u[3], av->mirror_warp ? 1.0f : 0.0f);
+    gl->Uniform1f(R->gl_u[4], av->led_round ? 1.0f : 0.0f);
+    gl->Uniform1f(R->gl_u[5], av->led_glow ? 1.0f : 0.0f);
+    gl->Uniform1f(R->gl_u[6], av->scanlines ? 1.0f : 0.0f);
+    gl->Begin(GL_TRIANGLE_STRIP);
+    gl->Vertex2f(-1.0f, -1.0f); gl->Vertex2f(1.0f, -1.0f);
+    gl->Vertex2f(-1.0f,  1.0f); gl->Vertex2f(1.0f,  1.0f);
+    gl->End();
+
+    gl->UseProgram((GLuint)prog);
+    gl->Viewport(vp[0], vp[1], vp[2], vp[3]);
+    if (scissor) gl->Enable(GL_SCISSOR_TEST);
+    if (blend) gl->Enable(GL_BLEND);
+    gl->PixelStorei(GL_UNPACK_ALIGNMENT, align);
+    gl->BindTexture(GL_TEXTURE_2D, (GLuint)tex0);
+    gl->ActiveTexture((GLenum)unit);
+    return lit;
+}
+
+/* Output rect of the WIN_W×WIN_H game image: largest fit, or largest
+ * integer multiple, centred. oh = output height in pixels. */
+static void render_dst(SDL_Renderer *rr, bool integer, SDL_Rect *dst, int *oh) {
+    int ow;
+    SDL_GetRendererOutputSize(rr, &ow, oh);
+    if (ow < 1) ow = 1;
+    if (*oh < 1) *oh = 1;
+    float s;
+    if (integer) {
+        int sx = ow / WIN_W, sy = *oh / WIN_H;
+        s = (float)((sx < sy) ? sx : sy);
+        if (s < 1.0f) s = 1.0f;
+    } else {
+        float sx = (float)ow / WIN_W, sy = (float)*oh / WIN_H;
+        s = (sx < sy) ? sx : sy;
     }
+    int dw = (int)(WIN_W * s), dh = (int)(WIN_H * s);
+    *dst = (SDL_Rect){ (ow - dw) / 2, (*oh - dh) / 2, dw, dh };
+}
 
-    /* Upload framebuffer to texture and render */
-    static SDL_Texture *game_tex = NULL;
-    static SDL_Renderer *game_tex_rr = NULL;  /* track renderer for invalidation */
-    if (!game_tex || game_tex_rr != rr) {
-        if (game_tex) SDL_DestroyTexture(game_tex);
-        game_tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_RGB888,
+/* CPU backend: framebuf + streaming texture, copied to the output.
+ * Returns lit pixel count, -1 if the texture can't be created. */
+static int render_cpu(SDL_Renderer *rr, AV *av, AVRender *R) {
+    if (!R->tex || R->tex_rr != rr) {
+        if (R->tex) SDL_DestroyTexture(R->tex);
+        R->tex = SDL_CreateTexture(rr, SDL_PIXELFORMAT_RGB888,
                                 SDL_TEXTUREACCESS_STREAMING, WIN_W, WIN_H);
-        game_tex_rr = rr;
-        if (!game_tex) {
+        R->tex_rr = rr;
+        R->ras.look = -1;  /* new texture: upload everything */
+        if (!R->tex) {
             fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
-            return;
+            return -1;
         }
     }
-    SDL_UpdateTexture(game_tex, NULL, framebuf, WIN_W * sizeof(uint32_t));
+
+    int lit = av_raster(&R->ras, av, R->framebuf);
+    PROF_BEGIN(av, PROF_UPLOAD);
+    for (int k = 0; k < R->ras.nspan; k++) {
+        int x0 = R->ras.span0[k];
+        SDL_Rect dr = { x0, 0, R->ras.span1[k] - x0, WIN_H };
+        SDL_UpdateTexture(R->tex, &dr, R->framebuf + x0, WIN_W * sizeof(uint32_t));
+    }
+    PROF_END(av, PROF_UPLOAD);
 
     /* Clear full window */
     SDL_SetRenderDrawColor(rr, 0, 0, 0, 255);
@@ -3247,23 +8892,77 @@ static void render(SDL_Renderer *rr, AV *av) {
 
     if (av->integer_scale) {
         /* Integer scaling: bypass logical size for pixel-perfect multiples */
-        int ow, oh;
+        int oh;
+        SDL_Rect dst;
         SDL_RenderSetLogicalSize(rr, 0, 0);
-        SDL_GetRendererOutputSize(rr, &ow, &oh);
-        if (ow < 1) ow = 1;
-        if (oh < 1) oh = 1;
-        int sx = ow / WIN_W, sy = oh / WIN_H;
-        int s = (sx < sy) ? sx : sy;
-        if (s < 1) s = 1;
-        int dw = WIN_W * s, dh = WIN_H * s;
-        SDL_Rect dst = { (ow - dw) / 2, (oh - dh) / 2, dw, dh };
+        render_dst(rr, true, &dst, &oh);
         SDL_SetRenderDrawColor(rr, 0, 0, 0, 255);
         SDL_RenderClear(rr);
-        SDL_RenderCopy(rr, game_tex, NULL, &dst);
+        SDL_RenderCopy(rr, R->tex, NULL, &dst);
         SDL_RenderSetLogicalSize(rr, WIN_W, WIN_H);
     } else {
-        SDL_RenderCopy(rr, game_tex, NULL, NULL);
+        SDL_RenderCopy(rr, R->tex, NULL, NULL);
+    }
+    return lit;
+}
+
+#ifdef AV_PROFILE
+/* Profiler panel under the stats line: per zone, mean/max of the last
+ * PROF_HIST_N spans and their log2 histogram (1 us .. 32 ms, one bar per
+ * bucket, height relative to the fullest); the gap row counts underruns */
+static void render_prof(SDL_Renderer *rr, const AVProf *p) {
+    static const char *lbl[PROF_ZONES] = {
+        "run", "disp", "render", "upload", "present", "audio", "gap" };
+    const int x0 = 4, y0 = 15, row = 11, bx = 4 + 30 * 7;
+    SDL_SetRenderDrawColor(rr, 0, 0, 0, 180);
+    SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_BLEND);
+    SDL_Rect bg = {0, y0 - 2, bx + PROF_BUCKETS * 5 + 6, PROF_ZONES * row + 3};
+    SDL_RenderFillRect(rr, &bg);
+    SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_NONE);
+    for (int z = 0; z < PROF_ZONES; z++) {
+        uint32_t hist[PROF_BUCKETS], top = 1;
+        uint64_t mean, max;
+        int y = y0 + z * row;
+        char t[48];
+        if (z == PROF_GAP)
+            snprintf(t, sizeof(t), "%-7s %u underruns", lbl[z], AV_LOAD_ACQ(&p->head[z]));
+        else if (prof_hist(p, z, PROF_HIST_N, hist, &mean, &max))
+            snprintf(t, sizeof(t), "%-7s %6.0fus max %6.0fus", lbl[z],
+                     (double)mean / 1000.0, (double)max / 1000.0);
+        else
+            snprintf(t, sizeof(t), "%-7s -", lbl[z]);
+        draw_text(rr, x0, y, t, 1, 200, 200, 120);
+        if (z == PROF_GAP || !AV_LOAD_ACQ(&p->head[z])) continue;
+        for (int b = 0; b < PROF_BUCKETS; b++) if (hist[b] > top) top = hist[b];
+        SDL_SetRenderDrawColor(rr, 90, 90, 90, 255);
+        SDL_Rect axis = {bx, y + 8, PROF_BUCKETS * 5, 1};
+        SDL_RenderFillRect(rr, &axis);
+        SDL_SetRenderDrawColor(rr, 100, 200, 100, 255);
+        for (int b = 0; b < PROF_BUCKETS; b++) {
+            int hgt = (int)((hist[b] * 8 + top - 1) / top);
+            SDL_Rect bar = {bx + b * 5, y + 8 - hgt, 4, hgt};
+            if (hgt) SDL_RenderFillRect(rr, &bar);
+        }
+    }
+}
+#endif
+
+static void render(SDL_Renderer *rr, AV *av) {
+    AVRender *R = av_render_state(av);
+    if (!R) return;
+    PROF_BEGIN(av, PROF_RENDER);
+    int lit = -1;
+    if (av->render_backend == RENDER_GL && R->gl_state >= 0) {
+        int oh;
+        SDL_Rect dst;
+        render_dst(rr, av->integer_scale, &dst, &oh);
+        SDL_SetRenderDrawColor(rr, 0, 0, 0, 255);
+        SDL_RenderClear(rr);
+        lit = render_gl(rr, av, R, &dst, oh);
+        R->ras.look = -1;  /* CPU framebuf is stale from here on */
     }
+    if (lit < 0) lit = render_cpu(rr, av, R);
+    if (lit < 0) return;
 
     /* Store stats */
     av->stat_pixels = lit;
@@ -3271,14 +8970,21 @@ static void render(SDL_Renderer *rr, AV *av) {
     /* Stats overlay (FPS, cycles, pixels) */
     if (av->show_stats) {
         char sb[128];
-        snprintf(sb, sizeof(sb), "FPS:%.1f Cy:%llu Px:%d",
-            av->stat_fps, (unsigned long long)av->cpu.cycles, av->stat_pixels);
+        uint64_t cy = av->disp_view ? av->view_cycles : av->cpu.cycles;
+        float lead = av->disp_view ? av->view_audio_lead : av->stat_audio_lead;
+        int o = snprintf(sb, sizeof(sb), "FPS:%.1f Cy:%llu Px:%d",
+            av->stat_fps, (unsigned long long)cy, av->stat_pixels);
+        if (av->sync_mode == SYNC_AUDIO && av->adev && o > 0 && o < (int)sizeof(sb))
+            snprintf(sb + o, sizeof(sb) - (size_t)o, " A:%.0fms", lead);
         SDL_SetRenderDrawColor(rr, 0, 0, 0, 180);
         SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_BLEND);
         SDL_Rect sb_bg = {0, 0, (int)strlen(sb) * 7 + 8, 12};
         SDL_RenderFillRect(rr, &sb_bg);
         SDL_SetRenderDrawBlendMode(rr, SDL_BLENDMODE_NONE);
         draw_text(rr, 4, 2, sb, 1, 100, 200, 100);
+#ifdef AV_PROFILE
+        if (av->prof) render_prof(rr, av->prof);
+#endif
     }
 
     /* OSD overlay */
@@ -3302,7 +9008,10 @@ static void render(SDL_Renderer *rr, AV *av) {
         draw_text(rr, WIN_W/2 - 38, WIN_H/2 - 6, "PAUSE", 2, 255, 200, 180);
     }
 
+    PROF_END(av, PROF_RENDER);
+    PROF_BEGIN(av, PROF_PRESENT);
     SDL_RenderPresent(rr);
+    PROF_END(av, PROF_PRESENT);
 }
 
 /* ---- Per-game save filename ---- */
@@ -3325,17 +9034,35 @@ int main(int argc, char **argv) {
     av_init(&av);
 
     /* Check for --test (works in SDL build too) */
-    for (int i = 1; i < argc; i++)
+    for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--test") == 0) return run_self_test();
+        if (strcmp(argv[i], "--bench") == 0) return run_bench(argc, argv);
+        if (strcmp(argv[i], "--make-pack") == 0) return run_make_pack(argc - i - 1, argv + i + 1);
+    }
 
     /* Parse command line arguments */
     bool opt_fullscreen = false;
     bool opt_no_sound = false;
     int opt_scale = 0;
     int opt_volume = -1;  /* -1 = not set */
+    int opt_engine = -1;  /* -1 = not set */
+    int opt_sched = -1;   /* -1 = not set */
+    int opt_phos = -1;    /* -1 = not set */
+    int opt_render = -1;  /* -1 = not set */
+    int opt_sync = -1;    /* -1 = not set */
+    int opt_runahead = -1; /* -1 = not set */
+    int opt_ff = -1;      /* -1 = not set */
+    const char *opt_profile = NULL;
+    bool opt_thread = false;
+    bool opt_no_idle = false;
+    const char *opt_net = NULL;  /* --net-host PORT / --net-join or --net-watch HOST:PORT */
+    int opt_net_role = NET_HOST;
+    const char *opt_pack = NULL;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--fullscreen") == 0) opt_fullscreen = true;
         else if (strcmp(argv[i], "--no-sound") == 0) opt_no_sound = true;
+        else if (strcmp(argv[i], "--emu-thread") == 0) opt_thread = true;
+        else if (strcmp(argv[i], "--no-idle-skip") == 0) opt_no_idle = true;
         else if (strcmp(argv[i], "--scale") == 0 && i+1 < argc) {
             char *end; long lv = strtol(argv[++i], &end, 10);
             if (*end == '\0' && lv >= 1 && lv <= 10) opt_scale = (int)lv;
@@ -3346,6 +9073,50 @@ int main(int argc, char **argv) {
             if (*end == '\0' && lv >= 0 && lv <= 10) opt_volume = (int)lv;
             else fprintf(stderr, "Invalid --volume value, ignoring\n");
         }
+        else if (strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+            opt_engine = parse_cpu_engine(argv[++i]);
+            if (opt_engine < 0) fprintf(stderr, "Invalid --engine value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--sched") == 0 && i+1 < argc) {
+            opt_sched = parse_frame_sched(argv[++i]);
+            if (opt_sched < 0) fprintf(stderr, "Invalid --sched value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--phosphor-fmt") == 0 && i+1 < argc) {
+            opt_phos = parse_phosphor_fmt(argv[++i]);
+            if (opt_phos < 0) fprintf(stderr, "Invalid --phosphor-fmt value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--render") == 0 && i+1 < argc) {
+            opt_render = parse_render_backend(argv[++i]);
+            if (opt_render < 0) fprintf(stderr, "Invalid --render value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--sync") == 0 && i+1 < argc) {
+            opt_sync = parse_sync_mode(argv[++i]);
+            if (opt_sync < 0) fprintf(stderr, "Invalid --sync value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--runahead") == 0 && i+1 < argc) {
+            char *end; long lv = strtol(argv[++i], &end, 10);
+            if (*end == '\0' && lv >= 0 && lv <= RUNAHEAD_MAX) opt_runahead = (int)lv;
+            else fprintf(stderr, "Invalid --runahead value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--ff-speed") == 0 && i+1 < argc) {
+            char *end; long lv = strtol(argv[++i], &end, 10);
+            if (*end == '\0' && (lv == 0 || (lv >= 2 && lv <= FF_SPEED_MAX))) opt_ff = (int)lv;
+            else fprintf(stderr, "Invalid --ff-speed value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc)
+            opt_profile = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc)
+            opt_pack = argv[++i];
+        else if ((strcmp(argv[i], "--break") == 0 || strcmp(argv[i], "--watch") == 0) && i+1 < argc) {
+            bool w = argv[i][2] == 'w';
+            if (!av_dbg_add(&av, argv[++i], w))
+                fprintf(stderr, "Invalid %s value, ignoring\n", w ? "--watch" : "--break");
+        }
+        else if ((strcmp(argv[i], "--net-host") == 0 || strcmp(argv[i], "--net-join") == 0 ||
+                  strcmp(argv[i], "--net-watch") == 0) && i+1 < argc) {
+            opt_net_role = argv[i][6] == 'h' ? NET_HOST : argv[i][6] == 'j' ? NET_JOIN : NET_WATCH;
+            opt_net = argv[++i];
+        }
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             printf("Adventure Vision Emulator v15\n\n"
                    "Usage: %s [options] [bios.rom game.rom]\n\n"
@@ -3354,12 +9125,33 @@ int main(int argc, char **argv) {
                    "  --scale N       Window scale factor (1-10)\n"
                    "  --volume N      Initial volume (0-10, default 7)\n"
                    "  --no-sound      Disable audio\n"
+                   "  --engine NAME   CPU engine: interp (default) or block\n"
+                   "  --sched NAME    Frame loop: poll (default) or event\n"
+                   "  --no-idle-skip  Interpret BIOS wait loops step by step (reference)\n"
+                   "  --phosphor-fmt NAME  Phosphor buffer: float (default) or q8\n"
+                   "  --render NAME   Renderer: cpu (default) or gl (shader at output resolution)\n"
+                   "  --sync NAME     Pacing: timer (default) or audio (audio clock + rate control)\n"
+                   "  --runahead N    Show N frames ahead to cut input lag (0-4, default 0)\n"
+                   "  --ff-speed N    Fast-forward (hold Tab): N x speed (2-16), 0 = uncapped (default)\n"
+                   "  --emu-thread    Emulate on a separate thread (triple-buffered frames)\n"
+                   "  --profile FILE  Write a Chrome trace of hot-path timings (-DAV_PROFILE builds)\n"
+                   "  --break ADDR[-END]    Debugger breakpoint(s) at PC (hex)\n"
+                   "  --watch ADDR[-END][:r|w|rw]  Debugger XRAM watch (hex, bank*100+addr, default w)\n"
+                   "  --net-host PORT       Rollback netplay: host a two-player session\n"
+                   "  --net-join HOST:PORT  Join a hosted session\n"
+                   "  --net-watch HOST:PORT Watch a hosted session\n"
+                   "  --pack FILE     Games and covers from a resource pack (mapped, not copied)\n"
+                   "  --make-pack OUT bios game... [cover.ppm...]  Build a resource pack\n"
                    "  --test          Run built-in self-test suite\n"
+                   "  --bench [--json FILE] [--frames N] [bios game...]  Throughput benchmark\n"
                    "  -h, --help      Show this help\n"
                    "\nHeadless options (no SDL):\n"
                    "  --frames N      Run N frames (default 60)\n"
                    "  --input UDLR    Inject inputs (U/D/L/R/1/2/3/4)\n"
-                   "  --dump          Dump VRAM as ASCII art each frame\n", argv[0]);
+                   "  --dump          Dump VRAM as ASCII art each frame\n"
+                   "  --batch FILE    Run a manifest of jobs (bios game [input] [frames])\n"
+                   "  --jobs N        Batch worker threads (default: one per CPU)\n"
+                   "  --wide          Batch: run same-ROM jobs in lockstep SIMD lanes\n", argv[0]);
             return 0;
         }
     }
@@ -3370,7 +9162,26 @@ int main(int argc, char **argv) {
     if (opt_fullscreen) cfg_fs = true;
     if (opt_scale) av.cfg_scale = opt_scale;
     if (opt_volume >= 0) av.snd_volume = opt_volume;  /* CLI overrides config */
+    if (opt_engine >= 0) av.cpu_engine = opt_engine;
+    if (opt_sched >= 0) av.frame_sched = opt_sched;
+    if (opt_phos >= 0) av.phosphor_fmt = opt_phos;
+    if (opt_render >= 0) av.render_backend = opt_render;
+    if (opt_sync >= 0) av.sync_mode = opt_sync;
+    if (opt_runahead >= 0) av.runahead = opt_runahead;
+    if (opt_ff >= 0) av.ff_speed = opt_ff;
+    if (opt_thread) av.emu_thread = true;
+    if (opt_no_idle) av.idle_skip = false;
     av.cfg_no_sound = opt_no_sound;
+    if (opt_net && (av.dbg.bps || av.dbg.watches)) {
+        /* A debugger stop splits a frame, which the peer never sees */
+        fprintf(stderr, "--break/--watch cannot be used with netplay\n");
+        return 1;
+    }
+#ifdef AV_PROFILE
+    av.prof = prof_create();  /* rings feed the stats overlay too */
+#else
+    if (opt_profile) fprintf(stderr, "--profile needs a build with -DAV_PROFILE, ignoring\n");
+#endif
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) < 0) {
         fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
@@ -3392,6 +9203,8 @@ int main(int argc, char **argv) {
     /* Set minimum size so menu remains usable */
     SDL_SetWindowMinimumSize(win, 640, 380);
 
+    /* The GL backend draws through the renderer's context, so ask for it */
+    if (av.render_backend == RENDER_GL) SDL_SetHint(SDL_HINT_RENDER_DRIVER, "opengl");
     SDL_Renderer *rr = SDL_CreateRenderer(win, -1,
         SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     if (!rr) {
@@ -3426,19 +9239,33 @@ int main(int argc, char **argv) {
     char *pos_argv[2] = {NULL, NULL};
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] != '-' && pos_args < 2) pos_argv[pos_args++] = argv[i];
-        else if (strncmp(argv[i], "--scale", 7) == 0 || strncmp(argv[i], "--volume", 8) == 0) i++;
+        else if (strncmp(argv[i], "--scale", 7) == 0 || strncmp(argv[i], "--volume", 8) == 0 ||
+                 strcmp(argv[i], "--engine") == 0 || strcmp(argv[i], "--sched") == 0 ||
+                 strncmp(argv[i], "--net-", 6) == 0 || strcmp(argv[i], "--break") == 0 ||
+                 strcmp(argv[i], "--watch") == 0 || strcmp(argv[i], "--pack") == 0) i++;
     }
     bool direct_mode = (pos_args >= 2);
 
+    /* Resource pack: assembled in (EMBED_PACK), replaced by --pack FILE */
+    AVPack pack;
+    memset(&pack, 0, sizeof(pack));
+#ifdef EMBED_PACK
+    if (!pack_open_mem(&pack, av_pack_blob, (size_t)(av_pack_blob_end - av_pack_blob)))
+        fprintf(stderr, "Embedded resource pack is invalid, ignoring\n");
+#endif
+    if (opt_pack) pack_load(&pack, opt_pack);
+
     /* ===== OUTER LOOP: menu → game → menu ===== */
+    static HostFrame hf;
     while (1) {
         char game_title[256] = "Adventure Vision";
 
         /* Reset emulation state for new game, preserving persistent fields:
          * adev, rewind_buf, wav, config (volume, scale, gamma, etc.) */
         {
-            /* Stop WAV if active before resetting */
-            if (av.wav.active) {
+            /* Stop WAV and movie if active before resetting */
+            if (av.movie.fp) movie_stop(&av);
+            if (av.wav.fp) {
                 if (adev) SDL_LockAudioDevice(adev);
                 av.wav.active = false;
                 if (adev) SDL_UnlockAudioDevice(adev);
@@ -3446,7 +9273,7 @@ int main(int argc, char **argv) {
             }
             /* Save persistent fields */
             uint32_t      p_adev       = av.adev;
-            RewindSnap   *p_rwbuf      = av.rewind_buf;
+            Rewind       *p_rwbuf      = av.rewind_buf;
             int           p_volume     = av.snd_volume;
             int           p_scale      = av.cfg_scale;
             bool          p_no_sound   = av.cfg_no_sound;
@@ -3477,10 +9304,10 @@ int main(int argc, char **argv) {
             av.stat_frame_ticks = 0;
             av.stat_fps = 0;
             av.stat_pixels = 0;
-            memset(&av.dbg, 0, sizeof(av.dbg));
+            /* Breakpoints and watches (--break/--watch) carry over */
+            av.dbg.active = av.dbg.bps || av.dbg.watches;
+            av_dbg_realign(&av);
             av.dbg_run_to = 0xFFFF;
-            av.dbg_watch_addr = 0xFFFF;
-            av.dbg_watch_en = false;
             av.bq_x1 = av.bq_x2 = av.bq_y1 = av.bq_y2 = 0.0f;
             av.bq_prof = -1;  /* force recompute */
             av.rc_jitter = 1.0f; av.rc_drift = 0.0f;
@@ -3489,10 +9316,9 @@ int main(int argc, char **argv) {
             av.cpu.P2 = 0xFF;
             av.cpu.t0 = true;
             memset(av.cpu.xram + 0x100, 0xFF, 0x300);
-            /* Init sound (under lock since audio thread may be running) */
-            if (adev) SDL_LockAudioDevice(adev);
-            cop411_init(&av.snd);
-            if (adev) SDL_UnlockAudioDevice(adev);
+            /* Init sound (through the queue: the audio thread owns it) */
+            av.snd_proto_state = av.snd_proto_hi = 0;
+            snd_post(&av, SND_EV_RESET, 0, 0, NULL);
             snprintf(av.save_name, sizeof(av.save_name), "advision.sav");
             /* Restore persistent fields */
             av.adev          = p_adev;
@@ -3528,6 +9354,7 @@ int main(int argc, char **argv) {
         } else {
             GameMenu menu;
             memset(&menu, 0, sizeof(menu));
+            menu.pack = pack.base ? &pack : NULL;
             menu_scan(&menu, ".");
 
             if (menu.game_count == 0 && !menu.has_bios) {
@@ -3539,6 +9366,7 @@ int main(int argc, char **argv) {
                     "  P=Pause  R=Reset  F5=Save  F7=Load  F11=Fullscreen\n"
                     "  +/-=Volume\n",
                     argv[0]);
+                menu_free(&menu);
                 break;
             }
 
@@ -3547,10 +9375,17 @@ int main(int argc, char **argv) {
                 sel = 0;
             } else {
                 sel = menu_run(&menu, rr, win);
-                if (sel < 0) break;
+                if (sel < 0) { menu_free(&menu); break; }
             }
+            MenuGame game = menu.games[sel];
+            menu_free(&menu);
 
             /* Load BIOS */
+            if (menu.bios_pack >= 0) {
+                PackEntry e = pack_entry(&pack, menu.bios_pack);
+                memset(av.cpu.irom, 0xFF, IROM_SZ);
+                memcpy(av.cpu.irom, e.data, e.size);
+            } else
 #ifdef EMBED_ROMS
             if (menu.bios_embedded) {
                 int bsz = (int)sizeof(embedded_bios);
@@ -3563,32 +9398,43 @@ int main(int argc, char **argv) {
             }
 
             /* Load game */
-            if (menu.game_embed_idx[sel] >= 0) {
+            if (game.pack_idx >= 0) {
+                PackEntry e = pack_entry(&pack, game.pack_idx);
+                memset(av.cpu.erom, 0xFF, EROM_SZ);
+                memcpy(av.cpu.erom, e.data, e.size);
+            } else if (game.embed_idx >= 0) {
 #ifdef EMBED_ROMS
-                int idx = menu.game_embed_idx[sel];
+                int idx = game.embed_idx;
                 int gsz = embedded_games[idx].size;
                 if (gsz > EROM_SZ) gsz = EROM_SZ;
                 memcpy(av.cpu.erom, embedded_games[idx].data, gsz);
 #endif
             } else {
-                if (!load_file(av.cpu.erom, EROM_SZ, menu.game_paths[sel])) break;
+                if (!load_file(av.cpu.erom, EROM_SZ, game.path)) break;
             }
 
-            snprintf(game_title, sizeof(game_title), "Adventure Vision - %.200s", menu.game_names[sel]);
-            make_save_name(av.save_name, sizeof(av.save_name), menu.game_names[sel]);
+            snprintf(game_title, sizeof(game_title), "Adventure Vision - %.200s", game.name);
+            make_save_name(av.save_name, sizeof(av.save_name), game.name);
         }
 
         SDL_SetWindowTitle(win, game_title);
         av.back_to_menu = false;
 
         /* ===== GAME LOOP ===== */
+        if (opt_net && !(av.net = net_link_open(&av, opt_net_role, opt_net))) break;
+        EmuThread *et = av.emu_thread ? emu_thread_start(&av) : NULL;
         while (av.running && !av.back_to_menu) {
             SDL_Event e;
             while (SDL_PollEvent(&e)) {
+                if (et) SDL_LockMutex(et->lock);
                 switch (e.type) {
                 case SDL_QUIT: av.running = false; break;
                 case SDL_KEYDOWN: case SDL_KEYUP: {
                     bool p = (e.type == SDL_KEYDOWN);
+                    if (p && av.net && net_key_blocked(&e.key.keysym)) {
+                        osd_show(&av, "Not during netplay");
+                        break;
+                    }
                     switch (e.key.keysym.sym) {
                     case SDLK_UP:    av.input.u=p; break;
                     case SDLK_DOWN:  av.input.d=p; break;
@@ -3598,6 +9444,10 @@ int main(int argc, char **argv) {
                     case SDLK_x: av.input.b2=p; break;
                     case SDLK_a: av.input.b3=p; break;
                     case SDLK_s: av.input.b4=p; break;
+                    case SDLK_TAB:
+                        if (p != av.ff_held) osd_show(&av, p ? "Fast forward" : "Normal speed");
+                        av.ff_held = p;
+                        break;
                     case SDLK_ESCAPE:
                         if (p) {
                             if (direct_mode) av.running = false;
@@ -3611,7 +9461,7 @@ int main(int argc, char **argv) {
                         }
                         break;
                     case SDLK_r:
-                        if (p) { av_reset(&av); osd_show(&av, "Reset"); }
+                        if (p) { movie_cut(&av); av_reset(&av); osd_show(&av, "Reset"); }
                         break;
                     case SDLK_PLUS: case SDLK_EQUALS: case SDLK_KP_PLUS:
                         if (p) {
@@ -3645,23 +9495,29 @@ int main(int argc, char **argv) {
                         }
                         break;
                     case SDLK_F2:
+                        /* F2: WAV, Shift+F2: A/V capture (.avc) */
                         if(p) {
-                            if (av.wav.active) {
+                            if (av.wav.fp) {
+                                bool avc = av.wav.fmt == REC_AVC;
                                 AUDIO_LOCK(&av);
                                 av.wav.active = false;  /* signal audio thread to stop writing */
                                 AUDIO_UNLOCK(&av);
                                 wav_stop(&av.wav);
-                                osd_show(&av, "WAV saved");
+                                osd_show(&av, avc ? "Capture saved" : "WAV saved");
                             } else {
+                                int fmt = (e.key.keysym.mod & KMOD_SHIFT) ? REC_AVC : REC_WAV;
                                 time_t now = time(NULL);
                                 struct tm *t = localtime(&now);
                                 char wfn[128];
-                                snprintf(wfn, sizeof(wfn), "advision_%04d%02d%02d_%02d%02d%02d.wav",
-                                    t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
-                                if (adev) SDL_LockAudioDevice(adev);
-                                wav_start(&av.wav, wfn);
-                                if (adev) SDL_UnlockAudioDevice(adev);
-                                osd_show(&av, av.wav.active ? "Recording WAV..." : "WAV failed");
+                                snprintf(wfn, sizeof(wfn), "advision_%04d%02d%02d_%02d%02d%02d.%s",
+                                    t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec,
+                                    fmt == REC_AVC ? "avc" : "wav");
+                                wav_start(&av.wav, wfn, fmt);
+                                AUDIO_LOCK(&av);
+                                av.wav.active = av.wav.fp != NULL;
+                                AUDIO_UNLOCK(&av);
+                                osd_show(&av, !av.wav.active ? "Recording failed" :
+                                         fmt == REC_AVC ? "Capturing A/V..." : "Recording WAV...");
                             }
                         }
                         break;
@@ -3682,10 +9538,17 @@ int main(int argc, char **argv) {
                         }
                         break;
                     case SDLK_F5:
-                        if(p) {
-                            AUDIO_LOCK(&av);
+                        /* F5: save state, Shift+F5: input movie from here */
+                        if (p && (e.key.keysym.mod & KMOD_SHIFT)) {
+                            if (av.movie.fp) { movie_cut(&av); break; }
+                            time_t now = time(NULL);
+                            struct tm *t = localtime(&now);
+                            char mfn[128];
+                            snprintf(mfn, sizeof(mfn), "advision_%04d%02d%02d_%02d%02d%02d.avm",
+                                t->tm_year+1900, t->tm_mon+1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+                            osd_show(&av, movie_start(&av, mfn, true) ? "Recording movie..." : "Movie failed");
+                        } else if(p) {
                             bool saved = save_state(&av, av.save_name);
-                            AUDIO_UNLOCK(&av);
                             osd_show(&av, saved ? "State saved" : "Save failed!");
                         }
                         break;
@@ -3697,20 +9560,18 @@ int main(int argc, char **argv) {
                         break;
                     case SDLK_F7:
                         if(p) {
-                            AUDIO_LOCK(&av);
+                            movie_cut(&av);
                             bool loaded = load_state(&av, av.save_name);
-                            AUDIO_UNLOCK(&av);
                             osd_show(&av, loaded ? "State loaded" : "No save found");
                         }
                         break;
                     case SDLK_F8:
                         if(p) {
                             /* Rewind: pop multiple frames for visible effect */
-                            AUDIO_LOCK(&av);
                             int rw = 0;
+                            movie_cut(&av);
                             for (int ri = 0; ri < 4; ri++)
                                 if (rewind_pop(&av)) rw++;
-                            AUDIO_UNLOCK(&av);
                             if (rw > 0) {
                                 char rb[32]; snprintf(rb, 32, "Rewind -%d", rw);
                                 osd_show(&av, rb);
@@ -3720,7 +9581,7 @@ int main(int argc, char **argv) {
                     case SDLK_F9:
                         if(p) {
                             if (av.dbg.active && av.dbg.stepping) {
-                                i8048_exec(&av.cpu,&av); dbg_print(&av.cpu);
+                                av_dbg_step(&av); dbg_print(&av.cpu);
                             } else {
                                 av.scanlines = !av.scanlines;
                                 osd_show(&av, av.scanlines ? "Scanlines ON" : "Scanlines OFF");
@@ -3728,7 +9589,7 @@ int main(int argc, char **argv) {
                         }
                         break;
                     case SDLK_F10:
-                        if(p && av.dbg.active) av.dbg.stepping=false;
+                        if(p && av.dbg.active) av_dbg_continue(&av);
                         break;
                     case SDLK_F11:
                         if(p) {
@@ -3738,7 +9599,7 @@ int main(int argc, char **argv) {
                         }
                         break;
                     case SDLK_F12:
-                        if(p) { screenshot_bmp(rr); osd_show(&av, "Screenshot saved"); }
+                        if(p) { screenshot_png(&av); osd_show(&av, "Screenshot saved"); }
                         break;
                     case SDLK_g:
                         if(p) {
@@ -3778,6 +9639,11 @@ int main(int argc, char **argv) {
                 case SDL_DROPFILE: {
                     /* Drag & drop: load ROM file into game slot */
                     char *drop = e.drop.file;
+                    if (drop && av.net) {
+                        osd_show(&av, "Not during netplay");
+                        SDL_free(drop);
+                        drop = NULL;
+                    }
                     if (drop) {
                         long dsz = 0;
                         FILE *df = fopen(drop, "rb");
@@ -3805,6 +9671,7 @@ int main(int argc, char **argv) {
                     case SDL_CONTROLLER_BUTTON_B: av.input.b2=p; break;
                     case SDL_CONTROLLER_BUTTON_X: av.input.b3=p; break;
                     case SDL_CONTROLLER_BUTTON_Y: av.input.b4=p; break;
+                    case SDL_CONTROLLER_BUTTON_RIGHTSHOULDER: av.ff_held=p; break;
                     case SDL_CONTROLLER_BUTTON_START:
                         if(p){ av.paused=!av.paused; osd_show(&av, av.paused?"Paused":"Resumed"); }
                         break;
@@ -3825,8 +9692,10 @@ int main(int argc, char **argv) {
                     break;
                 default: break;
                 }
+                if (et) SDL_UnlockMutex(et->lock);
             }
 
+            if (et) SDL_LockMutex(et->lock);
             if(gp){
                 int16_t lx = SDL_GameControllerGetAxis(gp, SDL_CONTROLLER_AXIS_LEFTX);
                 int16_t ly = SDL_GameControllerGetAxis(gp, SDL_CONTROLLER_AXIS_LEFTY);
@@ -3842,33 +9711,38 @@ int main(int argc, char **argv) {
                 }
             }
 
-            if(!av.paused && !av.dbg.stepping)
-                av_run_frame(&av);
-
-            render(rr, &av);
-
-            /* Flush WAV ring buffer to disk (main thread only) */
-            if (av.wav.fp) wav_flush_safe(&av, &av.wav);
+            /* osd_* belongs to the UI thread (render() counts it down without
+             * the lock); netplay status from host_frame_run is posted here */
+            if (av.net && av.net->osd) { osd_show(&av, av.net->osd); av.net->osd = NULL; }
+
+            /* Threaded: draw the newest published frame, if any */
+            if (et) {
+                SDL_UnlockMutex(et->lock);
+                const TBFrame *shown = frame_tb_take(&et->tb);
+                if (!shown) { SDL_Delay(1); continue; }
+                av.disp_view = &shown->disp;
+                av.view_cycles = shown->cycles;
+                av.view_audio_lead = shown->audio_lead;
+                render(rr, &av);
+            } else {
+                host_frame_run(&av, &hf);
+                render(rr, &av);
+                host_frame_done(&av, &hf);
+            }
 
-            /* Frame timing + FPS measurement */
-            {
-                static Uint32 last_tick = 0;
-                Uint32 now = SDL_GetTicks();
-                if (!last_tick || (now - last_tick) > 500)
-                    last_tick = now;
-                /* Measure FPS (smoothed) */
-                Uint32 dt = now - av.stat_frame_ticks;
-                if (dt > 0 && dt < 500) {
-                    float ifps = 1000.0f / (float)dt;
-                    av.stat_fps = av.stat_fps * 0.9f + ifps * 0.1f;
-                }
-                av.stat_frame_ticks = now;
-                Uint32 target = last_tick + (1000 / FPS);
-                if (now < target)
-                    SDL_Delay(target - now);
-                last_tick = SDL_GetTicks();
+            /* Measure FPS (smoothed) */
+            Uint32 now = SDL_GetTicks();
+            Uint32 dt = now - av.stat_frame_ticks;
+            if (dt > 0 && dt < 500) {
+                float ifps = 1000.0f / (float)dt;
+                av.stat_fps = av.stat_fps * 0.9f + ifps * 0.1f;
             }
+            av.stat_frame_ticks = now;
+            if (!et) host_frame_pace(&av, &hf);
         }
+        emu_thread_stop(et, &av);
+        net_link_close(av.net);
+        av.net = NULL;
 
         if (!av.running || direct_mode) break;
         SDL_SetWindowTitle(win, "Adventure Vision");
@@ -3877,18 +9751,26 @@ int main(int argc, char **argv) {
     /* Save config on clean exit */
     config_save(&av, fullscreen);
 
-    /* Stop WAV recording if active */
-    if (av.wav.active) {
+    /* Stop WAV and movie recording if active */
+    if (av.movie.fp) movie_stop(&av);
+    if (av.wav.fp) {
         if (adev) SDL_LockAudioDevice(adev);
         av.wav.active = false;
         if (adev) SDL_UnlockAudioDevice(adev);
         wav_stop(&av.wav);
     }
 
-    /* Free rewind buffer */
+    /* Free rewind buffer and decoded-op cache */
     if (av.rewind_buf) { free(av.rewind_buf); av.rewind_buf = NULL; }
+    if (av.icache) { free(av.icache); av.icache = NULL; }
+    av_render_free(&av);
 
     if(adev) SDL_CloseAudioDevice(adev);
+#ifdef AV_PROFILE
+    if (av.prof && opt_profile) prof_export(av.prof, opt_profile);
+    free(av.prof);
+#endif
+    pack_close(&pack);
     if(gp) SDL_GameControllerClose(gp);
     SDL_DestroyRenderer(rr);
     SDL_DestroyWindow(win);
@@ -3896,19 +9778,276 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-#else
+#elif !defined(AV_LIB)
 /* Headless mode */
+
+/* ---- VRAM ASCII dump ---- */
+static void dump_vram_ascii(const AVDisp *d) {
+    for (int y = 0; y < SH; y++) {
+        for (int x = 0; x < SW; x++) {
+            float v = disp_px(d, x, y);
+            putchar(v > 0.7f ? '#' : v > 0.3f ? '*' : v > 0.05f ? '.' : ' ');
+        }
+        putchar('\n');
+    }
+}
+
+/* Append a WIN_W×WIN_H XRGB8888 buffer to f as packed RGB24 */
+static bool write_raw_rgb(FILE *f, const uint32_t *fb) {
+    uint8_t line[3 * WIN_W];
+    for (int y = 0; y < WIN_H; y++) {
+        for (int x = 0; x < WIN_W; x++) {
+            uint32_t c = fb[y * WIN_W + x];
+            line[3*x] = (uint8_t)(c >> 16); line[3*x+1] = (uint8_t)(c >> 8); line[3*x+2] = (uint8_t)c;
+        }
+        if (fwrite(line, sizeof(line), 1, f) != 1) return false;
+    }
+    return true;
+}
+
+/* ---- Batch runner (--batch manifest) ----
+ * Manifest: one job per line, "bios game [input] [frames]" ('#' comments,
+ * "double quotes" around paths with spaces, input "-" = no buttons,
+ * frames defaults to --frames). Each job gets its own AV and runs on a
+ * pool of worker threads. ROMs are loaded up front on the main thread and
+ * results are printed in manifest order once all jobs are done, so output
+ * does not depend on scheduling. Without pthreads (MSVC) jobs run serially.
+ * With --wide, consecutive jobs on the same ROMs and frame count are packed
+ * into groups of up to WIDE_LANES run by the lockstep wide interpreter. */
+#if !defined(_MSC_VER)
+#include <pthread.h>
+#include <unistd.h>
+#define AV_BATCH_THREADS
+#endif
+
+#define BATCH_MAX_JOBS 4096
+
+typedef struct {
+    char     game[512], input[32];
+    int      frames;
+    bool     ok;           /* ROMs loaded */
+    uint8_t  irom[IROM_SZ], erom[EROM_SZ];
+    I8048    cpu;          /* final CPU state for dbg_print */
+    int      lit;
+    uint64_t vram_hash;    /* FNV-1a over XRAM banks 1-3 (display VRAM) */
+} BatchJob;
+
+typedef struct {
+    BatchJob *jobs;
+    int      *unit;        /* first job of each work unit */
+    int       count, units, next;
+    int       engine, sched;
+#ifdef AV_BATCH_THREADS
+    pthread_mutex_t lock;
+#endif
+} BatchQueue;
+
+/* Split a manifest line in place into whitespace-separated fields,
+ * honouring "quoted strings". Returns the field count. */
+static int batch_split(char *p, char **tok, int max) {
+    int n = 0;
+    while (n < max) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+        if (!*p || *p == '#') break;
+        char end = ' ';
+        if (*p == '"') { end = '"'; p++; }
+        tok[n++] = p;
+        while (*p && *p != end && !(end == ' ' && (*p == '\t' || *p == '\r' || *p == '\n'))) p++;
+        if (!*p) break;
+        *p++ = '\0';
+    }
+    return n;
+}
+
+static void batch_job_setup(AV *av, const BatchJob *j, int engine, int sched) {
+    av_init(av);
+    av->cpu_engine = engine;
+    av->frame_sched = sched;
+    memcpy(av->cpu.irom, j->irom, IROM_SZ);
+    memcpy(av->cpu.erom, j->erom, EROM_SZ);
+    av_apply_input(av, j->input);
+}
+
+static void batch_job_finish(AV *av, BatchJob *j) {
+    j->cpu = av->cpu;
+    j->lit = disp_lit_count(&av->disp);
+    j->vram_hash = fnv1a(FNV_INIT, av->cpu.xram + 0x100, XRAM_SZ - 0x100);
+    free(av->rewind_buf);
+    free(av->icache);
+}
+
+/* Run jobs[0..n-1]: one AV, or n lockstep lanes when n > 1 */
+static void batch_run_unit(BatchJob *jobs, int n, int engine, int sched) {
+    AV *av = (AV *)malloc((size_t)n * sizeof(AV));
+    AV *lanes[WIDE_LANES];
+    if (!av) { for (int i = 0; i < n; i++) jobs[i].ok = false; return; }
+    for (int i = 0; i < n; i++) { batch_job_setup(&av[i], &jobs[i], engine, sched); lanes[i] = &av[i]; }
+    for (int f = 0; f < jobs[0].frames; f++) {
+        if (n == 1) av_run_frame(&av[0]);
+        else av_wide_run_frame(lanes, n);
+    }
+    for (int i = 0; i < n; i++) batch_job_finish(&av[i], &jobs[i]);
+    free(av);
+}
+
+static void *batch_worker(void *arg) {
+    BatchQueue *q = (BatchQueue *)arg;
+    for (;;) {
+#ifdef AV_BATCH_THREADS
+        pthread_mutex_lock(&q->lock);
+#endif
+        int u = q->next++;
+#ifdef AV_BATCH_THREADS
+        pthread_mutex_unlock(&q->lock);
+#endif
+        if (u >= q->units) break;
+        int first = q->unit[u], last = u + 1 < q->units ? q->unit[u + 1] : q->count;
+        if (q->jobs[first].ok) batch_run_unit(&q->jobs[first], last - first, q->engine, q->sched);
+    }
+    return NULL;
+}
+
+static int run_batch(const char *manifest, int threads, int def_frames, int engine, int sched, bool wide) {
+    FILE *f = fopen(manifest, "r");
+    if (!f) { fprintf(stderr, "Cannot open manifest '%s'\n", manifest); return 1; }
+    BatchJob *jobs = (BatchJob *)calloc(BATCH_MAX_JOBS, sizeof(BatchJob));
+    if (!jobs) { fclose(f); return 1; }
+    int n = 0;
+    char line[1200];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *tok[4];
+        lineno++;
+        int k = batch_split(line, tok, 4);
+        if (k == 0) continue;
+        if (k < 2) { fprintf(stderr, "Manifest line %d: expected 'bios game', skipping\n", lineno); continue; }
+        if (n >= BATCH_MAX_JOBS) { fprintf(stderr, "Manifest: more than %d jobs, truncating\n", BATCH_MAX_JOBS); break; }
+        BatchJob *j = &jobs[n++];
+        j->ok = load_file(j->irom, IROM_SZ, tok[0]) && load_file(j->erom, EROM_SZ, tok[1]);
+        snprintf(j->game, sizeof(j->game), "%s", tok[1]);
+        snprintf(j->input, sizeof(j->input), "%s", (k > 2 && strcmp(tok[2], "-") != 0) ? tok[2] : "");
+        long lv = k > 3 ? strtol(tok[3], NULL, 10) : 0;
+        j->frames = (lv > 0 && lv < 1000000) ? (int)lv : def_frames;
+    }
+    fclose(f);
+
+    BatchQueue q;
+    memset(&q, 0, sizeof(q));
+    q.jobs = jobs; q.count = n;
+    q.engine = engine; q.sched = sched;
+    q.unit = (int *)malloc((size_t)(n > 0 ? n : 1) * sizeof(int));
+    if (!q.unit) { free(jobs); return 1; }
+    for (int i = 0; i < n; i++) {
+        const BatchJob *j = &jobs[i];
+        int u0 = q.units ? q.unit[q.units - 1] : -1;
+        const BatchJob *h = u0 >= 0 ? &jobs[u0] : NULL;
+        if (wide && h && i - u0 < WIDE_LANES && h->ok && j->ok && h->frames == j->frames &&
+            memcmp(h->irom, j->irom, IROM_SZ) == 0 && memcmp(h->erom, j->erom, EROM_SZ) == 0)
+            continue;  /* joins the current lockstep group */
+        q.unit[q.units++] = i;
+    }
+#ifdef AV_BATCH_THREADS
+#ifdef _WIN32
+    if (threads <= 0) threads = pthread_num_processors_np();  /* MinGW: no sysconf */
+#else
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (threads > q.units) threads = q.units;
+    if (threads < 1) threads = 1;
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_t *tid = (pthread_t *)calloc((size_t)threads, sizeof(pthread_t));
+    int started = 0;
+    if (tid)
+        for (; started < threads; started++)
+            if (pthread_create(&tid[started], NULL, batch_worker, &q) != 0) break;
+    if (started == 0) batch_worker(&q);  /* no threads: run on the main thread */
+    for (int t = 0; t < started; t++) pthread_join(tid[t], NULL);
+    free(tid);
+    pthread_mutex_destroy(&q.lock);
+#else
+    (void)threads;
+    batch_worker(&q);
+#endif
+
+    int failed = 0;
+    for (int i = 0; i < n; i++) {
+        const BatchJob *j = &jobs[i];
+        printf("=== job %d: %s [%s] %d frames ===\n", i, j->game, j->input, j->frames);
+        if (!j->ok) { printf("FAILED\n"); failed++; continue; }
+        dbg_print(&j->cpu);
+        printf("%llu cycles, %d pixels lit, vram %016llx\n",
+               (unsigned long long)j->cpu.cycles, j->lit, (unsigned long long)j->vram_hash);
+    }
+    printf("%d jobs, %d failed\n", n, failed);
+    free(q.unit);
+    free(jobs);
+    return failed > 0 ? 1 : 0;
+}
+
+/* --png path for frame f: "%d" becomes the 5-digit frame number */
+static void png_frame_path(char *out, size_t sz, const char *pat, int f) {
+    const char *m = strstr(pat, "%d");
+    if (!m) { snprintf(out, sz, "%s", pat); return; }
+    snprintf(out, sz, "%.*s%05d%s", (int)(m - pat), pat, f, m + 2);
+}
+
+static size_t fx_ring_size(uint32_t slots) { return FX_RING_HDR + (size_t)slots * FX_REC_SZ; }
+
+/* Shared-memory ring for --shm: /dev/shm/NAME on Linux, kept after exit
+ * so a reader can drain it (the next run starts it over) */
+static uint8_t *fx_shm_open(const char *name, uint32_t slots) {
+#ifdef AV_STATE_MMAP
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    size_t sz = fx_ring_size(slots);
+    int fd = shm_open(path, O_CREAT | O_RDWR, 0600);
+    void *m = fd >= 0 && ftruncate(fd, (off_t)sz) == 0
+        ? mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (fd >= 0) close(fd);
+    if (m == MAP_FAILED) { fprintf(stderr, "Cannot create shared memory '%s'\n", path); return NULL; }
+    uint8_t *ring = (uint8_t *)m;
+    fx_header(ring, slots);
+    for (uint32_t k = 0; k < slots; k++) memset(ring + FX_RING_HDR + (size_t)k * FX_REC_SZ, 0, 4);
+    return ring;
+#else
+    (void)slots;
+    fprintf(stderr, "--shm '%s': no shared memory on this platform, use --pipe\n", name);
+    return NULL;
+#endif
+}
+
+static void fx_shm_close(uint8_t *ring, uint32_t slots) {
+#ifdef AV_STATE_MMAP
+    munmap(ring, fx_ring_size(slots));
+#else
+    (void)ring; (void)slots;
+#endif
+}
+
 int main(int argc, char **argv) {
     /* Check for --test flag */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--test") == 0) return run_self_test();
+        if (strcmp(argv[i], "--bench") == 0) return run_bench(argc, argv);
+        if (strcmp(argv[i], "--make-pack") == 0) return run_make_pack(argc - i - 1, argv + i + 1);
     }
 
     /* Parse headless options */
     int num_frames = 60;
     const char *input_str = NULL;
     bool do_dump = false;
+    int engine = CPU_ENGINE_INTERP;
+    int sched = FRAME_SCHED_POLL;
+    int phos = PHOSPHOR_FLOAT;
+    const char *batch_path = NULL;
+    int batch_threads = 0;  /* 0 = one per online CPU */
+    bool batch_wide = false;
+    const char *png_path = NULL, *raw_path = NULL, *movie_path = NULL;
+    const char *prof_path = NULL, *shm_name = NULL, *pipe_path = NULL;
     char *bios_path = NULL, *game_path = NULL;
+    const char *pack_path = NULL;
+    static AV av;
+    av_init(&av);
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--frames") == 0 && i+1 < argc) {
             char *end; long lv = strtol(argv[++i], &end, 10);
@@ -3918,51 +10057,197 @@ int main(int argc, char **argv) {
             input_str = argv[++i];
         else if (strcmp(argv[i], "--dump") == 0)
             do_dump = true;
+        else if (strcmp(argv[i], "--no-idle-skip") == 0)
+            av.idle_skip = false;
+        else if (strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+            int e = parse_cpu_engine(argv[++i]);
+            if (e >= 0) engine = e;
+            else fprintf(stderr, "Invalid --engine value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--sched") == 0 && i+1 < argc) {
+            int e = parse_frame_sched(argv[++i]);
+            if (e >= 0) sched = e;
+            else fprintf(stderr, "Invalid --sched value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--phosphor-fmt") == 0 && i+1 < argc) {
+            int e = parse_phosphor_fmt(argv[++i]);
+            if (e >= 0) phos = e;
+            else fprintf(stderr, "Invalid --phosphor-fmt value, ignoring\n");
+        }
+        else if (strcmp(argv[i], "--png") == 0 && i+1 < argc)
+            png_path = argv[++i];
+        else if (strcmp(argv[i], "--raw") == 0 && i+1 < argc)
+            raw_path = argv[++i];
+        else if (strcmp(argv[i], "--shm") == 0 && i+1 < argc)
+            shm_name = argv[++i];
+        else if (strcmp(argv[i], "--pipe") == 0 && i+1 < argc)
+            pipe_path = argv[++i];
+        else if (strcmp(argv[i], "--movie") == 0 && i+1 < argc)
+            movie_path = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0 && i+1 < argc)
+            prof_path = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc)
+            batch_path = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i+1 < argc)
+            pack_path = argv[++i];
+        else if ((strcmp(argv[i], "--break") == 0 || strcmp(argv[i], "--watch") == 0) && i+1 < argc) {
+            bool w = argv[i][2] == 'w';
+            if (!av_dbg_add(&av, argv[++i], w))
+                fprintf(stderr, "Invalid %s value, ignoring\n", w ? "--watch" : "--break");
+        }
+        else if (strcmp(argv[i], "--wide") == 0)
+            batch_wide = true;
+        else if (strcmp(argv[i], "--jobs") == 0 && i+1 < argc) {
+            char *end; long lv = strtol(argv[++i], &end, 10);
+            if (*end == '\0' && lv >= 1 && lv <= 256) batch_threads = (int)lv;
+            else fprintf(stderr, "Invalid --jobs value, ignoring\n");
+        }
         else if (argv[i][0] != '-') {
             if (!bios_path) bios_path = argv[i];
             else if (!game_path) game_path = argv[i];
         }
     }
 
-    if (!bios_path || !game_path) {
-        printf("Usage: %s [--test] [--frames N] [--input UDLR1234] [--dump] <bios.rom> <game.rom>\n", argv[0]);
+    if (batch_path)
+        return run_batch(batch_path, batch_threads, num_frames, engine, sched, batch_wide);
+
+    /* A pack supplies the BIOS and the game: the one operand, if any, is
+     * part of the game's name */
+    AVPack pack;
+    memset(&pack, 0, sizeof(pack));
+#ifdef EMBED_PACK
+    if (!pack_path && !game_path)
+        pack_open_mem(&pack, av_pack_blob, (size_t)(av_pack_blob_end - av_pack_blob));
+#endif
+    if (pack_path && !pack_load(&pack, pack_path)) return 1;
+
+    if (!pack.base && (!bios_path || !game_path)) {
+        printf("Usage: %s [--test] [--bench [--json FILE]] [--frames N] [--input UDLR1234] [--dump] [--engine interp|block] [--sched poll|event] [--no-idle-skip] [--phosphor-fmt float|q8] [--png FILE] [--raw FILE] [--shm NAME] [--pipe FILE] [--movie FILE.avm] [--profile FILE.json] [--break ADDR] [--watch ADDR[:rw]] <bios.rom> <game.rom>\n"
+               "       %s [options] --pack FILE.avpk [game name]\n"
+               "       %s --make-pack OUT.avpk bios.rom game.bin... [cover.ppm...]\n"
+               "       %s --batch manifest.txt [--jobs N] [--wide] [--frames N] [--engine ...] [--sched ...]\n",
+               argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
-    AV av; av_init(&av);
-    if (!load_file(av.cpu.irom, IROM_SZ, bios_path)) return 1;
-    if (!load_file(av.cpu.erom, EROM_SZ, game_path)) return 1;
-
-    /* Apply input string */
-    if (input_str) {
-        for (const char *p = input_str; *p; p++) {
-            switch (*p) {
-            case 'U': case 'u': av.input.u = true; break;
-            case 'D': case 'd': av.input.d = true; break;
-            case 'L': case 'l': av.input.l = true; break;
-            case 'R': case 'r': av.input.r = true; break;
-            case '1': av.input.b1 = true; break;
-            case '2': av.input.b2 = true; break;
-            case '3': av.input.b3 = true; break;
-            case '4': av.input.b4 = true; break;
-            }
+    av.dbg.active = av.dbg.bps || av.dbg.watches;
+    av.cpu_engine = engine;
+    av.frame_sched = sched;
+    av.phosphor_fmt = phos;
+    if (pack.base) {
+        bool ok = pack_load_roms(&pack, bios_path, av.cpu.irom, av.cpu.erom);
+        pack_close(&pack);
+        if (!ok) return 1;
+    } else {
+        if (!load_file(av.cpu.irom, IROM_SZ, bios_path)) return 1;
+        if (!load_file(av.cpu.erom, EROM_SZ, game_path)) return 1;
+    }
+
+    /* Apply input string; a movie replaces it and sets the frame count */
+    if (input_str) av_apply_input(&av, input_str);
+    if (movie_path && (num_frames = movie_open(&av, movie_path)) < 0) return 1;
+#ifdef AV_PROFILE
+    if (prof_path && !(av.prof = prof_create())) { fprintf(stderr, "Out of memory\n"); return 1; }
+#else
+    if (prof_path) fprintf(stderr, "--profile needs a build with -DAV_PROFILE, ignoring\n");
+#endif
+
+    /* Frame export: --raw appends every frame, --png writes the last one,
+     * or every frame when the path holds %d */
+    bool png_each = png_path && strstr(png_path, "%d");
+    FILE *raw_f = NULL;
+    AVRaster *ras = NULL;
+    uint32_t *fb = NULL;
+    if (png_path || raw_path) {
+        ras = (AVRaster *)malloc(sizeof(AVRaster));
+        fb = (uint32_t *)malloc(WIN_W * WIN_H * sizeof(uint32_t));
+        if (!ras || !fb) { fprintf(stderr, "Out of memory\n"); return 1; }
+        av_raster_init(ras);
+    }
+    if (raw_path && !(raw_f = fopen(raw_path, "wb"))) {
+        fprintf(stderr, "Cannot open %s\n", raw_path);
+        return 1;
+    }
+    /* Binary frame records: a shared-memory ring and/or a stream */
+    uint8_t *fx_ring = NULL, *fx_rec = NULL;
+    FILE *pipe_f = NULL;
+    if (shm_name && !(fx_ring = fx_shm_open(shm_name, FX_SLOTS))) return 1;
+    if (pipe_path) {
+        uint8_t h[FX_RING_HDR];
+        fx_header(h, 0);
+#ifdef SIGPIPE
+        signal(SIGPIPE, SIG_IGN);   /* a reader going away is a write error, not a kill */
+#endif
+        fx_rec = (uint8_t *)malloc(FX_REC_SZ);
+        if (!fx_rec || !(pipe_f = fopen(pipe_path, "wb")) || fwrite(h, sizeof(h), 1, pipe_f) != 1) {
+            fprintf(stderr, "Cannot open %s\n", pipe_path);
+            return 1;
         }
     }
 
+    int export_err = 0, ran = 0;
     for (int f = 0; f < num_frames; f++) {
+        if (movie_path && !movie_next(&av)) break;
         av_run_frame(&av);
+        /* Debugger: log each stop and run on to the end of the frame */
+        while (av.dbg.stepping) {
+            av_dbg_report(&av);
+            av_dbg_continue(&av);
+            av_run_frame(&av);
+        }
+        ran++;
+        if (fx_ring) fx_ring_push(fx_ring, &av);
+        if (pipe_f) {
+            fx_build(&av, fx_rec);
+            wav_le32(fx_rec, (uint32_t)ran);
+            if (fwrite(fx_rec, FX_REC_SZ, 1, pipe_f) != 1) {
+                fprintf(stderr, "%s: write failed at frame %d (%s), stopping\n",
+                        pipe_path, ran, strerror(errno));
+                export_err++;
+                break;
+            }
+        }
         if (do_dump) {
             printf("--- Frame %d ---\n", f);
             dump_vram_ascii(&av.disp);
         }
+        if (raw_f || png_each || (png_path && f == num_frames - 1)) {
+            av_raster(ras, &av, fb);
+            if (raw_f && !write_raw_rgb(raw_f, fb)) export_err++;
+            if (png_path && (png_each || f == num_frames - 1)) {
+                char fn[1024];
+                png_frame_path(fn, sizeof(fn), png_path, f);
+                if (!write_png(fn, fb)) export_err++;
+            }
+        }
+    }
+    if (raw_f && fclose(raw_f) != 0) export_err++;
+    if (pipe_f && fclose(pipe_f) != 0) export_err++;
+    if (fx_ring) fx_shm_close(fx_ring, FX_SLOTS);
+    free(fx_rec);
+    free(ras);
+    free(fb);
+    if (export_err) fprintf(stderr, "Frame export: %d write errors\n", export_err);
+    bool movie_ok = true;
+    if (movie_path) {
+        if (ran == num_frames) movie_next(&av);  /* trailing state checks */
+        uint32_t checks = av.movie.checks;
+        movie_ok = movie_stop(&av) && ran == num_frames;
+        printf("Movie: %d/%d frames, %u state checks, %s\n", ran, num_frames, checks,
+               movie_ok ? "in sync" : av.movie.desync ? "DESYNC" : "incomplete");
     }
 
     dbg_print(&av.cpu);
-    int lit = 0;
-    for (int i = 0; i < SW*SH; i++) if (av.disp.phosphor[i] > 0.1f) lit++;
+    if (av.dbg.active) printf("Debugger: %u stops\n", av.dbg.stops);
+    int lit = disp_lit_count(&av.disp);
     printf("%llu cycles, %d pixels lit, %d frames.\n",
-        (unsigned long long)av.cpu.cycles, lit, num_frames);
+        (unsigned long long)av.cpu.cycles, lit, ran);
+#ifdef AV_PROFILE
+    if (av.prof && !prof_export(av.prof, prof_path)) movie_ok = false;
+    free(av.prof);
+#endif
     if (av.rewind_buf) free(av.rewind_buf);
-    return 0;
+    if (av.icache) free(av.icache);
+    return movie_ok && !export_err ? 0 : 1;
 }
 #endif
@@ -1,11 +1,50 @@
 #!/bin/bash
 # embed_roms.sh — Convert Adventure Vision ROMs into a C header
 # Usage: ./embed_roms.sh <bios.rom> <game1.bin> [game2.bin] ...
+#        ./embed_roms.sh --pack <out.avpk> <bios.rom> <game.bin>... [cover.jpg|png|ppm...]
 #
 # Output: embedded_roms.h (include in adventure_vision.c with -DEMBED_ROMS)
+#   or, with --pack, one binary resource pack (ROMs raw, covers compressed)
+#   for -DEMBED_PACK='"out.avpk"' or --pack at run time
 
 set -e
 
+# Resource pack: covers become 252x360 PPMs (ImageMagick), then the
+# emulator's --make-pack writes the archive
+if [ "$1" = "--pack" ]; then
+    if [ $# -lt 4 ]; then
+        echo "Usage: $0 --pack <out.avpk> <bios.rom> <game.bin>... [cover.jpg|png|ppm...]"
+        exit 1
+    fi
+    OUT="$2"
+    shift 2
+    ADVISION="${ADVISION:-./advision}"
+    if [ ! -x "$ADVISION" ]; then
+        echo "Error: '$ADVISION' not found (build it, or set ADVISION=path)"
+        exit 1
+    fi
+    TMP=$(mktemp -d)
+    trap 'rm -rf "$TMP"' EXIT
+    ARGS=()
+    for F in "$@"; do
+        case "${F,,}" in
+        *.jpg|*.jpeg|*.png)
+            BASENAME=$(basename "$F")
+            PPM="$TMP/${BASENAME%.*}.ppm"
+            convert "$F" -resize '252x360!' -depth 8 "$PPM"
+            ARGS+=("$PPM") ;;
+        *)
+            ARGS+=("$F") ;;
+        esac
+    done
+    "$ADVISION" --make-pack "$OUT" "${ARGS[@]}"
+    echo ""
+    echo "Build with:"
+    echo "  gcc -O2 -DUSE_SDL -DEMBED_PACK='\"$OUT\"' -o advision adventure_vision.c -lSDL2 -lm"
+    echo "or run with:  ./advision --pack $OUT"
+    exit 0
+fi
+
 if [ $# -lt 2 ]; then
     echo "Usage: $0 <bios.rom> <game1.bin> [game2.bin] ..."
     echo ""
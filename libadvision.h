@@ -0,0 +1,91 @@
+/*
+ * libadvision — the Adventure Vision core as a library
+ *
+ * The emulator without its frontends: no SDL, no files, no global state.
+ * Every call takes an instance, so instances run in parallel on different
+ * threads; one instance must not be used by two threads at once.
+ *
+ *  Build (adventure_vision.c without either main):
+ *    gcc -O2 -DAV_LIB -pthread -c adventure_vision.c -o libadvision.o
+ *    ar rcs libadvision.a libadvision.o
+ *  Link with -pthread -lm.
+ */
+#ifndef LIBADVISION_H
+#define LIBADVISION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AVL_WIDTH        150     /* LED columns */
+#define AVL_HEIGHT       40      /* LED rows */
+#define AVL_RGB_WIDTH    750     /* avl_frame_rgb: 5 × 5 pixels per LED */
+#define AVL_RGB_HEIGHT   200
+#define AVL_AUDIO_RATE   44100
+#define AVL_FPS          15
+#define AVL_FRAME_SAMPLES (AVL_AUDIO_RATE / AVL_FPS)
+#define AVL_BIOS_SIZE    1024
+#define AVL_GAME_SIZE    4096
+
+/* Input mask bits (1 = held) */
+enum {
+    AVL_UP = 0x01, AVL_DOWN = 0x02, AVL_LEFT = 0x04, AVL_RIGHT = 0x08,
+    AVL_B1 = 0x10, AVL_B2 = 0x20, AVL_B3 = 0x40, AVL_B4 = 0x80
+};
+
+typedef struct avl avl;
+typedef struct avl_pool avl_pool;
+
+/* A powered-off machine with no ROMs (block engine, event scheduler,
+ * 8-bit phosphor). NULL if out of memory. */
+avl *avl_create(void);
+void avl_destroy(avl *e);
+
+/* Copy the ROMs in (shorter images are padded with $FF, longer ones are
+ * refused) and reset. 0 on success, -1 on a bad size. */
+int avl_load_rom(avl *e, const void *bios, size_t bios_len, const void *game, size_t game_len);
+void avl_reset(avl *e);
+
+/* Run `frames` frames with the buttons in `mask` held */
+void avl_step(avl *e, uint8_t mask, int frames);
+
+/* Display after the last step: AVL_WIDTH × AVL_HEIGHT phosphor levels,
+ * 0-255, row 0 at the top. Valid until the next call on the instance. */
+const uint8_t *avl_frame(avl *e);
+/* The same frame drawn with the default LED look, XRGB8888,
+ * AVL_RGB_WIDTH × AVL_RGB_HEIGHT. NULL if out of memory. */
+const uint32_t *avl_frame_rgb(avl *e);
+
+/* Audio of the last avl_step: *count mono samples at AVL_AUDIO_RATE
+ * (AVL_FRAME_SAMPLES per frame), raw COP411L output before the speaker
+ * filter, in [-1, 1] */
+const float *avl_audio(const avl *e, int *count);
+
+uint64_t avl_frame_count(const avl *e);
+
+/* Machine state (CPU, RAM, display, sound) as a versioned blob. Returns
+ * the blob size, written only if it fits in cap (buf may be NULL to ask).
+ * avl_load_state returns 0, or -1 if the blob is malformed (the instance
+ * is then unchanged). ROMs are not part of the state. */
+size_t avl_save_state(const avl *e, void *buf, size_t cap);
+int avl_load_state(avl *e, const void *buf, size_t len);
+
+/* Worker threads for avl_step_many, started once and reused. threads
+ * <= 0 = one per online CPU. Without thread support the pool runs
+ * everything on the caller. NULL if out of memory. */
+avl_pool *avl_pool_create(int threads);
+void avl_pool_destroy(avl_pool *p);
+
+/* Advance envs[0..n-1], each by `frames` frames with masks[i] held (masks
+ * may be NULL = no buttons), spread over the pool and the calling thread.
+ * Returns when all are done; pool may be NULL to run them in turn. */
+void avl_step_many(avl_pool *p, avl *const *envs, const uint8_t *masks, int n, int frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBADVISION_H */